@@ -0,0 +1,237 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Bench.h"
+
+#include <stdlib.h>
+
+// Upper bound of buffers which entered a branch, but have not left it yet (e.g. were dropped by a leaky queue)
+#define MAX_PENDING_ENTRIES 10000
+
+typedef struct _BenchEntry {
+    GstClockTime pts;
+    gint64 time;
+} BenchEntry;
+
+typedef struct _BenchBranch {
+    gchar* name;
+    GMutex lock;
+    GQueue pending;
+    GArray* latencies; // in milliseconds
+    gint64 first_exit_time;
+    gint64 last_exit_time;
+} BenchBranch;
+
+struct _BenchContext {
+    GMutex lock;
+    guint64 frames;
+    gint64 first_frame_time;
+    gint64 last_frame_time;
+
+    GPtrArray* branches;
+};
+
+static void bench_branch_free(gpointer data) {
+    BenchBranch* branch = data;
+
+    g_queue_clear_full(&branch->pending, g_free);
+    g_array_unref(branch->latencies);
+    g_mutex_clear(&branch->lock);
+    g_free(branch->name);
+    g_free(branch);
+}
+
+BenchContext* bench_new(void) {
+    BenchContext* bench = g_new0(BenchContext, 1);
+
+    g_mutex_init(&bench->lock);
+    bench->branches = g_ptr_array_new_with_free_func(bench_branch_free);
+
+    return bench;
+}
+
+void bench_free(BenchContext* bench) {
+    if (!bench) {
+        return;
+    }
+
+    // Probes hold raw pointers to branches, so the pipeline must be already stopped at this point
+    g_ptr_array_unref(bench->branches);
+    g_mutex_clear(&bench->lock);
+    g_free(bench);
+}
+
+static GstBuffer* probe_buffer(GstPadProbeInfo* info) {
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        return GST_PAD_PROBE_INFO_BUFFER(info);
+    }
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        return gst_buffer_list_length(list) > 0 ? gst_buffer_list_get(list, 0) : NULL;
+    }
+
+    return NULL;
+}
+
+static GstPadProbeReturn throughput_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    BenchContext* bench = user_data;
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&bench->lock);
+    if (bench->frames == 0) {
+        bench->first_frame_time = now;
+    }
+    bench->last_frame_time = now;
+    ++bench->frames;
+    g_mutex_unlock(&bench->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn branch_entry_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    BenchBranch* branch = user_data;
+    GstBuffer* buffer = probe_buffer(info);
+    BenchEntry* entry;
+
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    entry = g_new(BenchEntry, 1);
+    entry->pts = GST_BUFFER_PTS(buffer);
+    entry->time = g_get_monotonic_time();
+
+    g_mutex_lock(&branch->lock);
+    g_queue_push_tail(&branch->pending, entry);
+    if (g_queue_get_length(&branch->pending) > MAX_PENDING_ENTRIES) {
+        g_free(g_queue_pop_head(&branch->pending));
+    }
+    g_mutex_unlock(&branch->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn branch_exit_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    BenchBranch* branch = user_data;
+    GstBuffer* buffer = probe_buffer(info);
+    BenchEntry* matched = NULL;
+    gint64 now = g_get_monotonic_time();
+
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    g_mutex_lock(&branch->lock);
+    if (branch->first_exit_time == 0) {
+        branch->first_exit_time = now;
+    }
+    branch->last_exit_time = now;
+    // Entries which are older than the matched one were dropped or merged inside the branch
+    while (!g_queue_is_empty(&branch->pending)) {
+        BenchEntry* entry = g_queue_peek_head(&branch->pending);
+        if (entry->pts > GST_BUFFER_PTS(buffer)) {
+            break;
+        }
+        g_free(matched);
+        matched = g_queue_pop_head(&branch->pending);
+    }
+    if (matched) {
+        gdouble latency_ms = (now - matched->time) / 1000.0;
+        g_array_append_val(branch->latencies, latency_ms);
+    }
+    g_mutex_unlock(&branch->lock);
+
+    g_free(matched);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static int add_probe(GstElement* element, const char* pad_name, GstPadProbeCallback callback, gpointer user_data) {
+    GstPad* pad = gst_element_get_static_pad(element, pad_name);
+
+    if (!pad) {
+        g_printerr("Error: element '%s' has no pad '%s'\n", GST_ELEMENT_NAME(element), pad_name);
+        return 1;
+    }
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, callback, user_data, NULL);
+    gst_object_unref(pad);
+
+    return 0;
+}
+
+int bench_watch_throughput(BenchContext* bench, GstElement* element, const char* pad_name) {
+    return add_probe(element, pad_name, throughput_probe, bench);
+}
+
+int bench_add_branch(BenchContext* bench,
+                     const char* name,
+                     GstElement* entry,
+                     const char* entry_pad_name,
+                     GstElement* exit,
+                     const char* exit_pad_name) {
+    BenchBranch* branch = g_new0(BenchBranch, 1);
+
+    branch->name = g_strdup(name);
+    g_mutex_init(&branch->lock);
+    g_queue_init(&branch->pending);
+    branch->latencies = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    g_ptr_array_add(bench->branches, branch);
+
+    if (add_probe(entry, entry_pad_name, branch_entry_probe, branch) != 0 ||
+        add_probe(exit, exit_pad_name, branch_exit_probe, branch) != 0) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    gdouble left = *(const gdouble*)a;
+    gdouble right = *(const gdouble*)b;
+
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static gdouble percentile(GArray* sorted, gdouble fraction) {
+    guint index = (guint)((sorted->len - 1) * fraction + 0.5);
+
+    return g_array_index(sorted, gdouble, index);
+}
+
+void bench_report(BenchContext* bench) {
+    gdouble duration;
+    guint i;
+
+    g_mutex_lock(&bench->lock);
+    duration = (bench->last_frame_time - bench->first_frame_time) / (gdouble)G_USEC_PER_SEC;
+    g_print("Benchmark results:\n");
+    if (bench->frames > 1 && duration > 0.0) {
+        g_print("  mixer: %" G_GUINT64_FORMAT " frames in %.2f s, %.2f fps\n",
+                bench->frames,
+                duration,
+                (bench->frames - 1) / duration);
+    } else {
+        g_print("  mixer: %" G_GUINT64_FORMAT " frames, not enough data to compute frame rate\n", bench->frames);
+    }
+    g_mutex_unlock(&bench->lock);
+
+    for (i = 0; i < bench->branches->len; ++i) {
+        BenchBranch* branch = g_ptr_array_index(bench->branches, i);
+
+        g_mutex_lock(&branch->lock);
+        duration = (branch->last_exit_time - branch->first_exit_time) / (gdouble)G_USEC_PER_SEC;
+        if (branch->latencies->len > 0) {
+            qsort(branch->latencies->data, branch->latencies->len, sizeof(gdouble), compare_doubles);
+            g_print("  %s: %u frames, %.2f fps, latency p50 %.3f ms, p99 %.3f ms\n",
+                    branch->name,
+                    branch->latencies->len,
+                    duration > 0.0 ? (branch->latencies->len - 1) / duration : 0.0,
+                    percentile(branch->latencies, 0.50),
+                    percentile(branch->latencies, 0.99));
+        } else {
+            g_print("  %s: no frames\n", branch->name);
+        }
+        g_mutex_unlock(&branch->lock);
+    }
+}
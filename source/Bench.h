@@ -0,0 +1,31 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_BENCH_H
+#define TWITCH_STREAMER_BENCH_H
+
+#include <gst/gst.h>
+
+// Collects throughput and per-frame latency numbers of a running pipeline. Everything is measured with pad probes, so
+// measurement does not change the topology of the pipeline
+typedef struct _BenchContext BenchContext;
+
+BenchContext* bench_new(void);
+void bench_free(BenchContext* bench);
+
+// Counts buffers leaving 'element' through its 'pad_name' pad to compute sustained frame rate
+int bench_watch_throughput(BenchContext* bench, GstElement* element, const char* pad_name);
+
+// Measures time each buffer spends between 'entry_pad_name' pad of 'entry' and 'exit_pad_name' pad of 'exit'.
+// Buffers are matched by PTS, so elements which re-chunk data (e.g. audio encoders) are supported as well: an exit
+// buffer is matched with the latest entry buffer which is not newer than it
+int bench_add_branch(BenchContext* bench,
+                     const char* name,
+                     GstElement* entry,
+                     const char* entry_pad_name,
+                     GstElement* exit,
+                     const char* exit_pad_name);
+
+// Prints collected numbers: frame rate and latency percentiles of every branch
+void bench_report(BenchContext* bench);
+
+#endif // TWITCH_STREAMER_BENCH_H
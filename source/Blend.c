@@ -0,0 +1,229 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Blend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BLEND_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || (defined(__ARM_NEON) && defined(__arm__))
+#define BLEND_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define MAX_IMPLEMENTATIONS 3
+
+static void blend_constant_c(guint8* dst, const guint8* src, int count, guint alpha) {
+    guint inverse = BLEND_OPAQUE - alpha;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        dst[i] = (guint8)((src[i] * alpha + dst[i] * inverse) >> 8);
+    }
+}
+
+// (x + 128 + ((x + 128) >> 8)) >> 8 is x / 255 rounded to nearest for any product of two bytes. Sum with the source
+// can exceed 255 only by rounding, it is saturated
+static void blend_premultiplied_c(guint8* dst, const guint8* src, const guint8* alpha, int count) {
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        guint product = dst[i] * (255 - alpha[i]) + 128;
+        guint value = src[i] + ((product + (product >> 8)) >> 8);
+        dst[i] = (guint8)MIN(value, 255);
+    }
+}
+
+#ifdef BLEND_X86
+// Kernels are compiled for their instruction set regardless of compiler flags, they are called only if the CPU
+// supports it. Bytes are widened to 16 bits, 255 * 256 still fits, and narrowed back with saturation
+__attribute__((target("sse2"))) static void blend_constant_sse2(guint8* dst,
+                                                                const guint8* src,
+                                                                int count,
+                                                                guint alpha) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i weight = _mm_set1_epi16((short)alpha);
+    __m128i inverse = _mm_set1_epi16((short)(BLEND_OPAQUE - alpha));
+    int i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), weight),
+                                    _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverse));
+        __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), weight),
+                                     _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverse));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm_srli_epi16(low, 8), _mm_srli_epi16(high, 8)));
+    }
+
+    blend_constant_c(dst + i, src + i, count - i, alpha);
+}
+
+// 255 - alpha is alpha with inverted bits, products of bytes and the rounding term still fit 16 bits
+__attribute__((target("sse2"))) static void blend_premultiplied_sse2(guint8* dst,
+                                                                     const guint8* src,
+                                                                     const guint8* alpha,
+                                                                     int count) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i ones = _mm_set1_epi8((char)0xff);
+    __m128i round = _mm_set1_epi16(128);
+    int i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i inverse = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(alpha + i)), ones);
+        __m128i low =
+            _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(inverse, zero)), round);
+        __m128i high =
+            _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(inverse, zero)), round);
+        low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+        high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu8(_mm_packus_epi16(low, high), s));
+    }
+
+    blend_premultiplied_c(dst + i, src + i, alpha + i, count - i);
+}
+
+// Unpacking and packing both work within 128-bit lanes, so bytes come back in their order
+__attribute__((target("avx2"))) static void blend_constant_avx2(guint8* dst,
+                                                                const guint8* src,
+                                                                int count,
+                                                                guint alpha) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i weight = _mm256_set1_epi16((short)alpha);
+    __m256i inverse = _mm256_set1_epi16((short)(BLEND_OPAQUE - alpha));
+    int i;
+
+    for (i = 0; i + 32 <= count; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), weight),
+                                       _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inverse));
+        __m256i high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), weight),
+                                        _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inverse));
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                            _mm256_packus_epi16(_mm256_srli_epi16(low, 8), _mm256_srli_epi16(high, 8)));
+    }
+
+    blend_constant_sse2(dst + i, src + i, count - i, alpha);
+}
+
+__attribute__((target("avx2"))) static void blend_premultiplied_avx2(guint8* dst,
+                                                                     const guint8* src,
+                                                                     const guint8* alpha,
+                                                                     int count) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i ones = _mm256_set1_epi8((char)0xff);
+    __m256i round = _mm256_set1_epi16(128);
+    int i;
+
+    for (i = 0; i + 32 <= count; i += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i inverse = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(alpha + i)), ones);
+        __m256i low = _mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(inverse, zero)), round);
+        __m256i high = _mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(inverse, zero)), round);
+        low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_epi16(low, 8)), 8);
+        high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_epi16(high, 8)), 8);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_adds_epu8(_mm256_packus_epi16(low, high), s));
+    }
+
+    blend_premultiplied_sse2(dst + i, src + i, alpha + i, count - i);
+}
+#endif // BLEND_X86
+
+#ifdef BLEND_NEON
+static void blend_constant_neon(guint8* dst, const guint8* src, int count, guint alpha) {
+    uint16x8_t weight = vdupq_n_u16((uint16_t)alpha);
+    uint16x8_t inverse = vdupq_n_u16((uint16_t)(BLEND_OPAQUE - alpha));
+    int i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t d = vld1q_u8(dst + i);
+        uint16x8_t low = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(s)), weight), vmovl_u8(vget_low_u8(d)), inverse);
+        uint16x8_t high =
+            vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(s)), weight), vmovl_u8(vget_high_u8(d)), inverse);
+        vst1q_u8(dst + i, vcombine_u8(vshrn_n_u16(low, 8), vshrn_n_u16(high, 8)));
+    }
+
+    blend_constant_c(dst + i, src + i, count - i, alpha);
+}
+
+static void blend_premultiplied_neon(guint8* dst, const guint8* src, const guint8* alpha, int count) {
+    uint16x8_t round = vdupq_n_u16(128);
+    int i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t d = vld1q_u8(dst + i);
+        uint8x16_t inverse = vmvnq_u8(vld1q_u8(alpha + i));
+        uint16x8_t low = vaddq_u16(vmull_u8(vget_low_u8(d), vget_low_u8(inverse)), round);
+        uint16x8_t high = vaddq_u16(vmull_u8(vget_high_u8(d), vget_high_u8(inverse)), round);
+        low = vaddq_u16(low, vshrq_n_u16(low, 8));
+        high = vaddq_u16(high, vshrq_n_u16(high, 8));
+        vst1q_u8(dst + i, vqaddq_u8(vcombine_u8(vshrn_n_u16(low, 8), vshrn_n_u16(high, 8)), s));
+    }
+
+    blend_premultiplied_c(dst + i, src + i, alpha + i, count - i);
+}
+#endif // BLEND_NEON
+
+static BlendImplementation implementations[MAX_IMPLEMENTATIONS];
+static guint implementation_count;
+static BlendConstantFunc selected_blend_constant = blend_constant_c;
+static BlendPremultipliedFunc selected_blend_premultiplied = blend_premultiplied_c;
+
+static void add_implementation(const char* name,
+                               BlendConstantFunc blend_constant,
+                               BlendPremultipliedFunc blend_premultiplied) {
+    implementations[implementation_count].name = name;
+    implementations[implementation_count].blend_constant = blend_constant;
+    implementations[implementation_count].blend_premultiplied = blend_premultiplied;
+    ++implementation_count;
+}
+
+static void detect_implementations(void) {
+    static gsize initialized = 0;
+
+    if (!g_once_init_enter(&initialized)) {
+        return;
+    }
+
+    add_implementation("c", blend_constant_c, blend_premultiplied_c);
+#ifdef BLEND_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        add_implementation("sse2", blend_constant_sse2, blend_premultiplied_sse2);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        add_implementation("avx2", blend_constant_avx2, blend_premultiplied_avx2);
+    }
+#endif
+#ifdef BLEND_NEON
+    add_implementation("neon", blend_constant_neon, blend_premultiplied_neon);
+#endif
+    selected_blend_constant = implementations[implementation_count - 1].blend_constant;
+    selected_blend_premultiplied = implementations[implementation_count - 1].blend_premultiplied;
+
+    g_once_init_leave(&initialized, 1);
+}
+
+const BlendImplementation* blend_implementations(guint* count) {
+    detect_implementations();
+    *count = implementation_count;
+
+    return implementations;
+}
+
+void blend_constant_row(guint8* dst, const guint8* src, int count, guint alpha) {
+    detect_implementations();
+    selected_blend_constant(dst, src, count, alpha);
+}
+
+void blend_premultiplied_row(guint8* dst, const guint8* src, const guint8* alpha, int count) {
+    detect_implementations();
+    selected_blend_premultiplied(dst, src, alpha, count);
+}
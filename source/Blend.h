@@ -0,0 +1,36 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_BLEND_H
+#define TWITCH_STREAMER_BLEND_H
+
+#include <glib.h>
+
+// Row kernels of the tile mixer and of the overlay layer. Opaque tiles are plain memcpy, kernels below are used only
+// for pixels which are really blended. Every kernel has plain C, SSE2 and AVX2 (x86) or NEON (ARM) variants, the
+// fastest one supported by the CPU is selected at runtime. All variants produce identical results
+
+// Opacity of a tile, 0 is transparent and BLEND_OPAQUE is opaque
+#define BLEND_OPAQUE 256
+
+// dst = (src * alpha + dst * (BLEND_OPAQUE - alpha)) / BLEND_OPAQUE for 'count' bytes. Works on any 8-bit plane,
+// including interleaved chroma, because every byte gets the same weight
+typedef void (*BlendConstantFunc)(guint8* dst, const guint8* src, int count, guint alpha);
+
+// dst = src + dst * (255 - alpha) / 255 for 'count' bytes, every byte has its own alpha (0 is transparent, 255 is
+// opaque) and 'src' is already multiplied by it. Used for graphics with transparent and antialiased edges
+typedef void (*BlendPremultipliedFunc)(guint8* dst, const guint8* src, const guint8* alpha, int count);
+
+typedef struct _BlendImplementation {
+    const char* name;
+    BlendConstantFunc blend_constant;
+    BlendPremultipliedFunc blend_premultiplied;
+} BlendImplementation;
+
+// Implementations supported by this CPU from the slowest to the fastest, the last one is used by the functions below
+const BlendImplementation* blend_implementations(guint* count);
+
+void blend_constant_row(guint8* dst, const guint8* src, int count, guint alpha);
+
+void blend_premultiplied_row(guint8* dst, const guint8* src, const guint8* alpha, int count);
+
+#endif // TWITCH_STREAMER_BLEND_H
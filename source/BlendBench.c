@@ -0,0 +1,186 @@
+// (c) Alexander Voitenko 2021 - present
+
+// Microbenchmark of the mixer stage. Measures throughput of every blend kernel supported by the CPU against plain
+// row copy, then composites the same synthetic tiles with compositor and with tilemixer
+
+#include "Blend.h"
+#include "TileMixer.h"
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// Kernels work on a luma plane of the default output size
+#define PLANE_WIDTH 1280
+#define PLANE_HEIGHT 720
+#define KERNEL_ITERATIONS 500
+#define HALF_OPAQUE (BLEND_OPAQUE / 2)
+
+// Mixers composite 2x2 grid of moving test patterns, the last tile is translucent and overlaps the others
+#define MIXER_FRAMES 600
+
+static gdouble plane_rate(gint64 start, gint64 end) {
+    gdouble seconds = (end - start) / (gdouble)G_USEC_PER_SEC;
+
+    return seconds > 0.0 ? (gdouble)PLANE_WIDTH * PLANE_HEIGHT * KERNEL_ITERATIONS / seconds / 1e9 : 0.0;
+}
+
+static int bench_kernels(void) {
+    guint8* source = g_malloc(PLANE_WIDTH * PLANE_HEIGHT);
+    guint8* background = g_malloc(PLANE_WIDTH * PLANE_HEIGHT);
+    guint8* target = g_malloc(PLANE_WIDTH * PLANE_HEIGHT);
+    guint8* alpha = g_malloc(PLANE_WIDTH * PLANE_HEIGHT);
+    const BlendImplementation* implementations;
+    guint count;
+    gint64 start;
+    int result = 0;
+    int row;
+    guint i;
+    int n;
+
+    for (i = 0; i < PLANE_WIDTH * PLANE_HEIGHT; ++i) {
+        source[i] = (guint8)(i * 7);
+        background[i] = (guint8)(i * 13);
+        alpha[i] = (guint8)(i * 5);
+    }
+
+    start = g_get_monotonic_time();
+    for (n = 0; n < KERNEL_ITERATIONS; ++n) {
+        for (row = 0; row < PLANE_HEIGHT; ++row) {
+            memcpy(target + row * PLANE_WIDTH, source + row * PLANE_WIDTH, PLANE_WIDTH);
+        }
+    }
+    g_print("  copy: %.2f Gpixel/s\n", plane_rate(start, g_get_monotonic_time()));
+
+    implementations = blend_implementations(&count);
+    for (i = 0; i < count; ++i) {
+        start = g_get_monotonic_time();
+        for (n = 0; n < KERNEL_ITERATIONS; ++n) {
+            for (row = 0; row < PLANE_HEIGHT; ++row) {
+                implementations[i].blend_constant(
+                    target + row * PLANE_WIDTH, source + row * PLANE_WIDTH, PLANE_WIDTH, HALF_OPAQUE);
+            }
+        }
+        g_print("  blend %s: %.2f Gpixel/s\n", implementations[i].name, plane_rate(start, g_get_monotonic_time()));
+
+        start = g_get_monotonic_time();
+        for (n = 0; n < KERNEL_ITERATIONS; ++n) {
+            for (row = 0; row < PLANE_HEIGHT; ++row) {
+                implementations[i].blend_premultiplied(
+                    target + row * PLANE_WIDTH, source + row * PLANE_WIDTH, alpha + row * PLANE_WIDTH, PLANE_WIDTH);
+            }
+        }
+        g_print("  blend premultiplied %s: %.2f Gpixel/s\n",
+                implementations[i].name,
+                plane_rate(start, g_get_monotonic_time()));
+    }
+
+    // Every variant must give the same result as the plain C one, odd length covers the scalar tail too
+    for (i = 1; i < count; ++i) {
+        guint8* expected = g_malloc(PLANE_WIDTH);
+        guint8* actual = g_malloc(PLANE_WIDTH);
+        guint constant_alpha;
+
+        for (constant_alpha = 0; constant_alpha <= BLEND_OPAQUE && result == 0; ++constant_alpha) {
+            memcpy(expected, background, PLANE_WIDTH);
+            memcpy(actual, background, PLANE_WIDTH);
+            implementations[0].blend_constant(expected, source, PLANE_WIDTH - 3, constant_alpha);
+            implementations[i].blend_constant(actual, source, PLANE_WIDTH - 3, constant_alpha);
+            if (memcmp(expected, actual, PLANE_WIDTH) != 0) {
+                g_printerr(
+                    "Error: blend %s differs from plain C at alpha %u\n", implementations[i].name, constant_alpha);
+                result = 1;
+            }
+        }
+
+        // Source is not premultiplied here, so saturation is covered as well
+        memcpy(expected, background, PLANE_WIDTH);
+        memcpy(actual, background, PLANE_WIDTH);
+        implementations[0].blend_premultiplied(expected, source, alpha, PLANE_WIDTH - 3);
+        implementations[i].blend_premultiplied(actual, source, alpha, PLANE_WIDTH - 3);
+        if (result == 0 && memcmp(expected, actual, PLANE_WIDTH) != 0) {
+            g_printerr("Error: premultiplied blend %s differs from plain C\n", implementations[i].name);
+            result = 1;
+        }
+        g_free(actual);
+        g_free(expected);
+    }
+
+    g_free(alpha);
+    g_free(target);
+    g_free(background);
+    g_free(source);
+
+    return result;
+}
+
+static int bench_mixer(const char* factory) {
+    gchar* description = g_strdup_printf(
+        "%s name=mix sink_0::xpos=0 sink_0::ypos=0 sink_1::xpos=640 sink_1::ypos=0 sink_2::xpos=0 sink_2::ypos=360 "
+        "sink_3::xpos=480 sink_3::ypos=270 sink_3::alpha=0.5 "
+        "! video/x-raw,format=I420,width=1280,height=720,framerate=30/1 ! fakesink sync=false "
+        "videotestsrc num-buffers=%i pattern=ball ! video/x-raw,format=I420,width=640,height=360 ! mix.sink_0 "
+        "videotestsrc num-buffers=%i pattern=smpte ! video/x-raw,format=I420,width=640,height=360 ! mix.sink_1 "
+        "videotestsrc num-buffers=%i pattern=ball ! video/x-raw,format=I420,width=640,height=360 ! mix.sink_2 "
+        "videotestsrc num-buffers=%i pattern=snow ! video/x-raw,format=I420,width=640,height=360 ! mix.sink_3",
+        factory,
+        MIXER_FRAMES,
+        MIXER_FRAMES,
+        MIXER_FRAMES,
+        MIXER_FRAMES);
+    GError* err = NULL;
+    GstElement* pipeline = gst_parse_launch(description, &err);
+    GstBus* bus;
+    GstMessage* msg;
+    gint64 start;
+    gdouble seconds;
+    int result = 0;
+
+    g_free(description);
+    if (!pipeline) {
+        g_printerr("Error: %s pipeline could not be created: %s\n", factory, err ? err->message : "unknown error");
+        g_clear_error(&err);
+        return 1;
+    }
+
+    bus = gst_element_get_bus(pipeline);
+    start = g_get_monotonic_time();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    seconds = (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC;
+
+    if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        g_printerr("Error: %s pipeline failed\n", factory);
+        result = 1;
+    } else {
+        g_print("  %s: %i frames in %.2f s, %.1f fps\n", factory, MIXER_FRAMES, seconds, MIXER_FRAMES / seconds);
+    }
+
+    gst_message_unref(msg);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipeline);
+
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    int result = 0;
+
+    gst_init(&argc, &argv);
+
+    if (!tile_mixer_register()) {
+        g_printerr("Error: tilemixer could not be registered\n");
+        return 1;
+    }
+
+    g_print("Row kernels, %ix%i plane:\n", PLANE_WIDTH, PLANE_HEIGHT);
+    result |= bench_kernels();
+
+    g_print("Mixers, 4 tiles, 1280x720 I420:\n");
+    result |= bench_mixer("compositor");
+    result |= bench_mixer("tilemixer");
+
+    return result;
+}
@@ -0,0 +1,197 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Channels.h"
+
+#include <glib-unix.h>
+#include <signal.h>
+
+// Number of channels in one process and interval of per-channel stats
+#define MAX_CHANNELS 64
+#define CHANNEL_STATS_INTERVAL 10 // s
+
+// Channel arguments are parsed like the command line, so they own the strings referenced by the context
+typedef struct _Channel {
+    gchar* name;
+    gchar** words;
+    gchar** argv; // words reordered by option parser, strings are owned by 'words'
+    gpointer context;
+    gint reported_mixed_frames;
+} Channel;
+
+struct _Channels {
+    const ChannelCallbacks* callbacks;
+    GPtrArray* channels; // Channel*
+    GMainLoop* main_loop;
+    int running;
+};
+
+static void channel_free(Channels* channels, Channel* channel) {
+    if (channel->context) {
+        channels->callbacks->free(channel->context);
+    }
+    g_free(channel->argv);
+    g_strfreev(channel->words);
+    g_free(channel->name);
+    g_free(channel);
+}
+
+static Channel* create_channel(Channels* channels, GKeyFile* key_file, const gchar* name, int thread_budget) {
+    Channel* channel = g_new0(Channel, 1);
+    GError* error = NULL;
+    gchar* args;
+    int argc;
+    int i;
+
+    channel->name = g_strdup(name);
+
+    args = g_key_file_get_string(key_file, name, "args", &error);
+    if (!args || !g_shell_parse_argv(args, &argc, &channel->words, &error)) {
+        g_printerr("Error: invalid arguments of channel '%s': %s\n", name, error->message);
+        g_clear_error(&error);
+        g_free(args);
+        channel_free(channels, channel);
+        return NULL;
+    }
+    g_free(args);
+
+    // Option parser expects program name first
+    channel->argv = g_new0(gchar*, argc + 2);
+    channel->argv[0] = channel->name;
+    for (i = 0; i < argc; ++i) {
+        channel->argv[i + 1] = channel->words[i];
+    }
+
+    g_print("Channel '%s':\n", name);
+    channel->context = channels->callbacks->create(channels, channel->name, argc + 1, channel->argv, thread_budget);
+    if (!channel->context) {
+        channel_free(channels, channel);
+        return NULL;
+    }
+
+    return channel;
+}
+
+static gboolean report_channels(gpointer user_data) {
+    Channels* channels = user_data;
+    guint i;
+
+    for (i = 0; i < channels->channels->len; ++i) {
+        Channel* channel = g_ptr_array_index(channels->channels, i);
+        ChannelStats stats = {0};
+
+        channels->callbacks->get_stats(channel->context, &stats);
+        g_print("Channel '%s': %s, %.1f fps mixed, %" G_GUINT64_FORMAT " frames dropped\n",
+                channel->name,
+                stats.stopped ? "stopped" : "running",
+                (double)(stats.mixed_frames - channel->reported_mixed_frames) / CHANNEL_STATS_INTERVAL,
+                stats.dropped_frames);
+        channel->reported_mixed_frames = stats.mixed_frames;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean interrupt_handler(gpointer user_data) {
+    Channels* channels = user_data;
+    guint i;
+
+    g_print("Interrupted\n");
+    for (i = 0; i < channels->channels->len; ++i) {
+        channels->callbacks->interrupt(((Channel*)g_ptr_array_index(channels->channels, i))->context);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+void channels_stopped(Channels* channels) {
+    if (--channels->running == 0) {
+        g_main_loop_quit(channels->main_loop);
+    }
+}
+
+int channels_run(const char* path, int cpu_budget, const ChannelCallbacks* callbacks) {
+    Channels channels = {0};
+    GKeyFile* key_file = g_key_file_new();
+    GError* error = NULL;
+    gchar** groups = NULL;
+    gsize group_count = 0;
+    guint interrupt_source = 0;
+    guint terminate_source = 0;
+    guint stats_source = 0;
+    int result = 0;
+    gsize i;
+
+    channels.callbacks = callbacks;
+    channels.channels = g_ptr_array_new();
+
+    if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, &error)) {
+        g_printerr("Error: failed to load channels from '%s': %s\n", path, error->message);
+        g_clear_error(&error);
+        result = 1;
+        goto exit;
+    }
+
+    groups = g_key_file_get_groups(key_file, &group_count);
+    if (group_count < 1 || group_count > MAX_CHANNELS) {
+        g_printerr("Error: number of channels should be in range [1, %i]\n", MAX_CHANNELS);
+        result = 1;
+        goto exit;
+    }
+
+    if (cpu_budget == 0) {
+        cpu_budget = (int)g_get_num_processors();
+    }
+    g_print("Running %i channels with CPU budget of %i threads\n", (int)group_count, cpu_budget);
+
+    for (i = 0; i < group_count; ++i) {
+        Channel* channel = create_channel(&channels, key_file, groups[i], MAX(1, cpu_budget / (int)group_count));
+        if (!channel) {
+            result = 1;
+            goto exit;
+        }
+        g_ptr_array_add(channels.channels, channel);
+    }
+
+    channels.main_loop = g_main_loop_new(NULL, FALSE);
+    interrupt_source = g_unix_signal_add(SIGINT, interrupt_handler, &channels);
+    terminate_source = g_unix_signal_add(SIGTERM, interrupt_handler, &channels);
+
+    for (i = 0; i < channels.channels->len; ++i) {
+        if (callbacks->start(((Channel*)g_ptr_array_index(channels.channels, i))->context, channels.main_loop) != 0) {
+            result = 1;
+            goto exit;
+        }
+        ++channels.running;
+    }
+
+    stats_source = g_timeout_add_seconds(CHANNEL_STATS_INTERVAL, report_channels, &channels);
+    g_main_loop_run(channels.main_loop);
+
+    for (i = 0; i < channels.channels->len; ++i) {
+        Channel* channel = g_ptr_array_index(channels.channels, i);
+        g_print("Channel '%s':\n", channel->name);
+        callbacks->report(channel->context);
+    }
+
+exit:
+    if (stats_source) {
+        g_source_remove(stats_source);
+    }
+    if (terminate_source) {
+        g_source_remove(terminate_source);
+    }
+    if (interrupt_source) {
+        g_source_remove(interrupt_source);
+    }
+    for (i = 0; i < channels.channels->len; ++i) {
+        channel_free(&channels, g_ptr_array_index(channels.channels, i));
+    }
+    g_ptr_array_unref(channels.channels);
+    if (channels.main_loop) {
+        g_main_loop_unref(channels.main_loop);
+    }
+    g_strfreev(groups);
+    g_key_file_free(key_file);
+
+    return result;
+}
@@ -0,0 +1,51 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_CHANNELS_H
+#define TWITCH_STREAMER_CHANNELS_H
+
+#include <glib.h>
+
+// Multi-channel mode: many independent pipelines in one process. Every group of the key file is a channel, its 'args'
+// key holds the same arguments as the command line, e.g.
+//   [sintel]
+//   args=--output=rtmp://localhost/live/sintel --loop=on data/sintel_trailer-480p.webm
+// CPU budget is split evenly between channels, so encoders and decoders of all channels together do not run more
+// threads than there are CPUs. Channels run in one main loop and stop independently, the loop is quit when the last
+// of them stops. Pipelines are driven through callbacks, every channel has its own opaque context
+typedef struct _Channels Channels;
+
+// Counters of a channel, reported periodically
+typedef struct _ChannelStats {
+    gboolean stopped;
+    gint mixed_frames; // since the channel was started
+    guint64 dropped_frames;
+} ChannelStats;
+
+typedef struct _ChannelCallbacks {
+    // Parses 'argv' of channel 'name' like the command line and creates its pipeline, returns NULL on error. The
+    // context may reference 'name' and 'argv', they live until it is freed. 'thread_budget' is the share of the channel
+    gpointer (*create)(Channels* channels, const gchar* name, int argc, gchar** argv, int thread_budget);
+
+    // Sets the pipeline playing in 'main_loop', returns 0 on success. Once it stops, channels_stopped must be called
+    int (*start)(gpointer context, GMainLoop* main_loop);
+
+    // Stops the pipeline gracefully on SIGINT or SIGTERM
+    void (*interrupt)(gpointer context);
+
+    void (*get_stats)(gpointer context, ChannelStats* stats);
+
+    // Prints the final report of the pipeline after the main loop has quit
+    void (*report)(gpointer context);
+
+    // Stops the pipeline if it is still running and frees the context
+    void (*free)(gpointer context);
+} ChannelCallbacks;
+
+// Runs every channel described in key file 'path' until all of them stop. 'cpu_budget' is the number of threads shared
+// by all channels, zero means the number of CPUs. Returns 0 on success
+int channels_run(const char* path, int cpu_budget, const ChannelCallbacks* callbacks);
+
+// Tells that the pipeline of a channel has stopped
+void channels_stopped(Channels* channels);
+
+#endif // TWITCH_STREAMER_CHANNELS_H
@@ -0,0 +1,544 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "ClipCache.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include <glib/gstdio.h>
+
+#define PULL_TIMEOUT (100 * GST_MSECOND)
+// Used for frames without duration in clips without frame rate
+#define DEFAULT_FRAME_DURATION (GST_SECOND / 30)
+
+typedef struct _CachedClip {
+    ClipCache* cache;
+    gchar* uri;
+    int width;
+    int height;
+
+    GstCaps* caps;
+    GPtrArray* frames;     // GstBuffer*, timestamps start from zero
+    GstClockTime duration; // duration of one pass
+    gsize bytes;
+    int users; // sources playing the clip, such clips are never evicted
+} CachedClip;
+
+struct _ClipCache {
+    gsize budget;
+    gsize max_file_size;
+    gchar* format;
+
+    GMutex lock;
+    GQueue clips; // CachedClip*, the most recently used first
+    gsize used_bytes;
+
+    // Clips asked for while streaming are decoded one at a time by a worker thread
+    GThreadPool* decoder;
+    GHashTable* decoding; // "WIDTHxHEIGHT URI" of clips queued or being decoded
+    gint stopping;
+};
+
+// Clip to be decoded in the background
+typedef struct _ClipJob {
+    gchar* key;
+    gchar* uri;
+    int width;
+    int height;
+} ClipJob;
+
+// State of one source playing a cached clip
+typedef struct _ClipPlayer {
+    CachedClip* clip;
+    guint next_frame;
+    GstClockTime pass_start; // timestamp of the first frame of the current pass
+} ClipPlayer;
+
+static void cached_clip_free(CachedClip* clip) {
+    if (clip->caps) {
+        gst_caps_unref(clip->caps);
+    }
+    g_ptr_array_unref(clip->frames);
+    g_free(clip->uri);
+    g_free(clip);
+}
+
+static gboolean is_file_small_enough(ClipCache* cache, const char* uri) {
+    gchar* path = g_filename_from_uri(uri, NULL, NULL);
+    GStatBuf stat_buf;
+    gboolean result;
+
+    // Only local files are cached, their size is known in advance
+    if (!path) {
+        return FALSE;
+    }
+
+    result = g_stat(path, &stat_buf) == 0 && (gsize)stat_buf.st_size <= cache->max_file_size;
+    g_free(path);
+
+    return result;
+}
+
+static void decoder_pad_added(GstElement* decoder, GstPad* pad, gpointer user_data) {
+    GstPad* sink_pad = gst_element_get_static_pad(GST_ELEMENT(user_data), "sink");
+    GstCaps* caps = gst_pad_get_current_caps(pad);
+
+    // Only video is cached, other streams stay unlinked
+    if (caps && !gst_pad_is_linked(sink_pad) &&
+        g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/x-raw")) {
+        gst_pad_link(pad, sink_pad);
+    }
+
+    if (caps) {
+        gst_caps_unref(caps);
+    }
+    gst_object_unref(sink_pad);
+}
+
+static GstElement* create_decode_pipeline(ClipCache* cache,
+                                          const char* uri,
+                                          int width,
+                                          int height,
+                                          GstElement** appsink) {
+    GstElement* pipeline = gst_pipeline_new(NULL);
+    GstElement* decoder = gst_element_factory_make("uridecodebin", NULL);
+    GstElement* convert = gst_element_factory_make("videoconvert", NULL);
+    GstElement* scale = gst_element_factory_make("videoscale", NULL);
+    GstElement* filter = gst_element_factory_make("capsfilter", NULL);
+    GstCaps* caps;
+
+    *appsink = gst_element_factory_make("appsink", NULL);
+    if (!pipeline || !decoder || !convert || !scale || !filter || !*appsink) {
+        g_printerr("Error: failed to create elements to decode clip '%s'\n", uri);
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        if (decoder) {
+            gst_object_unref(decoder);
+        }
+        if (convert) {
+            gst_object_unref(convert);
+        }
+        if (scale) {
+            gst_object_unref(scale);
+        }
+        if (filter) {
+            gst_object_unref(filter);
+        }
+        if (*appsink) {
+            gst_object_unref(*appsink);
+        }
+        return NULL;
+    }
+
+    caps = gst_caps_new_simple("video/x-raw",
+                               "format",
+                               G_TYPE_STRING,
+                               cache->format,
+                               "width",
+                               G_TYPE_INT,
+                               width,
+                               "height",
+                               G_TYPE_INT,
+                               height,
+                               "pixel-aspect-ratio",
+                               GST_TYPE_FRACTION,
+                               1,
+                               1,
+                               NULL);
+    g_object_set(filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    // Clip is decoded as fast as possible
+    g_object_set(decoder, "uri", uri, NULL);
+    g_object_set(*appsink, "sync", FALSE, NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline), decoder, convert, scale, filter, *appsink, NULL);
+    if (!gst_element_link_many(convert, scale, filter, *appsink, NULL)) {
+        g_printerr("Error: failed to link elements to decode clip '%s'\n", uri);
+        gst_object_unref(pipeline);
+        return NULL;
+    }
+    g_signal_connect(decoder, "pad-added", G_CALLBACK(decoder_pad_added), convert);
+
+    return pipeline;
+}
+
+static GstClockTime get_frame_duration(GstBuffer* buffer, GstCaps* caps) {
+    gint fps_n = 0;
+    gint fps_d = 1;
+
+    if (GST_BUFFER_DURATION_IS_VALID(buffer)) {
+        return GST_BUFFER_DURATION(buffer);
+    }
+
+    gst_structure_get_fraction(gst_caps_get_structure(caps, 0), "framerate", &fps_n, &fps_d);
+    if (fps_n <= 0) {
+        return DEFAULT_FRAME_DURATION;
+    }
+
+    return gst_util_uint64_scale_int(GST_SECOND, fps_d, fps_n);
+}
+
+// Returns TRUE if the frame is stored and the clip still fits into budget
+static gboolean store_frame(ClipCache* cache, CachedClip* clip, GstSample* sample, GstClockTime* first_pts) {
+    GstBuffer* decoded = gst_sample_get_buffer(sample);
+    GstBuffer* frame;
+    GstClockTime pts;
+
+    if (!clip->caps) {
+        clip->caps = gst_caps_ref(gst_sample_get_caps(sample));
+    }
+
+    // Decoded buffers belong to pools of the decode pipeline, so frames are copied into memory of their own
+    frame = gst_buffer_copy_deep(decoded);
+    GST_BUFFER_FLAG_UNSET(frame, GST_BUFFER_FLAG_DISCONT);
+
+    if (!GST_CLOCK_TIME_IS_VALID(*first_pts)) {
+        *first_pts = GST_BUFFER_PTS_IS_VALID(decoded) ? GST_BUFFER_PTS(decoded) : 0;
+    }
+    pts = GST_BUFFER_PTS_IS_VALID(decoded) && GST_BUFFER_PTS(decoded) >= *first_pts
+              ? GST_BUFFER_PTS(decoded) - *first_pts
+              : clip->duration;
+    GST_BUFFER_PTS(frame) = pts;
+    GST_BUFFER_DTS(frame) = pts;
+    GST_BUFFER_DURATION(frame) = get_frame_duration(decoded, clip->caps);
+
+    clip->duration = MAX(clip->duration, pts + GST_BUFFER_DURATION(frame));
+    clip->bytes += gst_buffer_get_size(frame);
+    g_ptr_array_add(clip->frames, frame);
+
+    return clip->bytes <= cache->budget;
+}
+
+// Decodes the whole clip in its own pipeline, blocks until it is done
+static CachedClip* decode_clip(ClipCache* cache, const char* uri, int width, int height) {
+    GstElement* appsink;
+    GstElement* pipeline = create_decode_pipeline(cache, uri, width, height, &appsink);
+    GstBus* bus;
+    CachedClip* clip;
+    GstClockTime first_pts = GST_CLOCK_TIME_NONE;
+    gboolean failed = FALSE;
+
+    if (!pipeline) {
+        return NULL;
+    }
+
+    clip = g_new0(CachedClip, 1);
+    clip->cache = cache;
+    clip->uri = g_strdup(uri);
+    clip->width = width;
+    clip->height = height;
+    clip->frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+
+    bus = gst_element_get_bus(pipeline);
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Error: unable to start decoding of clip '%s'\n", uri);
+        failed = TRUE;
+    }
+
+    while (!failed) {
+        GstSample* sample;
+        GstMessage* msg;
+
+        // Cache is being freed, decoding in the background is not finished
+        if (g_atomic_int_get(&cache->stopping)) {
+            failed = TRUE;
+            break;
+        }
+
+        sample = gst_app_sink_try_pull_sample(GST_APP_SINK(appsink), PULL_TIMEOUT);
+
+        if (sample) {
+            if (!store_frame(cache, clip, sample, &first_pts)) {
+                g_print("Clip '%s' does not fit into cache budget\n", uri);
+                failed = TRUE;
+            }
+            gst_sample_unref(sample);
+            continue;
+        }
+
+        if (gst_app_sink_is_eos(GST_APP_SINK(appsink))) {
+            break;
+        }
+
+        msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+        if (msg) {
+            GError* err;
+            gchar* debug_info;
+
+            gst_message_parse_error(msg, &err, &debug_info);
+            g_printerr("Error: failed to decode clip '%s': %s\n", uri, err->message);
+            g_clear_error(&err);
+            g_free(debug_info);
+            gst_message_unref(msg);
+            failed = TRUE;
+        }
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipeline);
+
+    if (!failed && clip->frames->len == 0) {
+        g_printerr("Error: clip '%s' has no video frames\n", uri);
+        failed = TRUE;
+    }
+
+    if (failed) {
+        cached_clip_free(clip);
+        return NULL;
+    }
+
+    return clip;
+}
+
+// Must be called with the lock held
+static CachedClip* find_clip(ClipCache* cache, const char* uri, int width, int height) {
+    GList* item;
+
+    for (item = cache->clips.head; item; item = item->next) {
+        CachedClip* clip = item->data;
+        if (clip->width == width && clip->height == height && g_strcmp0(clip->uri, uri) == 0) {
+            return clip;
+        }
+    }
+
+    return NULL;
+}
+
+// Must be called with the lock held. Returns FALSE if there is no room even after eviction
+static gboolean insert_clip(ClipCache* cache, CachedClip* clip) {
+    GList* item = cache->clips.tail;
+
+    while (item && cache->used_bytes + clip->bytes > cache->budget) {
+        CachedClip* evicted = item->data;
+        GList* prev = item->prev;
+
+        if (evicted->users == 0) {
+            g_print("Clip '%s' (%ix%i) is evicted from cache\n", evicted->uri, evicted->width, evicted->height);
+            cache->used_bytes -= evicted->bytes;
+            g_queue_delete_link(&cache->clips, item);
+            cached_clip_free(evicted);
+        }
+        item = prev;
+    }
+
+    if (cache->used_bytes + clip->bytes > cache->budget) {
+        return FALSE;
+    }
+
+    g_queue_push_head(&cache->clips, clip);
+    cache->used_bytes += clip->bytes;
+
+    return TRUE;
+}
+
+static void release_clip(CachedClip* clip) {
+    ClipCache* cache = clip->cache;
+
+    g_mutex_lock(&cache->lock);
+    --clip->users;
+    g_mutex_unlock(&cache->lock);
+}
+
+// Decodes the clip and stores it in the cache, blocks until it is done. Returns the clip with one more user, NULL if
+// it can not be cached
+static CachedClip* cache_clip(ClipCache* cache, const char* uri, int width, int height) {
+    CachedClip* clip;
+    gboolean inserted;
+    gsize used_bytes;
+
+    g_print("Decoding clip '%s' into cache...\n", uri);
+    clip = decode_clip(cache, uri, width, height);
+    if (!clip) {
+        return NULL;
+    }
+
+    g_mutex_lock(&cache->lock);
+    inserted = insert_clip(cache, clip);
+    if (inserted) {
+        ++clip->users;
+    }
+    used_bytes = cache->used_bytes;
+    g_mutex_unlock(&cache->lock);
+
+    if (!inserted) {
+        g_print("Clip '%s' does not fit into cache budget\n", uri);
+        cached_clip_free(clip);
+        return NULL;
+    }
+
+    g_print("Clip '%s' is cached: %u frames %ix%i, %" G_GSIZE_FORMAT " KB, cache uses %" G_GSIZE_FORMAT
+            " of %" G_GSIZE_FORMAT " KB\n",
+            uri,
+            clip->frames->len,
+            width,
+            height,
+            clip->bytes / 1024,
+            used_bytes / 1024,
+            cache->budget / 1024);
+
+    return clip;
+}
+
+static void clip_job_free(ClipJob* job) {
+    g_free(job->key);
+    g_free(job->uri);
+    g_free(job);
+}
+
+// Runs in the worker thread of the cache
+static void decode_job(gpointer job_data, gpointer user_data) {
+    ClipJob* job = job_data;
+    ClipCache* cache = user_data;
+    CachedClip* clip = NULL;
+
+    if (!g_atomic_int_get(&cache->stopping)) {
+        clip = cache_clip(cache, job->uri, job->width, job->height);
+    }
+    if (clip) {
+        release_clip(clip);
+    }
+
+    g_mutex_lock(&cache->lock);
+    g_hash_table_remove(cache->decoding, job->key);
+    g_mutex_unlock(&cache->lock);
+    clip_job_free(job);
+}
+
+// Queues the clip for decoding unless it is queued already
+static void decode_in_background(ClipCache* cache, const char* uri, int width, int height) {
+    gchar* key = g_strdup_printf("%ix%i %s", width, height, uri);
+    ClipJob* job;
+
+    g_mutex_lock(&cache->lock);
+    if (g_hash_table_contains(cache->decoding, key)) {
+        g_mutex_unlock(&cache->lock);
+        g_free(key);
+        return;
+    }
+    g_hash_table_add(cache->decoding, g_strdup(key));
+    g_mutex_unlock(&cache->lock);
+
+    job = g_new0(ClipJob, 1);
+    job->key = key;
+    job->uri = g_strdup(uri);
+    job->width = width;
+    job->height = height;
+    g_print("Clip '%s' is decoded into cache in the background, until then it is played from file\n", uri);
+    g_thread_pool_push(cache->decoder, job, NULL);
+}
+
+static void clip_player_free(gpointer user_data) {
+    ClipPlayer* player = user_data;
+
+    release_clip(player->clip);
+    g_free(player);
+}
+
+// Called in the streaming thread of appsrc whenever its queue runs low
+static void need_data(GstAppSrc* appsrc, guint length, gpointer user_data) {
+    ClipPlayer* player = user_data;
+    CachedClip* clip = player->clip;
+    GstBuffer* frame = g_ptr_array_index(clip->frames, player->next_frame);
+    // Memory of the frame is shared, only timestamps of the copy are changed
+    GstBuffer* buffer = gst_buffer_copy(frame);
+
+    GST_BUFFER_PTS(buffer) = player->pass_start + GST_BUFFER_PTS(frame);
+    GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+
+    if (++player->next_frame == clip->frames->len) {
+        player->next_frame = 0;
+        player->pass_start += clip->duration;
+    }
+
+    gst_app_src_push_buffer(appsrc, buffer);
+}
+
+ClipCache* clip_cache_new(gsize budget, gsize max_file_size, const char* format) {
+    ClipCache* cache = g_new0(ClipCache, 1);
+
+    cache->budget = budget;
+    cache->max_file_size = max_file_size;
+    cache->format = g_strdup(format);
+    g_mutex_init(&cache->lock);
+    g_queue_init(&cache->clips);
+    cache->decoding = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    cache->decoder = g_thread_pool_new(decode_job, cache, 1, FALSE, NULL);
+
+    return cache;
+}
+
+void clip_cache_free(ClipCache* cache) {
+    if (!cache) {
+        return;
+    }
+
+    // Queued clips are dropped, the one being decoded is interrupted
+    g_atomic_int_set(&cache->stopping, TRUE);
+    g_thread_pool_free(cache->decoder, TRUE, TRUE);
+    g_hash_table_destroy(cache->decoding);
+    g_queue_clear_full(&cache->clips, (GDestroyNotify)cached_clip_free);
+    g_mutex_clear(&cache->lock);
+    g_free(cache->format);
+    g_free(cache);
+}
+
+GstElement* clip_cache_create_source(ClipCache* cache,
+                                     const char* uri,
+                                     const char* name,
+                                     int width,
+                                     int height,
+                                     gboolean blocking) {
+    GstAppSrcCallbacks callbacks = {0};
+    GstElement* appsrc;
+    ClipPlayer* player;
+    CachedClip* clip;
+
+    g_mutex_lock(&cache->lock);
+    clip = find_clip(cache, uri, width, height);
+    if (clip) {
+        g_queue_remove(&cache->clips, clip);
+        g_queue_push_head(&cache->clips, clip);
+        ++clip->users;
+    }
+    g_mutex_unlock(&cache->lock);
+
+    if (!clip) {
+        if (!is_file_small_enough(cache, uri)) {
+            return NULL;
+        }
+
+        if (!blocking) {
+            decode_in_background(cache, uri, width, height);
+            return NULL;
+        }
+
+        clip = cache_clip(cache, uri, width, height);
+        if (!clip) {
+            return NULL;
+        }
+    }
+
+    appsrc = gst_element_factory_make("appsrc", name);
+    if (!appsrc) {
+        g_printerr("Error: failed to create source of cached clip '%s'\n", uri);
+        release_clip(clip);
+        return NULL;
+    }
+
+    player = g_new0(ClipPlayer, 1);
+    player->clip = clip;
+
+    g_object_set(appsrc, "caps", clip->caps, "format", GST_FORMAT_TIME, "is-live", FALSE, NULL);
+    callbacks.need_data = need_data;
+    gst_app_src_set_callbacks(GST_APP_SRC(appsrc), &callbacks, player, clip_player_free);
+    g_object_set_data(G_OBJECT(appsrc), "clip-cache-source", player);
+
+    return appsrc;
+}
+
+gboolean clip_cache_is_source(GstElement* element) {
+    return g_object_get_data(G_OBJECT(element), "clip-cache-source") != NULL;
+}
@@ -0,0 +1,36 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_CLIP_CACHE_H
+#define TWITCH_STREAMER_CLIP_CACHE_H
+
+#include <gst/gst.h>
+
+// In-memory store of short looping clips (bumpers, overlays) decoded once and already scaled to the tile size. Cached
+// clip is played by appsrc which pushes stored frames in a loop with continuous timestamps, so repeated passes cost no
+// decoding and no scaling. Clips are kept within memory budget, the least recently used ones which are not played by
+// any source are evicted first
+typedef struct _ClipCache ClipCache;
+
+// Clips of files bigger than 'max_file_size' bytes are never cached. Frames are stored in pixel 'format' (I420 or
+// NV12), which should match the format of the composited frame
+ClipCache* clip_cache_new(gsize budget, gsize max_file_size, const char* format);
+
+// Frees all clips, sources created by the cache should be already destroyed. Waits for the clip being decoded in the
+// background, if any
+void clip_cache_free(ClipCache* cache);
+
+// Creates appsrc named 'name' which plays clip 'uri' scaled to 'width'x'height' forever. Clip which is not cached yet
+// is decoded blocking the caller if 'blocking' is set, otherwise it is decoded in the background and NULL is returned,
+// so the caller plays the file as usual until the clip is cached. Returns NULL if clip can not be cached, e.g. file is
+// too big or clip does not fit into the budget
+GstElement* clip_cache_create_source(ClipCache* cache,
+                                     const char* uri,
+                                     const char* name,
+                                     int width,
+                                     int height,
+                                     gboolean blocking);
+
+// Returns TRUE if 'element' was created by clip_cache_create_source
+gboolean clip_cache_is_source(GstElement* element);
+
+#endif // TWITCH_STREAMER_CLIP_CACHE_H
@@ -0,0 +1,185 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Control.h"
+
+#include <gio/gio.h>
+
+#include <string.h>
+
+struct _ControlServer {
+    GSocketService* service;
+    GCancellable* cancellable;
+    ControlCommandHandler handler;
+    gpointer user_data;
+    struct _ControlClient* executing; // client which command is being handled
+};
+
+typedef struct _ControlClient {
+    ControlServer* server;
+    GSocketConnection* connection;
+    GDataInputStream* input;
+} ControlClient;
+
+struct _ControlReply {
+    ControlClient* client;
+};
+
+static void control_client_free(ControlClient* client) {
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_free(client);
+}
+
+static void read_next_line(ControlClient* client);
+
+static gchar* execute_line(ControlServer* server, ControlClient* client, const gchar* line) {
+    GError* error = NULL;
+    gchar** args = NULL;
+    gchar* reply;
+
+    if (!g_shell_parse_argv(line, NULL, &args, &error)) {
+        reply = g_strdup_printf("error: %s\n", error->message);
+        g_clear_error(&error);
+        return reply;
+    }
+
+    server->executing = client;
+    reply = server->handler(args, server->user_data);
+    server->executing = NULL;
+    g_strfreev(args);
+
+    return reply;
+}
+
+// Client is freed if it has disconnected, otherwise its next command is read
+static void send_reply(ControlClient* client, const gchar* reply) {
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(client->connection));
+
+    if (!g_output_stream_write_all(output, reply, strlen(reply), NULL, client->server->cancellable, NULL)) {
+        control_client_free(client);
+        return;
+    }
+
+    read_next_line(client);
+}
+
+static void line_read_callback(GObject* source, GAsyncResult* result, gpointer user_data) {
+    ControlClient* client = user_data;
+    gchar* line;
+    gchar* reply;
+
+    // NULL without error means that client has closed connection
+    line = g_data_input_stream_read_line_finish_utf8(client->input, result, NULL, NULL);
+    if (!line) {
+        control_client_free(client);
+        return;
+    }
+
+    g_strstrip(line);
+    if (line[0] == '\0') {
+        g_free(line);
+        read_next_line(client);
+        return;
+    }
+
+    g_print("Control command: %s\n", line);
+    reply = execute_line(client->server, client, line);
+    g_free(line);
+
+    // Deferred reply is sent by control_reply_send
+    if (!reply) {
+        return;
+    }
+
+    send_reply(client, reply);
+    g_free(reply);
+}
+
+static void read_next_line(ControlClient* client) {
+    g_data_input_stream_read_line_async(
+        client->input, G_PRIORITY_DEFAULT, client->server->cancellable, line_read_callback, client);
+}
+
+static gboolean incoming_handler(GSocketService* service,
+                                 GSocketConnection* connection,
+                                 GObject* source_object,
+                                 gpointer user_data) {
+    ControlClient* client = g_new0(ControlClient, 1);
+
+    client->server = user_data;
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_data_input_stream_set_newline_type(client->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+
+    read_next_line(client);
+
+    return TRUE;
+}
+
+ControlServer* control_server_new(int port, ControlCommandHandler handler, gpointer user_data) {
+    ControlServer* server;
+    GSocketService* service = g_socket_service_new();
+    GInetAddress* loopback;
+    GSocketAddress* address;
+    GError* error = NULL;
+    gboolean listening;
+
+    // Control socket allows to reconfigure the pipeline, so it is available on loopback interface only
+    loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new(loopback, port);
+    listening = g_socket_listener_add_address(G_SOCKET_LISTENER(service),
+                                              address,
+                                              G_SOCKET_TYPE_STREAM,
+                                              G_SOCKET_PROTOCOL_TCP,
+                                              NULL,
+                                              NULL,
+                                              &error);
+    g_object_unref(address);
+    g_object_unref(loopback);
+
+    if (!listening) {
+        g_printerr("Error: failed to listen for control commands on port %i: %s\n", port, error->message);
+        g_clear_error(&error);
+        g_object_unref(service);
+        return NULL;
+    }
+
+    server = g_new0(ControlServer, 1);
+    server->service = service;
+    server->cancellable = g_cancellable_new();
+    server->handler = handler;
+    server->user_data = user_data;
+
+    g_signal_connect(service, "incoming", G_CALLBACK(incoming_handler), server);
+    g_socket_service_start(service);
+    g_print("Control commands are accepted on 127.0.0.1:%i\n", port);
+
+    return server;
+}
+
+void control_server_free(ControlServer* server) {
+    if (!server) {
+        return;
+    }
+
+    g_cancellable_cancel(server->cancellable);
+    g_socket_service_stop(server->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+    g_object_unref(server->service);
+    g_object_unref(server->cancellable);
+    g_free(server);
+}
+
+ControlReply* control_server_defer_reply(ControlServer* server) {
+    ControlReply* reply = g_new0(ControlReply, 1);
+
+    reply->client = server->executing;
+
+    return reply;
+}
+
+void control_reply_send(ControlReply* reply, const gchar* text) {
+    send_reply(reply->client, text);
+    g_free(reply);
+}
@@ -0,0 +1,34 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_CONTROL_H
+#define TWITCH_STREAMER_CONTROL_H
+
+#include <glib.h>
+
+// Line based control protocol on localhost: every line is a command, words are split like in shell, so arguments
+// with spaces can be quoted. Commands are handled in the thread running the default main context, i.e. together with
+// bus messages of the pipeline, so handlers need no locking
+typedef struct _ControlServer ControlServer;
+
+// Handles one command, 'args' is NULL terminated list of words, the first one is the command name.
+// Returns newly allocated reply, every line of which ends with '\n'
+typedef gchar* (*ControlCommandHandler)(gchar** args, gpointer user_data);
+
+// Reply to a command which result is known later. The handler takes it with control_server_defer_reply and returns
+// NULL, the next command of the client is read once the reply is sent
+typedef struct _ControlReply ControlReply;
+
+// Starts listening on 127.0.0.1:'port'. Returns NULL on failure
+ControlServer* control_server_new(int port, ControlCommandHandler handler, gpointer user_data);
+
+// Stops listening, connected clients are not served anymore
+void control_server_free(ControlServer* server);
+
+// Must be called from the command handler only
+ControlReply* control_server_defer_reply(ControlServer* server);
+
+// Sends 'text' to the client which has sent the command and frees 'reply'. Every line of 'text' ends with '\n'. Must be
+// called before the server is freed
+void control_reply_send(ControlReply* reply, const gchar* text);
+
+#endif // TWITCH_STREAMER_CONTROL_H
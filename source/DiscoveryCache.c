@@ -0,0 +1,260 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "DiscoveryCache.h"
+
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <string.h>
+
+#define CACHE_DIR_NAME "twitch-streamer"
+#define CACHE_FILE_NAME "discovery.ini"
+
+#define KEY_SIZE "size"
+#define KEY_MTIME "mtime"
+#define KEY_CONTAINER_CAPS "container-caps"
+#define KEY_DECODERS "decoders"
+
+struct _DiscoveryCache {
+    gchar* path;
+
+    // Streaming threads of all sources record into the same key file
+    GMutex lock;
+    GKeyFile* file; // group per file, named by its absolute path
+    gboolean changed;
+};
+
+// Cached results for one source, they are read once when the source is attached
+typedef struct _SourceDiscovery {
+    DiscoveryCache* cache;
+    gchar* group;
+    GstCaps* container_caps; // NULL if type-finding has to run
+    gchar** decoders;        // NULL if decoders are not known yet
+    gboolean typefind_seen;
+    gboolean decoders_recorded;
+} SourceDiscovery;
+
+DiscoveryCache* discovery_cache_load(void) {
+    DiscoveryCache* cache = g_new0(DiscoveryCache, 1);
+    GError* err = NULL;
+
+    cache->path = g_build_filename(g_get_user_cache_dir(), CACHE_DIR_NAME, CACHE_FILE_NAME, NULL);
+    cache->file = g_key_file_new();
+    g_mutex_init(&cache->lock);
+
+    if (!g_key_file_load_from_file(cache->file, cache->path, G_KEY_FILE_NONE, &err)) {
+        if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            g_print("Discovery cache '%s' is not used: %s\n", cache->path, err->message);
+        }
+        g_clear_error(&err);
+        g_key_file_free(cache->file);
+        cache->file = g_key_file_new();
+    }
+
+    return cache;
+}
+
+void discovery_cache_save(DiscoveryCache* cache) {
+    gchar* dir;
+    GError* err = NULL;
+
+    if (!cache) {
+        return;
+    }
+
+    g_mutex_lock(&cache->lock);
+    if (cache->changed) {
+        dir = g_path_get_dirname(cache->path);
+        if (g_mkdir_with_parents(dir, 0755) != 0 || !g_key_file_save_to_file(cache->file, cache->path, &err)) {
+            g_printerr("Error: discovery cache could not be saved to '%s': %s\n",
+                       cache->path,
+                       err ? err->message : g_strerror(errno));
+            g_clear_error(&err);
+        } else {
+            cache->changed = FALSE;
+        }
+        g_free(dir);
+    }
+    g_mutex_unlock(&cache->lock);
+}
+
+void discovery_cache_free(DiscoveryCache* cache) {
+    if (!cache) {
+        return;
+    }
+
+    g_key_file_free(cache->file);
+    g_mutex_clear(&cache->lock);
+    g_free(cache->path);
+    g_free(cache);
+}
+
+static void source_discovery_free(gpointer user_data) {
+    SourceDiscovery* discovery = user_data;
+
+    if (discovery->container_caps) {
+        gst_caps_unref(discovery->container_caps);
+    }
+    g_strfreev(discovery->decoders);
+    g_free(discovery->group);
+    g_free(discovery);
+}
+
+static void have_type_handler(GstElement* typefind, guint probability, GstCaps* caps, SourceDiscovery* discovery) {
+    DiscoveryCache* cache = discovery->cache;
+    gchar* caps_string = gst_caps_to_string(caps);
+
+    g_mutex_lock(&cache->lock);
+    g_key_file_set_string(cache->file, discovery->group, KEY_CONTAINER_CAPS, caps_string);
+    cache->changed = TRUE;
+    g_mutex_unlock(&cache->lock);
+
+    g_free(caps_string);
+}
+
+// The first type-finder added to uridecodebin is the one of decodebin, which detects the container
+static void element_added_handler(GstBin* bin, GstBin* sub_bin, GstElement* element, SourceDiscovery* discovery) {
+    GstElementFactory* factory = gst_element_get_factory(element);
+
+    if (discovery->typefind_seen || !factory ||
+        g_strcmp0(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "typefind") != 0) {
+        return;
+    }
+    discovery->typefind_seen = TRUE;
+
+    if (discovery->container_caps) {
+        g_object_set(element, "force-caps", discovery->container_caps, NULL);
+    } else {
+        g_signal_connect(element, "have-type", G_CALLBACK(have_type_handler), discovery);
+    }
+}
+
+static gboolean is_cached_decoder(SourceDiscovery* discovery, GstPluginFeature* feature) {
+    return g_strv_contains((const gchar* const*)discovery->decoders, gst_plugin_feature_get_name(feature));
+}
+
+// Factories are already sorted by rank, the ones which were plugged last time are moved to the front. Higher ranked
+// decoders which failed to open the stream (e.g. hardware ones without a device) are not probed again
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+static GValueArray* autoplug_sort_handler(GstElement* bin,
+                                          GstPad* pad,
+                                          GstCaps* caps,
+                                          GValueArray* factories,
+                                          SourceDiscovery* discovery) {
+    GValueArray* sorted;
+    gboolean found = FALSE;
+    guint i;
+
+    if (!discovery->decoders) {
+        return NULL;
+    }
+
+    for (i = 0; i < factories->n_values && !found; ++i) {
+        found = is_cached_decoder(discovery, g_value_get_object(g_value_array_get_nth(factories, i)));
+    }
+    if (!found) {
+        return NULL;
+    }
+
+    sorted = g_value_array_new(factories->n_values);
+    for (i = 0; i < factories->n_values; ++i) {
+        GValue* factory = g_value_array_get_nth(factories, i);
+        if (is_cached_decoder(discovery, g_value_get_object(factory))) {
+            g_value_array_append(sorted, factory);
+        }
+    }
+    for (i = 0; i < factories->n_values; ++i) {
+        GValue* factory = g_value_array_get_nth(factories, i);
+        if (!is_cached_decoder(discovery, g_value_get_object(factory))) {
+            g_value_array_append(sorted, factory);
+        }
+    }
+
+    return sorted;
+}
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+// Decodebin exposes pads when all streams are decoded, so the decoders present at that moment are the plugged ones
+static void pad_added_handler(GstElement* source, GstPad* pad, SourceDiscovery* discovery) {
+    DiscoveryCache* cache = discovery->cache;
+    GPtrArray* names;
+    GValue item = G_VALUE_INIT;
+    GstIterator* iterator;
+
+    if (discovery->decoders_recorded) {
+        return;
+    }
+    discovery->decoders_recorded = TRUE;
+
+    names = g_ptr_array_new();
+    iterator = gst_bin_iterate_recurse(GST_BIN(source));
+    while (gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        GstElementFactory* factory = gst_element_get_factory(g_value_get_object(&item));
+        const gchar* klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+        if (klass && strstr(klass, "Decoder")) {
+            g_ptr_array_add(names, (gpointer)gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)));
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    if (names->len > 0) {
+        g_mutex_lock(&cache->lock);
+        g_key_file_set_string_list(
+            cache->file, discovery->group, KEY_DECODERS, (const gchar* const*)names->pdata, names->len);
+        cache->changed = TRUE;
+        g_mutex_unlock(&cache->lock);
+    }
+    g_ptr_array_unref(names);
+}
+
+void discovery_cache_attach(DiscoveryCache* cache, GstElement* source) {
+    SourceDiscovery* discovery;
+    GStatBuf file_stat;
+    gchar* uri = NULL;
+    gchar* path;
+    gchar* caps_string;
+
+    g_object_get(source, "uri", &uri, NULL);
+    path = uri ? g_filename_from_uri(uri, NULL, NULL) : NULL;
+    g_free(uri);
+    if (!path || g_stat(path, &file_stat) != 0) {
+        g_free(path);
+        return;
+    }
+
+    discovery = g_new0(SourceDiscovery, 1);
+    discovery->cache = cache;
+    discovery->group = path;
+
+    // Results for an older version of the file are forgotten
+    g_mutex_lock(&cache->lock);
+    if (g_key_file_has_group(cache->file, path) &&
+        ((guint64)file_stat.st_size != g_key_file_get_uint64(cache->file, path, KEY_SIZE, NULL) ||
+         (gint64)file_stat.st_mtime != g_key_file_get_int64(cache->file, path, KEY_MTIME, NULL))) {
+        g_key_file_remove_group(cache->file, path, NULL);
+    }
+    if (!g_key_file_has_group(cache->file, path)) {
+        g_key_file_set_uint64(cache->file, path, KEY_SIZE, (guint64)file_stat.st_size);
+        g_key_file_set_int64(cache->file, path, KEY_MTIME, (gint64)file_stat.st_mtime);
+        cache->changed = TRUE;
+    }
+    caps_string = g_key_file_get_string(cache->file, path, KEY_CONTAINER_CAPS, NULL);
+    discovery->decoders = g_key_file_get_string_list(cache->file, path, KEY_DECODERS, NULL, NULL);
+    g_mutex_unlock(&cache->lock);
+
+    if (caps_string) {
+        discovery->container_caps = gst_caps_from_string(caps_string);
+        g_free(caps_string);
+    }
+    g_print("Discovery of '%s': container type %s, decoders %s\n",
+            path,
+            discovery->container_caps ? "cached" : "unknown",
+            discovery->decoders ? "cached" : "unknown");
+
+    g_object_set_data_full(G_OBJECT(source), "discovery", discovery, source_discovery_free);
+    g_signal_connect(source, "deep-element-added", G_CALLBACK(element_added_handler), discovery);
+    g_signal_connect(source, "autoplug-sort", G_CALLBACK(autoplug_sort_handler), discovery);
+    g_signal_connect(source, "pad-added", G_CALLBACK(pad_added_handler), discovery);
+}
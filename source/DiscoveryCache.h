@@ -0,0 +1,27 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_DISCOVERY_CACHE_H
+#define TWITCH_STREAMER_DISCOVERY_CACHE_H
+
+#include <gst/gst.h>
+
+// Results of source discovery kept between runs: container caps found by type-finding and decoders plugged by
+// uridecodebin, per file. When a known file is started again, type-finding is skipped and the decoders which worked
+// last time are tried first, so no time is spent on probing the file and on decoders which fail to open it. Entries
+// are keyed by absolute path and dropped when size or modification time of the file changes
+typedef struct _DiscoveryCache DiscoveryCache;
+
+// Loads the cache from the user cache directory, missing or broken file gives an empty cache
+DiscoveryCache* discovery_cache_load(void);
+
+// Writes the cache back if anything was discovered since it was loaded or saved last time
+void discovery_cache_save(DiscoveryCache* cache);
+
+// Sources attached to the cache should be already destroyed
+void discovery_cache_free(DiscoveryCache* cache);
+
+// Applies cached results to uridecodebin 'source' and records what it discovers. Must be called before the source is
+// started, sources which do not play a local file are left as they are
+void discovery_cache_attach(DiscoveryCache* cache, GstElement* source);
+
+#endif // TWITCH_STREAMER_DISCOVERY_CACHE_H
@@ -0,0 +1,154 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "EncoderProfile.h"
+
+#include <string.h>
+
+// Values of x264enc enum and flags properties
+#define SPEED_PRESET_SUPERFAST 2
+#define SPEED_PRESET_FASTER 4
+#define SPEED_PRESET_FAST 5
+#define TUNE_NONE 0
+#define TUNE_ZERO_LATENCY 4
+
+typedef struct _EncoderSettings {
+    int speed_preset;
+    guint tune;
+    gboolean sliced_threads; // split every frame between threads instead of encoding several frames at once
+    int rc_lookahead;        // frames
+    guint bframes;
+    guint vbv_buffer; // ms, together with bitrate limits the size of a burst, so it bounds the player's buffer
+    guint qp_min;
+} EncoderSettings;
+
+static const EncoderSettings encoder_settings[] = {
+    [ENCODER_PROFILE_LOW_LATENCY] = {SPEED_PRESET_FASTER, TUNE_ZERO_LATENCY, TRUE, 0, 0, 500, 30},
+    [ENCODER_PROFILE_QUALITY] = {SPEED_PRESET_FAST, TUNE_NONE, FALSE, 20, 2, 2000, 20},
+    [ENCODER_PROFILE_CPU_SAVER] = {SPEED_PRESET_SUPERFAST, TUNE_ZERO_LATENCY, FALSE, 0, 0, 1000, 30},
+};
+
+int encoder_profile_from_string(const char* name, EncoderProfile* profile) {
+    if (!name || !profile) {
+        return 1;
+    }
+
+    if (strcmp(name, "low-latency") == 0) {
+        *profile = ENCODER_PROFILE_LOW_LATENCY;
+    } else if (strcmp(name, "quality") == 0) {
+        *profile = ENCODER_PROFILE_QUALITY;
+    } else if (strcmp(name, "cpu-saver") == 0) {
+        *profile = ENCODER_PROFILE_CPU_SAVER;
+    } else {
+        return 1;
+    }
+
+    return 0;
+}
+
+const char* encoder_profile_to_string(EncoderProfile profile) {
+    switch (profile) {
+    case ENCODER_PROFILE_LOW_LATENCY:
+        return "low-latency";
+    case ENCODER_PROFILE_QUALITY:
+        return "quality";
+    case ENCODER_PROFILE_CPU_SAVER:
+        return "cpu-saver";
+    }
+
+    return "unknown";
+}
+
+void encoder_profile_apply(EncoderProfile profile, GstElement* encoder, int bitrate, int framerate, int threads) {
+    const EncoderSettings* settings = &encoder_settings[profile];
+
+    // Encoder applies preset and tune first, the values below override what they imply
+    g_object_set(encoder, "speed-preset", settings->speed_preset, "tune", settings->tune, NULL);
+    g_object_set(encoder,
+                 "bitrate",
+                 (guint)bitrate,
+                 "vbv-buf-capacity",
+                 settings->vbv_buffer,
+                 "key-int-max",
+                 (guint)(framerate * KEYFRAME_INTERVAL),
+                 "b-adapt",
+                 settings->bframes > 0,
+                 "bframes",
+                 settings->bframes,
+                 "rc-lookahead",
+                 settings->rc_lookahead,
+                 "sliced-threads",
+                 settings->sliced_threads,
+                 "threads",
+                 (guint)threads,
+                 "qp-min",
+                 settings->qp_min,
+                 NULL);
+}
+
+guint encoder_profile_held_frames(EncoderProfile profile, int threads) {
+    const EncoderSettings* settings = &encoder_settings[profile];
+    guint frame_threads = 1;
+
+    // Sliced threads encode one frame at a time, otherwise x264 runs one and a half frame threads per core
+    if (!settings->sliced_threads) {
+        frame_threads = threads > 0 ? (guint)threads : g_get_num_processors() * 3 / 2;
+    }
+
+    return (guint)settings->rc_lookahead + settings->bframes + frame_threads;
+}
+
+static int check_uint(GstElement* encoder, const char* property, guint expected) {
+    guint value = 0;
+
+    g_object_get(encoder, property, &value, NULL);
+    if (value != expected) {
+        g_printerr("Error: encoder property '%s' is %u instead of %u\n", property, value, expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int check_int(GstElement* encoder, const char* property, int expected) {
+    int value = 0;
+
+    g_object_get(encoder, property, &value, NULL);
+    if (value != expected) {
+        g_printerr("Error: encoder property '%s' is %i instead of %i\n", property, value, expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int check_boolean(GstElement* encoder, const char* property, gboolean expected) {
+    gboolean value = FALSE;
+
+    g_object_get(encoder, property, &value, NULL);
+    if (!value != !expected) {
+        g_printerr("Error: encoder property '%s' is %s\n", property, value ? "on" : "off");
+        return 1;
+    }
+
+    return 0;
+}
+
+int encoder_profile_check(EncoderProfile profile, GstElement* encoder, int bitrate, int framerate, int threads) {
+    const EncoderSettings* settings = &encoder_settings[profile];
+    int errors = 0;
+
+    // Enum and flags properties are read as their integer values
+    errors += check_int(encoder, "speed-preset", settings->speed_preset);
+    errors += check_uint(encoder, "tune", settings->tune);
+    errors += check_uint(encoder, "bitrate", (guint)bitrate);
+    errors += check_uint(encoder, "vbv-buf-capacity", settings->vbv_buffer);
+    errors += check_uint(encoder, "key-int-max", (guint)(framerate * KEYFRAME_INTERVAL));
+    errors += check_boolean(encoder, "b-adapt", settings->bframes > 0);
+    errors += check_uint(encoder, "bframes", settings->bframes);
+    errors += check_int(encoder, "rc-lookahead", settings->rc_lookahead);
+    errors += check_boolean(encoder, "sliced-threads", settings->sliced_threads);
+    errors += check_uint(encoder, "threads", (guint)threads);
+    errors += check_uint(encoder, "qp-min", settings->qp_min);
+
+    return errors > 0;
+}
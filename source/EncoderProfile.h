@@ -0,0 +1,39 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_ENCODER_PROFILE_H
+#define TWITCH_STREAMER_ENCODER_PROFILE_H
+
+#include <gst/gst.h>
+
+// Named sets of x264 settings. Every profile sets all encoder properties it depends on, so results do not depend on
+// encoder defaults. All profiles put a keyframe every KEYFRAME_INTERVAL seconds, as required by Twitch ingest
+typedef enum _EncoderProfile {
+    // Zero latency tuning: no B-frames, no lookahead, sliced threads and VBV buffer of a fraction of a second
+    ENCODER_PROFILE_LOW_LATENCY,
+    // Better compression for the same bitrate: B-frames, lookahead and frame threads, latency of about a second
+    ENCODER_PROFILE_QUALITY,
+    // The least CPU per frame: the fastest presets without lookahead, for many channels per box
+    ENCODER_PROFILE_CPU_SAVER,
+} EncoderProfile;
+
+#define KEYFRAME_INTERVAL 2 // s
+
+// Parses profile name ("low-latency", "quality" or "cpu-saver"). Returns 0 on success
+int encoder_profile_from_string(const char* name, EncoderProfile* profile);
+
+// Returns printable name of the profile
+const char* encoder_profile_to_string(EncoderProfile profile);
+
+// Configures x264enc 'encoder' with 'bitrate' in kbit/s for video of 'framerate' fps. 'threads' limits encoder
+// threads, zero leaves the number automatic
+void encoder_profile_apply(EncoderProfile profile, GstElement* encoder, int bitrate, int framerate, int threads);
+
+// Number of input frames an encoder configured by encoder_profile_apply may hold at once: lookahead, B-frames and
+// frames of parallel frame threads. Automatic number of threads is estimated the way x264 chooses it
+guint encoder_profile_held_frames(EncoderProfile profile, int threads);
+
+// Reads properties of 'encoder' configured by encoder_profile_apply with the same arguments back. Encoder keeps the
+// previous value of a property it rejects, so every mismatch is printed. Returns 0 if all of them match
+int encoder_profile_check(EncoderProfile profile, GstElement* encoder, int bitrate, int framerate, int threads);
+
+#endif // TWITCH_STREAMER_ENCODER_PROFILE_H
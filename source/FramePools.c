@@ -0,0 +1,287 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "FramePools.h"
+
+#include <gst/video/video.h>
+
+#include <string.h>
+
+// Frames and their rows are aligned to the widest SIMD registers (AVX-512)
+#define FRAME_ALIGNMENT 64
+
+typedef struct _PoolStats {
+    GstElement* element; // not referenced, only identifies the stats
+    gchar* name;
+    guint depth;
+    gint pools;     // created pools, one per negotiation
+    gint allocated; // buffers allocated by all pools
+    gint acquired;  // frames produced
+} PoolStats;
+
+struct _FramePools {
+    guint depth;
+
+    GMutex lock;
+    GPtrArray* stats; // PoolStats*
+};
+
+// Video buffer pool which counts allocations and prefaults allocated memory
+typedef struct _CountingPool {
+    GstVideoBufferPool parent;
+    PoolStats* stats;
+} CountingPool;
+
+typedef struct _CountingPoolClass {
+    GstVideoBufferPoolClass parent_class;
+} CountingPoolClass;
+
+GType counting_pool_get_type(void);
+
+G_DEFINE_TYPE(CountingPool, counting_pool, GST_TYPE_VIDEO_BUFFER_POOL);
+
+static GstFlowReturn counting_pool_alloc_buffer(GstBufferPool* pool,
+                                                GstBuffer** buffer,
+                                                GstBufferPoolAcquireParams* params) {
+    CountingPool* counting_pool = (CountingPool*)pool;
+    GstFlowReturn result;
+    GstMapInfo map;
+
+    result = GST_BUFFER_POOL_CLASS(counting_pool_parent_class)->alloc_buffer(pool, buffer, params);
+    if (result != GST_FLOW_OK) {
+        return result;
+    }
+
+    // Pages are touched right away, so the first frames written into them do not fault
+    if (gst_buffer_map(*buffer, &map, GST_MAP_WRITE)) {
+        memset(map.data, 0, map.size);
+        gst_buffer_unmap(*buffer, &map);
+    }
+    g_atomic_int_inc(&counting_pool->stats->allocated);
+
+    return result;
+}
+
+static GstFlowReturn counting_pool_acquire_buffer(GstBufferPool* pool,
+                                                  GstBuffer** buffer,
+                                                  GstBufferPoolAcquireParams* params) {
+    CountingPool* counting_pool = (CountingPool*)pool;
+    GstFlowReturn result;
+
+    result = GST_BUFFER_POOL_CLASS(counting_pool_parent_class)->acquire_buffer(pool, buffer, params);
+    if (result == GST_FLOW_OK) {
+        g_atomic_int_inc(&counting_pool->stats->acquired);
+    }
+
+    return result;
+}
+
+static void counting_pool_class_init(CountingPoolClass* klass) {
+    GstBufferPoolClass* pool_class = GST_BUFFER_POOL_CLASS(klass);
+
+    pool_class->alloc_buffer = counting_pool_alloc_buffer;
+    pool_class->acquire_buffer = counting_pool_acquire_buffer;
+}
+
+static void counting_pool_init(CountingPool* pool) {
+}
+
+static void pool_stats_free(gpointer data) {
+    PoolStats* stats = data;
+
+    g_free(stats->name);
+    g_free(stats);
+}
+
+FramePools* frame_pools_new(guint depth) {
+    FramePools* pools = g_new0(FramePools, 1);
+
+    pools->depth = depth;
+    g_mutex_init(&pools->lock);
+    pools->stats = g_ptr_array_new_with_free_func(pool_stats_free);
+
+    return pools;
+}
+
+void frame_pools_free(FramePools* pools) {
+    if (!pools) {
+        return;
+    }
+
+    g_ptr_array_unref(pools->stats);
+    g_mutex_clear(&pools->lock);
+    g_free(pools);
+}
+
+// Downstream pools of other types give something a plain pool can not, e.g. frames which are displayed without copy
+static gboolean is_plain_pool(GstBufferPool* pool) {
+    return !pool || G_OBJECT_TYPE(pool) == GST_TYPE_BUFFER_POOL || G_OBJECT_TYPE(pool) == GST_TYPE_VIDEO_BUFFER_POOL;
+}
+
+static GstBufferPool* create_pool(PoolStats* stats, GstCaps* caps, gboolean video_meta, guint* size) {
+    CountingPool* pool = g_object_new(counting_pool_get_type(), NULL);
+    GstStructure* config;
+    GstAllocationParams params;
+    GstVideoAlignment alignment;
+    GstVideoInfo info;
+    guint i;
+
+    if (!gst_video_info_from_caps(&info, caps)) {
+        gst_object_unref(pool);
+        return NULL;
+    }
+
+    pool->stats = stats;
+    gst_allocation_params_init(&params);
+    params.align = FRAME_ALIGNMENT - 1;
+
+    config = gst_buffer_pool_get_config(GST_BUFFER_POOL(pool));
+    gst_buffer_pool_config_set_params(config, caps, (guint)GST_VIDEO_INFO_SIZE(&info), stats->depth, stats->depth);
+    gst_buffer_pool_config_set_allocator(config, NULL, &params);
+
+    // Rows can be padded only if consumers read strides from video meta
+    if (video_meta) {
+        gst_video_alignment_reset(&alignment);
+        for (i = 0; i < GST_VIDEO_MAX_PLANES; ++i) {
+            alignment.stride_align[i] = FRAME_ALIGNMENT - 1;
+        }
+        gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+        gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+        gst_buffer_pool_config_set_video_alignment(config, &alignment);
+    }
+
+    if (!gst_buffer_pool_set_config(GST_BUFFER_POOL(pool), config)) {
+        gst_object_unref(pool);
+        return NULL;
+    }
+
+    // Padded frames are bigger than the caps say
+    config = gst_buffer_pool_get_config(GST_BUFFER_POOL(pool));
+    gst_buffer_pool_config_get_params(config, NULL, size, NULL, NULL);
+    gst_structure_free(config);
+
+    return GST_BUFFER_POOL(pool);
+}
+
+// Rewrites answer of downstream to allocation query: the fixed pool and alignment replace what downstream proposed
+static GstPadProbeReturn allocation_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    PoolStats* stats = user_data;
+    GstQuery* query = GST_PAD_PROBE_INFO_QUERY(info);
+    GstBufferPool* proposed = NULL;
+    GstBufferPool* pool;
+    GstAllocationParams params;
+    GstCaps* caps;
+    gboolean need_pool;
+    guint size = 0;
+
+    if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    gst_query_parse_allocation(query, &caps, &need_pool);
+    if (!caps) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (gst_query_get_n_allocation_pools(query) > 0) {
+        gst_query_parse_nth_allocation_pool(query, 0, &proposed, NULL, NULL, NULL);
+    }
+    if (!is_plain_pool(proposed)) {
+        gst_object_unref(proposed);
+        return GST_PAD_PROBE_OK;
+    }
+    if (proposed) {
+        gst_object_unref(proposed);
+    }
+
+    pool = create_pool(stats, caps, gst_query_find_allocation_meta(query, GST_VIDEO_META_API_TYPE, NULL), &size);
+    if (!pool) {
+        g_printerr("Warning: fixed frame pool can not be used for '%s'\n", stats->name);
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (gst_query_get_n_allocation_pools(query) > 0) {
+        gst_query_set_nth_allocation_pool(query, 0, pool, size, stats->depth, stats->depth);
+    } else {
+        gst_query_add_allocation_pool(query, pool, size, stats->depth, stats->depth);
+    }
+    gst_object_unref(pool);
+
+    gst_allocation_params_init(&params);
+    params.align = FRAME_ALIGNMENT - 1;
+    if (gst_query_get_n_allocation_params(query) > 0) {
+        gst_query_set_nth_allocation_param(query, 0, NULL, &params);
+    } else {
+        gst_query_add_allocation_param(query, NULL, &params);
+    }
+
+    g_atomic_int_inc(&stats->pools);
+
+    return GST_PAD_PROBE_OK;
+}
+
+int frame_pools_attach(FramePools* pools, GstElement* element, const char* pad_name) {
+    GstPad* pad = gst_element_get_static_pad(element, pad_name);
+    PoolStats* stats;
+
+    if (!pad) {
+        g_printerr("Error: element '%s' has no pad '%s'\n", GST_ELEMENT_NAME(element), pad_name);
+        return 1;
+    }
+
+    stats = g_new0(PoolStats, 1);
+    stats->element = element;
+    stats->name = g_strdup(GST_ELEMENT_NAME(element));
+    stats->depth = pools->depth;
+
+    // Elements are attached from the main thread and from streaming threads of sources
+    g_mutex_lock(&pools->lock);
+    g_ptr_array_add(pools->stats, stats);
+    g_mutex_unlock(&pools->lock);
+
+    // The answer is rewritten after downstream has filled it
+    gst_pad_add_probe(
+        pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL, allocation_probe, stats, NULL);
+    gst_object_unref(pad);
+
+    return 0;
+}
+
+void frame_pools_detach(FramePools* pools, GstElement* element) {
+    guint i = 0;
+
+    g_mutex_lock(&pools->lock);
+    while (i < pools->stats->len) {
+        PoolStats* stats = g_ptr_array_index(pools->stats, i);
+
+        if (stats->element == element) {
+            g_ptr_array_remove_index(pools->stats, i);
+        } else {
+            ++i;
+        }
+    }
+    g_mutex_unlock(&pools->lock);
+}
+
+void frame_pools_report(FramePools* pools) {
+    guint i;
+
+    g_print("Frame pools (%u frames each):\n", pools->depth);
+
+    g_mutex_lock(&pools->lock);
+    for (i = 0; i < pools->stats->len; ++i) {
+        PoolStats* stats = g_ptr_array_index(pools->stats, i);
+        gint acquired = g_atomic_int_get(&stats->acquired);
+        gint allocated = g_atomic_int_get(&stats->allocated);
+
+        if (g_atomic_int_get(&stats->pools) == 0) {
+            g_print("  %s: pool was not used\n", stats->name);
+            continue;
+        }
+        g_print("  %s: %i frames, %i buffers allocated, %.4f allocations per frame\n",
+                stats->name,
+                acquired,
+                allocated,
+                acquired > 0 ? (double)allocated / acquired : 0.0);
+    }
+    g_mutex_unlock(&pools->lock);
+}
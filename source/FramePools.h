@@ -0,0 +1,31 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_FRAME_POOLS_H
+#define TWITCH_STREAMER_FRAME_POOLS_H
+
+#include <gst/gst.h>
+
+// Fixed size pools of raw video frames. Every pool holds exactly 'depth' frames, which are allocated and touched
+// when the pool is activated, so there is neither allocation nor page faults while streaming and memory footprint
+// does not depend on load. Frames are aligned for SIMD. Producer waits for a free frame when all of them are used
+// downstream, so depth should cover frames held by queues and sinks at the same time
+typedef struct _FramePools FramePools;
+
+FramePools* frame_pools_new(guint depth);
+
+// Pipeline must be already stopped, pools count frames into the context
+void frame_pools_free(FramePools* pools);
+
+// Makes 'element' produce frames leaving its 'pad_name' pad from a fixed pool. The pool is proposed in answer to
+// allocation query, so the element should not be negotiated yet. Special pools of downstream elements (e.g. of video
+// sinks) are kept
+int frame_pools_attach(FramePools* pools, GstElement* element, const char* pad_name);
+
+// Forgets pools of 'element' attached by frame_pools_attach, so they are not reported anymore. The element must be
+// already stopped
+void frame_pools_detach(FramePools* pools, GstElement* element);
+
+// Prints number of frames produced and buffers allocated by every pool
+void frame_pools_report(FramePools* pools);
+
+#endif // TWITCH_STREAMER_FRAME_POOLS_H
@@ -0,0 +1,268 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Ladder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Queue before each rung holds up to this amount of raw frames, slow rung drops frames instead of stalling the mixer
+#define RUNG_QUEUE_MAX_TIME (1 * GST_SECOND)
+
+static int make_even(int value) {
+    return value & ~1;
+}
+
+static int parse_rung(const char* description, int output_width, int output_height, LadderRung* rung) {
+    int width = 0;
+    int height = 0;
+    int bitrate = 0;
+    char tail;
+
+    if (sscanf(description, "%ix%i:%i%c", &width, &height, &bitrate, &tail) == 3) {
+        snprintf(rung->name, sizeof(rung->name), "%ix%i", width, height);
+    } else if (sscanf(description, "%ip:%i%c", &height, &bitrate, &tail) == 2) {
+        width = (int)((gint64)height * output_width / output_height);
+        snprintf(rung->name, sizeof(rung->name), "%ip", height);
+    } else {
+        g_printerr("Error: invalid ladder rung '%s'\n", description);
+        return 1;
+    }
+
+    if (width < 2 || height < 2 || width > output_width || height > output_height || bitrate <= 0) {
+        g_printerr("Error: ladder rung '%s' is out of range\n", description);
+        return 1;
+    }
+
+    // Subsampled YUV formats require even dimensions
+    rung->width = make_even(width);
+    rung->height = make_even(height);
+    rung->bitrate = bitrate;
+
+    return 0;
+}
+
+int ladder_parse(const char* description, int output_width, int output_height, LadderRung* rungs, int* rung_count) {
+    gchar** tokens = g_strsplit(description, ",", -1);
+    int result = 0;
+    int i;
+    int j;
+
+    *rung_count = 0;
+    for (i = 0; tokens[i]; ++i) {
+        if (i >= MAX_LADDER_RUNGS) {
+            g_printerr("Error: too many ladder rungs, max is %i\n", MAX_LADDER_RUNGS);
+            result = 1;
+            break;
+        }
+
+        memset(&rungs[i], 0, sizeof(LadderRung));
+        if (parse_rung(tokens[i], output_width, output_height, &rungs[i]) != 0) {
+            result = 1;
+            break;
+        }
+
+        // Rung name is part of element names and output locations, so rungs must not share it
+        for (j = 0; j < i && result == 0; ++j) {
+            if (strcmp(rungs[j].name, rungs[i].name) == 0) {
+                g_printerr("Error: ladder rung '%s' is given more than once\n", rungs[i].name);
+                result = 1;
+            }
+        }
+        if (result != 0) {
+            break;
+        }
+        ++*rung_count;
+    }
+
+    g_strfreev(tokens);
+
+    return result;
+}
+
+static gchar* expand_pattern(const char* pattern, const char* name) {
+    gchar** parts = g_strsplit(pattern, "%s", -1);
+    gchar* result = g_strjoinv(name, parts);
+
+    g_strfreev(parts);
+
+    return result;
+}
+
+int ladder_rung_create(LadderRung* rung,
+                       const char* const* output_patterns,
+                       const char* format,
+                       const SegmentPolicy* segments,
+                       gboolean fake_sink) {
+    GstCaps* caps;
+    char name_buf[255];
+    int i;
+
+    snprintf(name_buf, sizeof(name_buf), "ladder_%s_queue", rung->name);
+    rung->queue = gst_element_factory_make("queue", name_buf);
+    snprintf(name_buf, sizeof(name_buf), "ladder_%s_scale", rung->name);
+    rung->scale = gst_element_factory_make("videoscale", name_buf);
+    snprintf(name_buf, sizeof(name_buf), "ladder_%s_filter", rung->name);
+    rung->filter = gst_element_factory_make("capsfilter", name_buf);
+    snprintf(name_buf, sizeof(name_buf), "ladder_%s_x264_enc", rung->name);
+    rung->encoder = gst_element_factory_make("x264enc", name_buf);
+    snprintf(name_buf, sizeof(name_buf), "ladder_%s_encoded_tee", rung->name);
+    rung->encoded_tee = gst_element_factory_make("tee", name_buf);
+
+    if (!rung->queue || !rung->scale || !rung->filter || !rung->encoder || !rung->encoded_tee) {
+        g_printerr("Error: failed to create elements of ladder rung '%s'\n", rung->name);
+        return 1;
+    }
+
+    g_object_set(rung->queue,
+                 "leaky",
+                 2 /*downstream*/,
+                 "max-size-time",
+                 RUNG_QUEUE_MAX_TIME,
+                 "max-size-buffers",
+                 0,
+                 "max-size-bytes",
+                 0,
+                 NULL);
+
+    caps = gst_caps_new_simple("video/x-raw",
+                               "format",
+                               G_TYPE_STRING,
+                               format,
+                               "width",
+                               G_TYPE_INT,
+                               rung->width,
+                               "height",
+                               G_TYPE_INT,
+                               rung->height,
+                               NULL);
+    g_object_set(rung->filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    rung->output_count = 0;
+    for (i = 0; output_patterns && output_patterns[i]; ++i) {
+        gchar* location;
+        int result;
+
+        if (i >= MAX_OUTPUTS) {
+            g_printerr("Error: too many ladder outputs, max is %i\n", MAX_OUTPUTS);
+            return 1;
+        }
+
+        if (!strstr(output_patterns[i], "%s")) {
+            g_printerr("Error: ladder output '%s' does not contain %%s placeholder\n", output_patterns[i]);
+            return 1;
+        }
+
+        location = expand_pattern(output_patterns[i], rung->name);
+        snprintf(name_buf, sizeof(name_buf), "ladder_%s_output_%i", rung->name, i);
+        result = output_branch_create(&rung->output[i], name_buf, location, segments, fake_sink);
+        g_free(location);
+        if (result != 0) {
+            return 1;
+        }
+        ++rung->output_count;
+    }
+
+    if (rung->output_count == 0) {
+        g_printerr("Error: ladder rung '%s' has no outputs\n", rung->name);
+        return 1;
+    }
+
+    return 0;
+}
+
+int ladder_rung_add_and_link(LadderRung* rung, GstBin* bin, GstElement* video_tee, GstElement* encoded_audio_tee) {
+    GstPad* tee_src_pad;
+    GstPad* queue_sink_pad;
+    GstPadLinkReturn link_result;
+    int i;
+
+    gst_bin_add_many(bin, rung->queue, rung->scale, rung->filter, rung->encoder, rung->encoded_tee, NULL);
+
+    if (!gst_element_link_many(rung->queue, rung->scale, rung->filter, rung->encoder, rung->encoded_tee, NULL)) {
+        g_printerr("Error: elements of ladder rung '%s' could not be linked\n", rung->name);
+        return 1;
+    }
+
+    tee_src_pad = gst_element_get_request_pad(video_tee, "src_%u");
+    queue_sink_pad = gst_element_get_static_pad(rung->queue, "sink");
+    link_result = gst_pad_link(tee_src_pad, queue_sink_pad);
+    gst_object_unref(tee_src_pad);
+    gst_object_unref(queue_sink_pad);
+    if (link_result != GST_PAD_LINK_OK) {
+        g_printerr("Error: ladder rung '%s' could not be linked with video tee\n", rung->name);
+        return 1;
+    }
+
+    for (i = 0; i < rung->output_count; ++i) {
+        if (output_branch_add_and_link(&rung->output[i], bin, rung->encoded_tee, encoded_audio_tee) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int ladder_write_master_playlist(const LadderRung* rungs,
+                                 int rung_count,
+                                 const char* output_pattern,
+                                 int audio_bitrate) {
+    GString* playlist;
+    GError* error = NULL;
+    gchar* master_location;
+    gchar* master_dir;
+    int result = 0;
+    int i;
+
+    if (!g_str_has_suffix(output_pattern, ".m3u8")) {
+        return 0;
+    }
+
+    if (g_str_has_prefix(output_pattern, "file://")) {
+        output_pattern += strlen("file://");
+    }
+
+    master_location = expand_pattern(output_pattern, "master");
+    master_dir = g_path_get_dirname(master_location);
+
+    playlist = g_string_new("#EXTM3U\n");
+    for (i = 0; i < rung_count; ++i) {
+        gchar* rung_location = expand_pattern(output_pattern, rungs[i].name);
+        gchar* rung_dir = g_path_get_dirname(rung_location);
+        gchar* rung_file = g_path_get_basename(rung_location);
+
+        // Playlists in the same directory are referenced relatively, so the whole set can be moved
+        g_string_append_printf(playlist,
+                               "#EXT-X-STREAM-INF:BANDWIDTH=%i,RESOLUTION=%ix%i\n%s\n",
+                               rungs[i].bitrate * 1000 + audio_bitrate,
+                               rungs[i].width,
+                               rungs[i].height,
+                               g_strcmp0(rung_dir, master_dir) == 0 ? rung_file : rung_location);
+
+        g_free(rung_file);
+        g_free(rung_dir);
+        g_free(rung_location);
+    }
+
+    if (!g_file_set_contents(master_location, playlist->str, playlist->len, &error)) {
+        g_printerr("Error: failed to write master playlist '%s': %s\n", master_location, error->message);
+        g_clear_error(&error);
+        result = 1;
+    } else {
+        g_print("Master playlist: '%s'\n", master_location);
+    }
+
+    g_string_free(playlist, TRUE);
+    g_free(master_dir);
+    g_free(master_location);
+
+    return result;
+}
+
+void ladder_rung_clear(LadderRung* rung) {
+    int i;
+
+    for (i = 0; i < rung->output_count; ++i) {
+        output_branch_clear(&rung->output[i]);
+    }
+}
@@ -0,0 +1,58 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_LADDER_H
+#define TWITCH_STREAMER_LADDER_H
+
+#include "Output.h"
+
+#include <gst/gst.h>
+
+// Max number of renditions encoded from the same composited frame
+#define MAX_LADDER_RUNGS 6
+
+// Single rendition: composited frame is scaled to the rung size and encoded by its own encoder, which runs in its own
+// streaming thread. Encoded video is sent to rung outputs together with audio shared by all rungs
+typedef struct _LadderRung {
+    char name[32];
+    int width;
+    int height;
+    int bitrate; // kbit/s
+
+    GstElement* queue;
+    GstElement* scale;
+    GstElement* filter;
+    GstElement* encoder;
+    GstElement* encoded_tee;
+
+    int output_count;
+    OutputBranch output[MAX_OUTPUTS];
+} LadderRung;
+
+// Parses ladder description: comma separated list of HEIGHTp:BITRATE or WIDTHxHEIGHT:BITRATE rungs,
+// e.g. "720p:2500,480p:1200,360p:600". Width of HEIGHTp rungs keeps aspect ratio of the output. Names of rungs must
+// be unique. Returns 0 on success
+int ladder_parse(const char* description, int output_width, int output_height, LadderRung* rungs, int* rung_count);
+
+// Creates elements of the rung. Every output pattern produces one rung output, '%s' in pattern is replaced with the
+// rung name, e.g. "rtmp://localhost/live/stream_%s" or "hls/%s.m3u8". Scaled frames keep pixel 'format' of the
+// composited frame. Recording outputs are split by 'segments'. Encoder is created, but not configured
+int ladder_rung_create(LadderRung* rung,
+                       const char* const* output_patterns,
+                       const char* format,
+                       const SegmentPolicy* segments,
+                       gboolean fake_sink);
+
+// Adds elements to 'bin' and links rung between the tee with composited frames and the tee with encoded audio
+int ladder_rung_add_and_link(LadderRung* rung, GstBin* bin, GstElement* video_tee, GstElement* encoded_audio_tee);
+
+// Writes HLS master playlist which references playlists of all rungs, if output pattern is a HLS one.
+// 'audio_bitrate' is in bit/s. Returns 0 on success
+int ladder_write_master_playlist(const LadderRung* rungs,
+                                 int rung_count,
+                                 const char* output_pattern,
+                                 int audio_bitrate);
+
+// Frees memory owned by the rung, elements are owned by the bin they were added to
+void ladder_rung_clear(LadderRung* rung);
+
+#endif // TWITCH_STREAMER_LADDER_H
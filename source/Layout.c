@@ -0,0 +1,228 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Layout.h"
+
+#include <string.h>
+
+// Smallest inset size for picture-in-picture layout is 1/PIP_MAX_DIVISOR of the output
+#define PIP_MIN_DIVISOR 4
+#define PIP_MAX_DIVISOR 16
+
+static int make_even(int value) {
+    return value & ~1;
+}
+
+static void set_tile(LayoutTile* tile, int x, int y, int width, int height, int zorder) {
+    tile->x = make_even(x);
+    tile->y = make_even(y);
+    tile->width = make_even(width);
+    tile->height = make_even(height);
+    tile->zorder = zorder;
+}
+
+int layout_type_from_string(const char* name, LayoutType* type) {
+    if (!name || !type) {
+        return 1;
+    }
+
+    if (strcmp(name, "grid") == 0) {
+        *type = LAYOUT_GRID;
+    } else if (strcmp(name, "pip") == 0) {
+        *type = LAYOUT_PIP;
+    } else if (strcmp(name, "weighted") == 0) {
+        *type = LAYOUT_WEIGHTED;
+    } else {
+        return 1;
+    }
+
+    return 0;
+}
+
+const char* layout_type_to_string(LayoutType type) {
+    switch (type) {
+    case LAYOUT_GRID:
+        return "grid";
+    case LAYOUT_PIP:
+        return "pip";
+    case LAYOUT_WEIGHTED:
+        return "weighted";
+    }
+
+    return "unknown";
+}
+
+static int compute_grid(int count, int output_width, int output_height, LayoutTile* tiles) {
+    int columns = 1;
+    int rows;
+    int tile_width;
+    int tile_height;
+    int i;
+
+    while (columns * columns < count) {
+        ++columns;
+    }
+    rows = (count + columns - 1) / columns;
+
+    tile_width = make_even(output_width / columns);
+    tile_height = make_even(output_height / rows);
+
+    for (i = 0; i < count; ++i) {
+        int row = i / columns;
+        int column = i % columns;
+        // Last row may be incomplete, in this case it is centered horizontally
+        int tiles_in_row = row == rows - 1 ? count - row * columns : columns;
+        int x_offset = (output_width - tiles_in_row * tile_width) / 2;
+        int y_offset = (output_height - rows * tile_height) / 2;
+
+        set_tile(&tiles[i],
+                 x_offset + column * tile_width,
+                 y_offset + row * tile_height,
+                 tile_width,
+                 tile_height,
+                 0);
+    }
+
+    return 0;
+}
+
+static int compute_pip(int count, int output_width, int output_height, LayoutTile* tiles) {
+    int divisor;
+    int insets = count - 1;
+
+    set_tile(&tiles[0], 0, 0, output_width, output_height, 0);
+    if (insets == 0) {
+        return 0;
+    }
+
+    // Pick the biggest inset size which allows to fit all insets on the screen
+    for (divisor = PIP_MIN_DIVISOR; divisor <= PIP_MAX_DIVISOR; ++divisor) {
+        int inset_width = make_even(output_width / divisor);
+        int inset_height = make_even(output_height / divisor);
+        int margin = make_even(output_height / (divisor * 8));
+        int per_row;
+        int rows;
+        int i;
+
+        if (margin < 2) {
+            margin = 2;
+        }
+
+        per_row = (output_width - margin) / (inset_width + margin);
+        rows = (output_height - margin) / (inset_height + margin);
+        if (per_row * rows < insets) {
+            continue;
+        }
+
+        // Insets are placed from the bottom right corner to the left and then upwards
+        for (i = 0; i < insets; ++i) {
+            int column = i % per_row;
+            int row = i / per_row;
+
+            set_tile(&tiles[i + 1],
+                     output_width - (column + 1) * (inset_width + margin),
+                     output_height - (row + 1) * (inset_height + margin),
+                     inset_width,
+                     inset_height,
+                     1);
+        }
+
+        return 0;
+    }
+
+    return 1;
+}
+
+// Recursive slice-and-dice split: sources are divided into two groups of close total weight and the rectangle is
+// split along its longer side proportionally to these weights
+static void compute_weighted_region(
+    const double* weights, int first, int count, int x, int y, int width, int height, LayoutTile* tiles) {
+    double total = 0.0;
+    double prefix = 0.0;
+    double best_prefix = 0.0;
+    double best_diff = -1.0;
+    int split = 1;
+    int i;
+
+    if (count == 1) {
+        set_tile(&tiles[first], x, y, width, height, 0);
+        return;
+    }
+
+    for (i = 0; i < count; ++i) {
+        total += weights[first + i];
+    }
+
+    for (i = 1; i < count; ++i) {
+        double diff;
+
+        prefix += weights[first + i - 1];
+        diff = prefix * 2.0 > total ? prefix * 2.0 - total : total - prefix * 2.0;
+        if (best_diff < 0.0 || diff < best_diff) {
+            best_diff = diff;
+            best_prefix = prefix;
+            split = i;
+        }
+    }
+
+    if (width >= height) {
+        int first_width = make_even((int)(width * best_prefix / total));
+
+        compute_weighted_region(weights, first, split, x, y, first_width, height, tiles);
+        compute_weighted_region(
+            weights, first + split, count - split, x + first_width, y, width - first_width, height, tiles);
+    } else {
+        int first_height = make_even((int)(height * best_prefix / total));
+
+        compute_weighted_region(weights, first, split, x, y, width, first_height, tiles);
+        compute_weighted_region(
+            weights, first + split, count - split, x, y + first_height, width, height - first_height, tiles);
+    }
+}
+
+static int compute_weighted(
+    int count, const double* weights, int output_width, int output_height, LayoutTile* tiles) {
+    double equal_weights[count];
+    int i;
+
+    if (!weights) {
+        for (i = 0; i < count; ++i) {
+            equal_weights[i] = 1.0;
+        }
+        weights = equal_weights;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (!(weights[i] > 0.0)) {
+            return 1;
+        }
+    }
+
+    compute_weighted_region(weights, 0, count, 0, 0, output_width, output_height, tiles);
+
+    // Degenerated tiles are not allowed: they can not be negotiated by scalers
+    for (i = 0; i < count; ++i) {
+        if (tiles[i].width < 2 || tiles[i].height < 2) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int layout_compute(
+    LayoutType type, int count, const double* weights, int output_width, int output_height, LayoutTile* tiles) {
+    if (count <= 0 || !tiles || output_width < 2 || output_height < 2) {
+        return 1;
+    }
+
+    switch (type) {
+    case LAYOUT_GRID:
+        return compute_grid(count, output_width, output_height, tiles);
+    case LAYOUT_PIP:
+        return compute_pip(count, output_width, output_height, tiles);
+    case LAYOUT_WEIGHTED:
+        return compute_weighted(count, weights, output_width, output_height, tiles);
+    }
+
+    return 1;
+}
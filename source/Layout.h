@@ -0,0 +1,38 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_LAYOUT_H
+#define TWITCH_STREAMER_LAYOUT_H
+
+// Kinds of layouts the engine is able to compute
+typedef enum _LayoutType {
+    // Equal tiles in a near-square grid, incomplete last row is centered
+    LAYOUT_GRID,
+    // First source covers the whole output, the rest are small insets in the bottom right corner
+    LAYOUT_PIP,
+    // Area of each tile is proportional to the source weight
+    LAYOUT_WEIGHTED,
+} LayoutType;
+
+// Placement of a single source inside the output frame
+typedef struct _LayoutTile {
+    int x;
+    int y;
+    int width;
+    int height;
+    int zorder;
+} LayoutTile;
+
+// Parses layout name ("grid", "pip" or "weighted"). Returns 0 on success
+int layout_type_from_string(const char* name, LayoutType* type);
+
+// Returns printable name of the layout
+const char* layout_type_to_string(LayoutType type);
+
+// Computes placement of 'count' sources inside 'output_width' x 'output_height' frame.
+// 'weights' is used only by LAYOUT_WEIGHTED and may be NULL (all sources get equal weight).
+// Tile dimensions are always even, so they can be used directly with subsampled YUV formats.
+// Returns 0 on success
+int layout_compute(
+    LayoutType type, int count, const double* weights, int output_width, int output_height, LayoutTile* tiles);
+
+#endif // TWITCH_STREAMER_LAYOUT_H
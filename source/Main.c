@@ -1,68 +1,334 @@
 // (c) Alexander Voitenko 2021 - present
 
+#include "Bench.h"
+#include "Channels.h"
+#include "ClipCache.h"
+#include "Control.h"
+#include "DiscoveryCache.h"
+#include "EncoderProfile.h"
+#include "FramePools.h"
+#include "Ladder.h"
+#include "Layout.h"
+#include "Metrics.h"
+#include "Output.h"
+#include "Overlay.h"
+#include "QualityController.h"
+#include "SourceSet.h"
+#include "ThreadPlacement.h"
+#include "TileMixer.h"
+
+#include <glib-unix.h>
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <linux/limits.h>
 
+#include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 // Max number of sources (video files) used for processing
-// Note: currently this number can not be greater than 3 because videomixer's layout is hardcoded, so to make this
-//       number dynamic, layout creation should be refined. See setup_videomixer_layout function for details
-#define MAX_SOURCES 3
+// Note: actual number of sources is taken from command line, placement of each of them is computed by layout engine.
+//       See Layout.h for details
+#define MAX_SOURCES 16
 
-// Index of source file where extract audio track
-#define AUDIO_FROM_SOURCE_INDEX 0
+// Index of source which audio is always decoded, even if it is muted, so the audio mixer always has an input.
+// By default only this source is audible, audio of other sources is not decoded
+#define MAIN_AUDIO_SOURCE_INDEX 0
 
-// Output video parameters
-#define OUTPUT_VIDEO_WIDTH 1280
-#define OUTPUT_VIDEO_HEIGHT 720
+// Range of audio mixer pad volume
+#define MAX_AUDIO_VOLUME 10.0
+
+// Output video parameters, can be changed on command line
+#define DEFAULT_OUTPUT_WIDTH 1280
+#define DEFAULT_OUTPUT_HEIGHT 720
+#define DEFAULT_OUTPUT_FRAMERATE 30
+#define DEFAULT_OUTPUT_FORMAT "I420"
+#define MAX_OUTPUT_FRAMERATE 240
+
+// Negotiated formats are reported once caps of all elements are likely settled after the pipeline starts playing
+#define CONVERSION_REPORT_DELAY 2 // s
+
+// Interrupted pipeline which has not finished its outputs in this time is stopped anyway
+#define EOS_TIMEOUT 5 // s
 
 #define TWITCH_URL_PREFIX "rtmp://live.justin.tv/app"
+// Twitch stream keys start with it, so a key is not confused with a mistyped source path
+#define TWITCH_KEY_PREFIX "live_"
+
+// Encoding parameters
+#define VIDEO_BITRATE 768 // kbit/s
+#define AUDIO_BITRATE 128000 // bit/s
+
+// Adaptive quality is evaluated this often
+#define QUALITY_UPDATE_INTERVAL 1 // s
+
+// Fast start placeholders: slate shown in tiles of sources which have not started yet and silence
+#define PLACEHOLDER_COLOR 0xff202020 // ARGB
+#define PLACEHOLDER_AUDIO_CAPS "audio/x-raw,rate=48000,channels=2"
+
+// Default rotation of recorded segments
+#define DEFAULT_SEGMENT_TIME 60 // s
+
+// Clips of files up to this size are cached by default, if clip cache is enabled
+#define DEFAULT_CLIP_CACHE_MAX_FILE 8 // MB
+
+// Range of frame pool depth, smaller pools would stall on frames held by sinks and encoders
+#define MIN_FRAME_POOL_DEPTH 4
+#define MAX_FRAME_POOL_DEPTH 64
+// Frames of a pool held by the element which produces them (tile mixer keeps the previous frame) and by a sink or a
+// scaler which processes them
+#define PRODUCER_HELD_FRAMES 2
+#define CONSUMER_HELD_FRAMES 2
+
+// Scaled preview defaults, the preview queue holds so few frames that a slow display only drops them
+#define DEFAULT_PREVIEW_WIDTH 640
+#define DEFAULT_PREVIEW_HEIGHT 360
+#define DEFAULT_PREVIEW_FRAMERATE 10
+#define PREVIEW_QUEUE_MAX_BUFFERS 2
+
+// Benchmark mode parameters
+#define DEFAULT_BENCH_SOURCES 3
+#define BENCH_SOURCE_CAPS "video/x-raw,width=1280,height=720,framerate=30/1"
+
+// Local preview: full composited frames, frames scaled down and rate limited, or no preview and no audio playback
+typedef enum _PreviewMode { PREVIEW_FULL, PREVIEW_SCALED, PREVIEW_OFF } PreviewMode;
+
+// Latest QoS message received from an element
+typedef struct _QosStats {
+    guint64 processed;
+    guint64 dropped;
+    gint64 jitter;      // ns, positive if buffers are late
+    gdouble proportion; // rate at which upstream should produce data, relative to real-time
+} QosStats;
 
 // Structure to contain all our information, so we can pass it everywhere
 typedef struct _ApplicationContext {
     GstElement* pipeline;
 
+    // Bus messages, control commands and timers are all handled by the main loop in the main thread
+    GMainLoop* main_loop;
+    GstBus* bus;
+    guint bench_source;
+    int control_port;
+    ControlServer* control;
+    GHashTable* qos;       // element name -> QosStats*
+    GHashTable* buffering; // element name -> latest buffering percent
+
+    // Streaming is enabled if there is at least one output or ladder rung. All outputs share the same encoders,
+    // main video encoder exists only if there are outputs, rungs have their own video encoders
     gboolean streaming_enabled;
+    gboolean main_encoder_enabled;
+
+    // Composited frame is produced in this size, rate and pixel format, the format is pinned through mixer, clip
+    // cache and ladder, so frames are not converted between them
+    int output_width;
+    int output_height;
+    int output_framerate;
+    const char* output_format;
+    guint conversion_report_source;
+
+    int source_count;
     const char* source_paths[MAX_SOURCES];
-    const char* twitch_api_key;
+    // Multi-channel mode: every channel has its own context and pipeline, the main loop is shared and quits when the
+    // last running channel stops. channels is NULL in single channel mode
+    gchar* channels_file;
+    const char* channel_name;
+    Channels* channels;
+    gboolean stopped;
+    guint eos_timeout_source; // non-zero once the pipeline is interrupted and is finishing its outputs
+    gint mixed_frames;        // counted for channel stats only
+
+    // Threads of every encoder and decoder are limited by the CPU budget of the channel, zero leaves them automatic
+    int thread_budget;
+    EncoderProfile encoder_profile;
+    int video_bitrate; // kbit/s, of the main encoder before adaptive quality is applied
+    int encoder_threads;
+    int decoder_threads;
+
+    // Streaming threads of decode, mix, encode and audio stages can be pinned to their own cores, then encoders and
+    // decoders run as many threads as their stage has cores. NULL if threads are left to the scheduler
+    ThreadPlacement* placement;
+    gboolean audio_realtime;
+    int thread_report_interval; // s
+    guint thread_report_source;
+
+    int output_count;
+    gchar* output_locations[MAX_OUTPUTS];
+    SegmentPolicy segments; // of recording outputs
+    int rung_count;
+    LadderRung rung[MAX_LADDER_RUNGS];
+    gchar** ladder_outputs;
+
+    LayoutType layout_type;
+    double layout_weights[MAX_SOURCES];
+    gboolean layout_weights_set;
+    LayoutTile layout[MAX_SOURCES];
+
+    // Benchmark mode: pipeline runs headless for bench_seconds and reports throughput and latency
+    int bench_seconds;
+    gboolean synthetic_sources;
+    BenchContext* bench;
+
+    // Instrumentation: per-element metrics are logged every metrics_interval seconds and served on metrics_port
+    int metrics_interval;
+    int metrics_port;
+    MetricsContext* metrics;
+
+    // Scalers and mixer produce frames from fixed pools of frame_pool_depth frames, zero means default allocation
+    int frame_pool_depth;
+    FramePools* frame_pools;
 
     GstElement* source[MAX_SOURCES];
-
+    GstElement* test_audio_source[MAX_SOURCES];
+
+    // Loop modes of sources given on command line, sources added at runtime loop if a single mode 'on' is given
+    gboolean loop[MAX_SOURCES];
+    gboolean loop_runtime_sources;
+
+    // Looping sources of small files (except the one providing audio) are decoded once and played from clip cache
+    int clip_cache_budget;   // MB, zero disables the cache
+    int clip_cache_max_file; // MB
+    ClipCache* clip_cache;
+
+    // Sources can be added, removed and replaced at runtime. Topology is changed in the main thread only, streaming
+    // threads read source arrays and layout under source_lock. Sources added at runtime start their timestamps from
+    // zero, so their pads are offset by the running time at which they were linked
+    GMutex source_lock;
+    int source_id[MAX_SOURCES]; // unique number used in element names, indexes shift when a source is removed
+    int next_source_id;
+    GstClockTime source_offset[MAX_SOURCES]; // GST_CLOCK_TIME_NONE until the first pad of the source is linked
+    SourceSet* sources;
+
+    // Sources shown downscaled are decoded at reduced resolution where decoder supports it, otherwise they are
+    // scaled in their own streaming thread right after decoder. See decoder_added_handler for details
+    gboolean decode_downscale[MAX_SOURCES];
+    GstElement* video_scale[MAX_SOURCES];
+    GstElement* video_scale_filter[MAX_SOURCES];
+
+    // Audio of all sources is mixed once before the audio tee, every source has its own volume and mute. Audio of
+    // sources which are muted when they are created is not decoded at all
+    GstElement* audio_mixer;
+    GstPad* audio_mixer_sink_pad[MAX_SOURCES]; // NULL until audio of the source is linked
+    double audio_volume[MAX_SOURCES];
+    gboolean audio_mute[MAX_SOURCES];
+    gboolean audio_decoded[MAX_SOURCES];
     GstElement* audio_convert;
     GstElement* audio_resample;
-    GstElement* audio_sink[MAX_SOURCES];
     GstElement* audio_tee;
     GstElement* stream_audio_queue;
     GstElement* device_audio_queue;
     GstElement* audio_device_sink;
     GstElement* voaacenc;
 
-    GstElement* video_scale[MAX_SOURCES];
-    GstElement* videomixer;
+    // Sources are scaled by the compositor itself while blending, each one into its own sink pad. With incremental
+    // compositing tilemixer is used instead, it redraws only tiles which changed since the previous frame
+    gboolean incremental_compositing;
+    GstElement* video_mixer;
+    GstPad* video_mixer_sink_pad[MAX_SOURCES];
+    GstElement* video_mixer_filter;
     GstElement* video_tee;
     GstElement* stream_video_queue;
+    // Logos, tickers and captions are rendered once and drawn over the mixed video. Graphics given on command line
+    // are rendered before start, others are added, replaced and removed by control commands
+    gchar** overlays;
+    OverlayLayer* overlay;
+    // Device branches are leaky, so a slow display or audio device never holds the tees shared with streaming.
+    // They do not exist at all if preview is off
+    PreviewMode preview_mode;
+    int preview_width;
+    int preview_height;
+    int preview_framerate;
     GstElement* device_video_queue;
+    GstElement* preview_rate;
+    GstElement* preview_scale;
+    GstElement* preview_filter;
     GstElement* video_device_sink;
     GstElement* x264enc;
-    GstElement* flv_mux;
-    GstElement* rtmp_sink;
+
+    // Adaptive quality lowers bitrate of encoders, streamed frame rate and decoding of sources under pressure.
+    // quality_level is read by streaming threads of sources and of the mixer
+    gboolean adaptive_quality;
+    QualityController* quality;
+    guint quality_source;
+    const QualityLevel* quality_level;
+    int keyframe_countdown;    // s, keyframes are forced while frame rate is reduced
+    guint quality_frame_count; // composited frames, counted by the mixer thread
+
+    // Fast start makes both mixers live by linking live placeholder sources to them, so they aggregate by the clock
+    // from the first moment instead of waiting for the slowest source to preroll. Video placeholder is a slate under
+    // all tiles, it is hidden once every initial source has delivered a frame. Discovery results are cached per file
+    gboolean fast_start;
+    GstElement* placeholder_video;
+    GstElement* placeholder_video_filter;
+    GstElement* placeholder_audio;
+    GstElement* placeholder_audio_filter;
+    GstPad* placeholder_video_pad;
+    GstPad* placeholder_audio_pad;
+    gint sources_starting; // initial sources which have not delivered a frame yet, counted in streaming threads
+    DiscoveryCache* discovery_cache;
+    gint64 start_time; // monotonic, when the pipeline was set to playing
+
+    GstElement* encoded_video_tee;
+    GstElement* encoded_audio_tee;
+    OutputBranch output[MAX_OUTPUTS];
 } ApplicationContext;
 
 static int parse_command_line(int argc, char* argv[], ApplicationContext* data);
 static void print_usage();
 static int create_pipeline(ApplicationContext* data);
 static int run_pipeline(ApplicationContext* data);
+static int run_channels(const char* path, int cpu_budget);
 static void free_resources(ApplicationContext* data);
 
-// Handler for the pad-added signal
-static void pad_added_handler(GstElement* src, GstPad* pad, ApplicationContext* data);
+// Creates the set which links, removes and replaces sources of the pipeline
+static SourceSet* create_source_set(ApplicationContext* data);
+
+// Handler for the deep-element-added signal, used to configure decoders created by uridecodebin
+static void decoder_added_handler(GstBin* bin, GstBin* sub_bin, GstElement* element, ApplicationContext* data);
+
+// Handler for the deep-element-added signal, used to limit threads of decoders to the CPU budget
+static void decoder_threads_handler(GstBin* bin, GstBin* sub_bin, GstElement* element, ApplicationContext* data);
+
+// Sets enum 'property' of 'object' to the first of 'nicks' it supports, returns FALSE if none is supported
+static gboolean set_enum_property_by_nick(GObject* object, const char* property, const char* const* nicks);
+
+// Sources which audio is not decoded are marked when they are created
+static gboolean source_skips_audio(GstElement* source) {
+    return g_object_get_data(G_OBJECT(source), "skip-audio") != NULL;
+}
+
+// Stops autoplugging at compressed audio, so it is never decoded. Pad with compressed audio is exposed and left
+// unlinked, demuxer keeps pushing only the streams which are linked
+static gboolean skip_audio_handler(GstElement* bin, GstPad* pad, GstCaps* caps, gpointer user_data) {
+    return !g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "audio/");
+}
+
+static void connect_source_signals(ApplicationContext* data,
+                                   GstElement* source,
+                                   gboolean decode_downscale,
+                                   gboolean loop) {
+    source_set_watch(data->sources, source, !source_skips_audio(source), loop);
+    if (data->discovery_cache) {
+        discovery_cache_attach(data->discovery_cache, source);
+    }
+    if (source_skips_audio(source)) {
+        g_signal_connect(source, "autoplug-continue", G_CALLBACK(skip_audio_handler), NULL);
+    }
+    if (decode_downscale) {
+        g_signal_connect(source, "deep-element-added", G_CALLBACK(decoder_added_handler), data);
+    }
+    if (data->decoder_threads > 0) {
+        g_signal_connect(source, "deep-element-added", G_CALLBACK(decoder_threads_handler), data);
+    }
+}
 
 int main(int argc, char* argv[]) {
-    ApplicationContext data;
+    ApplicationContext data = {0};
     int return_code = 0;
 
+    g_mutex_init(&data.source_lock);
+
     g_print("Parsing command line...\n");
     if (parse_command_line(argc, argv, &data) != 0) {
         print_usage();
@@ -75,6 +341,11 @@ int main(int argc, char* argv[]) {
     gst_init(NULL, NULL);
     g_print("Done.\n");
 
+    if (data.channels_file) {
+        return_code = run_channels(data.channels_file, data.thread_budget);
+        goto exit;
+    }
+
     g_print("Creating pipeline...\n");
     if (create_pipeline(&data) != 0) {
         g_printerr("Error: unable to setup pipeline\n");
@@ -93,575 +364,3587 @@ int main(int argc, char* argv[]) {
 
 exit:
     free_resources(&data);
+    g_mutex_clear(&data.source_lock);
 
     return return_code;
 }
 
-static int parse_command_line(int argc, char* argv[], ApplicationContext* data) {
+static int parse_layout_weights(const char* weights, int source_count, double* parsed_weights) {
+    gchar** tokens = g_strsplit(weights, ",", -1);
+    int result = 0;
     int i;
 
-    if (argc != MAX_SOURCES + 1 && argc != MAX_SOURCES + 2) {
-        return 1;
-    }
-
-    data->streaming_enabled = argc == MAX_SOURCES + 2;
+    for (i = 0; tokens[i]; ++i) {
+        gchar* end = NULL;
 
-    if (data->streaming_enabled) {
-        g_print("Twitch streaming is enabled!\n");
-        data->twitch_api_key = argv[1];
-        for (i = 0; i < MAX_SOURCES; ++i) {
-            data->source_paths[i] = argv[i + 2];
-        }
-    } else {
-        g_print("Twitch streaming is NOT enabled, because twitch API key was not specified!\n");
-        data->twitch_api_key = "";
-        for (i = 0; i < MAX_SOURCES; ++i) {
-            data->source_paths[i] = argv[i + 1];
+        if (i >= MAX_SOURCES) {
+            g_printerr("Error: too many layout weights, max is %i\n", MAX_SOURCES);
+            result = 1;
+            break;
         }
-    }
-
-    return 0;
-}
-
-static void print_usage() {
-    g_print(
-        "Application to stream mixed video data to twitch\n"
-        "Usage:\n  ./twitch-streamer [twitch_api_key] video_path_1 video_path_2 video_path_3\n"
-        "Examples:\n  ./twitch-streamer live_111111111_aaaabbbcccddddeeeeffffggghhhhh ../data/sintel_trailer-480p.webm "
-        "../data/big_buck_bunny_trailer-360p.mp4 ../data/the_daily_dweebs-720p.mp4\n"
-        "  ./twitch-streamer ../data/sintel_trailer-480p.webm ../data/big_buck_bunny_trailer-360p.mp4 "
-        "../data/the_daily_dweebs-720p.mp4\n");
-}
-
-#define ENSURE_INITED(X, Y)                                                                  \
-    if (!X->Y) {                                                                             \
-        char buf[255];                                                                       \
-        snprintf(buf, sizeof(buf), "Error: pipeline element '%s', was not created\n", (#Y)); \
-        g_printerr("%s", buf);                                                               \
-        return 1;                                                                            \
-    }
-
-static int create_pipeline_elements(ApplicationContext* data) {
-    int i;
-    char string_buf[PATH_MAX + 1024];
-
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        snprintf(string_buf, sizeof(string_buf), "source_%i", i);
-        data->source[i] = gst_element_factory_make("uridecodebin", string_buf);
-    }
-
-    // Audio
-    data->audio_convert = gst_element_factory_make("audioconvert", "audio_convert");
-    data->audio_resample = gst_element_factory_make("audioresample", "audio_resample");
-    data->audio_tee = gst_element_factory_make("tee", "audio_tee");
-    if (data->streaming_enabled) {
-        data->voaacenc = gst_element_factory_make("voaacenc", "aac_encoder");
-        data->stream_audio_queue = gst_element_factory_make("queue", "stream_audio_queue");
-    } else {
-        data->stream_audio_queue = NULL;
-        data->voaacenc = NULL;
-    }
 
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        if (i == AUDIO_FROM_SOURCE_INDEX) {
-            data->audio_sink[i] = data->audio_tee;
-        } else {
-            snprintf(string_buf, sizeof(string_buf), "fake_audio_sink_%i", i);
-            data->audio_sink[i] = gst_element_factory_make("fakesink", string_buf);
+        parsed_weights[i] = g_ascii_strtod(tokens[i], &end);
+        if (end == tokens[i] || *end != '\0' || !(parsed_weights[i] > 0.0)) {
+            g_printerr("Error: invalid layout weight '%s'\n", tokens[i]);
+            result = 1;
+            break;
         }
     }
-    data->audio_device_sink = gst_element_factory_make("autoaudiosink", "audio_device_sink");
-    data->device_audio_queue = gst_element_factory_make("queue", "device_audio_queue");
-
-    // Video
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        snprintf(string_buf, sizeof(string_buf), "video_scale_%i", i);
-        data->video_scale[i] = gst_element_factory_make("videoscale", string_buf);
-    }
-    data->videomixer = gst_element_factory_make("videomixer", "video_mixer");
-    data->video_tee = gst_element_factory_make("tee", "video_tee");
-    if (data->streaming_enabled) {
-        data->stream_video_queue = gst_element_factory_make("queue", "stream_video_queue");
-        data->x264enc = gst_element_factory_make("x264enc", "x264_enc");
-        data->flv_mux = gst_element_factory_make("flvmux", "flv_mux");
-        data->rtmp_sink = gst_element_factory_make("rtmpsink", "rtmp_sink");
-    } else {
-        data->stream_video_queue = NULL;
-        data->x264enc = NULL;
-        data->flv_mux = NULL;
-        data->rtmp_sink = NULL;
-    }
-    data->device_video_queue = gst_element_factory_make("queue", "device_video_queue");
-    data->video_device_sink = gst_element_factory_make("autovideosink", "video_device_sink");
-
-    data->pipeline = gst_pipeline_new("twitch-pipeline");
-    if (!data->pipeline) {
-        g_printerr("Error: failed to create pipeline\n");
-        return 1;
-    }
 
-    // Ensure that everything was created properly
-    // Audio
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        ENSURE_INITED(data, source[i]);
-    }
-    ENSURE_INITED(data, audio_convert);
-    ENSURE_INITED(data, audio_resample);
-    ENSURE_INITED(data, audio_tee);
-    if (data->streaming_enabled) {
-        ENSURE_INITED(data, stream_audio_queue);
-        ENSURE_INITED(data, voaacenc);
-    }
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        ENSURE_INITED(data, audio_sink[i]);
-    }
-    ENSURE_INITED(data, audio_device_sink);
-    ENSURE_INITED(data, device_audio_queue);
-
-    // Video
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        ENSURE_INITED(data, video_scale[i]);
-    }
-    ENSURE_INITED(data, videomixer);
-    ENSURE_INITED(data, video_tee);
-    if (data->streaming_enabled) {
-        ENSURE_INITED(data, stream_video_queue);
-        ENSURE_INITED(data, x264enc);
-        ENSURE_INITED(data, flv_mux);
-        ENSURE_INITED(data, rtmp_sink);
+    if (result == 0 && i != source_count) {
+        g_printerr("Error: %i layout weights specified for %i sources\n", i, source_count);
+        result = 1;
     }
-    ENSURE_INITED(data, device_video_queue);
-    ENSURE_INITED(data, video_device_sink);
 
-    // Setting elements properties
-    char current_work_dir[PATH_MAX];
-    if (getcwd(current_work_dir, sizeof(current_work_dir)) != NULL) {
-        g_print("Current working dir: %s\n", current_work_dir);
-    } else {
-        g_printerr("Error: getcwd() error\n");
-        return 1;
-    }
+    g_strfreev(tokens);
 
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        char tmp_buf[PATH_MAX];
-        if (data->source_paths[i] && data->source_paths[i][0] == '/') { // absolute path
-            snprintf(tmp_buf, sizeof(tmp_buf), "%s", data->source_paths[i]);
-        } else {
-            snprintf(tmp_buf, sizeof(tmp_buf), "%s/%s", current_work_dir, data->source_paths[i]);
-        }
+    return result;
+}
 
-        if (access(tmp_buf, F_OK) != -1) {
-            g_print("Loading file: '%s'\n", tmp_buf);
-        } else {
-            g_printerr("Error: file '%s' does not exist!\n", tmp_buf);
-            return 1;
-        }
+// Audio mode is either a volume in range [0, MAX_AUDIO_VOLUME] or "mute". NULL means "mute"
+static int parse_audio_mode(const char* mode, double* volume, gboolean* mute) {
+    gchar* end = NULL;
 
-        snprintf(string_buf, sizeof(tmp_buf), "file://%s", tmp_buf);
-        g_object_set(data->source[i], "uri", string_buf, NULL);
+    *volume = 1.0;
+    *mute = TRUE;
+    if (!mode || g_strcmp0(mode, "mute") == 0) {
+        return 0;
     }
 
-    if (data->streaming_enabled) {
-        g_object_set(data->stream_audio_queue, "leaky", 2 /*downstream*/, NULL);
-        g_object_set(data->stream_audio_queue, "max-size-time", 5 * GST_SECOND, NULL);
-        g_object_set(data->stream_video_queue, "leaky", 2 /*downstream*/, NULL);
-        g_object_set(data->stream_video_queue, "max-size-time", 5 * GST_SECOND, NULL);
-
-        g_object_set(data->flv_mux, "streamable", TRUE, NULL);
-
-        g_object_set(data->x264enc, "bitrate", 768, NULL);
-        g_object_set(data->x264enc, "speed-preset", 4 /*Faster*/, NULL);
-        g_object_set(data->x264enc, "qp-min", 30, NULL);
-        g_object_set(data->x264enc, "tune", 4 /*Zero latency*/, NULL);
-
-        snprintf(string_buf, sizeof(string_buf), "%s/%s", TWITCH_URL_PREFIX, data->twitch_api_key);
-        g_object_set(data->rtmp_sink, "location", string_buf, NULL);
+    *volume = g_ascii_strtod(mode, &end);
+    if (end == mode || *end != '\0' || *volume < 0.0 || *volume > MAX_AUDIO_VOLUME) {
+        return 1;
     }
+    *mute = FALSE;
 
     return 0;
 }
 
-static int add_elements_to_pipeline(ApplicationContext* data) {
+// Parses comma separated audio modes, single mode is applied to all sources. Audio of the main source is decoded
+// even if it is muted
+static int parse_audio_modes(const char* modes, ApplicationContext* data) {
+    gchar** tokens = g_strsplit(modes, ",", -1);
+    guint count = g_strv_length(tokens);
+    int result = 0;
     int i;
 
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        if (!gst_bin_add(GST_BIN(data->pipeline), data->source[i])) {
-            g_printerr("Error: failed to add data source %i\n", i);
-            return 1;
-        }
+    if (count != 1 && count != (guint)data->source_count) {
+        g_printerr("Error: %u audio modes specified for %i sources\n", count, data->source_count);
+        result = 1;
+        goto exit;
     }
 
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        // Element for real audio sink is added below explicitly
-        if (i != AUDIO_FROM_SOURCE_INDEX) {
-            if (!gst_bin_add(GST_BIN(data->pipeline), data->audio_sink[i])) {
-                g_printerr("Error: failed to add audio sink %i\n", i);
-                return 1;
-            }
-        }
-    }
+    for (i = 0; i < data->source_count; ++i) {
+        const gchar* mode = tokens[count == 1 ? 0 : i];
 
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        if (!gst_bin_add(GST_BIN(data->pipeline), data->video_scale[i])) {
-            g_printerr("Error: failed to add video scale %i\n", i);
-            return 1;
+        if (parse_audio_mode(mode, &data->audio_volume[i], &data->audio_mute[i]) != 0) {
+            g_printerr("Error: invalid audio mode '%s', expected volume in range [0, %g] or mute\n",
+                       mode,
+                       MAX_AUDIO_VOLUME);
+            result = 1;
+            goto exit;
         }
+        data->audio_decoded[i] = !data->audio_mute[i] || i == MAIN_AUDIO_SOURCE_INDEX;
     }
 
-    // All other elements
-    gst_bin_add_many(GST_BIN(data->pipeline),
-                     data->audio_convert,
-                     data->audio_resample,
-                     data->audio_device_sink,
-                     data->audio_tee,
-                     data->device_audio_queue,
-                     data->videomixer,
-                     data->video_tee,
-                     data->device_video_queue,
-                     data->video_device_sink,
-                     NULL);
-
-    if (data->streaming_enabled) {
-        gst_bin_add_many(GST_BIN(data->pipeline),
-                         data->stream_audio_queue,
-                         data->voaacenc,
-                         data->stream_video_queue,
-                         data->flv_mux,
-                         data->x264enc,
-                         data->rtmp_sink,
-                         NULL);
-    }
+exit:
+    g_strfreev(tokens);
 
-    return 0;
+    return result;
 }
 
-static int setup_videomixer_layout(ApplicationContext* data) {
-    GstPad* video_mixer_sink_pad[MAX_SOURCES];
+// Parses comma separated per source modes, each one is either 'on_mode' or "off". Single mode is applied to all
+// sources, 'all_on' (if not NULL) tells whether it is a single mode which is on
+static int parse_source_modes(const char* modes,
+                              const char* description,
+                              const char* on_mode,
+                              ApplicationContext* data,
+                              gboolean* flags,
+                              gboolean* all_on) {
+    gchar** tokens = g_strsplit(modes, ",", -1);
+    guint count = g_strv_length(tokens);
     int result = 0;
     int i;
-    char string_buf[255];
 
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        snprintf(string_buf, sizeof(string_buf), "video_scale_%i", i);
-        video_mixer_sink_pad[i] = gst_element_get_request_pad(data->videomixer, "sink_%u");
-        if (!video_mixer_sink_pad[i]) {
-            g_printerr("Error: failed to get pad %i from video mixer\n", i);
+    if (count != 1 && count != (guint)data->source_count) {
+        g_printerr("Error: %u %s modes specified for %i sources\n", count, description, data->source_count);
+        result = 1;
+        goto exit;
+    }
+
+    for (i = 0; i < data->source_count; ++i) {
+        const gchar* mode = tokens[count == 1 ? 0 : i];
+
+        if (g_strcmp0(mode, on_mode) == 0) {
+            flags[i] = TRUE;
+        } else if (g_strcmp0(mode, "off") == 0) {
+            flags[i] = FALSE;
+        } else {
+            g_printerr("Error: invalid %s mode '%s'\n", description, mode);
             result = 1;
             goto exit;
         }
-        g_print("Requested pad from videomixer: %s\n", GST_PAD_NAME(video_mixer_sink_pad[i]));
     }
 
-    g_object_set(data->videomixer, "name", "mix", NULL);
-    g_object_set(data->videomixer, "background", 1, NULL); // black
-    g_object_set(video_mixer_sink_pad[0], "xpos", 0, NULL);
-    g_object_set(video_mixer_sink_pad[0], "ypos", 0, NULL);
-    g_object_set(video_mixer_sink_pad[1], "xpos", OUTPUT_VIDEO_WIDTH / 2, NULL);
-    g_object_set(video_mixer_sink_pad[1], "ypos", 0, NULL);
-    g_object_set(video_mixer_sink_pad[2], "xpos", OUTPUT_VIDEO_WIDTH / 4, NULL);
-    g_object_set(video_mixer_sink_pad[2], "ypos", OUTPUT_VIDEO_HEIGHT / 2, NULL);
+    if (all_on) {
+        *all_on = count == 1 && flags[0];
+    }
 
 exit:
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        if (video_mixer_sink_pad[i]) {
-            gst_object_unref(video_mixer_sink_pad[i]);
-        }
-    }
+    g_strfreev(tokens);
 
     return result;
 }
 
-static int link_pipeline_elements(ApplicationContext* data) {
+static int parse_command_line(int argc, char* argv[], ApplicationContext* data) {
+    GOptionContext* option_context;
+    GError* error = NULL;
+    gchar* layout_name = NULL;
+    gchar* layout_weights = NULL;
+    gchar* decode_downscale = NULL;
+    gchar* loop = NULL;
+    gchar* audio = NULL;
+    gchar** outputs = NULL;
+    gchar* ladder = NULL;
+    gchar* resolution = NULL;
+    gchar* format = NULL;
+    gchar* compositing = NULL;
+    gchar* preview = NULL;
+    gchar* encoder_profile = NULL;
+    gchar** cores = NULL;
+    int segment_time = DEFAULT_SEGMENT_TIME;
+    int segment_size = 0;
+    int segment_files = 0;
+    int bench_sources = DEFAULT_BENCH_SOURCES;
+    int first_source_arg = 1;
     int result = 0;
     int i;
 
-    GstPad* audio_tee_src_pad_1 = NULL;
-    GstPad* audio_tee_src_pad_2 = NULL;
-    GstPad* video_tee_src_pad_1 = NULL;
-    GstPad* video_tee_src_pad_2 = NULL;
+    GOptionEntry entries[] = {
+        {"layout", 'l', 0, G_OPTION_ARG_STRING, &layout_name, "Sources layout: grid (default), pip or weighted", "NAME"},
+        {"weights",
+         'w',
+         0,
+         G_OPTION_ARG_STRING,
+         &layout_weights,
+         "Comma separated weights of sources for weighted layout",
+         "W1,W2,..."},
+        {"decode-downscale",
+         'd',
+         0,
+         G_OPTION_ARG_STRING,
+         &decode_downscale,
+         "Reduced resolution decoding of downscaled sources: auto or off (default), one for all or per source",
+         "MODE[,MODE...]"},
+        {"loop",
+         0,
+         0,
+         G_OPTION_ARG_STRING,
+         &loop,
+         "Play sources in a loop: on or off (default), one for all or per source",
+         "MODE[,MODE...]"},
+        {"audio",
+         'a',
+         0,
+         G_OPTION_ARG_STRING,
+         &audio,
+         "Audio of sources: volume or mute, one for all or per source (default: only the first source is heard)",
+         "MODE[,MODE...]"},
+        {"resolution",
+         'r',
+         0,
+         G_OPTION_ARG_STRING,
+         &resolution,
+         "Output frame size (default 1280x720)",
+         "WIDTHxHEIGHT"},
+        {"framerate",
+         'f',
+         0,
+         G_OPTION_ARG_INT,
+         &data->output_framerate,
+         "Output frame rate (default 30)",
+         "FPS"},
+        {"format",
+         0,
+         0,
+         G_OPTION_ARG_STRING,
+         &format,
+         "Output pixel format: I420 (default) or NV12",
+         "FORMAT"},
+        {"preview",
+         0,
+         0,
+         G_OPTION_ARG_STRING,
+         &preview,
+         "Local preview: full, off, low or WIDTHxHEIGHT@FPS (default: full, off without display and in benchmark)",
+         "MODE"},
+        {"compositing",
+         0,
+         0,
+         G_OPTION_ARG_STRING,
+         &compositing,
+         "Compositing mode: full (default) or incremental",
+         "MODE"},
+        {"encoder-profile",
+         'e',
+         0,
+         G_OPTION_ARG_STRING,
+         &encoder_profile,
+         "Video encoder settings: low-latency (default), quality or cpu-saver",
+         "NAME"},
+        {"output",
+         'o',
+         0,
+         G_OPTION_ARG_STRING_ARRAY,
+         &outputs,
+         "Additional output: rtmp:// URL, local FLV file path or .mp4/.ts segments pattern, can be repeated",
+         "LOCATION"},
+        {"segment-time",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &segment_time,
+         "Start a new recorded segment after given number of seconds (default 60), 0 disables the limit",
+         "SECONDS"},
+        {"segment-size",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &segment_size,
+         "Start a new recorded segment after given size, 0 (default) disables the limit",
+         "MB"},
+        {"segment-files",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &segment_files,
+         "Keep only given number of the latest recorded segments, 0 (default) keeps all of them",
+         "N"},
+        {"ladder",
+         0,
+         0,
+         G_OPTION_ARG_STRING,
+         &ladder,
+         "Rendition ladder: comma separated HEIGHTp:BITRATE or WIDTHxHEIGHT:BITRATE rungs",
+         "RUNGS"},
+        {"ladder-output",
+         0,
+         0,
+         G_OPTION_ARG_STRING_ARRAY,
+         &data->ladder_outputs,
+         "Output of every ladder rung, %s is replaced with rung name, can be repeated",
+         "PATTERN"},
+        {"bench",
+         'b',
+         0,
+         G_OPTION_ARG_INT,
+         &data->bench_seconds,
+         "Run headless benchmark for given number of seconds",
+         "SECONDS"},
+        {"bench-sources",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &bench_sources,
+         "Number of synthetic sources used by benchmark when no files are given",
+         "N"},
+        {"clip-cache",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->clip_cache_budget,
+         "Play small looping sources from cache of decoded frames limited to given size",
+         "MB"},
+        {"clip-cache-max-file",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->clip_cache_max_file,
+         "Cache only clips of files up to given size (default 8)",
+         "MB"},
+        {"channels",
+         0,
+         0,
+         G_OPTION_ARG_FILENAME,
+         &data->channels_file,
+         "Run every channel described in given file in this process",
+         "FILE"},
+        {"cpu-budget",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->thread_budget,
+         "Number of threads shared by encoders and decoders of all channels",
+         "N"},
+        {"cores",
+         0,
+         0,
+         G_OPTION_ARG_STRING_ARRAY,
+         &cores,
+         "Pin threads of a stage (decode, mix, encode or audio) to given CPUs, can be repeated",
+         "STAGE=CPUS"},
+        {"audio-realtime",
+         0,
+         0,
+         G_OPTION_ARG_NONE,
+         &data->audio_realtime,
+         "Run audio mixing and encoding threads with real-time priority",
+         NULL},
+        {"thread-report",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->thread_report_interval,
+         "Log CPU use of every streaming thread every given number of seconds",
+         "SECONDS"},
+        {"frame-pool-depth",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->frame_pool_depth,
+         "Produce scaled and mixed frames from fixed pools of given number of frames",
+         "N"},
+        {"adaptive-quality",
+         0,
+         0,
+         G_OPTION_ARG_NONE,
+         &data->adaptive_quality,
+         "Lower bitrate, frame rate and decoding quality when encoding can not keep up, restore them afterwards",
+         NULL},
+        {"overlay",
+         0,
+         0,
+         G_OPTION_ARG_STRING_ARRAY,
+         &data->overlays,
+         "Graphic drawn over the mixed video, arguments of the overlay control command, can be repeated",
+         "GRAPHIC"},
+        {"fast-start",
+         0,
+         0,
+         G_OPTION_ARG_NONE,
+         &data->fast_start,
+         "Start outputs with the first composited frame, sources which are not ready yet show a placeholder. "
+         "Discovered container types and decoders are cached per file",
+         NULL},
+        {"metrics-interval",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->metrics_interval,
+         "Log per-element metrics every given number of seconds",
+         "SECONDS"},
+        {"metrics-port",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->metrics_port,
+         "Serve per-element metrics as plain text on given localhost port",
+         "PORT"},
+        {"control-port",
+         0,
+         0,
+         G_OPTION_ARG_INT,
+         &data->control_port,
+         "Accept control commands on given localhost port",
+         "PORT"},
+        {NULL}};
+
+    data->clip_cache_max_file = DEFAULT_CLIP_CACHE_MAX_FILE;
+    data->output_width = DEFAULT_OUTPUT_WIDTH;
+    data->output_height = DEFAULT_OUTPUT_HEIGHT;
+    data->output_framerate = DEFAULT_OUTPUT_FRAMERATE;
+    data->output_format = DEFAULT_OUTPUT_FORMAT;
+    data->video_bitrate = VIDEO_BITRATE;
+
+    option_context = g_option_context_new("[twitch_api_key] video_path_1 [video_path_2 ...]");
+    g_option_context_add_main_entries(option_context, entries, NULL);
+    g_option_context_set_help_enabled(option_context, FALSE);
+    if (!g_option_context_parse(option_context, &argc, &argv, &error)) {
+        g_printerr("Error: %s\n", error->message);
+        g_clear_error(&error);
+        result = 1;
+        goto exit;
+    }
 
-    GstPad* stream_audio_queue_snk_pad = NULL;
-    GstPad* device_audio_queue_snk_pad = NULL;
-    GstPad* stream_video_queue_snk_pad = NULL;
-    GstPad* device_video_queue_snk_pad = NULL;
+    if (data->thread_budget < 0) {
+        g_printerr("Error: CPU budget can not be negative\n");
+        result = 1;
+        goto exit;
+    }
 
-    GstCaps* video_scale_caps;
+    // Channels have their own arguments, others are not used
+    if (data->channels_file) {
+        goto exit;
+    }
 
-    char string_buf[255];
+    if (data->bench_seconds < 0) {
+        g_printerr("Error: benchmark duration can not be negative\n");
+        result = 1;
+        goto exit;
+    }
 
-    if (!gst_element_link_many(data->audio_convert, data->audio_resample, data->audio_tee, NULL)) {
-        g_printerr("Error: audio elements could not be linked\n");
+    // Chroma of 4:2:0 formats is subsampled in both directions, so odd sizes are not supported by encoders
+    if (resolution && (sscanf(resolution, "%ix%i", &data->output_width, &data->output_height) != 2 ||
+                       data->output_width <= 0 || data->output_height <= 0 || data->output_width % 2 != 0 ||
+                       data->output_height % 2 != 0)) {
+        g_printerr("Error: invalid resolution '%s', expected WIDTHxHEIGHT with positive even values\n", resolution);
         result = 1;
         goto exit;
     }
 
-    snprintf(string_buf,
-             sizeof(string_buf),
-             "video/x-raw,width=%i,height=%i",
-             OUTPUT_VIDEO_WIDTH / 2,
-             OUTPUT_VIDEO_HEIGHT / 2);
-    video_scale_caps = gst_caps_from_string(string_buf);
-    if (!video_scale_caps) {
-        g_printerr("Error: failed to create scale filter caps\n");
+    if (data->output_framerate < 1 || data->output_framerate > MAX_OUTPUT_FRAMERATE) {
+        g_printerr("Error: frame rate should be in range [1, %i]\n", MAX_OUTPUT_FRAMERATE);
         result = 1;
         goto exit;
     }
 
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        snprintf(string_buf, sizeof(string_buf), "sink_%i", i);
-        if (!gst_element_link_pads_filtered(
-                data->video_scale[i], "src", data->videomixer, string_buf, video_scale_caps)) {
-            g_printerr("Error: failed to link video %i with rescale filter\n", i);
+    // Both formats are blended by the compositor and accepted by the encoders directly
+    if (format) {
+        if (g_ascii_strcasecmp(format, "I420") == 0) {
+            data->output_format = "I420";
+        } else if (g_ascii_strcasecmp(format, "NV12") == 0) {
+            data->output_format = "NV12";
+        } else {
+            g_printerr("Error: unsupported pixel format '%s'\n", format);
             result = 1;
             goto exit;
         }
     }
 
-    gst_caps_unref(video_scale_caps);
+    if (compositing) {
+        if (g_strcmp0(compositing, "incremental") == 0) {
+            data->incremental_compositing = TRUE;
+        } else if (g_strcmp0(compositing, "full") != 0) {
+            g_printerr("Error: unknown compositing mode '%s'\n", compositing);
+            result = 1;
+            goto exit;
+        }
+    }
 
-    if (!gst_element_link_many(data->videomixer, data->video_tee, NULL)) {
-        g_printerr("Error: mixer output elements could not be linked\n");
+    data->encoder_profile = ENCODER_PROFILE_LOW_LATENCY;
+    if (encoder_profile && encoder_profile_from_string(encoder_profile, &data->encoder_profile) != 0) {
+        g_printerr("Error: unknown encoder profile '%s'\n", encoder_profile);
         result = 1;
         goto exit;
     }
 
-    audio_tee_src_pad_1 = gst_element_get_request_pad(data->audio_tee, "src_%u");
-    video_tee_src_pad_1 = gst_element_get_request_pad(data->video_tee, "src_%u");
-    if (data->streaming_enabled) {
-        audio_tee_src_pad_2 = gst_element_get_request_pad(data->audio_tee, "src_%u");
-        video_tee_src_pad_2 = gst_element_get_request_pad(data->video_tee, "src_%u");
+    if (segment_time < 0 || segment_size < 0 || segment_files < 0) {
+        g_printerr("Error: segment limits can not be negative\n");
+        result = 1;
+        goto exit;
     }
+    data->segments.max_time = (guint64)segment_time * GST_SECOND;
+    data->segments.max_bytes = (guint64)segment_size * 1024 * 1024;
+    data->segments.max_files = (guint)segment_files;
 
-    device_audio_queue_snk_pad = gst_element_get_static_pad(data->device_audio_queue, "sink");
-    device_video_queue_snk_pad = gst_element_get_static_pad(data->device_video_queue, "sink");
-    if (data->streaming_enabled) {
-        stream_audio_queue_snk_pad = gst_element_get_static_pad(data->stream_audio_queue, "sink");
-        stream_video_queue_snk_pad = gst_element_get_static_pad(data->stream_video_queue, "sink");
+    if (data->clip_cache_budget < 0 || data->clip_cache_max_file < 0) {
+        g_printerr("Error: clip cache sizes can not be negative\n");
+        result = 1;
+        goto exit;
     }
 
-    if (gst_pad_link(audio_tee_src_pad_1, device_audio_queue_snk_pad) != GST_PAD_LINK_OK ||
-        gst_pad_link(video_tee_src_pad_1, device_video_queue_snk_pad) != GST_PAD_LINK_OK) {
-        g_printerr("Error: tee could not be linked with device sinks\n");
+    if (data->frame_pool_depth != 0 &&
+        (data->frame_pool_depth < MIN_FRAME_POOL_DEPTH || data->frame_pool_depth > MAX_FRAME_POOL_DEPTH)) {
+        g_printerr("Error: frame pool depth should be 0 or in range [%i, %i]\n",
+                   MIN_FRAME_POOL_DEPTH,
+                   MAX_FRAME_POOL_DEPTH);
         result = 1;
         goto exit;
     }
 
-    if (data->streaming_enabled) {
-        if (gst_pad_link(audio_tee_src_pad_2, stream_audio_queue_snk_pad) != GST_PAD_LINK_OK ||
-            gst_pad_link(video_tee_src_pad_2, stream_video_queue_snk_pad) != GST_PAD_LINK_OK) {
-            g_printerr("Error: tee could not be linked with streaming sinks\n");
-            result = 1;
-            goto exit;
-        }
+    if (data->metrics_interval < 0) {
+        g_printerr("Error: metrics interval can not be negative\n");
+        result = 1;
+        goto exit;
+    }
 
-        if (!gst_element_link_many(data->stream_audio_queue, data->voaacenc, data->flv_mux, NULL)) {
-            g_printerr("Error: audio FLV elements could not be linked\n");
-            result = 1;
-            goto exit;
-        }
+    if (data->metrics_port < 0 || data->metrics_port > G_MAXUINT16) {
+        g_printerr("Error: metrics port should be in range [0, %i]\n", G_MAXUINT16);
+        result = 1;
+        goto exit;
+    }
+
+    if (data->control_port < 0 || data->control_port > G_MAXUINT16) {
+        g_printerr("Error: control port should be in range [0, %i]\n", G_MAXUINT16);
+        result = 1;
+        goto exit;
+    }
+
+    if (data->bench_seconds > 0) {
+        // Benchmark always runs the whole encoding path, but outputs go nowhere. If no files are given,
+        // synthetic sources are used
+        g_print("Benchmark mode is enabled, duration %i s\n", data->bench_seconds);
+        data->synthetic_sources = argc < 2;
+    } else if (argc < 2) {
+        result = 1;
+        goto exit;
+    } else if (g_str_has_prefix(argv[1], TWITCH_KEY_PREFIX)) {
+        // API key is optional, first argument is treated as a key only if it looks like a Twitch stream key
+        g_print("Twitch streaming is enabled!\n");
+        data->output_locations[data->output_count++] = g_strdup_printf("%s/%s", TWITCH_URL_PREFIX, argv[1]);
+        first_source_arg = 2;
+    } else {
+        g_print("Twitch streaming is NOT enabled, because twitch API key was not specified!\n");
+    }
 
-        if (!gst_element_link_many(data->stream_video_queue, data->x264enc, data->flv_mux, data->rtmp_sink, NULL)) {
-            g_printerr("Error: video FLV elements could not be linked\n");
+    for (i = 0; outputs && outputs[i]; ++i) {
+        if (data->output_count >= MAX_OUTPUTS) {
+            g_printerr("Error: too many outputs, max is %i\n", MAX_OUTPUTS);
             result = 1;
             goto exit;
         }
+        data->output_locations[data->output_count++] = g_strdup(outputs[i]);
     }
 
-    if (!gst_element_link_many(data->device_audio_queue, data->audio_device_sink, NULL)) {
-        g_printerr("Error: device audio elements could not be linked\n");
+    if (ladder &&
+        ladder_parse(ladder, data->output_width, data->output_height, data->rung, &data->rung_count) != 0) {
         result = 1;
         goto exit;
     }
 
-    if (!gst_element_link_many(data->device_video_queue, data->video_device_sink, NULL)) {
-        g_printerr("Error: device video elements could not be linked\n");
+    if (data->rung_count > 0 && !data->ladder_outputs) {
+        g_printerr("Error: ladder requires at least one --ladder-output\n");
         result = 1;
         goto exit;
     }
 
-    // Connect to the pad-added signal
-    for (i = 0; i < MAX_SOURCES; ++i) {
-        g_signal_connect(data->source[i], "pad-added", G_CALLBACK(pad_added_handler), data);
+    if (data->bench_seconds > 0 && data->output_count == 0) {
+        data->output_locations[data->output_count++] = g_strdup("bench");
     }
 
-exit:
-    // Clean resources
-    if (audio_tee_src_pad_1) {
-        gst_object_unref(audio_tee_src_pad_1);
+    data->main_encoder_enabled = data->output_count > 0;
+    data->streaming_enabled = data->main_encoder_enabled || data->rung_count > 0;
+
+    // Headless runs have nobody to watch the preview, benchmark measures preview only if it is asked for
+    data->preview_mode = PREVIEW_FULL;
+    data->preview_width = DEFAULT_PREVIEW_WIDTH;
+    data->preview_height = DEFAULT_PREVIEW_HEIGHT;
+    data->preview_framerate = DEFAULT_PREVIEW_FRAMERATE;
+    if (!preview) {
+        if (data->bench_seconds > 0 || (!g_getenv("DISPLAY") && !g_getenv("WAYLAND_DISPLAY"))) {
+            data->preview_mode = PREVIEW_OFF;
+        }
+    } else if (g_strcmp0(preview, "off") == 0) {
+        data->preview_mode = PREVIEW_OFF;
+    } else if (g_strcmp0(preview, "low") == 0) {
+        data->preview_mode = PREVIEW_SCALED;
+    } else if (g_strcmp0(preview, "full") != 0) {
+        data->preview_mode = PREVIEW_SCALED;
+        if (sscanf(preview, "%ix%i@%i", &data->preview_width, &data->preview_height, &data->preview_framerate) != 3 ||
+            data->preview_width <= 0 || data->preview_height <= 0 || data->preview_width % 2 != 0 ||
+            data->preview_height % 2 != 0 || data->preview_framerate < 1 ||
+            data->preview_framerate > data->output_framerate) {
+            g_printerr("Error: invalid preview '%s', expected full, off, low or WIDTHxHEIGHT@FPS with positive even "
+                       "size and frame rate not above the output one\n",
+                       preview);
+            result = 1;
+            goto exit;
+        }
+    }
+    if (data->preview_mode == PREVIEW_OFF && !data->streaming_enabled) {
+        g_printerr("Error: preview is off and there are no outputs, there is nothing to do\n");
+        result = 1;
+        goto exit;
+    }
+
+    // Pressure is measured on the queue and encoder of the main stream
+    if (data->adaptive_quality && !data->main_encoder_enabled) {
+        g_printerr("Error: adaptive quality requires at least one output\n");
+        result = 1;
+        goto exit;
+    }
+
+    // Live placeholders pace the mixers by the clock, while benchmark runs as fast as possible
+    if (data->fast_start && data->bench_seconds > 0) {
+        g_print("Fast start is off in benchmark mode\n");
+        data->fast_start = FALSE;
+    }
+
+    data->source_count = data->synthetic_sources ? bench_sources : argc - first_source_arg;
+    if (data->source_count < 1 || data->source_count > MAX_SOURCES) {
+        g_printerr("Error: number of sources should be in range [1, %i]\n", MAX_SOURCES);
+        result = 1;
+        goto exit;
+    }
+    for (i = 0; i < data->source_count && !data->synthetic_sources; ++i) {
+        data->source_paths[i] = argv[i + first_source_arg];
+    }
+
+    data->layout_type = LAYOUT_GRID;
+    if (layout_name && layout_type_from_string(layout_name, &data->layout_type) != 0) {
+        g_printerr("Error: unknown layout '%s'\n", layout_name);
+        result = 1;
+        goto exit;
+    }
+
+    if (layout_weights && data->layout_type != LAYOUT_WEIGHTED) {
+        g_printerr("Error: weights are used only by weighted layout\n");
+        result = 1;
+        goto exit;
+    }
+
+    data->layout_weights_set = layout_weights != NULL;
+    if (data->layout_weights_set &&
+        parse_layout_weights(layout_weights, data->source_count, data->layout_weights) != 0) {
+        result = 1;
+        goto exit;
+    }
+
+    if (decode_downscale &&
+        parse_source_modes(decode_downscale, "decode downscale", "auto", data, data->decode_downscale, NULL) != 0) {
+        result = 1;
+        goto exit;
+    }
+
+    // By default only the main source is heard, audio of other sources is not decoded
+    for (i = 0; i < data->source_count; ++i) {
+        data->audio_volume[i] = 1.0;
+        data->audio_mute[i] = i != MAIN_AUDIO_SOURCE_INDEX;
+        data->audio_decoded[i] = i == MAIN_AUDIO_SOURCE_INDEX;
+    }
+    if (audio && parse_audio_modes(audio, data) != 0) {
+        result = 1;
+        goto exit;
+    }
+
+    if (data->thread_report_interval < 0) {
+        g_printerr("Error: thread report interval can not be negative\n");
+        result = 1;
+        goto exit;
+    }
+    if (cores || data->audio_realtime || data->thread_report_interval > 0) {
+        data->placement = thread_placement_new(data->channel_name ? data->channel_name : "twitch-pipeline");
+        thread_placement_set_audio_realtime(data->placement, data->audio_realtime);
+        for (i = 0; cores && cores[i]; ++i) {
+            if (thread_placement_set_cores(data->placement, cores[i]) != 0) {
+                result = 1;
+                goto exit;
+            }
+        }
+    }
+
+    // Synthetic sources never end
+    if (loop && !data->synthetic_sources &&
+        parse_source_modes(loop, "loop", "on", data, data->loop, &data->loop_runtime_sources) != 0) {
+        result = 1;
+        goto exit;
+    }
+
+exit:
+    g_free(layout_name);
+    g_free(layout_weights);
+    g_free(decode_downscale);
+    g_free(loop);
+    g_free(audio);
+    g_strfreev(outputs);
+    g_free(ladder);
+    g_free(resolution);
+    g_free(format);
+    g_free(compositing);
+    g_free(preview);
+    g_free(encoder_profile);
+    g_strfreev(cores);
+    g_option_context_free(option_context);
+
+    return result;
+}
+
+static void print_usage() {
+    g_print(
+        "Application to stream mixed video data to twitch\n"
+        "Usage:\n  ./twitch-streamer [options] [twitch_api_key] video_path_1 [video_path_2 ... video_path_16]\n"
+        "Options:\n"
+        "  -l, --layout=NAME          sources layout: grid (default), pip or weighted\n"
+        "  -w, --weights=W1,W2,...    weights of sources for weighted layout, one per source\n"
+        "  -d, --decode-downscale=MODE[,MODE...]\n"
+        "                             decode downscaled sources at reduced resolution: auto or off (default),\n"
+        "                             single mode is applied to all sources\n"
+        "  --loop=MODE[,MODE...]      play sources in a loop without gaps: on or off (default), single mode is\n"
+        "                             applied to all sources and to the ones added at runtime\n"
+        "  -a, --audio=MODE[,MODE...] mix audio of sources: volume in range [0, 10] or mute, single mode is applied\n"
+        "                             to all sources, by default only the first source is heard. Audio of muted\n"
+        "                             sources is not decoded, except the first one\n"
+        "  -r, --resolution=WIDTHxHEIGHT\n"
+        "                             output frame size, even values (default 1280x720)\n"
+        "  -f, --framerate=FPS        output frame rate (default 30)\n"
+        "  --format=FORMAT            output pixel format: I420 (default) or NV12, used from compositor to encoders\n"
+        "  --preview=MODE             local preview: full, off, low (640x360 at 10 fps) or WIDTHxHEIGHT@FPS, it is\n"
+        "                             leaky and never slows down streaming. Default is full, off if there is no\n"
+        "                             display or in benchmark mode. Off disables local audio playback as well\n"
+        "  --compositing=MODE         full (default) blends every tile into every frame, incremental redraws only\n"
+        "                             tiles which got a new frame, for slides, paused feeds and static overlays\n"
+        "  -e, --encoder-profile=NAME video encoder settings: low-latency (default), quality or cpu-saver, all of\n"
+        "                             them put a keyframe every 2 seconds\n"
+        "  -o, --output=LOCATION      additional output: rtmp:// URL or local FLV file path, can be repeated,\n"
+        "                             all outputs share the same encoders. Locations ending with .mp4 or .ts record\n"
+        "                             rolling fragmented MP4 or MPEG-TS segments, e.g. rec/stream_%05d.mp4\n"
+        "  --segment-time=SECONDS     start a new recorded segment after given duration (default 60, 0 is unlimited)\n"
+        "  --segment-size=MB          start a new recorded segment after given size (default 0 is unlimited)\n"
+        "  --segment-files=N          keep only N latest recorded segments (default 0 keeps all)\n"
+        "  --ladder=RUNGS             rendition ladder encoded from the same composited frame, comma separated\n"
+        "                             HEIGHTp:BITRATE or WIDTHxHEIGHT:BITRATE rungs, e.g. 720p:2500,480p:1200\n"
+        "  --ladder-output=PATTERN    output of every rung, %s is replaced with rung name, can be repeated,\n"
+        "                             HLS master playlist is written for .m3u8 patterns\n"
+        "  -b, --bench=SECONDS        run headless benchmark, synthetic sources are used if no files are given\n"
+        "  --bench-sources=N          number of synthetic benchmark sources (default 3)\n"
+        "  --clip-cache=MB            decode small looping clips once into cache of frames scaled to tile size,\n"
+        "                             cache is limited to given size, the least recently used clips are evicted\n"
+        "  --clip-cache-max-file=MB   cache only clips of files up to given size (default 8)\n"
+        "  --channels=FILE            run many channels in one process, FILE has a [NAME] group with 'args' key\n"
+        "                             holding the usual arguments for every channel\n"
+        "  --cpu-budget=N             threads shared by encoders and decoders of all channels, by default equal to\n"
+        "                             the number of CPUs in multi-channel mode and automatic otherwise\n"
+        "  --cores=STAGE=CPUS         pin streaming threads of decode, mix, encode or audio stage to given CPUs,\n"
+        "                             e.g. decode=0-7 encode=8-15,24-31, can be repeated. Encoders and decoders\n"
+        "                             run as many threads as their stage has CPUs\n"
+        "  --audio-realtime           run audio mixing and encoding threads with SCHED_FIFO priority\n"
+        "  --thread-report=SECONDS    log CPU use of every streaming thread periodically\n"
+        "  --frame-pool-depth=N       produce scaled and mixed frames from preallocated pools of N aligned frames,\n"
+        "                             the slowest branch throttles the mixer instead of dropping frames\n"
+        "  --adaptive-quality         lower bitrate, frame rate and decoding quality step by step when encoding can\n"
+        "                             not keep up, instead of dropping frames in the stream queues\n"
+        "  --overlay=GRAPHIC          graphic drawn over the mixed video, rendered once: 'image NAME X Y PATH' or\n"
+        "                             'text NAME X Y TEXT [FONT]', can be repeated, see 'overlay' control command\n"
+        "  --fast-start               start outputs with the first composited frame, tiles of sources which are not\n"
+        "                             ready yet show a placeholder. Discovery results are cached per file\n"
+        "  --metrics-interval=SECONDS log per-element rates, processing time and queue levels periodically\n"
+        "  --metrics-port=PORT        serve the same metrics as plain text on http://127.0.0.1:PORT/\n"
+        "  --control-port=PORT        accept line based control commands on 127.0.0.1:PORT, send 'help' to list them\n"
+        "Examples:\n  ./twitch-streamer live_111111111_aaaabbbcccddddeeeeffffggghhhhh ../data/sintel_trailer-480p.webm "
+        "../data/big_buck_bunny_trailer-360p.mp4 ../data/the_daily_dweebs-720p.mp4\n"
+        "  ./twitch-streamer ../data/sintel_trailer-480p.webm ../data/big_buck_bunny_trailer-360p.mp4 "
+        "../data/the_daily_dweebs-720p.mp4\n"
+        "  ./twitch-streamer --layout=weighted --weights=2,1,1 ../data/sintel_trailer-480p.webm "
+        "../data/big_buck_bunny_trailer-360p.mp4 ../data/the_daily_dweebs-720p.mp4\n"
+        "  ./twitch-streamer --output=rtmp://localhost/live/test --output=record.flv ../data/sintel_trailer-480p.webm "
+        "../data/big_buck_bunny_trailer-360p.mp4\n"
+        "  ./twitch-streamer --ladder=720p:2500,480p:1200,360p:600 --ladder-output=hls/%s.m3u8 "
+        "../data/sintel_trailer-480p.webm ../data/big_buck_bunny_trailer-360p.mp4\n"
+        "  ./twitch-streamer --resolution=1920x1080 --framerate=60 --format=NV12 ../data/the_daily_dweebs-720p.mp4\n"
+        "  ./twitch-streamer --channels=channels.ini --cpu-budget=32\n"
+        "  ./twitch-streamer --bench=10 --bench-sources=9\n");
+}
+
+static int setup_layout(ApplicationContext* data) {
+    int i;
+
+    if (layout_compute(data->layout_type,
+                       data->source_count,
+                       data->layout_weights_set ? data->layout_weights : NULL,
+                       data->output_width,
+                       data->output_height,
+                       data->layout) != 0) {
+        g_printerr("Error: unable to compute '%s' layout for %i sources\n",
+                   layout_type_to_string(data->layout_type),
+                   data->source_count);
+        return 1;
+    }
+
+    g_print("Layout '%s':\n", layout_type_to_string(data->layout_type));
+    for (i = 0; i < data->source_count; ++i) {
+        g_print("  source %i: %ix%i at (%i, %i)\n",
+                i,
+                data->layout[i].width,
+                data->layout[i].height,
+                data->layout[i].x,
+                data->layout[i].y);
+    }
+
+    return 0;
+}
+
+static void configure_video_encoder(ApplicationContext* data, GstElement* encoder, int bitrate) {
+    encoder_profile_apply(data->encoder_profile, encoder, bitrate, data->output_framerate, data->encoder_threads);
+}
+
+#define ENSURE_INITED(X, Y)                                                                  \
+    if (!X->Y) {                                                                             \
+        char buf[255];                                                                       \
+        snprintf(buf, sizeof(buf), "Error: pipeline element '%s', was not created\n", (#Y)); \
+        g_printerr("%s", buf);                                                               \
+        return 1;                                                                            \
+    }
+
+// Returns URI of a local file or NULL if it does not exist, relative paths are resolved against the working dir
+static gchar* make_source_uri(const char* path) {
+    gchar* absolute_path;
+    gchar* uri = NULL;
+
+    if (path[0] == '/') {
+        absolute_path = g_strdup(path);
+    } else {
+        gchar* current_dir = g_get_current_dir();
+        absolute_path = g_build_filename(current_dir, path, NULL);
+        g_free(current_dir);
+    }
+
+    if (access(absolute_path, F_OK) != -1) {
+        g_print("Loading file: '%s'\n", absolute_path);
+        uri = g_strdup_printf("file://%s", absolute_path);
+    } else {
+        g_printerr("Error: file '%s' does not exist!\n", absolute_path);
+    }
+
+    g_free(absolute_path);
+
+    return uri;
+}
+
+// Returns source playing the clip from cache scaled to the tile size, or NULL if clip should be decoded as usual.
+// Audio of cached clips is not used, so the source providing audio is never cached
+static GstElement* create_cached_source(ApplicationContext* data,
+                                        const char* path,
+                                        const char* name,
+                                        const LayoutTile* tile) {
+    GstElement* source;
+    gchar* uri;
+
+    if (!data->clip_cache) {
+        return NULL;
+    }
+
+    uri = make_source_uri(path);
+    if (!uri) {
+        return NULL;
+    }
+
+    // Pipeline is not running yet, so sources given on command line wait for their clips
+    source = clip_cache_create_source(data->clip_cache, uri, name, tile->width, tile->height, TRUE);
+    g_free(uri);
+
+    return source;
+}
+
+static void configure_preview(ApplicationContext* data) {
+    GstCaps* caps;
+
+    // Leaky queues drop frames and audio which device sinks can not take in time, instead of blocking the tees
+    g_object_set(data->device_audio_queue, "leaky", 2 /*downstream*/, NULL);
+    g_object_set(data->device_video_queue, "leaky", 2 /*downstream*/, NULL);
+
+    if (data->preview_mode == PREVIEW_SCALED) {
+        g_object_set(data->device_video_queue,
+                     "max-size-buffers",
+                     PREVIEW_QUEUE_MAX_BUFFERS,
+                     "max-size-time",
+                     (guint64)0,
+                     "max-size-bytes",
+                     0,
+                     NULL);
+        g_object_set(data->preview_rate, "drop-only", TRUE, NULL);
+        caps = gst_caps_new_simple("video/x-raw",
+                                   "width",
+                                   G_TYPE_INT,
+                                   data->preview_width,
+                                   "height",
+                                   G_TYPE_INT,
+                                   data->preview_height,
+                                   "framerate",
+                                   GST_TYPE_FRACTION,
+                                   data->preview_framerate,
+                                   1,
+                                   NULL);
+        g_object_set(data->preview_filter, "caps", caps, NULL);
+        gst_caps_unref(caps);
+        g_print("Preview: %ix%i at %i fps\n", data->preview_width, data->preview_height, data->preview_framerate);
+    }
+
+    if (data->bench_seconds > 0) {
+        g_object_set(data->audio_device_sink, "sync", FALSE, NULL);
+        g_object_set(data->video_device_sink, "sync", FALSE, NULL);
+    }
+}
+
+// Placeholders are live, so the mixers aggregate by the clock and do not wait for sources which are still starting.
+// Video placeholder produces frames of the output size, so it is not scaled by the mixer
+static void configure_placeholders(ApplicationContext* data) {
+    GstCaps* caps;
+
+    g_object_set(data->placeholder_video,
+                 "is-live",
+                 TRUE,
+                 "pattern",
+                 17 /*solid-color*/,
+                 "foreground-color",
+                 PLACEHOLDER_COLOR,
+                 NULL);
+    caps = gst_caps_new_simple("video/x-raw",
+                               "format",
+                               G_TYPE_STRING,
+                               data->output_format,
+                               "width",
+                               G_TYPE_INT,
+                               data->output_width,
+                               "height",
+                               G_TYPE_INT,
+                               data->output_height,
+                               "framerate",
+                               GST_TYPE_FRACTION,
+                               data->output_framerate,
+                               1,
+                               NULL);
+    g_object_set(data->placeholder_video_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+
+    g_object_set(data->placeholder_audio, "is-live", TRUE, "wave", 4 /*silence*/, NULL);
+    caps = gst_caps_from_string(PLACEHOLDER_AUDIO_CAPS);
+    g_object_set(data->placeholder_audio_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+}
+
+static int create_pipeline_elements(ApplicationContext* data) {
+    int i;
+    char string_buf[PATH_MAX + 1024];
+
+    if (data->clip_cache_budget > 0) {
+        data->clip_cache = clip_cache_new((gsize)data->clip_cache_budget * 1024 * 1024,
+                                          (gsize)data->clip_cache_max_file * 1024 * 1024,
+                                          data->output_format);
+    }
+
+    for (i = 0; i < data->source_count; ++i) {
+        snprintf(string_buf, sizeof(string_buf), "source_%i", i);
+        if (data->synthetic_sources) {
+            data->source[i] = gst_element_factory_make("videotestsrc", string_buf);
+            snprintf(string_buf, sizeof(string_buf), "test_audio_source_%i", i);
+            data->test_audio_source[i] = gst_element_factory_make("audiotestsrc", string_buf);
+        } else {
+            if (data->loop[i] && !data->audio_decoded[i]) {
+                data->source[i] = create_cached_source(data, data->source_paths[i], string_buf, &data->layout[i]);
+            }
+            if (data->source[i]) {
+                // Cached frames are already of the tile size
+                data->decode_downscale[i] = FALSE;
+            } else {
+                data->source[i] = gst_element_factory_make("uridecodebin", string_buf);
+            }
+        }
+        data->video_scale[i] = NULL;
+        data->video_scale_filter[i] = NULL;
+        data->source_id[i] = i;
+    }
+    data->next_source_id = data->source_count;
+
+    // Audio
+    data->audio_mixer = gst_element_factory_make("audiomixer", "audio_mixer");
+    data->audio_convert = gst_element_factory_make("audioconvert", "audio_convert");
+    data->audio_resample = gst_element_factory_make("audioresample", "audio_resample");
+    data->audio_tee = gst_element_factory_make("tee", "audio_tee");
+    if (data->streaming_enabled) {
+        data->voaacenc = gst_element_factory_make("voaacenc", "aac_encoder");
+        data->stream_audio_queue = gst_element_factory_make("queue", "stream_audio_queue");
+        data->encoded_audio_tee = gst_element_factory_make("tee", "encoded_audio_tee");
+    } else {
+        data->stream_audio_queue = NULL;
+        data->voaacenc = NULL;
+        data->encoded_audio_tee = NULL;
+    }
+
+    // Nothing should be synchronized against the clock in benchmark mode
+    if (data->preview_mode != PREVIEW_OFF) {
+        data->audio_device_sink =
+            gst_element_factory_make(data->bench_seconds > 0 ? "fakesink" : "autoaudiosink", "audio_device_sink");
+        data->device_audio_queue = gst_element_factory_make("queue", "device_audio_queue");
+    } else {
+        data->audio_device_sink = NULL;
+        data->device_audio_queue = NULL;
+    }
+
+    // Video
+    if (data->incremental_compositing && !tile_mixer_register()) {
+        g_printerr("Error: failed to register tile mixer\n");
+        return 1;
+    }
+    data->video_mixer =
+        gst_element_factory_make(data->incremental_compositing ? "tilemixer" : "compositor", "video_mixer");
+    data->video_mixer_filter = gst_element_factory_make("capsfilter", "video_mixer_filter");
+    data->video_tee = gst_element_factory_make("tee", "video_tee");
+    if (data->main_encoder_enabled) {
+        data->stream_video_queue = gst_element_factory_make("queue", "stream_video_queue");
+        data->x264enc = gst_element_factory_make("x264enc", "x264_enc");
+        data->encoded_video_tee = gst_element_factory_make("tee", "encoded_video_tee");
+    } else {
+        data->stream_video_queue = NULL;
+        data->x264enc = NULL;
+        data->encoded_video_tee = NULL;
+    }
+    if (data->preview_mode != PREVIEW_OFF) {
+        data->device_video_queue = gst_element_factory_make("queue", "device_video_queue");
+        data->video_device_sink =
+            gst_element_factory_make(data->bench_seconds > 0 ? "fakesink" : "autovideosink", "video_device_sink");
+    } else {
+        data->device_video_queue = NULL;
+        data->video_device_sink = NULL;
+    }
+    // Frames are dropped before they are scaled
+    if (data->preview_mode == PREVIEW_SCALED) {
+        data->preview_rate = gst_element_factory_make("videorate", "preview_rate");
+        data->preview_scale = gst_element_factory_make("videoscale", "preview_scale");
+        data->preview_filter = gst_element_factory_make("capsfilter", "preview_filter");
+    } else {
+        data->preview_rate = NULL;
+        data->preview_scale = NULL;
+        data->preview_filter = NULL;
+    }
+    if (data->fast_start) {
+        data->placeholder_video = gst_element_factory_make("videotestsrc", "placeholder_video");
+        data->placeholder_video_filter = gst_element_factory_make("capsfilter", "placeholder_video_filter");
+        data->placeholder_audio = gst_element_factory_make("audiotestsrc", "placeholder_audio");
+        data->placeholder_audio_filter = gst_element_factory_make("capsfilter", "placeholder_audio_filter");
+        data->discovery_cache = discovery_cache_load();
+    } else {
+        data->placeholder_video = NULL;
+        data->placeholder_video_filter = NULL;
+        data->placeholder_audio = NULL;
+        data->placeholder_audio_filter = NULL;
+    }
+
+    data->pipeline = gst_pipeline_new(data->channel_name ? data->channel_name : "twitch-pipeline");
+    if (!data->pipeline) {
+        g_printerr("Error: failed to create pipeline\n");
+        return 1;
+    }
+
+    // Ensure that everything was created properly
+    // Audio
+    for (i = 0; i < data->source_count; ++i) {
+        ENSURE_INITED(data, source[i]);
+        if (data->synthetic_sources) {
+            ENSURE_INITED(data, test_audio_source[i]);
+        }
+    }
+    ENSURE_INITED(data, audio_mixer);
+    ENSURE_INITED(data, audio_convert);
+    ENSURE_INITED(data, audio_resample);
+    ENSURE_INITED(data, audio_tee);
+    if (data->streaming_enabled) {
+        ENSURE_INITED(data, stream_audio_queue);
+        ENSURE_INITED(data, voaacenc);
+        ENSURE_INITED(data, encoded_audio_tee);
+    }
+    if (data->preview_mode != PREVIEW_OFF) {
+        ENSURE_INITED(data, audio_device_sink);
+        ENSURE_INITED(data, device_audio_queue);
+    }
+
+    // Video
+    ENSURE_INITED(data, video_mixer);
+    ENSURE_INITED(data, video_mixer_filter);
+    ENSURE_INITED(data, video_tee);
+    if (data->main_encoder_enabled) {
+        ENSURE_INITED(data, stream_video_queue);
+        ENSURE_INITED(data, x264enc);
+        ENSURE_INITED(data, encoded_video_tee);
+    }
+    if (data->preview_mode != PREVIEW_OFF) {
+        ENSURE_INITED(data, device_video_queue);
+        ENSURE_INITED(data, video_device_sink);
+    }
+    if (data->preview_mode == PREVIEW_SCALED) {
+        ENSURE_INITED(data, preview_rate);
+        ENSURE_INITED(data, preview_scale);
+        ENSURE_INITED(data, preview_filter);
+    }
+    if (data->fast_start) {
+        ENSURE_INITED(data, placeholder_video);
+        ENSURE_INITED(data, placeholder_video_filter);
+        ENSURE_INITED(data, placeholder_audio);
+        ENSURE_INITED(data, placeholder_audio_filter);
+    }
+
+    // Setting elements properties
+    char current_work_dir[PATH_MAX];
+    if (getcwd(current_work_dir, sizeof(current_work_dir)) != NULL) {
+        g_print("Current working dir: %s\n", current_work_dir);
+    } else {
+        g_printerr("Error: getcwd() error\n");
+        return 1;
+    }
+
+    for (i = 0; i < data->source_count && data->synthetic_sources; ++i) {
+        // Every source gets its own pattern, only the source with audio is not silent
+        g_object_set(data->source[i], "pattern", i % 20, "is-live", FALSE, NULL);
+        g_object_set(data->test_audio_source[i],
+                     "wave",
+                     i == MAIN_AUDIO_SOURCE_INDEX ? 0 /*sine*/ : 4 /*silence*/,
+                     "is-live",
+                     FALSE,
+                     NULL);
+    }
+
+    for (i = 0; i < data->source_count && !data->synthetic_sources; ++i) {
+        gchar* uri;
+
+        if (clip_cache_is_source(data->source[i])) {
+            continue;
+        }
+
+        uri = make_source_uri(data->source_paths[i]);
+        if (!uri) {
+            return 1;
+        }
+        g_object_set(data->source[i], "uri", uri, NULL);
+        g_free(uri);
+
+        if (!data->audio_decoded[i]) {
+            g_object_set_data(G_OBJECT(data->source[i]), "skip-audio", GINT_TO_POINTER(TRUE));
+        }
+    }
+
+    if (data->streaming_enabled) {
+        g_object_set(data->stream_audio_queue, "leaky", 2 /*downstream*/, NULL);
+        g_object_set(data->stream_audio_queue, "max-size-time", 5 * GST_SECOND, NULL);
+        g_object_set(data->voaacenc, "bitrate", AUDIO_BITRATE, NULL);
+    }
+
+    if (data->main_encoder_enabled || data->rung_count > 0) {
+        g_print("Video encoder profile: %s\n", encoder_profile_to_string(data->encoder_profile));
+    }
+
+    if (data->main_encoder_enabled) {
+        g_object_set(data->stream_video_queue, "leaky", 2 /*downstream*/, NULL);
+        g_object_set(data->stream_video_queue, "max-size-time", 5 * GST_SECOND, NULL);
+        configure_video_encoder(data, data->x264enc, data->video_bitrate);
+    }
+
+    // Every rung has its own encoder with the same settings, except bitrate
+    for (i = 0; i < data->rung_count; ++i) {
+        if (ladder_rung_create(&data->rung[i],
+                               (const char* const*)data->ladder_outputs,
+                               data->output_format,
+                               &data->segments,
+                               data->bench_seconds > 0) != 0) {
+            return 1;
+        }
+        configure_video_encoder(data, data->rung[i].encoder, data->rung[i].bitrate);
+    }
+
+    for (i = 0; i < data->output_count; ++i) {
+        snprintf(string_buf, sizeof(string_buf), "output_%i", i);
+        if (output_branch_create(&data->output[i],
+                                 string_buf,
+                                 data->output_locations[i],
+                                 &data->segments,
+                                 data->bench_seconds > 0) != 0) {
+            return 1;
+        }
+    }
+
+    if (data->preview_mode != PREVIEW_OFF) {
+        configure_preview(data);
+    }
+    if (data->fast_start) {
+        configure_placeholders(data);
+    }
+
+    return 0;
+}
+
+static int add_elements_to_pipeline(ApplicationContext* data) {
+    int i;
+
+    for (i = 0; i < data->source_count; ++i) {
+        if (!gst_bin_add(GST_BIN(data->pipeline), data->source[i])) {
+            g_printerr("Error: failed to add data source %i\n", i);
+            return 1;
+        }
+        if (data->synthetic_sources && !gst_bin_add(GST_BIN(data->pipeline), data->test_audio_source[i])) {
+            g_printerr("Error: failed to add test audio source %i\n", i);
+            return 1;
+        }
+    }
+
+    // All other elements
+    gst_bin_add_many(GST_BIN(data->pipeline),
+                     data->audio_mixer,
+                     data->audio_convert,
+                     data->audio_resample,
+                     data->audio_tee,
+                     data->video_mixer,
+                     data->video_mixer_filter,
+                     data->video_tee,
+                     NULL);
+
+    if (data->preview_mode != PREVIEW_OFF) {
+        gst_bin_add_many(GST_BIN(data->pipeline),
+                         data->device_audio_queue,
+                         data->audio_device_sink,
+                         data->device_video_queue,
+                         data->video_device_sink,
+                         NULL);
+    }
+
+    if (data->preview_mode == PREVIEW_SCALED) {
+        gst_bin_add_many(
+            GST_BIN(data->pipeline), data->preview_rate, data->preview_scale, data->preview_filter, NULL);
+    }
+
+    if (data->fast_start) {
+        gst_bin_add_many(GST_BIN(data->pipeline),
+                         data->placeholder_video,
+                         data->placeholder_video_filter,
+                         data->placeholder_audio,
+                         data->placeholder_audio_filter,
+                         NULL);
+    }
+
+    if (data->streaming_enabled) {
+        gst_bin_add_many(
+            GST_BIN(data->pipeline), data->stream_audio_queue, data->voaacenc, data->encoded_audio_tee, NULL);
+    }
+
+    if (data->main_encoder_enabled) {
+        gst_bin_add_many(
+            GST_BIN(data->pipeline), data->stream_video_queue, data->x264enc, data->encoded_video_tee, NULL);
+    }
+
+    return 0;
+}
+
+// Places every source into its tile. Can be called on running pipeline, pad properties are applied by compositor to
+// the next output frame
+static void apply_video_mixer_layout(ApplicationContext* data) {
+    int i;
+
+    // Width and height of the pad make compositor scale the source directly while blending it into the output frame,
+    // so there is no separate scaler with its own intermediate frame per source
+    for (i = 0; i < data->source_count; ++i) {
+        g_object_set(data->video_mixer_sink_pad[i],
+                     "xpos",
+                     data->layout[i].x,
+                     "ypos",
+                     data->layout[i].y,
+                     "width",
+                     data->layout[i].width,
+                     "height",
+                     data->layout[i].height,
+                     "zorder",
+                     (guint)data->layout[i].zorder,
+                     NULL);
+
+        // Sources scaled right after decoder follow their tiles as well
+        if (data->video_scale_filter[i]) {
+            GstCaps* tile_caps = gst_caps_new_simple("video/x-raw",
+                                                     "width",
+                                                     G_TYPE_INT,
+                                                     data->layout[i].width,
+                                                     "height",
+                                                     G_TYPE_INT,
+                                                     data->layout[i].height,
+                                                     NULL);
+            g_object_set(data->video_scale_filter[i], "caps", tile_caps, NULL);
+            gst_caps_unref(tile_caps);
+        }
+    }
+}
+
+static gboolean hide_placeholder(gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    g_object_set(data->placeholder_video_pad, "alpha", 0.0, NULL);
+    g_print("All sources started %.2f s after start, placeholder is hidden\n",
+            (g_get_monotonic_time() - data->start_time) / (gdouble)G_USEC_PER_SEC);
+    discovery_cache_save(data->discovery_cache);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Buffer probe of the mixer pad of an initial source, removed after the first frame
+static GstPadProbeReturn source_started_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    if (g_atomic_int_dec_and_test(&data->sources_starting)) {
+        g_idle_add(hide_placeholder, data);
+    }
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+// Placeholder pads are requested before the pads of sources, so the slate stays under tiles with the same zorder
+static int link_placeholders(ApplicationContext* data) {
+    GstPad* video_pad;
+    GstPad* audio_pad;
+    int result = 0;
+
+    data->placeholder_video_pad = gst_element_get_request_pad(data->video_mixer, "sink_%u");
+    data->placeholder_audio_pad = gst_element_get_request_pad(data->audio_mixer, "sink_%u");
+    if (!data->placeholder_video_pad || !data->placeholder_audio_pad) {
+        g_printerr("Error: failed to get placeholder pads from mixers\n");
+        return 1;
+    }
+    g_object_set(data->placeholder_video_pad,
+                 "xpos",
+                 0,
+                 "ypos",
+                 0,
+                 "width",
+                 data->output_width,
+                 "height",
+                 data->output_height,
+                 "zorder",
+                 0u,
+                 NULL);
+
+    if (!gst_element_link(data->placeholder_video, data->placeholder_video_filter) ||
+        !gst_element_link(data->placeholder_audio, data->placeholder_audio_filter)) {
+        g_printerr("Error: placeholder elements could not be linked\n");
+        return 1;
+    }
+
+    video_pad = gst_element_get_static_pad(data->placeholder_video_filter, "src");
+    audio_pad = gst_element_get_static_pad(data->placeholder_audio_filter, "src");
+    if (gst_pad_link(video_pad, data->placeholder_video_pad) != GST_PAD_LINK_OK ||
+        gst_pad_link(audio_pad, data->placeholder_audio_pad) != GST_PAD_LINK_OK) {
+        g_printerr("Error: placeholders could not be linked with mixers\n");
+        result = 1;
+    }
+    gst_object_unref(video_pad);
+    gst_object_unref(audio_pad);
+
+    return result;
+}
+
+static int setup_video_mixer_layout(ApplicationContext* data) {
+    int i;
+
+    if (data->fast_start && link_placeholders(data) != 0) {
+        return 1;
+    }
+
+    for (i = 0; i < data->source_count; ++i) {
+        data->video_mixer_sink_pad[i] = gst_element_get_request_pad(data->video_mixer, "sink_%u");
+        if (!data->video_mixer_sink_pad[i]) {
+            g_printerr("Error: failed to get pad %i from video mixer\n", i);
+            return 1;
+        }
+        g_print("Requested pad from video mixer: %s\n", GST_PAD_NAME(data->video_mixer_sink_pad[i]));
+    }
+
+    // Sources removed before they have started keep the placeholder shown under the remaining tiles
+    if (data->fast_start) {
+        data->sources_starting = data->source_count;
+        for (i = 0; i < data->source_count; ++i) {
+            gst_pad_add_probe(
+                data->video_mixer_sink_pad[i], GST_PAD_PROBE_TYPE_BUFFER, source_started_probe, data, NULL);
+        }
+    }
+
+    // Area of tile mixer not covered by tiles is always black
+    if (!data->incremental_compositing) {
+        g_object_set(data->video_mixer, "background", 1, NULL); // black
+    }
+    apply_video_mixer_layout(data);
+
+    return 0;
+}
+
+static int parse_coordinate(const char* value, int* coordinate) {
+    gchar* end = NULL;
+    gint64 parsed = g_ascii_strtoll(value, &end, 10);
+
+    if (end == value || *end != '\0' || parsed < G_MININT || parsed > G_MAXINT) {
+        return 1;
+    }
+    *coordinate = (int)parsed;
+
+    return 0;
+}
+
+// Command waiting for its graphic to be rendered
+typedef struct _OverlayCommand {
+    OverlayLayer* layer;
+    ControlReply* reply;
+    gchar* error; // reply if the graphic can not be rendered
+} OverlayCommand;
+
+static void overlay_rendered_callback(GObject* source, GAsyncResult* result, gpointer user_data) {
+    OverlayCommand* command = user_data;
+
+    control_reply_send(command->reply, overlay_layer_set_finish(command->layer, result) == 0 ? "ok\n" : command->error);
+    g_free(command->error);
+    g_free(command);
+}
+
+// While streaming graphics are rendered in the background and the reply is sent once the new graphic is swapped in, the
+// mixer keeps drawing the previous ones meanwhile. Graphics given on command line are rendered before the start
+static gchar* run_overlay_command(ApplicationContext* data, gchar** args, gboolean render_async) {
+    guint count = g_strv_length(args);
+    const char* action = args[1];
+    GString* reply;
+    int x;
+    int y;
+
+    if (g_strcmp0(action, "list") == 0 && count == 2) {
+        reply = g_string_new(NULL);
+        overlay_layer_describe(data->overlay, reply);
+        g_string_append(reply, "ok\n");
+        return g_string_free(reply, FALSE);
+    }
+
+    if (g_strcmp0(action, "remove") == 0 && count == 3) {
+        if (overlay_layer_remove(data->overlay, args[2]) != 0) {
+            return g_strdup_printf("error: there is no graphic '%s'\n", args[2]);
+        }
+        return g_strdup("ok\n");
+    }
+
+    if ((g_strcmp0(action, "move") == 0 && count == 5) || (g_strcmp0(action, "image") == 0 && count == 6) ||
+        (g_strcmp0(action, "text") == 0 && (count == 6 || count == 7))) {
+        if (parse_coordinate(args[3], &x) != 0 || parse_coordinate(args[4], &y) != 0) {
+            return g_strdup_printf("error: invalid position '%s %s'\n", args[3], args[4]);
+        }
+        if (g_strcmp0(action, "move") == 0 && overlay_layer_move(data->overlay, args[2], x, y) != 0) {
+            return g_strdup_printf("error: there is no graphic '%s'\n", args[2]);
+        }
+        if (g_strcmp0(action, "move") != 0 && render_async) {
+            OverlayCommand* command = g_new0(OverlayCommand, 1);
+
+            command->layer = data->overlay;
+            command->reply = control_server_defer_reply(data->control);
+            if (g_strcmp0(action, "image") == 0) {
+                command->error = g_strdup_printf("error: image '%s' can not be rendered\n", args[5]);
+                overlay_layer_set_image_async(
+                    data->overlay, args[2], x, y, args[5], overlay_rendered_callback, command);
+            } else {
+                command->error = g_strdup("error: text can not be rendered\n");
+                overlay_layer_set_text_async(
+                    data->overlay, args[2], x, y, args[5], args[6], overlay_rendered_callback, command);
+            }
+            return NULL;
+        }
+        if (g_strcmp0(action, "image") == 0 && overlay_layer_set_image(data->overlay, args[2], x, y, args[5]) != 0) {
+            return g_strdup_printf("error: image '%s' can not be rendered\n", args[5]);
+        }
+        if (g_strcmp0(action, "text") == 0 &&
+            overlay_layer_set_text(data->overlay, args[2], x, y, args[5], args[6]) != 0) {
+            return g_strdup("error: text can not be rendered\n");
+        }
+        return g_strdup("ok\n");
+    }
+
+    return g_strdup("error: usage: overlay list | image NAME X Y PATH | text NAME X Y TEXT [FONT] | move NAME X Y | "
+                    "remove NAME\n");
+}
+
+static gchar* control_overlay(ApplicationContext* data, gchar** args) {
+    return run_overlay_command(data, args, TRUE);
+}
+
+// Tile mixer draws graphics into its kept frame, so they are redrawn only where something changed. Frames of
+// compositor are new every time, graphics are drawn into them right after the caps filter
+static int setup_overlay(ApplicationContext* data) {
+    GstPad* pad;
+    int i;
+
+    data->overlay = overlay_layer_new(data->output_format, data->output_width, data->output_height);
+    for (i = 0; data->overlays && data->overlays[i]; ++i) {
+        gchar* line = g_strconcat("overlay ", data->overlays[i], NULL);
+        gchar** args = NULL;
+        gchar* reply = NULL;
+        GError* error = NULL;
+        gboolean failed;
+
+        if (!g_shell_parse_argv(line, NULL, &args, &error)) {
+            g_printerr("Error: invalid overlay '%s': %s\n", data->overlays[i], error->message);
+            g_clear_error(&error);
+            failed = TRUE;
+        } else {
+            reply = run_overlay_command(data, args, FALSE);
+            failed = g_str_has_prefix(reply, "error: ");
+            if (failed) {
+                g_printerr("Error: invalid overlay '%s': %s", data->overlays[i], reply + strlen("error: "));
+            }
+        }
+        g_free(reply);
+        g_strfreev(args);
+        g_free(line);
+        if (failed) {
+            return 1;
+        }
+    }
+
+    if (data->incremental_compositing) {
+        g_object_set(data->video_mixer, "overlay", data->overlay, NULL);
+    } else {
+        pad = gst_element_get_static_pad(data->video_mixer_filter, "src");
+        overlay_layer_attach(data->overlay, pad);
+        gst_object_unref(pad);
+    }
+
+    return 0;
+}
+
+static int link_pipeline_elements(ApplicationContext* data) {
+    int result = 0;
+    int i;
+
+    GstPad* audio_tee_src_pad_1 = NULL;
+    GstPad* audio_tee_src_pad_2 = NULL;
+    GstPad* video_tee_src_pad_1 = NULL;
+    GstPad* video_tee_src_pad_2 = NULL;
+
+    GstPad* stream_audio_queue_snk_pad = NULL;
+    GstPad* device_audio_queue_snk_pad = NULL;
+    GstPad* stream_video_queue_snk_pad = NULL;
+    GstPad* device_video_queue_snk_pad = NULL;
+
+    GstCaps* video_mixer_caps;
+
+    if (!gst_element_link_many(data->audio_mixer, data->audio_convert, data->audio_resample, data->audio_tee, NULL)) {
+        g_printerr("Error: audio elements could not be linked\n");
+        result = 1;
+        goto exit;
+    }
+
+    // Output frame size, rate and format do not depend on sources and layout. Fixed format makes the compositor
+    // blend directly into the format encoders take, so there is no conversion between them
+    video_mixer_caps = gst_caps_new_simple("video/x-raw",
+                                           "format",
+                                           G_TYPE_STRING,
+                                           data->output_format,
+                                           "width",
+                                           G_TYPE_INT,
+                                           data->output_width,
+                                           "height",
+                                           G_TYPE_INT,
+                                           data->output_height,
+                                           "framerate",
+                                           GST_TYPE_FRACTION,
+                                           data->output_framerate,
+                                           1,
+                                           NULL);
+    g_object_set(data->video_mixer_filter, "caps", video_mixer_caps, NULL);
+    gst_caps_unref(video_mixer_caps);
+
+    if (!gst_element_link_many(data->video_mixer, data->video_mixer_filter, data->video_tee, NULL)) {
+        g_printerr("Error: mixer output elements could not be linked\n");
+        result = 1;
+        goto exit;
+    }
+
+    if (data->preview_mode != PREVIEW_OFF) {
+        audio_tee_src_pad_1 = gst_element_get_request_pad(data->audio_tee, "src_%u");
+        video_tee_src_pad_1 = gst_element_get_request_pad(data->video_tee, "src_%u");
+    }
+    if (data->streaming_enabled) {
+        audio_tee_src_pad_2 = gst_element_get_request_pad(data->audio_tee, "src_%u");
+    }
+    if (data->main_encoder_enabled) {
+        video_tee_src_pad_2 = gst_element_get_request_pad(data->video_tee, "src_%u");
+    }
+
+    if (data->preview_mode != PREVIEW_OFF) {
+        device_audio_queue_snk_pad = gst_element_get_static_pad(data->device_audio_queue, "sink");
+        device_video_queue_snk_pad = gst_element_get_static_pad(data->device_video_queue, "sink");
+    }
+    if (data->streaming_enabled) {
+        stream_audio_queue_snk_pad = gst_element_get_static_pad(data->stream_audio_queue, "sink");
+    }
+    if (data->main_encoder_enabled) {
+        stream_video_queue_snk_pad = gst_element_get_static_pad(data->stream_video_queue, "sink");
+    }
+
+    if (data->preview_mode != PREVIEW_OFF &&
+        (gst_pad_link(audio_tee_src_pad_1, device_audio_queue_snk_pad) != GST_PAD_LINK_OK ||
+         gst_pad_link(video_tee_src_pad_1, device_video_queue_snk_pad) != GST_PAD_LINK_OK)) {
+        g_printerr("Error: tee could not be linked with device sinks\n");
+        result = 1;
+        goto exit;
+    }
+
+    if (data->streaming_enabled) {
+        if (gst_pad_link(audio_tee_src_pad_2, stream_audio_queue_snk_pad) != GST_PAD_LINK_OK) {
+            g_printerr("Error: tee could not be linked with streaming sinks\n");
+            result = 1;
+            goto exit;
+        }
+
+        if (!gst_element_link_many(data->stream_audio_queue, data->voaacenc, data->encoded_audio_tee, NULL)) {
+            g_printerr("Error: audio encoding elements could not be linked\n");
+            result = 1;
+            goto exit;
+        }
+
+        // Rungs are scaled from the same composited frame and encoded in parallel, each in its own thread
+        for (i = 0; i < data->rung_count; ++i) {
+            if (ladder_rung_add_and_link(
+                    &data->rung[i], GST_BIN(data->pipeline), data->video_tee, data->encoded_audio_tee) != 0) {
+                result = 1;
+                goto exit;
+            }
+        }
+    }
+
+    if (data->main_encoder_enabled) {
+        if (gst_pad_link(video_tee_src_pad_2, stream_video_queue_snk_pad) != GST_PAD_LINK_OK) {
+            g_printerr("Error: tee could not be linked with streaming sinks\n");
+            result = 1;
+            goto exit;
+        }
+
+        if (!gst_element_link_many(data->stream_video_queue, data->x264enc, data->encoded_video_tee, NULL)) {
+            g_printerr("Error: video encoding elements could not be linked\n");
+            result = 1;
+            goto exit;
+        }
+
+        // Every output gets encoded data from the tees, so encoding is done only once for all of them
+        for (i = 0; i < data->output_count; ++i) {
+            if (output_branch_add_and_link(&data->output[i],
+                                           GST_BIN(data->pipeline),
+                                           data->encoded_video_tee,
+                                           data->encoded_audio_tee) != 0) {
+                result = 1;
+                goto exit;
+            }
+        }
+    }
+
+    if (data->preview_mode != PREVIEW_OFF &&
+        !gst_element_link_many(data->device_audio_queue, data->audio_device_sink, NULL)) {
+        g_printerr("Error: device audio elements could not be linked\n");
+        result = 1;
+        goto exit;
+    }
+
+    if ((data->preview_mode == PREVIEW_FULL &&
+         !gst_element_link_many(data->device_video_queue, data->video_device_sink, NULL)) ||
+        (data->preview_mode == PREVIEW_SCALED && !gst_element_link_many(data->device_video_queue,
+                                                                          data->preview_rate,
+                                                                          data->preview_scale,
+                                                                          data->preview_filter,
+                                                                          data->video_device_sink,
+                                                                          NULL))) {
+        g_printerr("Error: device video elements could not be linked\n");
+        result = 1;
+        goto exit;
+    }
+
+    // Connect to the pad-added signal, synthetic sources have static pads and are linked separately. Cached clips
+    // have static pads too, but they are linked by the main thread as all other sources
+    for (i = 0; i < data->source_count && !data->synthetic_sources; ++i) {
+        if (clip_cache_is_source(data->source[i])) {
+            source_set_watch(data->sources, data->source[i], FALSE, FALSE);
+        } else {
+            connect_source_signals(data, data->source[i], data->decode_downscale[i], data->loop[i]);
+        }
+    }
+
+exit:
+    // Clean resources
+    if (audio_tee_src_pad_1) {
+        gst_object_unref(audio_tee_src_pad_1);
     }
     if (audio_tee_src_pad_2) {
         gst_object_unref(audio_tee_src_pad_2);
     }
-    if (video_tee_src_pad_1) {
-        gst_object_unref(video_tee_src_pad_1);
+    if (video_tee_src_pad_1) {
+        gst_object_unref(video_tee_src_pad_1);
+    }
+    if (video_tee_src_pad_2) {
+        gst_object_unref(video_tee_src_pad_2);
+    }
+    if (stream_audio_queue_snk_pad) {
+        gst_object_unref(stream_audio_queue_snk_pad);
+    }
+    if (device_audio_queue_snk_pad) {
+        gst_object_unref(device_audio_queue_snk_pad);
+    }
+    if (stream_video_queue_snk_pad) {
+        gst_object_unref(stream_video_queue_snk_pad);
+    }
+    if (device_video_queue_snk_pad) {
+        gst_object_unref(device_video_queue_snk_pad);
+    }
+
+    return result;
+}
+
+// Requests audio mixer pad for the source once and applies volume and mute of the source to it. Returns new reference
+static GstPad* get_audio_mixer_pad(ApplicationContext* data, int index) {
+    if (!data->audio_mixer_sink_pad[index]) {
+        data->audio_mixer_sink_pad[index] = gst_element_get_request_pad(data->audio_mixer, "sink_%u");
+        if (!data->audio_mixer_sink_pad[index]) {
+            return NULL;
+        }
+        g_object_set(data->audio_mixer_sink_pad[index],
+                     "volume",
+                     data->audio_volume[index],
+                     "mute",
+                     data->audio_mute[index],
+                     NULL);
+    }
+
+    return gst_object_ref(data->audio_mixer_sink_pad[index]);
+}
+
+static int link_synthetic_sources(ApplicationContext* data) {
+    GstCaps* source_caps;
+    int result = 0;
+    int i;
+
+    source_caps = gst_caps_from_string(BENCH_SOURCE_CAPS);
+    if (!source_caps) {
+        g_printerr("Error: failed to create synthetic source caps\n");
+        return 1;
+    }
+
+    for (i = 0; i < data->source_count; ++i) {
+        GstPad* audio_sink_pad;
+        gboolean audio_linked;
+
+        if (!gst_element_link_pads_filtered(data->source[i],
+                                            "src",
+                                            data->video_mixer,
+                                            GST_PAD_NAME(data->video_mixer_sink_pad[i]),
+                                            source_caps)) {
+            g_printerr("Error: failed to link synthetic video source %i\n", i);
+            result = 1;
+            break;
+        }
+
+        // Silent synthetic sources are mixed too, so all of them run the same path
+        audio_sink_pad = get_audio_mixer_pad(data, i);
+        audio_linked = audio_sink_pad && gst_element_link_pads(data->test_audio_source[i],
+                                                               "src",
+                                                               data->audio_mixer,
+                                                               GST_PAD_NAME(audio_sink_pad));
+        if (audio_sink_pad) {
+            gst_object_unref(audio_sink_pad);
+        }
+        if (!audio_linked) {
+            g_printerr("Error: failed to link synthetic audio source %i\n", i);
+            result = 1;
+            break;
+        }
+    }
+
+    gst_caps_unref(source_caps);
+
+    return result;
+}
+
+static int setup_bench(ApplicationContext* data) {
+    char string_buf[255];
+    int i;
+
+    data->bench = bench_new();
+
+    if (bench_watch_throughput(data->bench, data->video_mixer, "src") != 0 ||
+        bench_add_branch(data->bench, "stream_video_encode", data->video_tee, "sink", data->x264enc, "src") != 0 ||
+        bench_add_branch(
+            data->bench, "stream_video_output", data->video_tee, "sink", data->output[0].sink, "sink") != 0 ||
+        bench_add_branch(data->bench, "stream_audio_encode", data->audio_tee, "sink", data->voaacenc, "src") != 0) {
+        return 1;
+    }
+
+    if (data->preview_mode != PREVIEW_OFF &&
+        (bench_add_branch(data->bench, "device_video", data->video_tee, "sink", data->video_device_sink, "sink") !=
+             0 ||
+         bench_add_branch(data->bench, "device_audio", data->audio_tee, "sink", data->audio_device_sink, "sink") !=
+             0)) {
+        return 1;
+    }
+
+    for (i = 0; i < data->rung_count; ++i) {
+        snprintf(string_buf, sizeof(string_buf), "ladder_%s_encode", data->rung[i].name);
+        if (bench_add_branch(data->bench, string_buf, data->video_tee, "sink", data->rung[i].encoder, "src") != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Leaky raw frame queues after the mixer share its pool, so each of them is limited to an equal part of frames which
+// encoders and sinks do not hold. Otherwise a stalled branch would use the pool up and block the mixer instead of
+// leaking. Returns 0 if the pool is deep enough for every queue to hold at least one frame
+static int limit_pooled_queues(ApplicationContext* data) {
+    GstElement* queues[MAX_LADDER_RUNGS + 2];
+    guint encoder_frames = encoder_profile_held_frames(data->encoder_profile, data->encoder_threads);
+    guint held = PRODUCER_HELD_FRAMES;
+    guint queue_count = 0;
+    guint queue_frames;
+    guint required;
+    guint i;
+
+    if (data->main_encoder_enabled) {
+        queues[queue_count++] = data->stream_video_queue;
+        held += encoder_frames;
+    }
+    // Scaled preview queue is already shorter, so it is counted as held
+    if (data->preview_mode == PREVIEW_FULL) {
+        queues[queue_count++] = data->device_video_queue;
+    } else if (data->preview_mode == PREVIEW_SCALED) {
+        held += PREVIEW_QUEUE_MAX_BUFFERS;
+    }
+    if (data->preview_mode != PREVIEW_OFF) {
+        held += CONSUMER_HELD_FRAMES;
+    }
+    for (i = 0; i < (guint)data->rung_count; ++i) {
+        queues[queue_count++] = data->rung[i].queue;
+        held += CONSUMER_HELD_FRAMES;
+    }
+
+    // Ladder scalers produce into pools of their own, which are held by rung encoders only
+    required = held + queue_count;
+    if (data->rung_count > 0) {
+        required = MAX(required, PRODUCER_HELD_FRAMES + encoder_frames);
+    }
+    if ((guint)data->frame_pool_depth < required) {
+        g_printerr("Error: frame pool depth should be at least %u, so encoders and sinks never use the pool up\n",
+                   required);
+        return 1;
+    }
+
+    queue_frames = ((guint)data->frame_pool_depth - held) / MAX(queue_count, 1);
+    for (i = 0; i < queue_count; ++i) {
+        g_object_set(queues[i],
+                     "max-size-buffers",
+                     queue_frames,
+                     "max-size-time",
+                     (guint64)0,
+                     "max-size-bytes",
+                     0,
+                     NULL);
+    }
+    g_print("Frame pools of %i frames, raw queues after the mixer hold up to %u of them\n",
+            data->frame_pool_depth,
+            queue_frames);
+
+    return 0;
+}
+
+// Frames leave the mixer and the ladder scalers through fixed pools, early scalers of sources are attached when they
+// are created
+static int setup_frame_pools(ApplicationContext* data) {
+    int i;
+
+    if (limit_pooled_queues(data) != 0) {
+        return 1;
+    }
+
+    data->frame_pools = frame_pools_new((guint)data->frame_pool_depth);
+
+    if (frame_pools_attach(data->frame_pools, data->video_mixer, "src") != 0) {
+        return 1;
+    }
+
+    for (i = 0; i < data->rung_count; ++i) {
+        if (frame_pools_attach(data->frame_pools, data->rung[i].scale, "src") != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Every element created in create_pipeline_elements is a direct child of the pipeline, decoders are created later
+// inside sources, so they are watched once created
+static int setup_metrics(ApplicationContext* data) {
+    GstIterator* iterator;
+    GValue item = G_VALUE_INIT;
+    int i;
+
+    data->metrics = metrics_new(data->metrics_interval, data->metrics_port);
+    if (!data->metrics) {
+        return 1;
+    }
+
+    iterator = gst_bin_iterate_elements(GST_BIN(data->pipeline));
+    while (gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        metrics_watch_element(data->metrics, g_value_get_object(&item));
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    // Cached clips are not decoded
+    for (i = 0; i < data->source_count && !data->synthetic_sources; ++i) {
+        if (!clip_cache_is_source(data->source[i])) {
+            metrics_watch_decoders(data->metrics, data->source[i]);
+        }
+    }
+
+    return 0;
+}
+
+// Encoding is the heavier half of the work, so half of the budget goes to encoders and half to decoders, each half
+// is split evenly. Every encoder and decoder gets at least one thread
+static void split_thread_budget(ApplicationContext* data) {
+    int encoder_count = (data->main_encoder_enabled ? 1 : 0) + data->rung_count;
+    int decoder_count = data->synthetic_sources ? 0 : data->source_count;
+    int encoder_budget = data->thread_budget - data->thread_budget / 2;
+    int decoder_budget = data->thread_budget / 2;
+
+    if (decoder_count == 0) {
+        encoder_budget = data->thread_budget;
+    }
+
+    data->encoder_threads = MAX(1, encoder_budget / MAX(1, encoder_count));
+    data->decoder_threads = MAX(1, decoder_budget / MAX(1, decoder_count));
+    g_print("CPU budget of %i threads: %i per video encoder, %i per video decoder\n",
+            data->thread_budget,
+            data->encoder_threads,
+            data->decoder_threads);
+}
+
+// Encoders and decoders of a pinned stage run as many threads as the stage has cores, split evenly between them. This
+// overrides the CPU budget for that stage
+static void match_stage_threads(ApplicationContext* data) {
+    int encoder_count = (data->main_encoder_enabled ? 1 : 0) + data->rung_count;
+    int decoder_count = data->synthetic_sources ? 0 : data->source_count;
+    int encode_cores = thread_placement_core_count(data->placement, THREAD_STAGE_ENCODE);
+    int decode_cores = thread_placement_core_count(data->placement, THREAD_STAGE_DECODE);
+
+    if (encode_cores > 0 && encoder_count > 0) {
+        data->encoder_threads = MAX(1, encode_cores / encoder_count);
+        g_print("Encode stage has %i cores: %i threads per video encoder\n", encode_cores, data->encoder_threads);
+    }
+    if (decode_cores > 0 && decoder_count > 0) {
+        data->decoder_threads = MAX(1, decode_cores / decoder_count);
+        g_print("Decode stage has %i cores: %i threads per video decoder\n", decode_cores, data->decoder_threads);
+    }
+}
+
+// Stages are marked on the elements which own streaming threads, elements inside sources get the mark of the source.
+// Encoders run in the threads of their queues
+static void place_pipeline_threads(ApplicationContext* data) {
+    int mix_cores = thread_placement_core_count(data->placement, THREAD_STAGE_MIX);
+    int i;
+
+    for (i = 0; i < data->source_count; ++i) {
+        thread_placement_set_stage(data->source[i], THREAD_STAGE_DECODE);
+        if (data->synthetic_sources) {
+            thread_placement_set_stage(data->test_audio_source[i], THREAD_STAGE_AUDIO);
+        }
+    }
+    thread_placement_set_stage(data->video_mixer, THREAD_STAGE_MIX);
+    thread_placement_set_stage(data->audio_mixer, THREAD_STAGE_AUDIO);
+    if (data->streaming_enabled) {
+        thread_placement_set_stage(data->stream_audio_queue, THREAD_STAGE_AUDIO);
+    }
+    if (data->main_encoder_enabled) {
+        thread_placement_set_stage(data->stream_video_queue, THREAD_STAGE_ENCODE);
+    }
+    for (i = 0; i < data->rung_count; ++i) {
+        thread_placement_set_stage(data->rung[i].queue, THREAD_STAGE_ENCODE);
+    }
+
+    // Compositor blends in parallel by default in as many threads as there are CPUs
+    if (mix_cores > 0 && g_object_class_find_property(G_OBJECT_GET_CLASS(data->video_mixer), "max-threads")) {
+        g_object_set(data->video_mixer, "max-threads", (guint)mix_cores, NULL);
+    }
+
+    thread_placement_attach(data->placement, data->pipeline);
+}
+
+static int create_pipeline(ApplicationContext* data) {
+    int i;
+
+    if (data->thread_budget > 0) {
+        split_thread_budget(data);
+    }
+    if (data->placement) {
+        match_stage_threads(data);
+    }
+
+    if (setup_layout(data) != 0) {
+        g_printerr("Error: failed to compute layout\n");
+        return 1;
+    }
+
+    if (create_pipeline_elements(data) != 0) {
+        g_printerr("Error: failed to create pipeline elements\n");
+        return 1;
+    }
+
+    if (add_elements_to_pipeline(data) != 0) {
+        g_printerr("Error: failed to add elements to pipeline\n");
+        return 1;
+    }
+
+    if (setup_video_mixer_layout(data) != 0) {
+        g_printerr("Error: failed to setup video mixer layout\n");
+        return 1;
+    }
+
+    data->sources = create_source_set(data);
+
+    if (link_pipeline_elements(data) != 0) {
+        g_printerr("Error: failed to link pipeline\n");
+        return 1;
+    }
+
+    if (data->synthetic_sources && link_synthetic_sources(data) != 0) {
+        g_printerr("Error: failed to link synthetic sources\n");
+        return 1;
+    }
+
+    if (setup_overlay(data) != 0) {
+        g_printerr("Error: failed to setup overlay\n");
+        return 1;
+    }
+
+    if (data->frame_pool_depth > 0 && setup_frame_pools(data) != 0) {
+        g_printerr("Error: failed to setup frame pools\n");
+        return 1;
+    }
+
+    if (data->bench_seconds > 0 && setup_bench(data) != 0) {
+        g_printerr("Error: failed to setup benchmark\n");
+        return 1;
+    }
+
+    if ((data->metrics_interval > 0 || data->metrics_port > 0) && setup_metrics(data) != 0) {
+        g_printerr("Error: failed to setup metrics\n");
+        return 1;
+    }
+
+    if (data->placement) {
+        place_pipeline_threads(data);
+    }
+
+    for (i = 0; data->rung_count > 0 && data->bench_seconds == 0 && data->ladder_outputs[i]; ++i) {
+        if (ladder_write_master_playlist(data->rung, data->rung_count, data->ladder_outputs[i], AUDIO_BITRATE) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#define CONTROL_HELP                                                                                     \
+    "layout NAME [W1,W2,...]  change sources layout, weights are used by weighted layout\n"              \
+    "source list              show sources with their indexes, tiles and audio\n"                        \
+    "source add PATH [MODE [AUDIO]]\n"                                                                   \
+    "                         add local file as a new source, MODE is decode downscale mode,\n"          \
+    "                         AUDIO is volume or mute (default), audio of muted source is not decoded\n" \
+    "source remove INDEX      remove source, layout is reflowed\n"                                       \
+    "source replace INDEX PATH [MODE [AUDIO]]\n"                                                         \
+    "                         replace source, new one is shown once it has prerolled\n"                  \
+    "audio INDEX VOLUME|mute|unmute\n"                                                                   \
+    "                         change volume of the source or mute it\n"                                  \
+    "overlay list             show graphics drawn over the video\n"                                      \
+    "overlay image NAME X Y PATH\n"                                                                      \
+    "overlay text NAME X Y TEXT [FONT]\n"                                                                \
+    "                         add or replace graphic rendered once from image file or text,\n"           \
+    "                         FONT is Pango font description, e.g. 'Sans Bold 24'\n"                     \
+    "overlay move NAME X Y    move graphic, it is not rendered again\n"                                  \
+    "overlay remove NAME      remove graphic\n"                                                          \
+    "bitrate [RUNG] KBPS      change bitrate of the main encoder or of the ladder rung\n"                \
+    "stats                    show pipeline latency, buffering levels and QoS of elements\n"             \
+    "help                     show this help\n"
+
+static gchar* control_layout(ApplicationContext* data, gchar** args) {
+    LayoutType old_type = data->layout_type;
+    gboolean old_weights_set = data->layout_weights_set;
+    double old_weights[MAX_SOURCES];
+    LayoutType type;
+
+    if (!args[1] || (args[2] && args[3])) {
+        return g_strdup("error: usage: layout NAME [W1,W2,...]\n");
+    }
+
+    if (layout_type_from_string(args[1], &type) != 0) {
+        return g_strdup_printf("error: unknown layout '%s'\n", args[1]);
+    }
+
+    if (args[2] && type != LAYOUT_WEIGHTED) {
+        return g_strdup("error: weights are used only by weighted layout\n");
+    }
+
+    memcpy(old_weights, data->layout_weights, sizeof(old_weights));
+    if (args[2] && parse_layout_weights(args[2], data->source_count, data->layout_weights) != 0) {
+        memcpy(data->layout_weights, old_weights, sizeof(old_weights));
+        return g_strdup("error: invalid layout weights\n");
+    }
+
+    g_mutex_lock(&data->source_lock);
+    data->layout_type = type;
+    data->layout_weights_set = args[2] != NULL;
+    if (setup_layout(data) != 0) {
+        data->layout_type = old_type;
+        data->layout_weights_set = old_weights_set;
+        memcpy(data->layout_weights, old_weights, sizeof(old_weights));
+        g_mutex_unlock(&data->source_lock);
+        return g_strdup("error: layout can not be computed\n");
+    }
+    g_mutex_unlock(&data->source_lock);
+
+    apply_video_mixer_layout(data);
+
+    return g_strdup("ok\n");
+}
+
+static int quality_bitrate_percent(ApplicationContext* data) {
+    const QualityLevel* level = g_atomic_pointer_get(&data->quality_level);
+
+    return level ? level->bitrate_percent : 100;
+}
+
+static gchar* control_bitrate(ApplicationContext* data, gchar** args) {
+    GstElement* encoder = data->x264enc;
+    LadderRung* rung = NULL;
+    const gchar* value = args[1];
+    GParamSpecUInt* spec;
+    gchar* end = NULL;
+    gint64 bitrate;
+    int i;
+
+    if (!args[1] || (args[2] && args[3])) {
+        return g_strdup("error: usage: bitrate [RUNG] KBPS\n");
+    }
+
+    if (args[2]) {
+        for (i = 0; i < data->rung_count && !rung; ++i) {
+            if (g_strcmp0(data->rung[i].name, args[1]) == 0) {
+                rung = &data->rung[i];
+            }
+        }
+        if (!rung) {
+            return g_strdup_printf("error: unknown ladder rung '%s'\n", args[1]);
+        }
+        encoder = rung->encoder;
+        value = args[2];
+    }
+
+    if (!encoder) {
+        return g_strdup("error: main encoder is not enabled\n");
+    }
+
+    spec = G_PARAM_SPEC_UINT(g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), "bitrate"));
+    bitrate = g_ascii_strtoll(value, &end, 10);
+    if (end == value || *end != '\0' || bitrate < spec->minimum || bitrate > spec->maximum) {
+        return g_strdup_printf("error: bitrate should be in range [%u, %u] kbit/s\n", spec->minimum, spec->maximum);
+    }
+
+    // Encoder is reconfigured in place, so its rate control state is kept and no keyframe is forced. Adaptive quality
+    // keeps scaling the new bitrate
+    if (rung) {
+        rung->bitrate = (int)bitrate;
+    } else {
+        data->video_bitrate = (int)bitrate;
+    }
+    g_object_set(encoder, "bitrate", (guint)(bitrate * quality_bitrate_percent(data) / 100), NULL);
+
+    return g_strdup("ok\n");
+}
+
+static gchar* control_stats(ApplicationContext* data) {
+    GString* reply = g_string_new(NULL);
+    GstQuery* query = gst_query_new_latency();
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    if (gst_element_query(data->pipeline, query)) {
+        gboolean live;
+        GstClockTime min_latency;
+        GstClockTime max_latency;
+
+        gst_query_parse_latency(query, &live, &min_latency, &max_latency);
+        g_string_append_printf(reply, "latency live=%s min_ms=%.1f", live ? "yes" : "no", min_latency / 1e6);
+        if (GST_CLOCK_TIME_IS_VALID(max_latency)) {
+            g_string_append_printf(reply, " max_ms=%.1f\n", max_latency / 1e6);
+        } else {
+            g_string_append(reply, " max_ms=none\n");
+        }
+    }
+    gst_query_unref(query);
+
+    g_hash_table_iter_init(&iter, data->buffering);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_string_append_printf(reply, "buffering element=%s percent=%i\n", (gchar*)key, GPOINTER_TO_INT(value));
+    }
+
+    g_hash_table_iter_init(&iter, data->qos);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        QosStats* stats = value;
+        g_string_append_printf(reply,
+                               "qos element=%s processed=%" G_GUINT64_FORMAT " dropped=%" G_GUINT64_FORMAT
+                               " jitter_ms=%.1f proportion=%.3f\n",
+                               (gchar*)key,
+                               stats->processed,
+                               stats->dropped,
+                               stats->jitter / 1e6,
+                               stats->proportion);
+    }
+
+    g_string_append(reply, "ok\n");
+
+    return g_string_free(reply, FALSE);
+}
+
+// Defined in the source management section below
+static gchar* control_source(ApplicationContext* data, gchar** args);
+static gchar* control_audio(ApplicationContext* data, gchar** args);
+
+// Control commands are handled in the main thread, see Control.h
+static gchar* handle_control_command(gchar** args, gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    if (g_strcmp0(args[0], "layout") == 0) {
+        return control_layout(data, args);
+    } else if (g_strcmp0(args[0], "bitrate") == 0) {
+        return control_bitrate(data, args);
+    } else if (g_strcmp0(args[0], "source") == 0) {
+        return control_source(data, args);
+    } else if (g_strcmp0(args[0], "audio") == 0) {
+        return control_audio(data, args);
+    } else if (g_strcmp0(args[0], "overlay") == 0) {
+        return control_overlay(data, args);
+    } else if (g_strcmp0(args[0], "stats") == 0) {
+        return control_stats(data);
+    } else if (g_strcmp0(args[0], "help") == 0) {
+        return g_strdup(CONTROL_HELP "ok\n");
+    }
+
+    return g_strdup_printf("error: unknown command '%s', send 'help' to list commands\n", args[0]);
+}
+
+static void store_qos_message(ApplicationContext* data, GstMessage* msg) {
+    QosStats* stats = g_hash_table_lookup(data->qos, GST_OBJECT_NAME(msg->src));
+    GstFormat format;
+
+    if (!stats) {
+        stats = g_new0(QosStats, 1);
+        g_hash_table_insert(data->qos, g_strdup(GST_OBJECT_NAME(msg->src)), stats);
+    }
+
+    gst_message_parse_qos_values(msg, &stats->jitter, &stats->proportion, NULL);
+    gst_message_parse_qos_stats(msg, &format, &stats->processed, &stats->dropped);
+}
+
+// Returns pixel format of negotiated raw video caps of 'pad', NULL if the pad carries something else or is not
+// negotiated yet. Returned string is interned, so it outlives the caps
+static const gchar* pad_video_format(GstPad* pad) {
+    GstCaps* caps = gst_pad_get_current_caps(pad);
+    const GstStructure* structure;
+    const gchar* format = NULL;
+
+    if (!caps) {
+        return NULL;
+    }
+
+    structure = gst_caps_get_structure(caps, 0);
+    if (gst_structure_has_name(structure, "video/x-raw")) {
+        format = g_intern_string(gst_structure_get_string(structure, "format"));
+    }
+    gst_caps_unref(caps);
+
+    return format;
+}
+
+// Reports every place where frames change pixel format: converters and scalers anywhere in the pipeline and mixer
+// pads, which convert frames inside the compositor. Output format is pinned from the compositor to the encoders, so
+// conversions are expected only on the source side
+static gboolean report_format_conversions(gpointer user_data) {
+    ApplicationContext* data = user_data;
+    GstIterator* iterator;
+    GValue item = G_VALUE_INIT;
+    const gchar* encoder_format;
+    GstPad* encoder_pad;
+    int conversions = 0;
+    int i;
+
+    data->conversion_report_source = 0;
+
+    g_print("Output video: %ix%i, %i fps, %s\n",
+            data->output_width,
+            data->output_height,
+            data->output_framerate,
+            data->output_format);
+
+    iterator = gst_bin_iterate_recurse(GST_BIN(data->pipeline));
+    while (gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        GstElement* element = g_value_get_object(&item);
+        GstPad* sink_pad = gst_element_get_static_pad(element, "sink");
+        GstPad* src_pad = gst_element_get_static_pad(element, "src");
+        const gchar* sink_format = sink_pad ? pad_video_format(sink_pad) : NULL;
+        const gchar* src_format = src_pad ? pad_video_format(src_pad) : NULL;
+
+        if (sink_format && src_format && sink_format != src_format) {
+            g_print("  conversion: %s -> %s in '%s'\n", sink_format, src_format, GST_ELEMENT_NAME(element));
+            ++conversions;
+        }
+
+        if (sink_pad) {
+            gst_object_unref(sink_pad);
+        }
+        if (src_pad) {
+            gst_object_unref(src_pad);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    for (i = 0; i < data->source_count; ++i) {
+        const gchar* format = data->video_mixer_sink_pad[i] ? pad_video_format(data->video_mixer_sink_pad[i]) : NULL;
+
+        if (format && g_strcmp0(format, data->output_format) != 0) {
+            g_print("  conversion: %s -> %s of source %i in compositor\n", format, data->output_format, i);
+            ++conversions;
+        }
+    }
+
+    if (data->x264enc) {
+        encoder_pad = gst_element_get_static_pad(data->x264enc, "sink");
+        encoder_format = pad_video_format(encoder_pad);
+        g_print("  encoder input: %s\n", encoder_format ? encoder_format : "not negotiated");
+        gst_object_unref(encoder_pad);
+    }
+    g_print("  %i conversion(s) found\n", conversions);
+
+    return G_SOURCE_REMOVE;
+}
+
+// In single channel mode the main loop is quit. In multi-channel mode only the pipeline of the channel is stopped,
+// others keep running, the main loop is quit when the last channel stops
+static void stop_channel(ApplicationContext* data) {
+    if (!data->channels) {
+        g_main_loop_quit(data->main_loop);
+        return;
+    }
+
+    if (data->stopped) {
+        return;
+    }
+
+    data->stopped = TRUE;
+    gst_element_set_state(data->pipeline, GST_STATE_NULL);
+    g_print("Channel '%s' is stopped\n", data->channel_name);
+    channels_stopped(data->channels);
+}
+
+static gboolean bus_message_handler(GstBus* bus, GstMessage* msg, ApplicationContext* data) {
+    GError* err;
+    gchar* debug_info;
+    gint percent;
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_ERROR:
+        gst_message_parse_error(msg, &err, &debug_info);
+        g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
+        g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
+        // Errors of sources added or swapped in at runtime take down only that source, the rest keeps streaming
+        if (!source_set_handle_error(data->sources, msg, err)) {
+            stop_channel(data);
+        }
+        g_clear_error(&err);
+        g_free(debug_info);
+        break;
+    case GST_MESSAGE_WARNING:
+        gst_message_parse_warning(msg, &err, &debug_info);
+        g_printerr("Warning received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
+        g_clear_error(&err);
+        g_free(debug_info);
+        break;
+    case GST_MESSAGE_EOS:
+        g_print("End-Of-Stream reached\n");
+        stop_channel(data);
+        break;
+    case GST_MESSAGE_STATE_CHANGED:
+        // We are only interested in state-changed messages from the pipeline
+        if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data->pipeline)) {
+            GstState old_state, new_state, pending_state;
+            gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
+            g_print("Pipeline state changed from %s to %s:\n",
+                    gst_element_state_get_name(old_state),
+                    gst_element_state_get_name(new_state));
+            if (new_state == GST_STATE_PLAYING && !data->conversion_report_source) {
+                data->conversion_report_source =
+                    g_timeout_add_seconds(CONVERSION_REPORT_DELAY, report_format_conversions, data);
+            }
+        }
+        break;
+    case GST_MESSAGE_QOS:
+        store_qos_message(data, msg);
+        if (data->quality) {
+            quality_controller_handle_qos(data->quality, msg);
+        }
+        break;
+    case GST_MESSAGE_BUFFERING:
+        // Outputs are live, so pipeline is not paused while a source is buffering, the level is only reported
+        gst_message_parse_buffering(msg, &percent);
+        g_hash_table_insert(data->buffering, g_strdup(GST_OBJECT_NAME(msg->src)), GINT_TO_POINTER(percent));
+        break;
+    case GST_MESSAGE_LATENCY:
+        // Latency of some element has changed, e.g. encoder was reconfigured
+        gst_bin_recalculate_latency(GST_BIN(data->pipeline));
+        break;
+    default:
+        // Other messages are not interesting
+        break;
+    }
+
+    return TRUE;
+}
+
+static gboolean bench_timeout_handler(gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    g_print("Benchmark time is over\n");
+    stop_channel(data);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean eos_timeout_handler(gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    g_printerr("Error: outputs were not finished in %i s, stopping anyway\n", EOS_TIMEOUT);
+    data->eos_timeout_source = 0;
+    stop_channel(data);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Stops the pipeline gracefully: end of stream is sent from every source, so muxers write their trailers and playlists
+// are closed, and the channel is stopped once EOS reaches its sinks (see bus_message_handler). Channel which does not
+// finish in time or is interrupted again is stopped right away
+static void interrupt_pipeline(ApplicationContext* data) {
+    if (data->stopped) {
+        return;
+    }
+    if (data->eos_timeout_source) {
+        stop_channel(data);
+        return;
+    }
+    data->eos_timeout_source = g_timeout_add_seconds(EOS_TIMEOUT, eos_timeout_handler, data);
+    gst_element_send_event(data->pipeline, gst_event_new_eos());
+}
+
+static gboolean interrupt_handler(gpointer user_data) {
+    g_print("Interrupted\n");
+    interrupt_pipeline(user_data);
+
+    return G_SOURCE_CONTINUE;
+}
+
+// Switches decoders of all sources to skip non-reference frames or to decode everything. Decoders which skip frames
+// because their stream has higher frame rate than the output are kept as they are
+static void set_quality_frame_skipping(ApplicationContext* data, gboolean skip_frames) {
+    static const char* const skip_nicks[] = {"nonref", "bidir", "1", NULL};
+    static const char* const decode_all_nicks[] = {"default", "0", NULL};
+    GValue item = G_VALUE_INIT;
+    GstIterator* iterator;
+    int i;
+
+    for (i = 0; i < data->source_count; ++i) {
+        if (!GST_IS_BIN(data->source[i])) {
+            continue;
+        }
+
+        iterator = gst_bin_iterate_recurse(GST_BIN(data->source[i]));
+        while (gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+            GObject* element = g_value_get_object(&item);
+            if (!g_object_get_data(element, "skip-frame-by-rate")) {
+                set_enum_property_by_nick(element, "skip-frame", skip_frames ? skip_nicks : decode_all_nicks);
+            }
+            g_value_reset(&item);
+        }
+        g_value_unset(&item);
+        gst_iterator_free(iterator);
+    }
+}
+
+static void apply_quality_level(ApplicationContext* data, const QualityLevel* level) {
+    const QualityLevel* previous = g_atomic_pointer_get(&data->quality_level);
+    gboolean previous_skip_frames = previous ? previous->skip_frames : FALSE;
+    int previous_framerate_divisor = previous ? previous->framerate_divisor : 1;
+    int i;
+
+    g_atomic_pointer_set(&data->quality_level, level);
+
+    g_object_set(data->x264enc, "bitrate", (guint)(data->video_bitrate * level->bitrate_percent / 100), NULL);
+    for (i = 0; i < data->rung_count; ++i) {
+        g_object_set(
+            data->rung[i].encoder, "bitrate", (guint)(data->rung[i].bitrate * level->bitrate_percent / 100), NULL);
+    }
+
+    if (previous_skip_frames != level->skip_frames) {
+        set_quality_frame_skipping(data, level->skip_frames);
+    }
+
+    // Frames are dropped by quality_rate_probe, see there
+    if (previous_framerate_divisor != level->framerate_divisor) {
+        data->keyframe_countdown = KEYFRAME_INTERVAL;
+    }
+}
+
+// Drops composited frames at reduced frame rate. Caps keep the configured frame rate, renegotiating them would
+// reinitialize encoders and change stream headers in the middle of live FLV and MPEG-TS streams; encoders follow
+// timestamps of the frames they get
+static GstPadProbeReturn quality_rate_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    ApplicationContext* data = user_data;
+    const QualityLevel* level = g_atomic_pointer_get(&data->quality_level);
+
+    if (!level || level->framerate_divisor == 1) {
+        data->quality_frame_count = 0;
+        return GST_PAD_PROBE_OK;
+    }
+
+    return data->quality_frame_count++ % (guint)level->framerate_divisor == 0 ? GST_PAD_PROBE_OK
+                                                                               : GST_PAD_PROBE_DROP;
+}
+
+static void force_keyframe(GstElement* encoder) {
+    gst_element_send_event(encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+static gboolean quality_update_handler(gpointer user_data) {
+    ApplicationContext* data = user_data;
+    const QualityLevel* level = quality_controller_update(data->quality);
+    int i;
+
+    if (level) {
+        apply_quality_level(data, level);
+    }
+
+    // Keyframe interval of encoders is set in frames, so at reduced frame rate it is kept in time by forcing them
+    level = data->quality_level;
+    if (level && level->framerate_divisor > 1 && --data->keyframe_countdown <= 0) {
+        force_keyframe(data->x264enc);
+        for (i = 0; i < data->rung_count; ++i) {
+            force_keyframe(data->rung[i].encoder);
+        }
+        data->keyframe_countdown = KEYFRAME_INTERVAL;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean thread_report_handler(gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    thread_placement_report(data->placement);
+
+    return G_SOURCE_CONTINUE;
+}
+
+// Time to the first frame is what viewers notice after a restart
+static GstPadProbeReturn first_frame_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    g_print("First frame composited %.2f s after start\n",
+            (g_get_monotonic_time() - data->start_time) / (gdouble)G_USEC_PER_SEC);
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+// Sets the pipeline playing and starts handling its messages and control commands in the main loop
+static int start_pipeline(ApplicationContext* data) {
+    GstStateChangeReturn ret;
+    GstPad* mixer_pad;
+    int i;
+
+    data->qos = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    data->buffering = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    if (data->control_port > 0) {
+        data->control = control_server_new(data->control_port, handle_control_command, data);
+        if (!data->control) {
+            return 1;
+        }
+    }
+
+    // Listen to the bus
+    data->bus = gst_element_get_bus(data->pipeline);
+    gst_bus_add_watch(data->bus, (GstBusFunc)bus_message_handler, data);
+
+    mixer_pad = gst_element_get_static_pad(data->video_mixer, "src");
+    gst_pad_add_probe(mixer_pad, GST_PAD_PROBE_TYPE_BUFFER, first_frame_probe, data, NULL);
+    gst_object_unref(mixer_pad);
+
+    // Start playing
+    data->start_time = g_get_monotonic_time();
+    ret = gst_element_set_state(data->pipeline, GST_STATE_PLAYING);
+    if (ret == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Error: unable to set the pipeline to the playing state\n");
+        return 1;
+    }
+
+    if (data->thread_report_interval > 0) {
+        data->thread_report_source =
+            g_timeout_add_seconds((guint)data->thread_report_interval, thread_report_handler, data);
+    }
+
+    // Benchmark is stopped by timeout, unless pipeline is finished earlier
+    if (data->bench_seconds > 0) {
+        data->bench_source = g_timeout_add((guint)data->bench_seconds * 1000, bench_timeout_handler, data);
+    }
+
+    if (data->adaptive_quality) {
+        data->quality = quality_controller_new(
+            data->stream_video_queue, data->stream_audio_queue, data->x264enc, data->output_framerate);
+        for (i = 0; i < data->output_count; ++i) {
+            quality_controller_watch_qos(data->quality, data->output[i].sink);
+        }
+        // Frames are dropped before graphics are drawn into them
+        mixer_pad = gst_element_get_static_pad(data->video_mixer, "src");
+        gst_pad_add_probe(mixer_pad, GST_PAD_PROBE_TYPE_BUFFER, quality_rate_probe, data, NULL);
+        gst_object_unref(mixer_pad);
+        data->quality_source = g_timeout_add_seconds(QUALITY_UPDATE_INTERVAL, quality_update_handler, data);
+    }
+
+    return 0;
+}
+
+static void report_pipeline(ApplicationContext* data) {
+    if (data->bench) {
+        // Runs of bench-profiles differ only in this line
+        g_print("Encoder profile %s, %i kbit/s, %i fps\n",
+                encoder_profile_to_string(data->encoder_profile),
+                data->video_bitrate,
+                data->output_framerate);
+        bench_report(data->bench);
+    }
+    if (data->frame_pools) {
+        frame_pools_report(data->frame_pools);
+    }
+    if (data->placement) {
+        thread_placement_report(data->placement);
+    }
+}
+
+// Removes everything start_pipeline has attached to the main loop
+static void finish_pipeline(ApplicationContext* data) {
+    if (data->bench_source) {
+        g_source_remove(data->bench_source);
+        data->bench_source = 0;
+    }
+    if (data->quality_source) {
+        g_source_remove(data->quality_source);
+        data->quality_source = 0;
+    }
+    if (data->thread_report_source) {
+        g_source_remove(data->thread_report_source);
+        data->thread_report_source = 0;
+    }
+    if (data->conversion_report_source) {
+        g_source_remove(data->conversion_report_source);
+        data->conversion_report_source = 0;
+    }
+    if (data->eos_timeout_source) {
+        g_source_remove(data->eos_timeout_source);
+        data->eos_timeout_source = 0;
+    }
+    if (data->bus) {
+        gst_bus_remove_watch(data->bus);
+        gst_object_unref(data->bus);
+        data->bus = NULL;
+    }
+}
+
+static int run_pipeline(ApplicationContext* data) {
+    guint interrupt_source;
+    guint terminate_source;
+    int result = 0;
+
+    data->main_loop = g_main_loop_new(NULL, FALSE);
+    interrupt_source = g_unix_signal_add(SIGINT, interrupt_handler, data);
+    terminate_source = g_unix_signal_add(SIGTERM, interrupt_handler, data);
+
+    if (start_pipeline(data) == 0) {
+        g_main_loop_run(data->main_loop);
+        report_pipeline(data);
+    } else {
+        result = 1;
+    }
+
+    finish_pipeline(data);
+    g_source_remove(terminate_source);
+    g_source_remove(interrupt_source);
+
+    return result;
+}
+
+static void free_channel(gpointer context) {
+    ApplicationContext* data = context;
+
+    finish_pipeline(data);
+    free_resources(data);
+    g_mutex_clear(&data->source_lock);
+    g_free(data);
+}
+
+static GstPadProbeReturn mixed_frames_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    g_atomic_int_inc(&data->mixed_frames);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static gpointer create_channel(Channels* channels, const gchar* name, int argc, gchar** argv, int thread_budget) {
+    ApplicationContext* data = g_new0(ApplicationContext, 1);
+    GstPad* mixer_pad;
+
+    data->channel_name = name;
+    data->channels = channels;
+    g_mutex_init(&data->source_lock);
+
+    if (parse_command_line(argc, argv, data) != 0 || data->channels_file) {
+        g_printerr("Error: invalid arguments of channel '%s'\n", name);
+        free_channel(data);
+        return NULL;
+    }
+
+    // Budget given in channel arguments is used as is
+    if (data->thread_budget == 0) {
+        data->thread_budget = thread_budget;
+    }
+
+    if (create_pipeline(data) != 0) {
+        g_printerr("Error: unable to setup pipeline of channel '%s'\n", name);
+        free_channel(data);
+        return NULL;
+    }
+
+    mixer_pad = gst_element_get_static_pad(data->video_mixer, "src");
+    gst_pad_add_probe(mixer_pad, GST_PAD_PROBE_TYPE_BUFFER, mixed_frames_probe, data, NULL);
+    gst_object_unref(mixer_pad);
+
+    return data;
+}
+
+static int start_channel(gpointer context, GMainLoop* main_loop) {
+    ApplicationContext* data = context;
+
+    data->main_loop = g_main_loop_ref(main_loop);
+
+    return start_pipeline(data);
+}
+
+static void interrupt_channel(gpointer context) {
+    interrupt_pipeline(context);
+}
+
+static void get_channel_stats(gpointer context, ChannelStats* stats) {
+    ApplicationContext* data = context;
+    GHashTableIter iter;
+    gpointer value;
+
+    stats->stopped = data->stopped;
+    stats->mixed_frames = g_atomic_int_get(&data->mixed_frames);
+    g_hash_table_iter_init(&iter, data->qos);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        stats->dropped_frames += ((QosStats*)value)->dropped;
+    }
+}
+
+static void report_channel(gpointer context) {
+    report_pipeline(context);
+}
+
+// Every channel gets its own context and pipeline, see Channels.h
+static int run_channels(const char* path, int cpu_budget) {
+    ChannelCallbacks callbacks = {0};
+
+    callbacks.create = create_channel;
+    callbacks.start = start_channel;
+    callbacks.interrupt = interrupt_channel;
+    callbacks.get_stats = get_channel_stats;
+    callbacks.report = report_channel;
+    callbacks.free = free_channel;
+
+    return channels_run(path, cpu_budget, &callbacks);
+}
+
+static void free_resources(ApplicationContext* data) {
+    int i;
+
+    if (data->pipeline) {
+        gst_element_set_state(data->pipeline, GST_STATE_NULL);
+        if (data->placeholder_video_pad) {
+            gst_element_release_request_pad(data->video_mixer, data->placeholder_video_pad);
+            gst_object_unref(data->placeholder_video_pad);
+        }
+        if (data->placeholder_audio_pad) {
+            gst_element_release_request_pad(data->audio_mixer, data->placeholder_audio_pad);
+            gst_object_unref(data->placeholder_audio_pad);
+        }
+        for (i = 0; i < data->source_count; ++i) {
+            if (data->video_mixer_sink_pad[i]) {
+                gst_element_release_request_pad(data->video_mixer, data->video_mixer_sink_pad[i]);
+                gst_object_unref(data->video_mixer_sink_pad[i]);
+            }
+            if (data->audio_mixer_sink_pad[i]) {
+                gst_element_release_request_pad(data->audio_mixer, data->audio_mixer_sink_pad[i]);
+                gst_object_unref(data->audio_mixer_sink_pad[i]);
+            }
+        }
+        gst_object_unref(data->pipeline);
     }
-    if (video_tee_src_pad_2) {
-        gst_object_unref(video_tee_src_pad_2);
+
+    source_set_free(data->sources);
+    clip_cache_free(data->clip_cache);
+    discovery_cache_save(data->discovery_cache);
+    discovery_cache_free(data->discovery_cache);
+    control_server_free(data->control);
+    if (data->main_loop) {
+        g_main_loop_unref(data->main_loop);
     }
-    if (stream_audio_queue_snk_pad) {
-        gst_object_unref(stream_audio_queue_snk_pad);
+    if (data->qos) {
+        g_hash_table_destroy(data->qos);
     }
-    if (device_audio_queue_snk_pad) {
-        gst_object_unref(device_audio_queue_snk_pad);
+    if (data->buffering) {
+        g_hash_table_destroy(data->buffering);
     }
-    if (stream_video_queue_snk_pad) {
-        gst_object_unref(stream_video_queue_snk_pad);
+
+    bench_free(data->bench);
+    metrics_free(data->metrics);
+    frame_pools_free(data->frame_pools);
+    quality_controller_free(data->quality);
+    thread_placement_free(data->placement);
+    overlay_layer_free(data->overlay);
+
+    for (i = 0; i < data->output_count; ++i) {
+        output_branch_clear(&data->output[i]);
+        g_free(data->output_locations[i]);
     }
-    if (device_video_queue_snk_pad) {
-        gst_object_unref(device_video_queue_snk_pad);
+
+    for (i = 0; i < data->rung_count; ++i) {
+        ladder_rung_clear(&data->rung[i]);
     }
+    g_strfreev(data->ladder_outputs);
+    g_strfreev(data->overlays);
+    g_free(data->channels_file);
+}
 
-    return result;
+// Decoded frames which are still bigger than the tile are scaled right after decoder, in the streaming thread of the
+// source, so the mixer thread receives and processes frames of the tile size only.
+// Returns pad where decoded video should be linked to
+static GstPad* create_early_video_scale(ApplicationContext* data, int index, const GstStructure* decoded_struct) {
+    const LayoutTile* tile = &data->layout[index];
+    GstCaps* tile_caps;
+    GstPad* filter_src_pad;
+    char string_buf[255];
+    int width = 0;
+    int height = 0;
+
+    gst_structure_get_int(decoded_struct, "width", &width);
+    gst_structure_get_int(decoded_struct, "height", &height);
+    if (width <= tile->width && height <= tile->height) {
+        g_print("Source %i is decoded at %ix%i, no scaling before mixer is required\n", index, width, height);
+        return gst_object_ref(data->video_mixer_sink_pad[index]);
+    }
+
+    g_print("Source %i is decoded at %ix%i, scaling it to %ix%i right after decoder\n",
+            index,
+            width,
+            height,
+            tile->width,
+            tile->height);
+
+    snprintf(string_buf, sizeof(string_buf), "video_scale_%i", data->source_id[index]);
+    data->video_scale[index] = gst_element_factory_make("videoscale", string_buf);
+    snprintf(string_buf, sizeof(string_buf), "video_scale_filter_%i", data->source_id[index]);
+    data->video_scale_filter[index] = gst_element_factory_make("capsfilter", string_buf);
+    if (!data->video_scale[index] || !data->video_scale_filter[index]) {
+        g_printerr("Error: failed to create early video scale for source %i\n", index);
+        return NULL;
+    }
+
+    tile_caps = gst_caps_new_simple(
+        "video/x-raw", "width", G_TYPE_INT, tile->width, "height", G_TYPE_INT, tile->height, NULL);
+    g_object_set(data->video_scale_filter[index], "caps", tile_caps, NULL);
+    gst_caps_unref(tile_caps);
+
+    gst_bin_add_many(GST_BIN(data->pipeline), data->video_scale[index], data->video_scale_filter[index], NULL);
+    if (data->metrics) {
+        metrics_watch_element(data->metrics, data->video_scale[index]);
+    }
+    if (data->frame_pools && frame_pools_attach(data->frame_pools, data->video_scale[index], "src") != 0) {
+        return NULL;
+    }
+
+    filter_src_pad = gst_element_get_static_pad(data->video_scale_filter[index], "src");
+    if (!gst_element_link(data->video_scale[index], data->video_scale_filter[index]) ||
+        gst_pad_link(filter_src_pad, data->video_mixer_sink_pad[index]) != GST_PAD_LINK_OK) {
+        g_printerr("Error: failed to link early video scale for source %i\n", index);
+        gst_object_unref(filter_src_pad);
+        return NULL;
+    }
+    gst_object_unref(filter_src_pad);
+
+    gst_element_sync_state_with_parent(data->video_scale_filter[index]);
+    gst_element_sync_state_with_parent(data->video_scale[index]);
+
+    return gst_element_get_static_pad(data->video_scale[index], "sink");
 }
 
-static int create_pipeline(ApplicationContext* data) {
-    if (create_pipeline_elements(data) != 0) {
-        g_printerr("Error: failed to create pipeline elements\n");
-        return 1;
+static GstClockTime get_running_time(ApplicationContext* data) {
+    GstClock* clock = gst_element_get_clock(data->pipeline);
+    GstClockTime now;
+
+    // Pipeline has no clock until it is started
+    if (!clock) {
+        return 0;
     }
 
-    if (add_elements_to_pipeline(data) != 0) {
-        g_printerr("Error: failed to add elements to pipeline\n");
+    now = gst_clock_get_time(clock) - gst_element_get_base_time(data->pipeline);
+    gst_object_unref(clock);
+
+    return now;
+}
+
+static int link_source_pad(ApplicationContext* data, int index, GstPad* pad, gboolean is_video) {
+    GstPad* sink_pad = NULL;
+    int result = 0;
+
+    if (is_video) {
+        if (data->decode_downscale[index]) {
+            GstCaps* caps = gst_pad_get_current_caps(pad);
+            sink_pad = create_early_video_scale(data, index, gst_caps_get_structure(caps, 0));
+            gst_caps_unref(caps);
+        } else {
+            sink_pad = gst_object_ref(data->video_mixer_sink_pad[index]);
+        }
+    } else {
+        sink_pad = get_audio_mixer_pad(data, index);
+    }
+
+    if (!sink_pad) {
+        g_printerr("Error: failed to get sink pad for source %i\n", index);
         return 1;
     }
 
-    if (setup_videomixer_layout(data) != 0) {
-        g_printerr("Error: failed to setup videomixer layout\n");
+    // All pads of the source share the same offset, so audio and video stay in sync
+    if (!GST_CLOCK_TIME_IS_VALID(data->source_offset[index])) {
+        data->source_offset[index] = get_running_time(data);
+        g_print("Source %i starts at running time %" GST_TIME_FORMAT "\n",
+                index,
+                GST_TIME_ARGS(data->source_offset[index]));
+    }
+    gst_pad_set_offset(pad, (gint64)data->source_offset[index]);
+
+    if (GST_PAD_LINK_FAILED(gst_pad_link(pad, sink_pad))) {
+        g_print("Pad '%s' of source %i could not be linked\n", GST_PAD_NAME(pad), index);
+        result = 1;
+    } else {
+        g_print("Link succeeded (pad '%s' of source %i)\n", GST_PAD_NAME(pad), index);
+    }
+
+    gst_object_unref(sink_pad);
+
+    return result;
+}
+
+// Stopped element of a source (the source itself or its early scaler) is forgotten by metrics and frame pools, so they
+// neither keep it and its decoders alive nor report them
+static void forget_source_element(ApplicationContext* data, GstElement* element) {
+    if (data->metrics) {
+        metrics_unwatch_element(data->metrics, element);
+    }
+    if (data->frame_pools) {
+        frame_pools_detach(data->frame_pools, element);
+    }
+}
+
+// Stops the source and removes it together with its own elements from the pipeline
+static void remove_source_elements(ApplicationContext* data, int index) {
+    gst_element_set_state(data->source[index], GST_STATE_NULL);
+    forget_source_element(data, data->source[index]);
+    gst_bin_remove(GST_BIN(data->pipeline), data->source[index]);
+
+    if (data->video_scale[index]) {
+        gst_element_set_state(data->video_scale[index], GST_STATE_NULL);
+        gst_element_set_state(data->video_scale_filter[index], GST_STATE_NULL);
+        forget_source_element(data, data->video_scale[index]);
+        gst_bin_remove_many(GST_BIN(data->pipeline), data->video_scale[index], data->video_scale_filter[index], NULL);
+    }
+
+    // Audio of the replacement gets its own pad, it may have no audio at all
+    if (data->audio_mixer_sink_pad[index]) {
+        gst_element_release_request_pad(data->audio_mixer, data->audio_mixer_sink_pad[index]);
+        gst_object_unref(data->audio_mixer_sink_pad[index]);
+        data->audio_mixer_sink_pad[index] = NULL;
+    }
+}
+
+// Number of sources has changed, so weights do not match them anymore. Must be called with source_lock held
+static void reflow_layout(ApplicationContext* data) {
+    if (data->layout_weights_set) {
+        g_print("Layout weights are reset, because number of sources has changed\n");
+        data->layout_weights_set = FALSE;
+    }
+
+    if (setup_layout(data) != 0) {
+        g_printerr("Error: failed to reflow layout\n");
+    }
+}
+
+static GstElement* get_source_handler(int index, gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    return index < data->source_count ? data->source[index] : NULL;
+}
+
+static void link_source_pad_handler(int index, GstPad* pad, gboolean is_video, gpointer user_data) {
+    link_source_pad(user_data, index, pad, is_video);
+}
+
+// Settings of a replacement, they are applied once it takes the place of the old source
+typedef struct _SourceSettings {
+    int id;
+    double audio_volume;
+    gboolean audio_mute;
+    gboolean decode_downscale;
+} SourceSettings;
+
+static void replace_source_handler(int index, GstElement* replacement, gpointer user_data) {
+    ApplicationContext* data = user_data;
+    SourceSettings* settings;
+    int i;
+
+    remove_source_elements(data, index);
+
+    if (replacement) {
+        settings = g_object_get_data(G_OBJECT(replacement), "source-settings");
+
+        g_mutex_lock(&data->source_lock);
+        data->source[index] = replacement;
+        data->audio_volume[index] = settings->audio_volume;
+        data->audio_mute[index] = settings->audio_mute;
+        data->audio_decoded[index] = !source_skips_audio(replacement);
+        data->source_id[index] = settings->id;
+        data->decode_downscale[index] = settings->decode_downscale;
+        data->video_scale[index] = NULL;
+        data->video_scale_filter[index] = NULL;
+        data->source_offset[index] = GST_CLOCK_TIME_NONE;
+        g_mutex_unlock(&data->source_lock);
+        return;
+    }
+
+    gst_element_release_request_pad(data->video_mixer, data->video_mixer_sink_pad[index]);
+    gst_object_unref(data->video_mixer_sink_pad[index]);
+
+    g_mutex_lock(&data->source_lock);
+    for (i = index; i < data->source_count - 1; ++i) {
+        data->source[i] = data->source[i + 1];
+        data->audio_mixer_sink_pad[i] = data->audio_mixer_sink_pad[i + 1];
+        data->audio_volume[i] = data->audio_volume[i + 1];
+        data->audio_mute[i] = data->audio_mute[i + 1];
+        data->audio_decoded[i] = data->audio_decoded[i + 1];
+        data->source_id[i] = data->source_id[i + 1];
+        data->decode_downscale[i] = data->decode_downscale[i + 1];
+        data->video_scale[i] = data->video_scale[i + 1];
+        data->video_scale_filter[i] = data->video_scale_filter[i + 1];
+        data->video_mixer_sink_pad[i] = data->video_mixer_sink_pad[i + 1];
+        data->source_offset[i] = data->source_offset[i + 1];
+    }
+    --data->source_count;
+    data->video_mixer_sink_pad[data->source_count] = NULL;
+    data->audio_mixer_sink_pad[data->source_count] = NULL;
+    reflow_layout(data);
+    g_mutex_unlock(&data->source_lock);
+
+    apply_video_mixer_layout(data);
+}
+
+static void discard_source_handler(GstElement* source, gpointer user_data) {
+    ApplicationContext* data = user_data;
+
+    gst_element_set_state(source, GST_STATE_NULL);
+    forget_source_element(data, source);
+    gst_bin_remove(GST_BIN(data->pipeline), source);
+}
+
+static SourceSet* create_source_set(ApplicationContext* data) {
+    SourceSetCallbacks callbacks = {0};
+
+    callbacks.get_source = get_source_handler;
+    callbacks.link_pad = link_source_pad_handler;
+    callbacks.replace_source = replace_source_handler;
+    callbacks.discard_source = discard_source_handler;
+
+    return source_set_new(data->pipeline, &data->source_lock, MAIN_AUDIO_SOURCE_INDEX, &callbacks, data);
+}
+
+// Adds source to the running pipeline, its pads are linked once it has prerolled
+static void start_source(ApplicationContext* data, GstElement* source, gboolean decode_downscale) {
+    gboolean cached = clip_cache_is_source(source);
+
+    if (data->placement) {
+        thread_placement_set_stage(source, THREAD_STAGE_DECODE);
+    }
+    if (cached) {
+        source_set_watch(data->sources, source, FALSE, FALSE);
+    } else {
+        connect_source_signals(data, source, decode_downscale, data->loop_runtime_sources);
+    }
+    if (data->metrics) {
+        metrics_watch_element(data->metrics, source);
+        if (!cached) {
+            metrics_watch_decoders(data->metrics, source);
+        }
+    }
+
+    source_set_start(data->sources, source);
+}
+
+// Creates uridecodebin for a local file. Looping clips which audio is not decoded are played from clip cache scaled to
+// 'tile' if possible
+static int create_source_elements(ApplicationContext* data,
+                                  const char* path,
+                                  gboolean decode_audio,
+                                  const LayoutTile* tile,
+                                  GstElement** source,
+                                  int* source_id) {
+    char string_buf[255];
+    gchar* uri = make_source_uri(path);
+    int id = data->next_source_id;
+
+    *source = NULL;
+    if (!uri) {
         return 1;
     }
 
-    if (link_pipeline_elements(data) != 0) {
-        g_printerr("Error: failed to link pipeline\n");
+    snprintf(string_buf, sizeof(string_buf), "source_%i", id);
+    if (data->clip_cache && data->loop_runtime_sources && !decode_audio) {
+        // Main loop must not wait for decoding, the clip is played from cache by the sources created after it is done
+        *source = clip_cache_create_source(data->clip_cache, uri, string_buf, tile->width, tile->height, FALSE);
+    }
+    if (!*source) {
+        *source = gst_element_factory_make("uridecodebin", string_buf);
+    }
+
+    if (!*source) {
+        g_printerr("Error: failed to create source '%s'\n", path);
+        g_free(uri);
         return 1;
     }
 
+    if (!clip_cache_is_source(*source)) {
+        g_object_set(*source, "uri", uri, NULL);
+    }
+    if (!decode_audio) {
+        g_object_set_data(G_OBJECT(*source), "skip-audio", GINT_TO_POINTER(TRUE));
+    }
+    g_free(uri);
+    *source_id = id;
+    ++data->next_source_id;
+
     return 0;
 }
 
-static int run_pipeline(ApplicationContext* data) {
-    GstBus* bus;
-    GstMessage* msg;
-    GstStateChangeReturn ret;
-    gboolean terminate = FALSE;
+static int parse_source_index(ApplicationContext* data, const char* value) {
+    gchar* end = NULL;
+    gint64 index = g_ascii_strtoll(value, &end, 10);
 
-    // Start playing
-    ret = gst_element_set_state(data->pipeline, GST_STATE_PLAYING);
-    if (ret == GST_STATE_CHANGE_FAILURE) {
-        g_printerr("Error: unable to set the pipeline to the playing state\n");
+    if (end == value || *end != '\0' || index < 0 || index >= data->source_count) {
+        return -1;
+    }
+
+    return (int)index;
+}
+
+static int parse_source_mode(const char* mode, gboolean* decode_downscale) {
+    if (!mode || g_strcmp0(mode, "off") == 0) {
+        *decode_downscale = FALSE;
+    } else if (g_strcmp0(mode, "auto") == 0) {
+        *decode_downscale = TRUE;
+    } else {
         return 1;
     }
 
-    // Listen to the bus
-    bus = gst_element_get_bus(data->pipeline);
-    do {
-        msg = gst_bus_timed_pop_filtered(
-            bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
-
-        // Parse message
-        if (msg != NULL) {
-            GError* err;
-            gchar* debug_info;
-
-            switch (GST_MESSAGE_TYPE(msg)) {
-            case GST_MESSAGE_ERROR:
-                gst_message_parse_error(msg, &err, &debug_info);
-                g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
-                g_printerr("Debugging information: %s\n", debug_info ? debug_info : "none");
-                g_clear_error(&err);
-                g_free(debug_info);
-                terminate = TRUE;
-                break;
-            case GST_MESSAGE_EOS:
-                g_print("End-Of-Stream reached\n");
-                terminate = TRUE;
-                break;
-            case GST_MESSAGE_STATE_CHANGED:
-                // We are only interested in state-changed messages from the pipeline
-                if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data->pipeline)) {
-                    GstState old_state, new_state, pending_state;
-                    gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
-                    g_print("Pipeline state changed from %s to %s:\n",
-                            gst_element_state_get_name(old_state),
-                            gst_element_state_get_name(new_state));
-                }
-                break;
-            default:
-                // We should not reach here
-                g_printerr("Error: unexpected message received\n");
-                break;
-            }
-            gst_message_unref(msg);
+    return 0;
+}
+
+static gchar* control_source_list(ApplicationContext* data) {
+    GString* reply = g_string_new(NULL);
+    int i;
+
+    for (i = 0; i < data->source_count; ++i) {
+        gchar* uri = NULL;
+
+        // Sources playing cached clips have no URI
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(data->source[i]), "uri")) {
+            g_object_get(data->source[i], "uri", &uri, NULL);
         }
-    } while (!terminate);
+        g_string_append_printf(reply,
+                               "source index=%i element=%s tile=%ix%i+%i+%i audio=%s volume=%.2f uri=%s\n",
+                               i,
+                               GST_ELEMENT_NAME(data->source[i]),
+                               data->layout[i].width,
+                               data->layout[i].height,
+                               data->layout[i].x,
+                               data->layout[i].y,
+                               !data->audio_decoded[i] ? "off" : data->audio_mute[i] ? "muted" : "on",
+                               data->audio_volume[i],
+                               uri ? uri : "cached");
+        g_free(uri);
+    }
 
-    gst_object_unref(bus);
+    g_string_append(reply, "ok\n");
 
-    return 0;
+    return g_string_free(reply, FALSE);
 }
 
-static void free_resources(ApplicationContext* data) {
-    if (data->pipeline) {
-        gst_element_set_state(data->pipeline, GST_STATE_NULL);
-        gst_object_unref(data->pipeline);
+static gchar* control_source_add(ApplicationContext* data,
+                                 const char* path,
+                                 const char* mode,
+                                 const char* audio_mode) {
+    int index = data->source_count;
+    gboolean decode_downscale;
+    double audio_volume;
+    gboolean audio_mute;
+    GstElement* source;
+    GstPad* mixer_pad;
+    int source_id;
+    LayoutTile layout[MAX_SOURCES];
+
+    if (index >= MAX_SOURCES) {
+        return g_strdup_printf("error: too many sources, max is %i\n", MAX_SOURCES);
     }
+
+    if (parse_source_mode(mode, &decode_downscale) != 0) {
+        return g_strdup_printf("error: invalid decode downscale mode '%s'\n", mode);
+    }
+
+    if (parse_audio_mode(audio_mode, &audio_volume, &audio_mute) != 0) {
+        return g_strdup_printf("error: invalid audio mode '%s'\n", audio_mode);
+    }
+
+    // Tile of the new source in the layout it is going to be reflowed to, weights are reset by reflow
+    if (layout_compute(data->layout_type, index + 1, NULL, data->output_width, data->output_height, layout) != 0) {
+        return g_strdup_printf("error: unable to compute layout for %i sources\n", index + 1);
+    }
+
+    if (create_source_elements(data, path, !audio_mute, &layout[index], &source, &source_id) != 0) {
+        return g_strdup_printf("error: source '%s' can not be created\n", path);
+    }
+    if (clip_cache_is_source(source)) {
+        decode_downscale = FALSE;
+    }
+
+    mixer_pad = gst_element_get_request_pad(data->video_mixer, "sink_%u");
+    if (!mixer_pad) {
+        gst_object_unref(source);
+        return g_strdup("error: failed to get pad from video mixer\n");
+    }
+
+    g_mutex_lock(&data->source_lock);
+    data->source[index] = source;
+    data->audio_mixer_sink_pad[index] = NULL;
+    data->audio_volume[index] = audio_volume;
+    data->audio_mute[index] = audio_mute;
+    data->audio_decoded[index] = !audio_mute;
+    data->source_id[index] = source_id;
+    data->decode_downscale[index] = decode_downscale;
+    data->video_scale[index] = NULL;
+    data->video_scale_filter[index] = NULL;
+    data->video_mixer_sink_pad[index] = mixer_pad;
+    data->source_offset[index] = GST_CLOCK_TIME_NONE;
+    ++data->source_count;
+    reflow_layout(data);
+    g_mutex_unlock(&data->source_lock);
+
+    apply_video_mixer_layout(data);
+    start_source(data, source, decode_downscale);
+
+    return g_strdup_printf("source index=%i element=%s\nok\n", index, GST_ELEMENT_NAME(source));
 }
 
-// This function will be called by the pad-added signal
-static void pad_added_handler(GstElement* src, GstPad* new_pad, ApplicationContext* data) {
-    GstPad* sink_pad = NULL;
-    GstPadLinkReturn ret;
-    GstCaps* new_pad_caps = NULL;
-    GstStructure* new_pad_struct = NULL;
-    const gchar* new_pad_type = NULL;
+static gchar* control_source_remove(ApplicationContext* data, int index) {
+    if (index == MAIN_AUDIO_SOURCE_INDEX) {
+        return g_strdup_printf("error: source %i is the main audio source, it can be replaced, but not removed\n",
+                               index);
+    }
+
+    source_set_remove(data->sources, index);
+
+    return g_strdup("ok\n");
+}
+
+static gchar* control_source_replace(ApplicationContext* data,
+                                     int index,
+                                     const char* path,
+                                     const char* mode,
+                                     const char* audio_mode) {
+    SourceSettings* settings;
+    gboolean decode_downscale;
+    double audio_volume;
+    gboolean audio_mute;
+    GstElement* source;
+    int source_id;
+
+    if (parse_source_mode(mode, &decode_downscale) != 0) {
+        return g_strdup_printf("error: invalid decode downscale mode '%s'\n", mode);
+    }
+
+    if (parse_audio_mode(audio_mode, &audio_volume, &audio_mute) != 0) {
+        return g_strdup_printf("error: invalid audio mode '%s'\n", audio_mode);
+    }
+
+    if (create_source_elements(data,
+                               path,
+                               !audio_mute || index == MAIN_AUDIO_SOURCE_INDEX,
+                               &data->layout[index],
+                               &source,
+                               &source_id) != 0) {
+        return g_strdup_printf("error: source '%s' can not be created\n", path);
+    }
+    if (clip_cache_is_source(source)) {
+        decode_downscale = FALSE;
+    }
+
+    settings = g_new0(SourceSettings, 1);
+    settings->id = source_id;
+    settings->audio_volume = audio_volume;
+    settings->audio_mute = audio_mute;
+    settings->decode_downscale = decode_downscale;
+    g_object_set_data_full(G_OBJECT(source), "source-settings", settings, g_free);
+
+    // Old source keeps playing until the new one has prerolled. The reply is sent once the change is finished or
+    // aborted
+    source_set_replace(data->sources, index, source, control_server_defer_reply(data->control));
+    start_source(data, source, decode_downscale);
+
+    return NULL;
+}
+
+// Sources are changed one at a time, the change is finished asynchronously in the main thread
+static gchar* control_source(ApplicationContext* data, gchar** args) {
+    int index;
+
+    if (data->synthetic_sources) {
+        return g_strdup("error: synthetic sources can not be changed\n");
+    }
+
+    if (g_strcmp0(args[1], "list") == 0 && !args[2]) {
+        return control_source_list(data);
+    }
+
+    if (source_set_is_changing(data->sources)) {
+        return g_strdup("error: previous source change is not finished yet\n");
+    }
+
+    if (g_strcmp0(args[1], "add") == 0 && args[2] && (!args[3] || !args[4] || !args[5])) {
+        return control_source_add(data, args[2], args[3], args[3] ? args[4] : NULL);
+    }
+
+    if (g_strcmp0(args[1], "remove") == 0 && args[2] && !args[3]) {
+        index = parse_source_index(data, args[2]);
+        return index < 0 ? g_strdup_printf("error: invalid source index '%s'\n", args[2])
+                         : control_source_remove(data, index);
+    }
+
+    if (g_strcmp0(args[1], "replace") == 0 && args[2] && args[3] && (!args[4] || !args[5] || !args[6])) {
+        index = parse_source_index(data, args[2]);
+        return index < 0 ? g_strdup_printf("error: invalid source index '%s'\n", args[2])
+                         : control_source_replace(data, index, args[3], args[4], args[4] ? args[5] : NULL);
+    }
+
+    return g_strdup("error: usage: source list | add PATH [MODE [AUDIO]] | remove INDEX | "
+                    "replace INDEX PATH [MODE [AUDIO]]\n");
+}
+
+// Volume and mute are changed on the mixer pad, so decoded audio of the source is not interrupted
+static gchar* control_audio(ApplicationContext* data, gchar** args) {
+    int index;
+    double volume = 0.0;
+    gboolean unmute;
+    gboolean mute;
+
+    if (!args[1] || !args[2] || args[3]) {
+        return g_strdup("error: usage: audio INDEX VOLUME|mute|unmute\n");
+    }
+    unmute = g_strcmp0(args[2], "unmute") == 0;
+    mute = g_strcmp0(args[2], "mute") == 0;
+
+    index = parse_source_index(data, args[1]);
+    if (index < 0) {
+        return g_strdup_printf("error: invalid source index '%s'\n", args[1]);
+    }
+
+    if (!mute && !unmute && parse_audio_mode(args[2], &volume, &mute) != 0) {
+        return g_strdup_printf("error: invalid volume '%s', expected value in range [0, %g]\n",
+                               args[2],
+                               MAX_AUDIO_VOLUME);
+    }
+
+    if (!mute && !data->audio_decoded[index]) {
+        return g_strdup_printf("error: audio of source %i is not decoded, replace the source to hear it\n", index);
+    }
+
+    data->audio_mute[index] = mute;
+    if (!mute && !unmute) {
+        data->audio_volume[index] = volume;
+    }
+    if (data->audio_mixer_sink_pad[index]) {
+        g_object_set(data->audio_mixer_sink_pad[index],
+                     "volume",
+                     data->audio_volume[index],
+                     "mute",
+                     data->audio_mute[index],
+                     NULL);
+    }
+
+    return g_strdup_printf("audio index=%i volume=%.2f mute=%s\nok\n",
+                           index,
+                           data->audio_volume[index],
+                           data->audio_mute[index] ? "yes" : "no");
+}
+
+// Sets enum property to the first value with matching nick. Nicks of decoder enums differ between plugin versions
+static gboolean set_enum_property_by_nick(GObject* object, const char* property, const char* const* nicks) {
+    GParamSpec* spec = g_object_class_find_property(G_OBJECT_GET_CLASS(object), property);
     int i;
 
-    g_print("Received new pad '%s' from '%s':\n", GST_PAD_NAME(new_pad), GST_ELEMENT_NAME(src));
-
-    // Check the new pad's type
-    new_pad_caps = gst_pad_get_current_caps(new_pad);
-    new_pad_struct = gst_caps_get_structure(new_pad_caps, 0);
-    new_pad_type = gst_structure_get_name(new_pad_struct);
-    if (g_str_has_prefix(new_pad_type, "audio/x-raw")) {
-        // This is linear search but in case of small number of streams impact is not noticeable.
-        // Need to search a source because we cannot imply the order in which this callback is called.
-        for (i = 0; i < MAX_SOURCES; ++i) {
-            if (data->source[i] == src) {
-                if (i == AUDIO_FROM_SOURCE_INDEX) {
-                    sink_pad = gst_element_get_static_pad(data->audio_convert, "sink");
-                } else {
-                    sink_pad = gst_element_get_static_pad(data->audio_sink[i], "sink");
-                }
-                break;
-            }
+    if (!spec || !G_IS_PARAM_SPEC_ENUM(spec)) {
+        return FALSE;
+    }
+
+    for (i = 0; nicks[i]; ++i) {
+        GEnumValue* value = g_enum_get_value_by_nick(G_PARAM_SPEC_ENUM(spec)->enum_class, nicks[i]);
+        if (value) {
+            g_object_set(object, property, value->value, NULL);
+            return TRUE;
         }
-    } else if (g_str_has_prefix(new_pad_type, "video/x-raw")) {
-        // Read comment above about this search approach
-        for (i = 0; i < MAX_SOURCES; ++i) {
-            if (data->source[i] == src) {
-                sink_pad = gst_element_get_static_pad(data->video_scale[i], "sink");
-                break;
-            }
+    }
+
+    return FALSE;
+}
+
+// Index of the source is looked up on every use, because indexes shift when sources are removed
+typedef struct _DecoderProbeContext {
+    ApplicationContext* data;
+    GstElement* source;
+} DecoderProbeContext;
+
+// Configures decoder from the stream caps, before decoder itself handles them and opens the codec
+static GstPadProbeReturn decoder_caps_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    static const char* const non_reference_nicks[] = {"nonref", "bidir", "1", NULL};
+    DecoderProbeContext* context = user_data;
+    LayoutTile tile;
+    int source_index;
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+    GstElement* decoder;
+    GstCaps* caps;
+    const GstStructure* structure;
+    int width = 0;
+    int height = 0;
+    int framerate_num = 0;
+    int framerate_den = 1;
+    int lowres = 0;
+
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    g_mutex_lock(&context->data->source_lock);
+    source_index = source_set_find(context->data->sources, context->source);
+    if (source_index >= 0) {
+        tile = context->data->layout[source_index];
+    }
+    g_mutex_unlock(&context->data->source_lock);
+    if (source_index < 0) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    gst_event_parse_caps(event, &caps);
+    structure = gst_caps_get_structure(caps, 0);
+    decoder = gst_pad_get_parent_element(pad);
+    if (!decoder) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Each lowres step halves both dimensions, it is used only while the result still covers the whole tile
+    if (gst_structure_get_int(structure, "width", &width) && gst_structure_get_int(structure, "height", &height) &&
+        g_object_class_find_property(G_OBJECT_GET_CLASS(decoder), "lowres")) {
+        while (lowres < 2 && (width >> (lowres + 1)) >= tile.width && (height >> (lowres + 1)) >= tile.height) {
+            ++lowres;
         }
+        g_object_set(decoder, "lowres", lowres, NULL);
+        g_print("Decoder '%s' of source %i: %ix%i stream, lowres level %i\n",
+                GST_ELEMENT_NAME(decoder),
+                source_index,
+                width,
+                height,
+                lowres);
     }
 
-    if (!sink_pad) {
-        g_printerr("Error: failed to get sink pad in pad_added_handler\n");
-        goto exit;
+    // Frames above output frame rate would be dropped by mixer anyway, so non-reference ones are not decoded at all
+    if (gst_structure_get_fraction(structure, "framerate", &framerate_num, &framerate_den) && framerate_den > 0 &&
+        (gint64)framerate_num > (gint64)context->data->output_framerate * framerate_den &&
+        set_enum_property_by_nick(G_OBJECT(decoder), "skip-frame", non_reference_nicks)) {
+        // Adaptive quality must not restore decoding of these frames
+        g_object_set_data(G_OBJECT(decoder), "skip-frame-by-rate", GINT_TO_POINTER(TRUE));
+        g_print("Decoder '%s' of source %i: %i/%i fps stream, non-reference frames are skipped\n",
+                GST_ELEMENT_NAME(decoder),
+                source_index,
+                framerate_num,
+                framerate_den);
     }
 
-    ret = gst_pad_link(new_pad, sink_pad);
-    if (GST_PAD_LINK_FAILED(ret)) {
-        g_print("Type is '%s' but link failed\n", new_pad_type);
-    } else {
-        g_print("Link succeeded (type '%s')\n", new_pad_type);
+    gst_object_unref(decoder);
+
+    return GST_PAD_PROBE_OK;
+}
+
+// This function will be called by the deep-element-added signal of sources when decoder threads are limited by the
+// CPU budget of the channel
+static void decoder_threads_handler(GstBin* bin, GstBin* sub_bin, GstElement* element, ApplicationContext* data) {
+    static const char* const thread_properties[] = {"max-threads", "threads", "n-threads", NULL};
+    GstElementFactory* factory = gst_element_get_factory(element);
+    const gchar* klass;
+    int i;
+
+    if (!factory) {
+        return;
     }
 
-exit:
-    if (sink_pad) {
-        gst_object_unref(sink_pad);
+    klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    if (!klass || !strstr(klass, "Decoder") || !strstr(klass, "Video")) {
+        return;
+    }
+
+    // Decoders name the property differently: libav 'max-threads', libvpx 'threads', dav1d 'n-threads'
+    for (i = 0; thread_properties[i]; ++i) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), thread_properties[i])) {
+            g_object_set(element, thread_properties[i], data->decoder_threads, NULL);
+            g_print("Decoder '%s' of '%s' is limited to %i threads\n",
+                    GST_ELEMENT_NAME(element),
+                    GST_ELEMENT_NAME(bin),
+                    data->decoder_threads);
+            return;
+        }
+    }
+}
+
+// This function will be called by the deep-element-added signal of sources with reduced resolution decoding
+static void decoder_added_handler(GstBin* bin, GstBin* sub_bin, GstElement* element, ApplicationContext* data) {
+    GstElementFactory* factory = gst_element_get_factory(element);
+    DecoderProbeContext* context;
+    GstPad* sink_pad;
+    const gchar* klass;
+
+    if (!factory) {
+        return;
+    }
+
+    klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    if (!klass || !strstr(klass, "Decoder") || !strstr(klass, "Video")) {
+        return;
     }
 
-    if (new_pad_caps != NULL) {
-        gst_caps_unref(new_pad_caps);
+    sink_pad = gst_element_get_static_pad(element, "sink");
+    if (!sink_pad) {
+        return;
     }
-}
\ No newline at end of file
+
+    // Handler is connected to the source itself, the decoder is configured when its caps are known
+    context = g_new(DecoderProbeContext, 1);
+    context->data = data;
+    context->source = GST_ELEMENT(bin);
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, decoder_caps_probe, context, g_free);
+    g_print("Reduced resolution decoding is set up for '%s' of '%s'\n",
+            GST_ELEMENT_NAME(element),
+            GST_ELEMENT_NAME(bin));
+
+    gst_object_unref(sink_pad);
+}
@@ -0,0 +1,485 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Metrics.h"
+
+#include <gio/gio.h>
+
+#include <stdarg.h>
+#include <string.h>
+
+#define METRIC_PREFIX "twitch_streamer_element_"
+
+typedef struct _ElementMetrics {
+    GstElement* element;
+    gchar* name;
+    gboolean is_queue;
+
+    GMutex lock;
+    guint64 buffers_in;
+    guint64 buffers_out;
+    guint64 bytes_out;
+    gint64 last_input_time; // 0 if the latest input has already produced output
+    guint64 processed;
+    gint64 processing_time;     // in microseconds
+    gint64 processing_time_max; // since the last log
+
+    // Counters at the time of the last log, used to compute rates
+    guint64 logged_buffers_in;
+    guint64 logged_buffers_out;
+    guint64 logged_bytes_out;
+    guint64 logged_processed;
+    gint64 logged_processing_time;
+} ElementMetrics;
+
+struct _MetricsContext {
+    guint log_source;
+    GSocketService* service;
+    GCancellable* cancellable;
+
+    GMutex lock; // protects array of elements, elements are added from streaming threads as well
+    GPtrArray* elements;
+    gint64 last_log_time;
+};
+
+static void element_metrics_free(gpointer data) {
+    ElementMetrics* stats = data;
+
+    gst_object_unref(stats->element);
+    g_mutex_clear(&stats->lock);
+    g_free(stats->name);
+    g_free(stats);
+}
+
+static void probe_size(GstPadProbeInfo* info, guint* buffers, gsize* bytes) {
+    *buffers = 0;
+    *bytes = 0;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        *buffers = 1;
+        *bytes = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        *buffers = gst_buffer_list_length(list);
+        *bytes = gst_buffer_list_calculate_size(list);
+    }
+}
+
+static GstPadProbeReturn input_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    ElementMetrics* stats = user_data;
+    guint buffers;
+    gsize bytes;
+
+    probe_size(info, &buffers, &bytes);
+
+    g_mutex_lock(&stats->lock);
+    stats->buffers_in += buffers;
+    stats->last_input_time = g_get_monotonic_time();
+    g_mutex_unlock(&stats->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn output_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    ElementMetrics* stats = user_data;
+    gint64 now = g_get_monotonic_time();
+    guint buffers;
+    gsize bytes;
+
+    probe_size(info, &buffers, &bytes);
+
+    g_mutex_lock(&stats->lock);
+    stats->buffers_out += buffers;
+    stats->bytes_out += bytes;
+    // Time spent in queues is waiting, not processing, their fill level is reported instead
+    if (stats->last_input_time != 0 && !stats->is_queue) {
+        gint64 elapsed = now - stats->last_input_time;
+        stats->processing_time += elapsed;
+        stats->processing_time_max = MAX(stats->processing_time_max, elapsed);
+        ++stats->processed;
+        stats->last_input_time = 0;
+    }
+    g_mutex_unlock(&stats->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void watch_pad(GstElement* element, GstPad* pad, gpointer user_data) {
+    GstPadProbeCallback callback = GST_PAD_IS_SINK(pad) ? input_probe : output_probe;
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, callback, user_data, NULL);
+}
+
+static gboolean watch_existing_pad(GstElement* element, GstPad* pad, gpointer user_data) {
+    watch_pad(element, pad, user_data);
+
+    return TRUE;
+}
+
+static void watch_element(MetricsContext* metrics, GstElement* element, const char* name) {
+    ElementMetrics* stats = g_new0(ElementMetrics, 1);
+    GstElementFactory* factory = gst_element_get_factory(element);
+
+    stats->element = gst_object_ref(element);
+    stats->name = g_strdup(name);
+    stats->is_queue = factory && g_strcmp0(GST_OBJECT_NAME(factory), "queue") == 0;
+    g_mutex_init(&stats->lock);
+
+    g_mutex_lock(&metrics->lock);
+    g_ptr_array_add(metrics->elements, stats);
+    g_mutex_unlock(&metrics->lock);
+
+    // Request pads of tees and sometimes pads of decoders appear after the element is watched
+    g_signal_connect(element, "pad-added", G_CALLBACK(watch_pad), stats);
+    gst_element_foreach_pad(element, watch_existing_pad, stats);
+}
+
+void metrics_watch_element(MetricsContext* metrics, GstElement* element) {
+    watch_element(metrics, element, GST_ELEMENT_NAME(element));
+}
+
+static void decoder_added_handler(GstBin* bin, GstBin* sub_bin, GstElement* element, MetricsContext* metrics) {
+    GstElementFactory* factory = gst_element_get_factory(element);
+    const gchar* klass;
+    gchar* name;
+
+    if (!factory) {
+        return;
+    }
+
+    klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    if (!klass || !strstr(klass, "Decoder")) {
+        return;
+    }
+
+    name = g_strdup_printf("%s/%s", GST_ELEMENT_NAME(bin), GST_ELEMENT_NAME(element));
+    watch_element(metrics, element, name);
+    g_free(name);
+}
+
+void metrics_watch_decoders(MetricsContext* metrics, GstElement* bin) {
+    g_signal_connect(bin, "deep-element-added", G_CALLBACK(decoder_added_handler), metrics);
+}
+
+void metrics_unwatch_element(MetricsContext* metrics, GstElement* element) {
+    guint i = 0;
+
+    g_signal_handlers_disconnect_by_func(element, decoder_added_handler, metrics);
+
+    g_mutex_lock(&metrics->lock);
+    while (i < metrics->elements->len) {
+        ElementMetrics* stats = g_ptr_array_index(metrics->elements, i);
+
+        if (stats->element != element && !gst_object_has_as_ancestor(GST_OBJECT(stats->element), GST_OBJECT(element))) {
+            ++i;
+            continue;
+        }
+
+        g_signal_handlers_disconnect_by_data(stats->element, stats);
+        g_ptr_array_remove_index(metrics->elements, i);
+    }
+    g_mutex_unlock(&metrics->lock);
+}
+
+// Fill level and drops of a queue. Dropped buffers entered the queue, but neither left it nor stay in it
+static void get_queue_state(ElementMetrics* stats, guint* level_buffers, guint64* level_time, guint64* dropped) {
+    guint64 buffers_in;
+    guint64 buffers_out;
+
+    g_object_get(stats->element, "current-level-buffers", level_buffers, "current-level-time", level_time, NULL);
+
+    g_mutex_lock(&stats->lock);
+    buffers_in = stats->buffers_in;
+    buffers_out = stats->buffers_out;
+    g_mutex_unlock(&stats->lock);
+
+    *dropped = buffers_in > buffers_out + *level_buffers ? buffers_in - buffers_out - *level_buffers : 0;
+}
+
+static void log_metrics(MetricsContext* metrics, gint64 now) {
+    gdouble interval = (now - metrics->last_log_time) / (gdouble)G_USEC_PER_SEC;
+    guint i;
+
+    metrics->last_log_time = now;
+    if (interval <= 0) {
+        return;
+    }
+
+    g_mutex_lock(&metrics->lock);
+    for (i = 0; i < metrics->elements->len; ++i) {
+        ElementMetrics* stats = g_ptr_array_index(metrics->elements, i);
+        GString* line = g_string_new(NULL);
+        guint64 processed;
+        gint64 processing_time;
+
+        g_mutex_lock(&stats->lock);
+        g_string_append_printf(line,
+                               "metrics: element=%s in_fps=%.1f out_fps=%.1f out_kbps=%.0f",
+                               stats->name,
+                               (stats->buffers_in - stats->logged_buffers_in) / interval,
+                               (stats->buffers_out - stats->logged_buffers_out) / interval,
+                               (stats->bytes_out - stats->logged_bytes_out) * 8 / 1000.0 / interval);
+        processed = stats->processed - stats->logged_processed;
+        processing_time = stats->processing_time - stats->logged_processing_time;
+        if (processed > 0) {
+            g_string_append_printf(line,
+                                   " proc_avg_ms=%.2f proc_max_ms=%.2f",
+                                   processing_time / 1000.0 / processed,
+                                   stats->processing_time_max / 1000.0);
+        }
+        stats->logged_buffers_in = stats->buffers_in;
+        stats->logged_buffers_out = stats->buffers_out;
+        stats->logged_bytes_out = stats->bytes_out;
+        stats->logged_processed = stats->processed;
+        stats->logged_processing_time = stats->processing_time;
+        stats->processing_time_max = 0;
+        g_mutex_unlock(&stats->lock);
+
+        if (stats->is_queue) {
+            guint level_buffers;
+            guint64 level_time;
+            guint64 dropped;
+
+            get_queue_state(stats, &level_buffers, &level_time, &dropped);
+            g_string_append_printf(line,
+                                   " level_buffers=%u level_ms=%" G_GUINT64_FORMAT " dropped=%" G_GUINT64_FORMAT,
+                                   level_buffers,
+                                   level_time / GST_MSECOND,
+                                   dropped);
+        }
+
+        g_print("%s\n", line->str);
+        g_string_free(line, TRUE);
+    }
+    g_mutex_unlock(&metrics->lock);
+}
+
+static void append_metric(GString* text, const char* metric, const char* element, const char* format, ...) {
+    va_list args;
+
+    g_string_append_printf(text, METRIC_PREFIX "%s{element=\"%s\"} ", metric, element);
+    va_start(args, format);
+    g_string_append_vprintf(text, format, args);
+    va_end(args);
+    g_string_append_c(text, '\n');
+}
+
+static gchar* format_metrics(MetricsContext* metrics) {
+    GString* text = g_string_new(NULL);
+    guint i;
+
+    g_mutex_lock(&metrics->lock);
+    for (i = 0; i < metrics->elements->len; ++i) {
+        ElementMetrics* stats = g_ptr_array_index(metrics->elements, i);
+
+        g_mutex_lock(&stats->lock);
+        append_metric(text, "buffers_in_total", stats->name, "%" G_GUINT64_FORMAT, stats->buffers_in);
+        append_metric(text, "buffers_out_total", stats->name, "%" G_GUINT64_FORMAT, stats->buffers_out);
+        append_metric(text, "bytes_out_total", stats->name, "%" G_GUINT64_FORMAT, stats->bytes_out);
+        if (!stats->is_queue) {
+            append_metric(text, "processed_total", stats->name, "%" G_GUINT64_FORMAT, stats->processed);
+            append_metric(text,
+                          "processing_seconds_total",
+                          stats->name,
+                          "%.6f",
+                          stats->processing_time / (gdouble)G_USEC_PER_SEC);
+        }
+        g_mutex_unlock(&stats->lock);
+
+        if (stats->is_queue) {
+            guint level_buffers;
+            guint64 level_time;
+            guint64 dropped;
+
+            get_queue_state(stats, &level_buffers, &level_time, &dropped);
+            append_metric(text, "queue_level_buffers", stats->name, "%u", level_buffers);
+            append_metric(text, "queue_level_seconds", stats->name, "%.3f", level_time / (gdouble)GST_SECOND);
+            append_metric(text, "queue_dropped_total", stats->name, "%" G_GUINT64_FORMAT, dropped);
+        }
+    }
+    g_mutex_unlock(&metrics->lock);
+
+    return g_string_free(text, FALSE);
+}
+
+typedef struct _MetricsClient {
+    MetricsContext* metrics;
+    GCancellable* cancellable; // metrics context is freed once it is cancelled
+    GSocketConnection* connection;
+    GDataInputStream* input;
+    gchar* response;
+} MetricsClient;
+
+static void metrics_client_free(MetricsClient* client) {
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_object_unref(client->cancellable);
+    g_free(client->response);
+    g_free(client);
+}
+
+static void response_written_callback(GObject* source, GAsyncResult* result, gpointer user_data) {
+    MetricsClient* client = user_data;
+
+    g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, NULL);
+    metrics_client_free(client);
+}
+
+static void send_response(MetricsClient* client) {
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(client->connection));
+    gchar* body = format_metrics(client->metrics);
+
+    client->response = g_strdup_printf("HTTP/1.0 200 OK\r\n"
+                                       "Content-Type: text/plain; version=0.0.4\r\n"
+                                       "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                                       "Connection: close\r\n\r\n%s",
+                                       strlen(body),
+                                       body);
+    g_free(body);
+
+    g_output_stream_write_all_async(output,
+                                    client->response,
+                                    strlen(client->response),
+                                    G_PRIORITY_DEFAULT,
+                                    client->cancellable,
+                                    response_written_callback,
+                                    client);
+}
+
+static void read_request_line(MetricsClient* client);
+
+// Every request gets the same response, so request is read only to let the client finish sending it. Request ends
+// with an empty line
+static void request_line_callback(GObject* source, GAsyncResult* result, gpointer user_data) {
+    MetricsClient* client = user_data;
+    gchar* line;
+
+    line = g_data_input_stream_read_line_finish(client->input, result, NULL, NULL);
+    if (!line || g_cancellable_is_cancelled(client->cancellable)) {
+        g_free(line);
+        metrics_client_free(client);
+        return;
+    }
+
+    if (line[0] == '\0') {
+        send_response(client);
+    } else {
+        read_request_line(client);
+    }
+    g_free(line);
+}
+
+static void read_request_line(MetricsClient* client) {
+    g_data_input_stream_read_line_async(
+        client->input, G_PRIORITY_DEFAULT, client->cancellable, request_line_callback, client);
+}
+
+static gboolean incoming_handler(GSocketService* service,
+                                 GSocketConnection* connection,
+                                 GObject* source_object,
+                                 gpointer user_data) {
+    MetricsClient* client = g_new0(MetricsClient, 1);
+
+    client->metrics = user_data;
+    client->cancellable = g_object_ref(client->metrics->cancellable);
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_data_input_stream_set_newline_type(client->input, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+
+    read_request_line(client);
+
+    return TRUE;
+}
+
+static gboolean log_handler(gpointer user_data) {
+    MetricsContext* metrics = user_data;
+
+    log_metrics(metrics, g_get_monotonic_time());
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSocketService* create_service(int port) {
+    GSocketService* service = g_socket_service_new();
+    GInetAddress* loopback;
+    GSocketAddress* address;
+    GError* error = NULL;
+    gboolean listening;
+
+    // Metrics are not meant to be public, so endpoint is available on loopback interface only
+    loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new(loopback, port);
+    listening = g_socket_listener_add_address(G_SOCKET_LISTENER(service),
+                                              address,
+                                              G_SOCKET_TYPE_STREAM,
+                                              G_SOCKET_PROTOCOL_TCP,
+                                              NULL,
+                                              NULL,
+                                              &error);
+    g_object_unref(address);
+    g_object_unref(loopback);
+
+    if (!listening) {
+        g_printerr("Error: failed to listen for metrics on port %i: %s\n", port, error->message);
+        g_clear_error(&error);
+        g_object_unref(service);
+        return NULL;
+    }
+
+    return service;
+}
+
+MetricsContext* metrics_new(int log_interval, int port) {
+    MetricsContext* metrics;
+    GSocketService* service = NULL;
+
+    if (port > 0) {
+        service = create_service(port);
+        if (!service) {
+            return NULL;
+        }
+    }
+
+    metrics = g_new0(MetricsContext, 1);
+    metrics->service = service;
+    metrics->cancellable = g_cancellable_new();
+    g_mutex_init(&metrics->lock);
+    metrics->elements = g_ptr_array_new_with_free_func(element_metrics_free);
+    metrics->last_log_time = g_get_monotonic_time();
+
+    if (log_interval > 0) {
+        metrics->log_source = g_timeout_add_seconds(log_interval, log_handler, metrics);
+    }
+
+    if (service) {
+        g_signal_connect(service, "incoming", G_CALLBACK(incoming_handler), metrics);
+        g_socket_service_start(service);
+        g_print("Metrics are served on http://127.0.0.1:%i/\n", port);
+    }
+
+    return metrics;
+}
+
+void metrics_free(MetricsContext* metrics) {
+    if (!metrics) {
+        return;
+    }
+
+    if (metrics->log_source) {
+        g_source_remove(metrics->log_source);
+    }
+
+    // Clients being served are freed by their pending callbacks
+    g_cancellable_cancel(metrics->cancellable);
+    if (metrics->service) {
+        g_socket_service_stop(metrics->service);
+        g_socket_listener_close(G_SOCKET_LISTENER(metrics->service));
+        g_object_unref(metrics->service);
+    }
+    g_object_unref(metrics->cancellable);
+
+    // Probes hold raw pointers to element metrics, so the pipeline must be already stopped at this point
+    g_ptr_array_unref(metrics->elements);
+    g_mutex_clear(&metrics->lock);
+    g_free(metrics);
+}
@@ -0,0 +1,32 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_METRICS_H
+#define TWITCH_STREAMER_METRICS_H
+
+#include <gst/gst.h>
+
+// Per-element instrumentation of a running pipeline: buffer rates, processing time, queue fill levels and drops.
+// Everything is measured with pad probes, numbers are printed as periodic structured logs and served as plain text
+// (Prometheus exposition format) on localhost
+typedef struct _MetricsContext MetricsContext;
+
+// Numbers are logged every 'log_interval' seconds and served on http://127.0.0.1:'port'/ by the main loop, zero
+// disables logs or endpoint respectively. Returns NULL if endpoint could not be started
+MetricsContext* metrics_new(int log_interval, int port);
+
+// Stops logs and endpoint, the pipeline must be already stopped at this point
+void metrics_free(MetricsContext* metrics);
+
+// Watches all pads of 'element', including the ones which will be added later. Buffers entering element through sink
+// pads and leaving it through src pads are counted, processing time is the time from the latest input buffer to the
+// next output buffer. For queues fill level and number of dropped buffers are reported instead
+void metrics_watch_element(MetricsContext* metrics, GstElement* element);
+
+// Watches decoders which will be created inside 'bin' (e.g. uridecodebin), they are reported as "<bin>/<decoder>"
+void metrics_watch_decoders(MetricsContext* metrics, GstElement* bin);
+
+// Stops reporting 'element' and every watched element inside it (e.g. decoders of a bin) and releases them. Probes
+// hold raw pointers to element metrics, so the element must be already stopped
+void metrics_unwatch_element(MetricsContext* metrics, GstElement* element);
+
+#endif // TWITCH_STREAMER_METRICS_H
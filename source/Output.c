@@ -0,0 +1,307 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Output.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Queue of each destination holds up to this amount of encoded data, older data is dropped when destination is slow
+#define OUTPUT_QUEUE_MAX_TIME (5 * GST_SECOND)
+
+// Video of a slow destination is dropped from this fill level of its queue on, until the next keyframe
+#define VIDEO_DROP_LEVEL_PERCENT 75
+
+// Recording queues absorb disk stalls of this length without dropping data
+#define RECORDING_QUEUE_MAX_TIME (30 * GST_SECOND)
+
+// Recorded MP4 segments are fragmented, so a segment which was not finalized (e.g. after a crash) is still playable
+#define RECORDING_FRAGMENT_DURATION 2000 // ms
+
+// HLS segments parameters
+#define HLS_TARGET_DURATION 2
+#define HLS_PLAYLIST_LENGTH 5
+#define HLS_MAX_FILES 10
+
+static gboolean is_network_location(const char* location) {
+    return g_str_has_prefix(location, "rtmp://") || g_str_has_prefix(location, "rtmps://");
+}
+
+static gboolean is_hls_location(const char* location) {
+    return g_str_has_suffix(location, ".m3u8");
+}
+
+static gboolean is_mp4_recording_location(const char* location) {
+    return g_str_has_suffix(location, ".mp4");
+}
+
+static gboolean is_recording_location(const char* location) {
+    return is_mp4_recording_location(location) || g_str_has_suffix(location, ".ts");
+}
+
+static const char* local_path(const char* location) {
+    return g_str_has_prefix(location, "file://") ? location + strlen("file://") : location;
+}
+
+// Dropped P-frames would corrupt the picture until the next keyframe, so the whole rest of GOP is dropped instead.
+// Dropping starts before the queue is full, so the queue itself never leaks arbitrary frames
+static GstPadProbeReturn video_drop_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    OutputBranch* output = user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    guint64 level_time;
+
+    g_object_get(output->video_queue, "current-level-time", &level_time, NULL);
+    if (level_time >= output->video_drop_level) {
+        if (!output->video_dropping) {
+            g_printerr("Warning: output '%s' can not keep up, video is dropped until the next keyframe\n",
+                       output->location);
+        }
+        output->video_dropping = TRUE;
+    } else if (output->video_dropping && !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        output->video_dropping = FALSE;
+    }
+
+    return output->video_dropping ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+static void add_video_drop_probe(OutputBranch* output) {
+    GstPad* pad = gst_element_get_static_pad(output->video_queue, "sink");
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, video_drop_probe, output, NULL);
+    gst_object_unref(pad);
+}
+
+static int setup_recording_sink(GstElement* sink,
+                                const char* name,
+                                const char* location,
+                                const SegmentPolicy* segments) {
+    const char* path = local_path(location);
+    const char* extension = strrchr(path, '.');
+    gchar* pattern;
+    GstElement* muxer;
+    char name_buf[255];
+
+    snprintf(name_buf, sizeof(name_buf), "%s_mux", name);
+    muxer = gst_element_factory_make(is_mp4_recording_location(location) ? "mp4mux" : "mpegtsmux", name_buf);
+    if (!muxer) {
+        g_printerr("Error: failed to create muxer of output '%s' ('%s')\n", name, location);
+        return 1;
+    }
+    if (is_mp4_recording_location(location)) {
+        g_object_set(muxer, "fragment-duration", RECORDING_FRAGMENT_DURATION, NULL);
+    }
+
+    if (strchr(path, '%')) {
+        pattern = g_strdup(path);
+    } else {
+        pattern = g_strdup_printf("%.*s_%%05d%s", (int)(extension - path), path, extension);
+    }
+
+    g_object_set(sink,
+                 "location",
+                 pattern,
+                 "muxer",
+                 muxer,
+                 "max-size-time",
+                 segments->max_time,
+                 "max-size-bytes",
+                 segments->max_bytes,
+                 "max-files",
+                 segments->max_files,
+                 NULL);
+    g_print("Output '%s': segments '%s'\n", name, pattern);
+    g_free(pattern);
+
+    return 0;
+}
+
+static void setup_hls_sink(GstElement* sink, const char* location) {
+    const char* playlist = local_path(location);
+    gchar* base = g_strndup(playlist, strlen(playlist) - strlen(".m3u8"));
+    gchar* segments = g_strdup_printf("%s_%%05d.ts", base);
+
+    g_object_set(sink,
+                 "playlist-location",
+                 playlist,
+                 "location",
+                 segments,
+                 "target-duration",
+                 HLS_TARGET_DURATION,
+                 "playlist-length",
+                 HLS_PLAYLIST_LENGTH,
+                 "max-files",
+                 HLS_MAX_FILES,
+                 NULL);
+
+    g_free(segments);
+    g_free(base);
+}
+
+int output_branch_create(OutputBranch* output,
+                         const char* name,
+                         const char* location,
+                         const SegmentPolicy* segments,
+                         gboolean fake_sink) {
+    char name_buf[255];
+    const char* sink_factory;
+    GstClockTime queue_max_time = OUTPUT_QUEUE_MAX_TIME;
+
+    output->location = g_strdup(location);
+    output->sender = NULL;
+    output->parser = NULL;
+    output->video_dropping = FALSE;
+
+    if (fake_sink) {
+        sink_factory = "fakesink";
+    } else if (is_network_location(location)) {
+        // Network errors are handled by the sender, so they never stop the main pipeline
+        sink_factory = "appsink";
+    } else if (is_hls_location(location)) {
+        sink_factory = "hlssink2";
+    } else if (is_recording_location(location)) {
+        sink_factory = "splitmuxsink";
+    } else {
+        sink_factory = "filesink";
+    }
+
+    snprintf(name_buf, sizeof(name_buf), "%s_video_queue", name);
+    output->video_queue = gst_element_factory_make("queue", name_buf);
+    snprintf(name_buf, sizeof(name_buf), "%s_audio_queue", name);
+    output->audio_queue = gst_element_factory_make("queue", name_buf);
+    snprintf(name_buf, sizeof(name_buf), "%s_sink", name);
+    output->sink = gst_element_factory_make(sink_factory, name_buf);
+    // HLS and recording sinks have their own muxers
+    if (!fake_sink && (is_hls_location(location) || is_recording_location(location))) {
+        output->flv_mux = NULL;
+    } else {
+        snprintf(name_buf, sizeof(name_buf), "%s_flv_mux", name);
+        output->flv_mux = gst_element_factory_make("flvmux", name_buf);
+        if (!output->flv_mux) {
+            g_printerr("Error: failed to create FLV muxer of output '%s' ('%s')\n", name, location);
+            return 1;
+        }
+    }
+
+    // FLV takes avc stream format, MP4 and MPEG-TS (of recordings and HLS) muxers take others, the parser converts to
+    // the one the muxer needs, so the encoder output is negotiated by other outputs
+    if (!fake_sink && (is_recording_location(location) || is_hls_location(location))) {
+        snprintf(name_buf, sizeof(name_buf), "%s_parser", name);
+        output->parser = gst_element_factory_make("h264parse", name_buf);
+        if (!output->parser) {
+            g_printerr("Error: failed to create H.264 parser of output '%s' ('%s')\n", name, location);
+            return 1;
+        }
+    }
+    if (!fake_sink && is_recording_location(location)) {
+        queue_max_time = RECORDING_QUEUE_MAX_TIME;
+    }
+
+    if (!output->video_queue || !output->audio_queue || !output->sink) {
+        g_printerr("Error: failed to create elements of output '%s' ('%s')\n", name, location);
+        return 1;
+    }
+
+    // Slow destination only loses its own data and never blocks tees shared with other destinations. Every AAC frame
+    // decodes on its own, so audio queue may drop any of them
+    g_object_set(output->video_queue,
+                 "leaky",
+                 2 /*downstream*/,
+                 "max-size-time",
+                 queue_max_time,
+                 "max-size-buffers",
+                 0,
+                 "max-size-bytes",
+                 0,
+                 NULL);
+    g_object_set(output->audio_queue,
+                 "leaky",
+                 2 /*downstream*/,
+                 "max-size-time",
+                 queue_max_time,
+                 "max-size-buffers",
+                 0,
+                 "max-size-bytes",
+                 0,
+                 NULL);
+    output->video_drop_level = queue_max_time * VIDEO_DROP_LEVEL_PERCENT / 100;
+    add_video_drop_probe(output);
+
+    if (output->flv_mux) {
+        g_object_set(output->flv_mux, "streamable", TRUE, NULL);
+    }
+
+    if (fake_sink) {
+        g_object_set(output->sink, "sync", FALSE, NULL);
+    } else if (is_network_location(location)) {
+        output->sender = rtmp_sender_new(name, location);
+        rtmp_sender_attach(output->sender, output->sink);
+    } else if (is_hls_location(location)) {
+        setup_hls_sink(output->sink, location);
+    } else if (is_recording_location(location)) {
+        if (setup_recording_sink(output->sink, name, location, segments) != 0) {
+            return 1;
+        }
+    } else {
+        g_object_set(output->sink, "location", local_path(location), NULL);
+    }
+
+    g_print("Output '%s': '%s' (%s)\n", name, location, sink_factory);
+
+    return 0;
+}
+
+static int link_tee(GstElement* tee, GstElement* queue) {
+    GstPad* tee_src_pad = gst_element_get_request_pad(tee, "src_%u");
+    GstPad* queue_sink_pad = gst_element_get_static_pad(queue, "sink");
+    int result = 0;
+
+    if (!tee_src_pad || !queue_sink_pad || gst_pad_link(tee_src_pad, queue_sink_pad) != GST_PAD_LINK_OK) {
+        result = 1;
+    }
+
+    if (tee_src_pad) {
+        gst_object_unref(tee_src_pad);
+    }
+    if (queue_sink_pad) {
+        gst_object_unref(queue_sink_pad);
+    }
+
+    return result;
+}
+
+int output_branch_add_and_link(OutputBranch* output, GstBin* bin, GstElement* video_tee, GstElement* audio_tee) {
+    GstElement* muxer = output->flv_mux ? output->flv_mux : output->sink;
+    GstElement* video_src = output->parser ? output->parser : output->video_queue;
+    // Recording sink has request pads for any number of audio streams
+    const char* audio_pad = !output->flv_mux && is_recording_location(output->location) ? "audio_%u" : "audio";
+
+    gst_bin_add_many(bin, output->video_queue, output->audio_queue, output->sink, NULL);
+    if (output->flv_mux) {
+        gst_bin_add(bin, output->flv_mux);
+    }
+    if (output->parser) {
+        gst_bin_add(bin, output->parser);
+    }
+
+    // Queues have ANY caps, so muxer pads are requested explicitly
+    if ((output->parser && !gst_element_link(output->video_queue, output->parser)) ||
+        !gst_element_link_pads(video_src, "src", muxer, "video") ||
+        !gst_element_link_pads(output->audio_queue, "src", muxer, audio_pad) ||
+        (output->flv_mux && !gst_element_link(output->flv_mux, output->sink))) {
+        g_printerr("Error: muxer of output '%s' could not be linked\n", output->location);
+        return 1;
+    }
+
+    if (link_tee(video_tee, output->video_queue) != 0 || link_tee(audio_tee, output->audio_queue) != 0) {
+        g_printerr("Error: output '%s' could not be linked with encoders\n", output->location);
+        return 1;
+    }
+
+    return 0;
+}
+
+void output_branch_clear(OutputBranch* output) {
+    rtmp_sender_free(output->sender);
+    output->sender = NULL;
+    g_free(output->location);
+    output->location = NULL;
+}
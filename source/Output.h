@@ -0,0 +1,54 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_OUTPUT_H
+#define TWITCH_STREAMER_OUTPUT_H
+
+#include "RtmpSender.h"
+
+#include <gst/gst.h>
+
+// Max number of destinations sharing one encoded stream
+#define MAX_OUTPUTS 8
+
+// Rotation of recorded segments, zero disables the limit
+typedef struct _SegmentPolicy {
+    guint64 max_time;  // ns, a segment is closed at the first keyframe after this duration
+    guint64 max_bytes; // a segment is closed at the first keyframe after this size
+    guint max_files;   // the oldest segments are deleted above this number
+} SegmentPolicy;
+
+// Single destination of already encoded audio and video: own leaky queues, muxer and sink. Locations starting
+// with rtmp:// or rtmps:// are streamed by reconnecting RtmpSender, locations ending with .m3u8 are written as HLS
+// playlist with MPEG-TS segments next to it. Locations ending with .mp4 or .ts are recordings: rolling fragmented
+// MP4 or MPEG-TS segments, the location is a printf pattern of segment index (e.g. "rec_%05d.mp4"), the index is
+// appended if it has none. Anything else is treated as a local FLV file path
+typedef struct _OutputBranch {
+    gchar* location;
+
+    GstElement* video_queue;
+    GstElement* audio_queue;
+    GstElement* parser;  // NULL if muxer takes the stream format of the encoder
+    GstElement* flv_mux; // NULL if sink muxes data itself
+    GstElement* sink;
+    RtmpSender* sender; // NULL if output is not a network one
+
+    // Video is dropped until the next keyframe once the queue holds this much of it, changed by streaming thread
+    GstClockTime video_drop_level;
+    gboolean video_dropping;
+} OutputBranch;
+
+// Creates elements of output, their names are prefixed with 'name'. Recordings are split by 'segments'. If
+// 'fake_sink' is TRUE, data goes to fakesink instead of 'location'. 'output' must not move while the pipeline runs
+int output_branch_create(OutputBranch* output,
+                         const char* name,
+                         const char* location,
+                         const SegmentPolicy* segments,
+                         gboolean fake_sink);
+
+// Adds elements to 'bin' and links them to tees with encoded video and audio
+int output_branch_add_and_link(OutputBranch* output, GstBin* bin, GstElement* video_tee, GstElement* audio_tee);
+
+// Frees memory owned by the output, elements are owned by the bin they were added to, so it should be stopped already
+void output_branch_clear(OutputBranch* output);
+
+#endif // TWITCH_STREAMER_OUTPUT_H
@@ -0,0 +1,774 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "Overlay.h"
+
+#include "Blend.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include <string.h>
+
+#define PULL_TIMEOUT (100 * GST_MSECOND)
+#define RENDER_TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+// Graphics are rendered into AYUV, which keeps alpha of every pixel, and converted into the output format here.
+// Colorimetry of the rendering is set to the one of the output frame, so colors are not shifted
+#define IMAGE_PIPELINE \
+    "uridecodebin name=decoder ! videoconvert ! capsfilter name=filter ! appsink name=sink sync=false"
+#define TEXT_PIPELINE                                                                                      \
+    "appsrc name=source format=time caps=text/x-raw,format=utf8 ! textrender name=render halignment=left " \
+    "valignment=top ! video/x-raw,format=AYUV ! appsink name=sink sync=false"
+
+typedef struct _OverlayGraphic {
+    gchar* name;
+    gchar* content; // what the graphic shows, for listing
+    int x;
+    int y;
+
+    // AYUV frame as rendered, only its visible part (bounding box of pixels which are not transparent) is drawn
+    GstSample* rendering;
+    GstVideoRectangle visible;
+
+    // Premultiplied image in the output format and alpha of its every byte, both have layout of 'info'. Area is the
+    // bounding box of the graphic in the frame with even coordinates, images are NULL if it is outside the frame
+    GstVideoRectangle area;
+    GstVideoInfo info;
+    GstBuffer* pixels;
+    GstBuffer* alpha;
+} OverlayGraphic;
+
+// Graphic to be rendered, possibly in a thread of its own, so it carries a copy of everything it needs
+typedef struct _OverlayRender {
+    GstVideoInfo info; // of frames the graphic is drawn into
+    gchar* name;
+    int x;
+    int y;
+    gchar* path; // image, NULL for text
+    gchar* text;
+    gchar* font;
+} OverlayRender;
+
+struct _OverlayLayer {
+    GstVideoInfo info; // of frames the graphics are drawn into
+
+    // Graphics are replaced in the main thread and drawn by the mixer thread
+    GMutex lock;
+    GPtrArray* graphics; // OverlayGraphic*, in drawing order
+    GArray* damage;      // GstVideoRectangle, kept only after the mixer took it once
+    gboolean damage_taken;
+};
+
+static gboolean rectangle_intersect(const GstVideoRectangle* a, const GstVideoRectangle* b, GstVideoRectangle* result) {
+    int x0 = MAX(a->x, b->x);
+    int y0 = MAX(a->y, b->y);
+    int x1 = MIN(a->x + a->w, b->x + b->w);
+    int y1 = MIN(a->y + a->h, b->y + b->h);
+
+    result->x = x0;
+    result->y = y0;
+    result->w = x1 - x0;
+    result->h = y1 - y0;
+
+    return result->w > 0 && result->h > 0;
+}
+
+// Components of one plane share subsampling, so the first component of the plane describes it
+static guint plane_component(const GstVideoFrame* frame, guint plane) {
+    guint i;
+
+    for (i = 0; i < GST_VIDEO_FRAME_N_COMPONENTS(frame); ++i) {
+        if ((guint)GST_VIDEO_FRAME_COMP_PLANE(frame, i) == plane) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+static guint8* component_byte(GstVideoFrame* frame, guint component, int x, int y) {
+    return (guint8*)GST_VIDEO_FRAME_COMP_DATA(frame, component) + y * GST_VIDEO_FRAME_COMP_STRIDE(frame, component) +
+           x * GST_VIDEO_FRAME_COMP_PSTRIDE(frame, component);
+}
+
+static void clear_images(OverlayGraphic* graphic) {
+    if (graphic->pixels) {
+        gst_buffer_unref(graphic->pixels);
+        graphic->pixels = NULL;
+    }
+    if (graphic->alpha) {
+        gst_buffer_unref(graphic->alpha);
+        graphic->alpha = NULL;
+    }
+    graphic->area.x = 0;
+    graphic->area.y = 0;
+    graphic->area.w = 0;
+    graphic->area.h = 0;
+}
+
+static void overlay_graphic_free(gpointer user_data) {
+    OverlayGraphic* graphic = user_data;
+
+    clear_images(graphic);
+    if (graphic->rendering) {
+        gst_sample_unref(graphic->rendering);
+    }
+    g_free(graphic->content);
+    g_free(graphic->name);
+    g_free(graphic);
+}
+
+OverlayLayer* overlay_layer_new(const char* format, int width, int height) {
+    OverlayLayer* layer = g_new0(OverlayLayer, 1);
+
+    gst_video_info_set_format(&layer->info, gst_video_format_from_string(format), width, height);
+    g_mutex_init(&layer->lock);
+    layer->graphics = g_ptr_array_new_with_free_func(overlay_graphic_free);
+    layer->damage = g_array_new(FALSE, FALSE, sizeof(GstVideoRectangle));
+
+    return layer;
+}
+
+void overlay_layer_free(OverlayLayer* layer) {
+    if (!layer) {
+        return;
+    }
+
+    g_ptr_array_unref(layer->graphics);
+    g_array_unref(layer->damage);
+    g_mutex_clear(&layer->lock);
+    g_free(layer);
+}
+
+// Runs 'pipeline' until its appsink gets the first frame, blocks until then. Pipeline is consumed
+static GstSample* render_first_frame(GstElement* pipeline, const char* what) {
+    GstElement* sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gint64 deadline = g_get_monotonic_time() + RENDER_TIMEOUT_US;
+    GstSample* sample = NULL;
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Error: unable to start rendering of %s\n", what);
+        goto exit;
+    }
+
+    while (!sample) {
+        GstMessage* msg;
+
+        sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink), PULL_TIMEOUT);
+        if (sample) {
+            break;
+        }
+
+        if (gst_app_sink_is_eos(GST_APP_SINK(sink))) {
+            g_printerr("Error: %s has no video frames\n", what);
+            break;
+        }
+
+        msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+        if (msg) {
+            GError* err;
+            gchar* debug_info;
+
+            gst_message_parse_error(msg, &err, &debug_info);
+            g_printerr("Error: failed to render %s: %s\n", what, err->message);
+            g_clear_error(&err);
+            g_free(debug_info);
+            gst_message_unref(msg);
+            break;
+        }
+
+        if (g_get_monotonic_time() > deadline) {
+            g_printerr("Error: rendering of %s timed out\n", what);
+            break;
+        }
+    }
+
+exit:
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+
+    return sample;
+}
+
+static GstSample* render_image(const GstVideoInfo* info, const char* path) {
+    gchar* what = g_strdup_printf("image '%s'", path);
+    GError* err = NULL;
+    GstElement* pipeline = NULL;
+    GstElement* element;
+    GstSample* sample = NULL;
+    gchar* colorimetry;
+    gchar* uri;
+    GstCaps* caps;
+
+    uri = gst_filename_to_uri(path, &err);
+    if (!uri) {
+        g_printerr("Error: invalid path of %s: %s\n", what, err->message);
+        g_clear_error(&err);
+        goto exit;
+    }
+
+    pipeline = gst_parse_launch(IMAGE_PIPELINE, &err);
+    if (!pipeline || err) {
+        g_printerr("Error: failed to create elements to render %s: %s\n", what, err ? err->message : "unknown error");
+        g_clear_error(&err);
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        goto exit;
+    }
+
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "decoder");
+    g_object_set(element, "uri", uri, NULL);
+    gst_object_unref(element);
+
+    colorimetry = gst_video_colorimetry_to_string(&info->colorimetry);
+    caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "AYUV", NULL);
+    if (colorimetry) {
+        gst_caps_set_simple(caps, "colorimetry", G_TYPE_STRING, colorimetry, NULL);
+    }
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "filter");
+    g_object_set(element, "caps", caps, NULL);
+    gst_object_unref(element);
+    gst_caps_unref(caps);
+    g_free(colorimetry);
+
+    sample = render_first_frame(pipeline, what);
+
+exit:
+    g_free(uri);
+    g_free(what);
+
+    return sample;
+}
+
+static GstSample* render_text(const char* text, const char* font) {
+    GError* err = NULL;
+    GstElement* pipeline = gst_parse_launch(TEXT_PIPELINE, &err);
+    GstElement* element;
+    GstBuffer* buffer;
+
+    if (!pipeline || err) {
+        g_printerr("Error: failed to create elements to render text: %s\n", err ? err->message : "unknown error");
+        g_clear_error(&err);
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        return NULL;
+    }
+
+    if (font) {
+        element = gst_bin_get_by_name(GST_BIN(pipeline), "render");
+        g_object_set(element, "font-desc", font, NULL);
+        gst_object_unref(element);
+    }
+
+    // Text is queued before the pipeline starts, end of stream lets it finish right after the frame
+    buffer = gst_buffer_new_wrapped(g_strdup(text), strlen(text));
+    GST_BUFFER_PTS(buffer) = 0;
+    GST_BUFFER_DURATION(buffer) = GST_SECOND;
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "source");
+    gst_app_src_push_buffer(GST_APP_SRC(element), buffer);
+    gst_app_src_end_of_stream(GST_APP_SRC(element));
+    gst_object_unref(element);
+
+    return render_first_frame(pipeline, "text");
+}
+
+// Finds bounding box of pixels which are not transparent, returns FALSE if there are none
+static gboolean find_visible_area(GstSample* rendering, GstVideoRectangle* visible) {
+    GstVideoInfo info;
+    GstVideoFrame frame;
+    int x0 = G_MAXINT;
+    int y0 = G_MAXINT;
+    int x1 = -1;
+    int y1 = -1;
+    int x;
+    int y;
+
+    if (!gst_video_info_from_caps(&info, gst_sample_get_caps(rendering)) ||
+        GST_VIDEO_INFO_FORMAT(&info) != GST_VIDEO_FORMAT_AYUV ||
+        !gst_video_frame_map(&frame, &info, gst_sample_get_buffer(rendering), GST_MAP_READ)) {
+        return FALSE;
+    }
+
+    for (y = 0; y < GST_VIDEO_FRAME_HEIGHT(&frame); ++y) {
+        const guint8* row = (const guint8*)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0) +
+                            y * GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+        for (x = 0; x < GST_VIDEO_FRAME_WIDTH(&frame); ++x) {
+            if (row[x * 4] != 0) {
+                x0 = MIN(x0, x);
+                x1 = MAX(x1, x);
+                y0 = MIN(y0, y);
+                y1 = y;
+            }
+        }
+    }
+    gst_video_frame_unmap(&frame);
+
+    visible->x = x0;
+    visible->y = y0;
+    visible->w = x1 - x0 + 1;
+    visible->h = y1 - y0 + 1;
+
+    return x1 >= 0;
+}
+
+static guint8 premultiply(guint value, guint alpha) {
+    return (guint8)((value * alpha + 127) / 255);
+}
+
+// Converts 2x2 pixels at 'x', 'y' of the area: luma of every pixel and the chroma sample they share. Chroma and its
+// alpha are averages of the premultiplied values of the pixels
+static void convert_block(const OverlayGraphic* graphic,
+                          const GstVideoFrame* rendering,
+                          GstVideoFrame* pixels,
+                          GstVideoFrame* alpha,
+                          int x,
+                          int y) {
+    guint alpha_sum = 0;
+    guint u_sum = 0;
+    guint v_sum = 0;
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        int pixel_x = x + (i & 1);
+        int pixel_y = y + (i >> 1);
+        int source_x = graphic->area.x + pixel_x - graphic->x + graphic->visible.x;
+        int source_y = graphic->area.y + pixel_y - graphic->y + graphic->visible.y;
+        const guint8* pixel;
+
+        if (source_x < graphic->visible.x || source_x >= graphic->visible.x + graphic->visible.w ||
+            source_y < graphic->visible.y || source_y >= graphic->visible.y + graphic->visible.h) {
+            continue;
+        }
+
+        // AYUV
+        pixel = (const guint8*)GST_VIDEO_FRAME_PLANE_DATA(rendering, 0) +
+                source_y * GST_VIDEO_FRAME_PLANE_STRIDE(rendering, 0) + source_x * 4;
+        *component_byte(pixels, GST_VIDEO_COMP_Y, pixel_x, pixel_y) = premultiply(pixel[1], pixel[0]);
+        *component_byte(alpha, GST_VIDEO_COMP_Y, pixel_x, pixel_y) = pixel[0];
+        alpha_sum += pixel[0];
+        u_sum += pixel[2] * pixel[0];
+        v_sum += pixel[3] * pixel[0];
+    }
+
+    *component_byte(pixels, GST_VIDEO_COMP_U, x / 2, y / 2) = (guint8)((u_sum + 510) / 1020);
+    *component_byte(pixels, GST_VIDEO_COMP_V, x / 2, y / 2) = (guint8)((v_sum + 510) / 1020);
+    *component_byte(alpha, GST_VIDEO_COMP_U, x / 2, y / 2) = (guint8)((alpha_sum + 2) / 4);
+    *component_byte(alpha, GST_VIDEO_COMP_V, x / 2, y / 2) = (guint8)((alpha_sum + 2) / 4);
+}
+
+// Converts the rendering placed at the position of the graphic into its images. Bounding box is extended to even
+// coordinates, so every chroma sample it touches is covered whole
+static void convert_graphic(const GstVideoInfo* frame_info, OverlayGraphic* graphic) {
+    GstVideoRectangle frame_rect = {0, 0, GST_VIDEO_INFO_WIDTH(frame_info), GST_VIDEO_INFO_HEIGHT(frame_info)};
+    GstVideoRectangle placed;
+    GstVideoInfo rendering_info;
+    GstVideoFrame rendering;
+    GstVideoFrame pixels;
+    GstVideoFrame alpha;
+    int x;
+    int y;
+
+    clear_images(graphic);
+
+    placed.x = graphic->x & ~1;
+    placed.y = graphic->y & ~1;
+    placed.w = ((graphic->x + graphic->visible.w + 1) & ~1) - placed.x;
+    placed.h = ((graphic->y + graphic->visible.h + 1) & ~1) - placed.y;
+    if (!rectangle_intersect(&placed, &frame_rect, &graphic->area)) {
+        return;
+    }
+
+    gst_video_info_from_caps(&rendering_info, gst_sample_get_caps(graphic->rendering));
+    gst_video_info_set_format(
+        &graphic->info, GST_VIDEO_INFO_FORMAT(frame_info), graphic->area.w, graphic->area.h);
+    graphic->pixels = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&graphic->info), NULL);
+    graphic->alpha = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&graphic->info), NULL);
+    gst_buffer_memset(graphic->pixels, 0, 0, GST_VIDEO_INFO_SIZE(&graphic->info));
+    gst_buffer_memset(graphic->alpha, 0, 0, GST_VIDEO_INFO_SIZE(&graphic->info));
+
+    if (!gst_video_frame_map(&rendering, &rendering_info, gst_sample_get_buffer(graphic->rendering), GST_MAP_READ)) {
+        g_printerr("Error: failed to map rendering of graphic '%s'\n", graphic->name);
+        clear_images(graphic);
+        return;
+    }
+    gst_video_frame_map(&pixels, &graphic->info, graphic->pixels, GST_MAP_WRITE);
+    gst_video_frame_map(&alpha, &graphic->info, graphic->alpha, GST_MAP_WRITE);
+
+    for (y = 0; y < graphic->area.h; y += 2) {
+        for (x = 0; x < graphic->area.w; x += 2) {
+            convert_block(graphic, &rendering, &pixels, &alpha, x, y);
+        }
+    }
+
+    gst_video_frame_unmap(&alpha);
+    gst_video_frame_unmap(&pixels);
+    gst_video_frame_unmap(&rendering);
+}
+
+// Must be called with the lock held
+static void add_damage(OverlayLayer* layer, const GstVideoRectangle* rect) {
+    if (layer->damage_taken && rect->w > 0 && rect->h > 0) {
+        g_array_append_val(layer->damage, *rect);
+    }
+}
+
+// Must be called with the lock held
+static guint find_graphic(OverlayLayer* layer, const char* name, OverlayGraphic** graphic) {
+    guint i;
+
+    for (i = 0; i < layer->graphics->len; ++i) {
+        *graphic = g_ptr_array_index(layer->graphics, i);
+        if (g_strcmp0((*graphic)->name, name) == 0) {
+            return i;
+        }
+    }
+    *graphic = NULL;
+
+    return layer->graphics->len;
+}
+
+static OverlayRender* overlay_render_new(OverlayLayer* layer, const char* name, int x, int y) {
+    OverlayRender* render = g_new0(OverlayRender, 1);
+
+    render->info = layer->info;
+    render->name = g_strdup(name);
+    render->x = x;
+    render->y = y;
+
+    return render;
+}
+
+static void overlay_render_free(gpointer user_data) {
+    OverlayRender* render = user_data;
+
+    g_free(render->font);
+    g_free(render->text);
+    g_free(render->path);
+    g_free(render->name);
+    g_free(render);
+}
+
+// Renders the graphic and converts it into its images, which is everything slow. Returns NULL on failure
+static OverlayGraphic* render_graphic(const OverlayRender* render) {
+    GstSample* rendering =
+        render->path ? render_image(&render->info, render->path) : render_text(render->text, render->font);
+    OverlayGraphic* graphic;
+
+    if (!rendering) {
+        return NULL;
+    }
+
+    graphic = g_new0(OverlayGraphic, 1);
+    graphic->name = g_strdup(render->name);
+    graphic->content =
+        render->path ? g_strdup_printf("image '%s'", render->path) : g_strdup_printf("text '%s'", render->text);
+    graphic->x = render->x;
+    graphic->y = render->y;
+    graphic->rendering = rendering;
+    if (!find_visible_area(rendering, &graphic->visible)) {
+        g_printerr("Error: graphic '%s' is transparent\n", render->name);
+        overlay_graphic_free(graphic);
+        return NULL;
+    }
+    convert_graphic(&render->info, graphic);
+
+    return graphic;
+}
+
+// Adds the graphic or replaces the one with the same name, the mixer thread only waits for graphics to be swapped
+static void swap_graphic(OverlayLayer* layer, OverlayGraphic* graphic) {
+    OverlayGraphic* old;
+    guint index;
+
+    g_mutex_lock(&layer->lock);
+    index = find_graphic(layer, graphic->name, &old);
+    if (old) {
+        add_damage(layer, &old->area);
+        overlay_graphic_free(old);
+        g_ptr_array_index(layer->graphics, index) = graphic;
+    } else {
+        g_ptr_array_add(layer->graphics, graphic);
+    }
+    add_damage(layer, &graphic->area);
+    g_mutex_unlock(&layer->lock);
+
+    g_print("Overlay graphic '%s' at %i,%i, %ix%i visible\n",
+            graphic->name,
+            graphic->x,
+            graphic->y,
+            graphic->area.w,
+            graphic->area.h);
+}
+
+static int set_graphic(OverlayLayer* layer, OverlayRender* render) {
+    OverlayGraphic* graphic = render_graphic(render);
+
+    overlay_render_free(render);
+    if (!graphic) {
+        return 1;
+    }
+    swap_graphic(layer, graphic);
+
+    return 0;
+}
+
+// Runs in a thread of the GTask pool, it does not touch the layer
+static void render_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable) {
+    OverlayGraphic* graphic = render_graphic(task_data);
+
+    g_task_return_pointer(task, graphic, graphic ? overlay_graphic_free : NULL);
+}
+
+static void set_graphic_async(OverlayRender* render, GAsyncReadyCallback callback, gpointer user_data) {
+    GTask* task = g_task_new(NULL, NULL, callback, user_data);
+
+    g_task_set_task_data(task, render, overlay_render_free);
+    g_task_run_in_thread(task, render_thread);
+    g_object_unref(task);
+}
+
+int overlay_layer_set_image(OverlayLayer* layer, const char* name, int x, int y, const char* path) {
+    OverlayRender* render = overlay_render_new(layer, name, x, y);
+
+    render->path = g_strdup(path);
+
+    return set_graphic(layer, render);
+}
+
+int overlay_layer_set_text(OverlayLayer* layer, const char* name, int x, int y, const char* text, const char* font) {
+    OverlayRender* render = overlay_render_new(layer, name, x, y);
+
+    render->text = g_strdup(text);
+    render->font = g_strdup(font);
+
+    return set_graphic(layer, render);
+}
+
+void overlay_layer_set_image_async(OverlayLayer* layer,
+                                   const char* name,
+                                   int x,
+                                   int y,
+                                   const char* path,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data) {
+    OverlayRender* render = overlay_render_new(layer, name, x, y);
+
+    render->path = g_strdup(path);
+    set_graphic_async(render, callback, user_data);
+}
+
+void overlay_layer_set_text_async(OverlayLayer* layer,
+                                  const char* name,
+                                  int x,
+                                  int y,
+                                  const char* text,
+                                  const char* font,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data) {
+    OverlayRender* render = overlay_render_new(layer, name, x, y);
+
+    render->text = g_strdup(text);
+    render->font = g_strdup(font);
+    set_graphic_async(render, callback, user_data);
+}
+
+int overlay_layer_set_finish(OverlayLayer* layer, GAsyncResult* result) {
+    OverlayGraphic* graphic = g_task_propagate_pointer(G_TASK(result), NULL);
+
+    if (!graphic) {
+        return 1;
+    }
+    swap_graphic(layer, graphic);
+
+    return 0;
+}
+
+// Kept rendering is converted again, new images are swapped in like a replaced graphic
+int overlay_layer_move(OverlayLayer* layer, const char* name, int x, int y) {
+    OverlayGraphic* graphic;
+    OverlayGraphic* moved;
+    guint index;
+
+    g_mutex_lock(&layer->lock);
+    find_graphic(layer, name, &graphic);
+    if (!graphic) {
+        g_mutex_unlock(&layer->lock);
+        g_printerr("Error: there is no graphic '%s'\n", name);
+        return 1;
+    }
+    moved = g_new0(OverlayGraphic, 1);
+    moved->name = g_strdup(name);
+    moved->content = g_strdup(graphic->content);
+    moved->rendering = gst_sample_ref(graphic->rendering);
+    moved->visible = graphic->visible;
+    g_mutex_unlock(&layer->lock);
+
+    moved->x = x;
+    moved->y = y;
+    convert_graphic(&layer->info, moved);
+
+    g_mutex_lock(&layer->lock);
+    index = find_graphic(layer, name, &graphic);
+    if (graphic) {
+        add_damage(layer, &graphic->area);
+        overlay_graphic_free(graphic);
+        g_ptr_array_index(layer->graphics, index) = moved;
+        add_damage(layer, &moved->area);
+        moved = NULL;
+    }
+    g_mutex_unlock(&layer->lock);
+
+    if (moved) {
+        overlay_graphic_free(moved);
+    }
+
+    return 0;
+}
+
+int overlay_layer_remove(OverlayLayer* layer, const char* name) {
+    OverlayGraphic* graphic;
+    guint index;
+
+    g_mutex_lock(&layer->lock);
+    index = find_graphic(layer, name, &graphic);
+    if (graphic) {
+        add_damage(layer, &graphic->area);
+        g_ptr_array_remove_index(layer->graphics, index);
+    }
+    g_mutex_unlock(&layer->lock);
+
+    if (!graphic) {
+        g_printerr("Error: there is no graphic '%s'\n", name);
+        return 1;
+    }
+
+    return 0;
+}
+
+void overlay_layer_describe(OverlayLayer* layer, GString* text) {
+    guint i;
+
+    g_mutex_lock(&layer->lock);
+    for (i = 0; i < layer->graphics->len; ++i) {
+        OverlayGraphic* graphic = g_ptr_array_index(layer->graphics, i);
+        g_string_append_printf(text,
+                               "overlay name=%s x=%i y=%i area=%ix%i %s\n",
+                               graphic->name,
+                               graphic->x,
+                               graphic->y,
+                               graphic->area.w,
+                               graphic->area.h,
+                               graphic->content);
+    }
+    g_mutex_unlock(&layer->lock);
+}
+
+// Draws 'part' of the frame from images of the graphic placed at 'area_x', 'area_y', only bytes under the graphic
+// are touched
+static void draw_part(GstVideoFrame* frame,
+                      const GstVideoRectangle* part,
+                      const GstVideoFrame* pixels,
+                      const GstVideoFrame* alpha,
+                      int area_x,
+                      int area_y) {
+    guint plane;
+
+    for (plane = 0; plane < GST_VIDEO_FRAME_N_PLANES(frame); ++plane) {
+        guint component = plane_component(frame, plane);
+        guint w_sub = GST_VIDEO_FORMAT_INFO_W_SUB(frame->info.finfo, component);
+        guint h_sub = GST_VIDEO_FORMAT_INFO_H_SUB(frame->info.finfo, component);
+        int pixel_stride = GST_VIDEO_FRAME_COMP_PSTRIDE(frame, component);
+        int stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, plane);
+        int image_stride = GST_VIDEO_FRAME_PLANE_STRIDE(pixels, plane);
+        int alpha_stride = GST_VIDEO_FRAME_PLANE_STRIDE(alpha, plane);
+        int image_offset = ((part->x - area_x) >> w_sub) * pixel_stride;
+        int image_row = (part->y - area_y) >> h_sub;
+        int bytes = (part->w >> w_sub) * pixel_stride;
+        int rows = part->h >> h_sub;
+        guint8* data = (guint8*)GST_VIDEO_FRAME_PLANE_DATA(frame, plane) + (part->y >> h_sub) * stride +
+                       (part->x >> w_sub) * pixel_stride;
+        const guint8* image_data =
+            (const guint8*)GST_VIDEO_FRAME_PLANE_DATA(pixels, plane) + image_row * image_stride + image_offset;
+        const guint8* alpha_data =
+            (const guint8*)GST_VIDEO_FRAME_PLANE_DATA(alpha, plane) + image_row * alpha_stride + image_offset;
+        int row;
+
+        for (row = 0; row < rows; ++row) {
+            blend_premultiplied_row(
+                data + row * stride, image_data + row * image_stride, alpha_data + row * alpha_stride, bytes);
+        }
+    }
+}
+
+void overlay_layer_draw(OverlayLayer* layer, GstVideoFrame* frame, const GstVideoRectangle* clip) {
+    GstVideoRectangle frame_rect = {0, 0, GST_VIDEO_FRAME_WIDTH(frame), GST_VIDEO_FRAME_HEIGHT(frame)};
+    guint i;
+
+    g_mutex_lock(&layer->lock);
+    for (i = 0; i < layer->graphics->len; ++i) {
+        OverlayGraphic* graphic = g_ptr_array_index(layer->graphics, i);
+        GstVideoRectangle part;
+        GstVideoFrame pixels;
+        GstVideoFrame alpha;
+
+        if (!graphic->pixels || !rectangle_intersect(&graphic->area, clip ? clip : &frame_rect, &part)) {
+            continue;
+        }
+        if (!gst_video_frame_map(&pixels, &graphic->info, graphic->pixels, GST_MAP_READ)) {
+            continue;
+        }
+        if (!gst_video_frame_map(&alpha, &graphic->info, graphic->alpha, GST_MAP_READ)) {
+            gst_video_frame_unmap(&pixels);
+            continue;
+        }
+        draw_part(frame, &part, &pixels, &alpha, graphic->area.x, graphic->area.y);
+        gst_video_frame_unmap(&alpha);
+        gst_video_frame_unmap(&pixels);
+    }
+    g_mutex_unlock(&layer->lock);
+}
+
+// Changes made before the first call are covered by the first frame, which is drawn whole
+void overlay_layer_take_damage(OverlayLayer* layer, GArray* damage) {
+    g_mutex_lock(&layer->lock);
+    layer->damage_taken = TRUE;
+    g_array_append_vals(damage, layer->damage->data, layer->damage->len);
+    g_array_set_size(layer->damage, 0);
+    g_mutex_unlock(&layer->lock);
+}
+
+// Frames without graphics pass untouched. Others are drawn in place: a frame just produced by the mixer is owned by
+// the pad and its memory is not shared, so making it writable copies nothing
+static GstPadProbeReturn draw_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    OverlayLayer* layer = user_data;
+    GstBuffer* buffer;
+    GstVideoFrame frame;
+    gboolean empty;
+
+    g_mutex_lock(&layer->lock);
+    empty = layer->graphics->len == 0;
+    g_mutex_unlock(&layer->lock);
+    if (empty) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    if (!gst_video_frame_map(&frame, &layer->info, buffer, GST_MAP_WRITE)) {
+        GST_WARNING_OBJECT(pad, "failed to map frame to draw graphics");
+        return GST_PAD_PROBE_OK;
+    }
+    overlay_layer_draw(layer, &frame, NULL);
+    gst_video_frame_unmap(&frame);
+
+    return GST_PAD_PROBE_OK;
+}
+
+void overlay_layer_attach(OverlayLayer* layer, GstPad* pad) {
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, draw_probe, layer, NULL);
+}
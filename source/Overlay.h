@@ -0,0 +1,71 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_OVERLAY_H
+#define TWITCH_STREAMER_OVERLAY_H
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+// Graphics drawn over the mixed video: logos, tickers, captions. Every graphic is decoded or rendered once and
+// converted into a premultiplied image in the output format with alpha of every byte, so drawing it is a single
+// blend of its bounding box (see Blend.h) with no rendering, scaling or conversion. A graphic is rendered again only
+// when it is replaced, moving it converts the kept rendering again. Graphics are drawn in the order they were added.
+// They are changed in the main thread and drawn by the mixer thread, rendering can be done in a thread of its own
+typedef struct _OverlayLayer OverlayLayer;
+
+// Graphics are drawn into frames of given format (I420 or NV12) and size
+OverlayLayer* overlay_layer_new(const char* format, int width, int height);
+
+void overlay_layer_free(OverlayLayer* layer);
+
+// Adds graphic 'name' or replaces it keeping its place in the drawing order. Image is any file GStreamer decodes,
+// video files give their first frame, and it is drawn with its own size and transparency. Top left corner is placed
+// at 'x', 'y', parts outside the frame are clipped
+int overlay_layer_set_image(OverlayLayer* layer, const char* name, int x, int y, const char* path);
+
+// Renders white 'text' with Pango font description 'font' (e.g. "Sans Bold 24"), default font if NULL
+int overlay_layer_set_text(OverlayLayer* layer, const char* name, int x, int y, const char* text, const char* font);
+
+// Same as above, but the graphic is rendered in a GTask thread, so rendering does not block the caller. 'callback' is
+// called in the thread default main context of the caller and swaps the graphic in with overlay_layer_set_finish
+void overlay_layer_set_image_async(OverlayLayer* layer,
+                                   const char* name,
+                                   int x,
+                                   int y,
+                                   const char* path,
+                                   GAsyncReadyCallback callback,
+                                   gpointer user_data);
+
+void overlay_layer_set_text_async(OverlayLayer* layer,
+                                  const char* name,
+                                  int x,
+                                  int y,
+                                  const char* text,
+                                  const char* font,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data);
+
+// Returns non-zero if the graphic could not be rendered, then the layer is not changed
+int overlay_layer_set_finish(OverlayLayer* layer, GAsyncResult* result);
+
+int overlay_layer_move(OverlayLayer* layer, const char* name, int x, int y);
+
+int overlay_layer_remove(OverlayLayer* layer, const char* name);
+
+// Appends a line per graphic with its name, bounding box and content
+void overlay_layer_describe(OverlayLayer* layer, GString* text);
+
+// Draws parts of graphics which are inside 'clip' of 'frame', the whole frame if 'clip' is NULL. Clip has even
+// coordinates, so subsampled chroma is drawn together with luma
+void overlay_layer_draw(OverlayLayer* layer, GstVideoFrame* frame, const GstVideoRectangle* clip);
+
+// Appends areas of the frame changed by graphics since the previous call to 'damage' (array of GstVideoRectangle),
+// for mixers which redraw only what changed
+void overlay_layer_take_damage(OverlayLayer* layer, GArray* damage);
+
+// Draws graphics into every frame passing 'pad', for mixers which produce a new frame every time. Frames are drawn
+// in place unless they are shared
+void overlay_layer_attach(OverlayLayer* layer, GstPad* pad);
+
+#endif // TWITCH_STREAMER_OVERLAY_H
@@ -0,0 +1,77 @@
+// (c) Alexander Voitenko 2021 - present
+
+// Checks that x264enc accepts every value of every encoder profile. A value out of range or a property the installed
+// encoder does not have is rejected by GObject with a warning, so warnings are counted and properties are read back
+
+#include "EncoderProfile.h"
+
+#include <gst/gst.h>
+
+// Bitrates and frame rates of the main encoder and of typical ladder rungs
+static const int check_bitrates[] = {400, 768, 2500, 6000};
+static const int check_framerates[] = {24, 30, 60};
+static const int check_threads[] = {0, 1, 4};
+
+static int rejected_values;
+
+static void warning_handler(const gchar* log_domain, GLogLevelFlags log_level, const gchar* message, gpointer data) {
+    g_printerr("Error: %s\n", message);
+    ++rejected_values;
+}
+
+static int check_profile(EncoderProfile profile) {
+    int failures = 0;
+    guint i;
+    guint j;
+    guint k;
+
+    for (i = 0; i < G_N_ELEMENTS(check_bitrates); ++i) {
+        for (j = 0; j < G_N_ELEMENTS(check_framerates); ++j) {
+            for (k = 0; k < G_N_ELEMENTS(check_threads); ++k) {
+                GstElement* encoder = gst_element_factory_make("x264enc", NULL);
+                int rejected = rejected_values;
+
+                if (!encoder) {
+                    g_printerr("Error: x264enc is not available\n");
+                    return 1;
+                }
+
+                encoder_profile_apply(profile, encoder, check_bitrates[i], check_framerates[j], check_threads[k]);
+                if (encoder_profile_check(
+                        profile, encoder, check_bitrates[i], check_framerates[j], check_threads[k]) != 0 ||
+                    rejected_values != rejected) {
+                    g_printerr("Error: profile '%s' is not accepted at %i kbit/s, %i fps, %i threads\n",
+                               encoder_profile_to_string(profile),
+                               check_bitrates[i],
+                               check_framerates[j],
+                               check_threads[k]);
+                    ++failures;
+                }
+                gst_object_unref(encoder);
+            }
+        }
+    }
+
+    g_print("Profile %s: %s\n", encoder_profile_to_string(profile), failures == 0 ? "ok" : "failed");
+
+    return failures > 0;
+}
+
+int main(int argc, char* argv[]) {
+    static const EncoderProfile profiles[] = {
+        ENCODER_PROFILE_LOW_LATENCY,
+        ENCODER_PROFILE_QUALITY,
+        ENCODER_PROFILE_CPU_SAVER,
+    };
+    int result = 0;
+    guint i;
+
+    gst_init(&argc, &argv);
+    g_log_set_handler("GLib-GObject", G_LOG_LEVEL_WARNING | G_LOG_LEVEL_CRITICAL, warning_handler, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(profiles); ++i) {
+        result |= check_profile(profiles[i]);
+    }
+
+    return result;
+}
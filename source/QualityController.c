@@ -0,0 +1,218 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "QualityController.h"
+
+// Pressure: the video queue holds more than this, i.e. the encoder is behind the mixer
+#define HIGH_QUEUE_LEVEL (1 * GST_SECOND)
+// Calm: the video queue holds less than this
+#define LOW_QUEUE_LEVEL (GST_SECOND / 5)
+// Share of frame duration spent by the encoder per frame, above the high one the encoder is about to fall behind
+#define HIGH_ENCODE_LOAD 0.9
+#define LOW_ENCODE_LOAD 0.6
+// Updates between two level decreases, so the effect of a change is seen before the next one
+#define DEGRADE_HOLD 2
+// Calm updates in a row before quality is raised by one level
+#define RECOVER_HOLD 10
+
+static const QualityLevel quality_levels[] = {
+    {100, 1, FALSE},
+    {75, 1, FALSE},
+    {75, 1, TRUE},
+    {50, 1, TRUE},
+    {50, 2, TRUE},
+};
+
+#define QUALITY_LEVEL_COUNT (int)(sizeof(quality_levels) / sizeof(quality_levels[0]))
+
+struct _QualityController {
+    GstElement* video_queue;
+    GstElement* audio_queue;
+    int framerate;
+
+    int level;
+    int updates_since_change;
+    int calm_updates;
+    int late_messages; // since the previous update, counted in the main thread
+    GPtrArray* qos_elements; // GstElement*, QoS messages of other elements are ignored
+
+    gint overruns; // since the previous update, counted in streaming threads
+
+    // Time from a frame entering the encoder to the encoded frame leaving it. Only frames which leave in the same chain
+    // call they entered are counted: with lookahead, B-frames or frame threads the frame that leaves is an earlier
+    // one, and its time would include the delay, not the work done per frame
+    GMutex lock;
+    GstClockTime entry_pts;
+    gint64 entry_time;
+    gint64 encode_time;
+    guint encoded_frames;
+};
+
+static void overrun_handler(GstElement* queue, gpointer user_data) {
+    QualityController* controller = user_data;
+
+    g_atomic_int_inc(&controller->overruns);
+}
+
+static GstPadProbeReturn encoder_entry_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    QualityController* controller = user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    g_mutex_lock(&controller->lock);
+    controller->entry_pts = GST_BUFFER_PTS(buffer);
+    controller->entry_time = g_get_monotonic_time();
+    g_mutex_unlock(&controller->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Encoded frame keeps the timestamp of the raw one
+static GstPadProbeReturn encoder_exit_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    QualityController* controller = user_data;
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    g_mutex_lock(&controller->lock);
+    if (controller->entry_time > 0 && GST_BUFFER_PTS_IS_VALID(buffer) &&
+        GST_BUFFER_PTS(buffer) == controller->entry_pts) {
+        controller->encode_time += g_get_monotonic_time() - controller->entry_time;
+        ++controller->encoded_frames;
+        controller->entry_time = 0;
+    }
+    g_mutex_unlock(&controller->lock);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void add_probe(GstElement* element, const char* pad_name, GstPadProbeCallback callback, gpointer user_data) {
+    GstPad* pad = gst_element_get_static_pad(element, pad_name);
+
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, user_data, NULL);
+    gst_object_unref(pad);
+}
+
+QualityController* quality_controller_new(GstElement* video_queue,
+                                          GstElement* audio_queue,
+                                          GstElement* encoder,
+                                          int framerate) {
+    QualityController* controller = g_new0(QualityController, 1);
+
+    controller->video_queue = gst_object_ref(video_queue);
+    controller->audio_queue = audio_queue ? gst_object_ref(audio_queue) : NULL;
+    controller->framerate = framerate;
+    controller->qos_elements = g_ptr_array_new_with_free_func(gst_object_unref);
+    g_mutex_init(&controller->lock);
+
+    // Leaky queue emits overrun right before it drops a buffer
+    g_signal_connect(video_queue, "overrun", G_CALLBACK(overrun_handler), controller);
+    if (audio_queue) {
+        g_signal_connect(audio_queue, "overrun", G_CALLBACK(overrun_handler), controller);
+    }
+    add_probe(encoder, "sink", encoder_entry_probe, controller);
+    add_probe(encoder, "src", encoder_exit_probe, controller);
+
+    quality_controller_watch_qos(controller, video_queue);
+    if (audio_queue) {
+        quality_controller_watch_qos(controller, audio_queue);
+    }
+    quality_controller_watch_qos(controller, encoder);
+
+    return controller;
+}
+
+void quality_controller_free(QualityController* controller) {
+    if (!controller) {
+        return;
+    }
+
+    gst_object_unref(controller->video_queue);
+    if (controller->audio_queue) {
+        gst_object_unref(controller->audio_queue);
+    }
+    g_ptr_array_unref(controller->qos_elements);
+    g_mutex_clear(&controller->lock);
+    g_free(controller);
+}
+
+void quality_controller_watch_qos(QualityController* controller, GstElement* element) {
+    g_ptr_array_add(controller->qos_elements, gst_object_ref(element));
+}
+
+void quality_controller_handle_qos(QualityController* controller, GstMessage* msg) {
+    gint64 jitter = 0;
+    guint i;
+
+    for (i = 0; i < controller->qos_elements->len; ++i) {
+        if (gst_object_has_as_ancestor(GST_MESSAGE_SRC(msg), g_ptr_array_index(controller->qos_elements, i))) {
+            break;
+        }
+    }
+    if (i == controller->qos_elements->len) {
+        return;
+    }
+
+    gst_message_parse_qos_values(msg, &jitter, NULL, NULL);
+    if (jitter > 0) {
+        ++controller->late_messages;
+    }
+}
+
+const QualityLevel* quality_controller_update(QualityController* controller) {
+    const QualityLevel* current = &quality_levels[controller->level];
+    guint64 queue_level = 0;
+    gint overruns = g_atomic_int_and(&controller->overruns, 0);
+    int late_messages = controller->late_messages;
+    gdouble frame_duration_ms = 1000.0 * current->framerate_divisor / controller->framerate;
+    gdouble encode_ms = 0.0;
+    gboolean pressure;
+    gboolean calm;
+
+    controller->late_messages = 0;
+    ++controller->updates_since_change;
+    g_object_get(controller->video_queue, "current-level-time", &queue_level, NULL);
+
+    g_mutex_lock(&controller->lock);
+    if (controller->encoded_frames > 0) {
+        encode_ms = controller->encode_time / 1000.0 / controller->encoded_frames;
+    }
+    controller->encode_time = 0;
+    controller->encoded_frames = 0;
+    g_mutex_unlock(&controller->lock);
+
+    pressure = overruns > 0 || late_messages > 0 || queue_level > HIGH_QUEUE_LEVEL ||
+               encode_ms > frame_duration_ms * HIGH_ENCODE_LOAD;
+    calm = !pressure && queue_level < LOW_QUEUE_LEVEL && encode_ms < frame_duration_ms * LOW_ENCODE_LOAD;
+
+    if (pressure) {
+        controller->calm_updates = 0;
+        if (controller->level + 1 >= QUALITY_LEVEL_COUNT || controller->updates_since_change < DEGRADE_HOLD) {
+            return NULL;
+        }
+        ++controller->level;
+    } else if (calm) {
+        if (++controller->calm_updates < RECOVER_HOLD || controller->level == 0) {
+            return NULL;
+        }
+        --controller->level;
+    } else {
+        controller->calm_updates = 0;
+        return NULL;
+    }
+
+    g_print("Quality level %i of %i (queue %.2f s, %i overruns, %i late elements, encoding %.1f of %.1f ms per "
+            "frame): %i%% bitrate, 1/%i framerate, %s\n",
+            controller->level,
+            QUALITY_LEVEL_COUNT - 1,
+            (gdouble)queue_level / GST_SECOND,
+            overruns,
+            late_messages,
+            encode_ms,
+            frame_duration_ms,
+            quality_levels[controller->level].bitrate_percent,
+            quality_levels[controller->level].framerate_divisor,
+            quality_levels[controller->level].skip_frames ? "non-reference frames are not decoded"
+                                                          : "all frames are decoded");
+
+    controller->updates_since_change = 0;
+    controller->calm_updates = 0;
+
+    return &quality_levels[controller->level];
+}
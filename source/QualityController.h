@@ -0,0 +1,42 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_QUALITY_CONTROLLER_H
+#define TWITCH_STREAMER_QUALITY_CONTROLLER_H
+
+#include <gst/gst.h>
+
+// Settings of one quality level, level 0 is the configured quality and every next level is cheaper than the previous
+typedef struct _QualityLevel {
+    int bitrate_percent;   // of configured bitrate of every video encoder
+    int framerate_divisor; // only every such composited frame is streamed, caps keep the configured frame rate
+    gboolean skip_frames;  // decoders do not decode non-reference frames
+} QualityLevel;
+
+// Feedback controller which trades quality for smoothness. Pressure is detected from overruns and fill level of the
+// stream queues, QoS messages of late elements of the main stream and time the encoder spends per frame. Under
+// pressure quality is lowered one level at a time, it is raised back one level at a time after a calm period, so it
+// does not oscillate
+typedef struct _QualityController QualityController;
+
+// Watches leaky stream queues and the main video encoder, 'audio_queue' may be NULL. QoS messages of these elements
+// are counted
+QualityController* quality_controller_new(GstElement* video_queue,
+                                          GstElement* audio_queue,
+                                          GstElement* encoder,
+                                          int framerate);
+
+// Pipeline must be already stopped, probes and signal handlers count into the controller
+void quality_controller_free(QualityController* controller);
+
+// QoS messages of 'element' and its children are counted as well, e.g. of output sinks. Preview and ladder rungs are
+// not watched, their lateness does not delay the main stream
+void quality_controller_watch_qos(QualityController* controller, GstElement* element);
+
+// Counts QoS message of a late watched element, is called from the bus handler
+void quality_controller_handle_qos(QualityController* controller, GstMessage* msg);
+
+// Evaluates pressure since the previous call, is called periodically from the main loop. Returns the new level if it
+// has changed, NULL otherwise
+const QualityLevel* quality_controller_update(QualityController* controller);
+
+#endif // TWITCH_STREAMER_QUALITY_CONTROLLER_H
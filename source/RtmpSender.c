@@ -0,0 +1,347 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "RtmpSender.h"
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+// Backlog is dropped entirely if it grows above this size, until the next keyframe arrives
+#define BACKLOG_MAX_BYTES (16 * 1024 * 1024)
+// Live tags are dropped until the next keyframe if this much data is waiting to be sent
+#define SEND_QUEUE_MAX_BYTES (4 * 1024 * 1024)
+
+#define RECONNECT_INITIAL_DELAY (250 * G_TIME_SPAN_MILLISECOND)
+#define RECONNECT_MAX_DELAY (10 * G_TIME_SPAN_SECOND)
+// Connection which lived this long is considered to be stable, so backoff starts from the beginning
+#define STABLE_CONNECTION_TIME (10 * G_TIME_SPAN_SECOND)
+#define BUS_POLL_INTERVAL (100 * GST_MSECOND)
+// After end of stream the last tags are still being sent when sender is stopped, it waits for them this long
+#define EOS_DRAIN_TIMEOUT (2 * G_TIME_SPAN_SECOND)
+
+struct _RtmpSender {
+    gchar* name;
+    gchar* location;
+    GThread* thread;
+
+    GMutex lock;
+    GCond cond;
+    gboolean stopping;
+    gboolean eos;
+    GstCaps* caps;                // contains FLV stream headers
+    GQueue backlog;               // GstBuffer*, starts from the last keyframe
+    gsize backlog_bytes;
+    gboolean backlog_overflow;    // backlog is not collected until the next keyframe
+    gboolean send_queue_overflow; // live tags are not sent until the next keyframe
+    GstElement* appsrc;           // not NULL while sender pipeline is running
+};
+
+static gboolean is_keyframe(GstBuffer* buffer) {
+    // flvmux marks all audio tags as delta units when there is video
+    return !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) &&
+           !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_HEADER);
+}
+
+// Must be called with the lock held
+static void clear_backlog(RtmpSender* sender) {
+    g_queue_clear_full(&sender->backlog, (GDestroyNotify)gst_buffer_unref);
+    sender->backlog_bytes = 0;
+}
+
+// Must be called with the lock held
+static void store_in_backlog(RtmpSender* sender, GstBuffer* buffer) {
+    gsize size = gst_buffer_get_size(buffer);
+
+    if (is_keyframe(buffer)) {
+        clear_backlog(sender);
+        sender->backlog_overflow = FALSE;
+    }
+
+    if (sender->backlog_overflow) {
+        return;
+    }
+
+    if (sender->backlog_bytes + size > BACKLOG_MAX_BYTES) {
+        g_printerr("Warning: backlog of output '%s' is full, it is dropped until the next keyframe\n", sender->name);
+        clear_backlog(sender);
+        sender->backlog_overflow = TRUE;
+        return;
+    }
+
+    g_queue_push_tail(&sender->backlog, gst_buffer_ref(buffer));
+    sender->backlog_bytes += size;
+}
+
+// Must be called with the lock held
+static void send_live(RtmpSender* sender, GstBuffer* buffer) {
+    guint64 queued_bytes;
+
+    if (!sender->appsrc) {
+        return;
+    }
+
+    queued_bytes = gst_app_src_get_current_level_bytes(GST_APP_SRC(sender->appsrc));
+    if (queued_bytes > SEND_QUEUE_MAX_BYTES) {
+        if (!sender->send_queue_overflow) {
+            g_printerr("Warning: output '%s' can not keep up, tags are dropped until the next keyframe\n",
+                       sender->name);
+        }
+        sender->send_queue_overflow = TRUE;
+    } else if (sender->send_queue_overflow && is_keyframe(buffer)) {
+        sender->send_queue_overflow = FALSE;
+    }
+
+    if (!sender->send_queue_overflow) {
+        gst_app_src_push_buffer(GST_APP_SRC(sender->appsrc), gst_buffer_ref(buffer));
+    }
+}
+
+static GstFlowReturn on_new_sample(GstAppSink* appsink, gpointer user_data) {
+    RtmpSender* sender = user_data;
+    GstSample* sample = gst_app_sink_pull_sample(appsink);
+    GstBuffer* buffer;
+    GstCaps* caps;
+
+    if (!sample) {
+        return GST_FLOW_EOS;
+    }
+
+    buffer = gst_sample_get_buffer(sample);
+    caps = gst_sample_get_caps(sample);
+
+    g_mutex_lock(&sender->lock);
+    if (caps && (!sender->caps || !gst_caps_is_equal(caps, sender->caps))) {
+        gst_caps_replace(&sender->caps, caps);
+        if (sender->appsrc) {
+            gst_app_src_set_caps(GST_APP_SRC(sender->appsrc), caps);
+        }
+        g_cond_broadcast(&sender->cond);
+    }
+
+    // Header tags are sent by rtmpsink itself from the stream headers in caps on every connection
+    if (buffer && !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_HEADER)) {
+        store_in_backlog(sender, buffer);
+        send_live(sender, buffer);
+    }
+    g_mutex_unlock(&sender->lock);
+
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+static void on_eos(GstAppSink* appsink, gpointer user_data) {
+    RtmpSender* sender = user_data;
+
+    g_mutex_lock(&sender->lock);
+    sender->eos = TRUE;
+    if (sender->appsrc) {
+        gst_app_src_end_of_stream(GST_APP_SRC(sender->appsrc));
+    }
+    g_cond_broadcast(&sender->cond);
+    g_mutex_unlock(&sender->lock);
+}
+
+static GstElement* create_sender_pipeline(RtmpSender* sender, GstCaps* caps, GstElement** appsrc) {
+    GstElement* pipeline = gst_pipeline_new(NULL);
+    GstElement* sink = gst_element_factory_make("rtmpsink", NULL);
+
+    *appsrc = gst_element_factory_make("appsrc", NULL);
+    if (!pipeline || !*appsrc || !sink) {
+        g_printerr("Error: failed to create sender pipeline of output '%s'\n", sender->name);
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        if (*appsrc) {
+            gst_object_unref(*appsrc);
+        }
+        if (sink) {
+            gst_object_unref(sink);
+        }
+        return NULL;
+    }
+
+    // Tags arrive already paced by the main pipeline, so they are sent as soon as possible
+    g_object_set(*appsrc, "caps", caps, "format", GST_FORMAT_TIME, "is-live", TRUE, "block", FALSE, NULL);
+    g_object_set(sink, "location", sender->location, "sync", FALSE, NULL);
+
+    gst_bin_add_many(GST_BIN(pipeline), *appsrc, sink, NULL);
+    if (!gst_element_link(*appsrc, sink)) {
+        g_printerr("Error: failed to link sender pipeline of output '%s'\n", sender->name);
+        gst_object_unref(pipeline);
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+// Blocks until sender pipeline fails, finishes or sender is stopped. Stopped sender which has got end of stream
+// keeps waiting for a while, so the last tags reach the server
+static void wait_for_disconnect(RtmpSender* sender, GstElement* pipeline) {
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gint64 drain_end_time = 0;
+
+    for (;;) {
+        GstMessage* msg = gst_bus_timed_pop_filtered(bus, BUS_POLL_INTERVAL, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+        gboolean stopping;
+
+        if (msg) {
+            if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+                GError* err;
+                gchar* debug_info;
+
+                gst_message_parse_error(msg, &err, &debug_info);
+                g_printerr("Error: output '%s' failed: %s\n", sender->name, err->message);
+                g_clear_error(&err);
+                g_free(debug_info);
+            } else {
+                g_print("Output '%s' finished\n", sender->name);
+            }
+            gst_message_unref(msg);
+            break;
+        }
+
+        g_mutex_lock(&sender->lock);
+        stopping = sender->stopping;
+        if (stopping && sender->eos) {
+            if (drain_end_time == 0) {
+                drain_end_time = g_get_monotonic_time() + EOS_DRAIN_TIMEOUT;
+            }
+            stopping = g_get_monotonic_time() >= drain_end_time;
+            if (stopping) {
+                g_printerr("Warning: output '%s' is stopped before the end of stream is sent\n", sender->name);
+            }
+        }
+        g_mutex_unlock(&sender->lock);
+        if (stopping) {
+            break;
+        }
+    }
+
+    gst_object_unref(bus);
+}
+
+static gpointer sender_thread(gpointer user_data) {
+    RtmpSender* sender = user_data;
+    gint64 delay = RECONNECT_INITIAL_DELAY;
+    guint connection = 0;
+
+    g_mutex_lock(&sender->lock);
+    while (!sender->stopping && !sender->eos) {
+        GstElement* pipeline;
+        GstElement* appsrc;
+        GstCaps* caps;
+        gint64 connected_time;
+        gint64 retry_time;
+        guint replayed = 0;
+        GList* item;
+
+        // Nothing can be sent before stream headers are known
+        if (!sender->caps) {
+            g_cond_wait(&sender->cond, &sender->lock);
+            continue;
+        }
+
+        caps = gst_caps_ref(sender->caps);
+        g_mutex_unlock(&sender->lock);
+
+        pipeline = create_sender_pipeline(sender, caps, &appsrc);
+        gst_caps_unref(caps);
+        if (pipeline && gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            g_printerr("Error: unable to start sender pipeline of output '%s'\n", sender->name);
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            gst_object_unref(pipeline);
+            pipeline = NULL;
+        }
+
+        if (pipeline) {
+            // Replay starts from the last keyframe, so the server can decode stream immediately
+            g_mutex_lock(&sender->lock);
+            for (item = sender->backlog.head; item; item = item->next) {
+                gst_app_src_push_buffer(GST_APP_SRC(appsrc), gst_buffer_ref(item->data));
+                ++replayed;
+            }
+            sender->appsrc = appsrc;
+            sender->send_queue_overflow = FALSE;
+            g_mutex_unlock(&sender->lock);
+
+            ++connection;
+            connected_time = g_get_monotonic_time();
+            g_print("Output '%s': connection %u to '%s' started, %u backlog tags replayed\n",
+                    sender->name,
+                    connection,
+                    sender->location,
+                    replayed);
+
+            wait_for_disconnect(sender, pipeline);
+
+            g_mutex_lock(&sender->lock);
+            sender->appsrc = NULL;
+            g_mutex_unlock(&sender->lock);
+
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            gst_object_unref(pipeline);
+
+            if (g_get_monotonic_time() - connected_time >= STABLE_CONNECTION_TIME) {
+                delay = RECONNECT_INITIAL_DELAY;
+            }
+        }
+
+        g_mutex_lock(&sender->lock);
+        if (sender->stopping || sender->eos) {
+            break;
+        }
+
+        g_print("Output '%s': reconnecting in %" G_GINT64_FORMAT " ms\n", sender->name, delay / 1000);
+        retry_time = g_get_monotonic_time() + delay;
+        while (!sender->stopping && !sender->eos && g_cond_wait_until(&sender->cond, &sender->lock, retry_time)) {
+            // Woken up by new caps, keep waiting until retry time, stop request or end of stream
+        }
+        delay = MIN(delay * 2, RECONNECT_MAX_DELAY);
+    }
+    g_mutex_unlock(&sender->lock);
+
+    return NULL;
+}
+
+RtmpSender* rtmp_sender_new(const char* name, const char* location) {
+    RtmpSender* sender = g_new0(RtmpSender, 1);
+
+    sender->name = g_strdup(name);
+    sender->location = g_strdup(location);
+    g_mutex_init(&sender->lock);
+    g_cond_init(&sender->cond);
+    g_queue_init(&sender->backlog);
+    sender->thread = g_thread_new(name, sender_thread, sender);
+
+    return sender;
+}
+
+void rtmp_sender_free(RtmpSender* sender) {
+    if (!sender) {
+        return;
+    }
+
+    g_mutex_lock(&sender->lock);
+    sender->stopping = TRUE;
+    g_cond_broadcast(&sender->cond);
+    g_mutex_unlock(&sender->lock);
+    g_thread_join(sender->thread);
+
+    clear_backlog(sender);
+    if (sender->caps) {
+        gst_caps_unref(sender->caps);
+    }
+    g_cond_clear(&sender->cond);
+    g_mutex_clear(&sender->lock);
+    g_free(sender->location);
+    g_free(sender->name);
+    g_free(sender);
+}
+
+void rtmp_sender_attach(RtmpSender* sender, GstElement* appsink) {
+    GstAppSinkCallbacks callbacks = {0};
+
+    callbacks.eos = on_eos;
+    callbacks.new_sample = on_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, sender, NULL);
+}
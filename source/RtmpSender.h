@@ -0,0 +1,23 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_RTMP_SENDER_H
+#define TWITCH_STREAMER_RTMP_SENDER_H
+
+#include <gst/gst.h>
+
+// Sends FLV stream to RTMP server from its own small pipeline (appsrc ! rtmpsink), so network errors never reach the
+// main pipeline: encoders keep running, and the sender reconnects with exponential backoff. Encoded FLV tags starting
+// from the last keyframe are kept in a bounded backlog and replayed once connection is back
+typedef struct _RtmpSender RtmpSender;
+
+// Creates sender and starts its connection thread
+RtmpSender* rtmp_sender_new(const char* name, const char* location);
+
+// Stops connection thread and frees sender. Appsink attached to the sender should be already stopped. If it has got end
+// of stream, the sender waits (a couple of seconds at most) until the end of stream is sent to the server
+void rtmp_sender_free(RtmpSender* sender);
+
+// Makes sender consume FLV tags arriving to 'appsink'
+void rtmp_sender_attach(RtmpSender* sender, GstElement* appsink);
+
+#endif // TWITCH_STREAMER_RTMP_SENDER_H
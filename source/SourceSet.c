@@ -0,0 +1,580 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "SourceSet.h"
+
+#include "ClipCache.h"
+
+// Replacement source which has not prerolled in this time is dropped and the old source keeps playing
+#define SOURCE_PREROLL_TIMEOUT 10 // s
+
+// Removal or replacement of a source in progress
+typedef struct _SourceChange {
+    int index;
+    GstElement* old_source;
+    gint old_pads_pending; // linked pads of the old source which are not blocked yet
+    gboolean old_blocking_started;
+    GstElement* new_source; // NULL for removal
+    guint new_preroll_timeout;
+    ControlReply* reply; // sent when the change is finished or aborted
+    GPtrArray* new_pads; // PendingPad*, pads of the new source waiting for the old source to be unlinked
+} SourceChange;
+
+struct _SourceSet {
+    GstElement* pipeline;
+    GMutex* lock; // of the owner, protects the change pointer as well
+    int main_index;
+    SourceSetCallbacks callbacks;
+    gpointer user_data;
+    SourceChange* change;
+};
+
+// Source pad waiting in blocked state until it is linked by the main thread
+typedef struct _PendingPad {
+    SourceSet* set;
+    GstElement* source;
+    GstPad* pad;
+    gulong probe_id;
+    gboolean is_video;
+} PendingPad;
+
+// Looping state of a file source, attached to the source element
+typedef struct _SourceLoop {
+    GstElement* source;      // not referenced, the loop is owned by the source
+    GstPad* pad;             // pad used to send seeks, the first one which appeared
+    gboolean started;        // initial segment seek is done
+    GPtrArray* pending_pads; // PendingPad*, pads waiting for the initial seek
+    guint count;             // number of completed passes
+} SourceLoop;
+
+static gboolean pending_pad_handler(gpointer user_data);
+
+static void start_source_change(SourceSet* set);
+
+static void pending_pad_free(gpointer user_data) {
+    PendingPad* pending = user_data;
+
+    gst_object_unref(pending->pad);
+    gst_object_unref(pending->source);
+    g_free(pending);
+}
+
+static void source_change_free(SourceChange* change) {
+    gst_object_unref(change->old_source);
+    if (change->new_source) {
+        gst_object_unref(change->new_source);
+    }
+    g_ptr_array_unref(change->new_pads);
+    g_free(change);
+}
+
+static void source_loop_free(gpointer user_data) {
+    SourceLoop* loop = user_data;
+
+    g_ptr_array_unref(loop->pending_pads);
+    g_free(loop);
+}
+
+int source_set_find(SourceSet* set, GstElement* element) {
+    GstElement* source;
+    int i;
+
+    // This is linear search but in case of small number of sources impact is not noticeable
+    for (i = 0; (source = set->callbacks.get_source(i, set->user_data)); ++i) {
+        if (source == element) {
+            return i;
+        }
+    }
+
+    // Replacement is configured for the place of the source it replaces
+    if (set->change && set->change->new_source == element) {
+        return set->change->index;
+    }
+
+    return -1;
+}
+
+gboolean source_set_is_changing(SourceSet* set) {
+    return set->change != NULL;
+}
+
+static void link_pending_pad(PendingPad* pending, int index) {
+    SourceSet* set = pending->set;
+
+    set->callbacks.link_pad(index, pending->pad, pending->is_video, set->user_data);
+    gst_pad_remove_probe(pending->pad, pending->probe_id);
+    pending_pad_free(pending);
+}
+
+static SourceLoop* get_source_loop(GstElement* source) {
+    return g_object_get_data(G_OBJECT(source), "source-loop");
+}
+
+static void send_loop_seek(SourceLoop* loop, GstSeekFlags flags) {
+    GstEvent* seek =
+        gst_event_new_seek(1.0, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+
+    if (!gst_pad_send_event(loop->pad, seek)) {
+        g_printerr("Error: segment seek failed, source '%s' will not loop\n", GST_ELEMENT_NAME(loop->source));
+    }
+}
+
+// Pads of the source are blocked while the initial seek is done, now they can be linked
+static gboolean loop_started(gpointer user_data) {
+    SourceLoop* loop = user_data;
+    guint i;
+
+    loop->started = TRUE;
+    for (i = 0; i < loop->pending_pads->len; ++i) {
+        pending_pad_handler(g_ptr_array_index(loop->pending_pads, i));
+    }
+    g_ptr_array_set_size(loop->pending_pads, 0);
+    gst_object_unref(loop->source);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Runs in a thread of its own: seeks are not allowed from the main thread, which may be waiting for state change, nor
+// from streaming threads of the source
+static void start_loop(GstElement* source, gpointer user_data) {
+    SourceLoop* loop = user_data;
+
+    // Flush does not reach the rest of the pipeline, because pads of the source are not linked yet
+    send_loop_seek(loop, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT);
+    g_idle_add(loop_started, loop);
+}
+
+static void rewind_loop(GstElement* source, gpointer user_data) {
+    SourceLoop* loop = user_data;
+
+    // Non-flushing seek queues the next segment after the current one, so its running time follows without a gap
+    send_loop_seek(loop, GST_SEEK_FLAG_SEGMENT);
+    g_print("Source '%s' looped %u time(s)\n", GST_ELEMENT_NAME(source), ++loop->count);
+}
+
+static GstPadProbeReturn loop_event_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    SourceLoop* loop = user_data;
+
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_SEGMENT_DONE) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // The event would make encoders and muxers drain, every pad gets it but the source is rewound once
+    if (pad == loop->pad) {
+        gst_element_call_async(loop->source, rewind_loop, loop, NULL);
+    }
+
+    return GST_PAD_PROBE_DROP;
+}
+
+// Holds pads of a looping source until it is switched to segment mode. Returns TRUE if the pad is taken
+static gboolean hold_loop_pad(PendingPad* pending) {
+    SourceLoop* loop = get_source_loop(pending->source);
+
+    if (!loop || loop->started) {
+        return FALSE;
+    }
+
+    g_ptr_array_add(loop->pending_pads, pending);
+
+    if (!loop->pad) {
+        loop->pad = pending->pad;
+        gst_object_ref(loop->source);
+        gst_element_call_async(loop->source, start_loop, loop, NULL);
+    }
+
+    return TRUE;
+}
+
+static gboolean pending_pad_handler(gpointer user_data) {
+    PendingPad* pending = user_data;
+    SourceSet* set = pending->set;
+    SourceChange* change = set->change;
+    int index;
+
+    if (hold_loop_pad(pending)) {
+        return G_SOURCE_REMOVE;
+    }
+
+    // Video pad of the replacement means that it has prerolled, so the old source can be unlinked
+    if (change && change->new_source == pending->source) {
+        g_ptr_array_add(change->new_pads, pending);
+        if (pending->is_video && !change->old_blocking_started) {
+            start_source_change(set);
+        }
+        return G_SOURCE_REMOVE;
+    }
+
+    // Pad of a source which has been removed meanwhile stays blocked until the source is stopped
+    index = source_set_find(set, pending->source);
+    if (index < 0) {
+        pending_pad_free(pending);
+        return G_SOURCE_REMOVE;
+    }
+
+    link_pending_pad(pending, index);
+
+    return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn block_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    // Data flow stays blocked as long as the probe is installed
+    return GST_PAD_PROBE_OK;
+}
+
+// Blocks the pad until it is linked by the main thread
+static void queue_source_pad(SourceSet* set, GstElement* source, GstPad* pad, gboolean is_video) {
+    PendingPad* pending = g_new0(PendingPad, 1);
+    SourceLoop* loop = get_source_loop(source);
+
+    pending->set = set;
+    pending->source = gst_object_ref(source);
+    pending->pad = gst_object_ref(pad);
+    pending->is_video = is_video;
+    pending->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, block_probe, NULL, NULL);
+
+    if (loop) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, loop_event_probe, loop, NULL);
+    }
+
+    g_idle_add(pending_pad_handler, pending);
+}
+
+// This function will be called by the pad-added signal. Pads are linked in the main thread, which owns the topology,
+// until then the streaming thread of the pad is blocked
+static void pad_added_handler(GstElement* src, GstPad* new_pad, SourceSet* set) {
+    GstCaps* new_pad_caps;
+    const gchar* new_pad_type;
+
+    g_print("Received new pad '%s' from '%s':\n", GST_PAD_NAME(new_pad), GST_ELEMENT_NAME(src));
+
+    // Check the new pad's type
+    new_pad_caps = gst_pad_get_current_caps(new_pad);
+    if (!new_pad_caps) {
+        g_print("Pad has no caps, ignoring it\n");
+        return;
+    }
+    new_pad_type = gst_structure_get_name(gst_caps_get_structure(new_pad_caps, 0));
+    if (!g_str_has_prefix(new_pad_type, "audio/x-raw") && !g_str_has_prefix(new_pad_type, "video/x-raw")) {
+        g_print("Type is '%s', ignoring it\n", new_pad_type);
+        gst_caps_unref(new_pad_caps);
+        return;
+    }
+    // Raw audio streams need no decoding, but they are not mixed either
+    if (g_str_has_prefix(new_pad_type, "audio/x-raw") && g_object_get_data(G_OBJECT(src), "skip-audio-pads")) {
+        g_print("Audio of the source is off, ignoring it\n");
+        gst_caps_unref(new_pad_caps);
+        return;
+    }
+
+    queue_source_pad(set, src, new_pad, g_str_has_prefix(new_pad_type, "video/x-raw"));
+    gst_caps_unref(new_pad_caps);
+}
+
+void source_set_watch(SourceSet* set, GstElement* source, gboolean link_audio, gboolean loop) {
+    GstPad* pad;
+
+    if (clip_cache_is_source(source)) {
+        pad = gst_element_get_static_pad(source, "src");
+        queue_source_pad(set, source, pad, TRUE);
+        gst_object_unref(pad);
+        return;
+    }
+
+    if (loop) {
+        SourceLoop* source_loop = g_new0(SourceLoop, 1);
+        source_loop->source = source;
+        source_loop->pending_pads = g_ptr_array_new();
+        g_object_set_data_full(G_OBJECT(source), "source-loop", source_loop, source_loop_free);
+    }
+
+    if (!link_audio) {
+        g_object_set_data(G_OBJECT(source), "skip-audio-pads", GINT_TO_POINTER(TRUE));
+    }
+    g_signal_connect(source, "pad-added", G_CALLBACK(pad_added_handler), set);
+}
+
+void source_set_start(SourceSet* set, GstElement* source) {
+    g_object_set_data(G_OBJECT(source), "runtime-source", GINT_TO_POINTER(TRUE));
+    gst_bin_add(GST_BIN(set->pipeline), source);
+    gst_element_sync_state_with_parent(source);
+}
+
+static void set_change(SourceSet* set, SourceChange* change) {
+    g_mutex_lock(set->lock);
+    set->change = change;
+    g_mutex_unlock(set->lock);
+}
+
+// Sources fail independently, but they are removed one at a time once no other change is in progress. The main audio
+// source is never marked as failed, its errors stop the pipeline
+static void remove_failed_source(SourceSet* set) {
+    GstElement* source;
+    int i;
+
+    for (i = 0; !set->change && (source = set->callbacks.get_source(i, set->user_data)); ++i) {
+        if (g_object_get_data(G_OBJECT(source), "source-failed")) {
+            g_print("Source %i has failed, removing it\n", i);
+            source_set_remove(set, i);
+        }
+    }
+}
+
+static gboolean finish_source_change(gpointer user_data) {
+    SourceSet* set = user_data;
+    SourceChange* change = set->change;
+    int index = change->index;
+    guint i;
+
+    // Stopping the old source releases its blocked streaming threads. The replacement is in the arrays of the owner
+    // before the change is cleared, so it can be found all the time
+    set->callbacks.replace_source(index, change->new_source, set->user_data);
+    set_change(set, NULL);
+
+    if (change->new_source) {
+        for (i = 0; i < change->new_pads->len; ++i) {
+            link_pending_pad(g_ptr_array_index(change->new_pads, i), index);
+        }
+        g_ptr_array_set_free_func(change->new_pads, NULL);
+        g_print("Source %i is replaced\n", index);
+    } else {
+        g_print("Source %i is removed\n", index);
+    }
+
+    if (change->reply) {
+        control_reply_send(change->reply, "ok\n");
+    }
+    source_change_free(change);
+    remove_failed_source(set);
+
+    return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn old_source_idle_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    SourceSet* set = user_data;
+
+    // Pad stays blocked while the probe is installed, every pad is counted once
+    if (g_object_get_data(G_OBJECT(pad), "source-change-blocked")) {
+        return GST_PAD_PROBE_OK;
+    }
+    g_object_set_data(G_OBJECT(pad), "source-change-blocked", GINT_TO_POINTER(TRUE));
+
+    if (g_atomic_int_dec_and_test(&set->change->old_pads_pending)) {
+        g_idle_add(finish_source_change, set);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Blocks linked pads of the old source between buffers, the change is finished once all of them are blocked
+static void start_source_change(SourceSet* set) {
+    SourceChange* change = set->change;
+    GPtrArray* pads = g_ptr_array_new_with_free_func(gst_object_unref);
+    GstIterator* iterator = gst_element_iterate_src_pads(change->old_source);
+    GValue item = G_VALUE_INIT;
+    guint i;
+
+    change->old_blocking_started = TRUE;
+    if (change->new_preroll_timeout) {
+        g_source_remove(change->new_preroll_timeout);
+        change->new_preroll_timeout = 0;
+    }
+
+    while (gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        GstPad* pad = g_value_get_object(&item);
+        if (gst_pad_is_linked(pad)) {
+            g_ptr_array_add(pads, gst_object_ref(pad));
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    // Idle probe may be called right away, extra count keeps the change from finishing before all probes are added
+    g_atomic_int_set(&change->old_pads_pending, (gint)pads->len + 1);
+    for (i = 0; i < pads->len; ++i) {
+        gst_pad_add_probe(g_ptr_array_index(pads, i), GST_PAD_PROBE_TYPE_IDLE, old_source_idle_probe, set, NULL);
+    }
+    if (g_atomic_int_dec_and_test(&change->old_pads_pending)) {
+        g_idle_add(finish_source_change, set);
+    }
+
+    g_ptr_array_unref(pads);
+}
+
+// Replacement is dropped before it has taken the place of the old source, which keeps playing
+static void abort_source_change(SourceSet* set, const gchar* reason) {
+    SourceChange* change = set->change;
+    gchar* reply;
+
+    set_change(set, NULL);
+
+    if (change->new_preroll_timeout) {
+        g_source_remove(change->new_preroll_timeout);
+    }
+    // Stopping the replacement releases its blocked streaming threads, its pads are never linked
+    set->callbacks.discard_source(change->new_source, set->user_data);
+    g_print("Replacement of source %i is aborted: %s\n", change->index, reason);
+
+    if (change->reply) {
+        reply = g_strdup_printf("error: %s\n", reason);
+        control_reply_send(change->reply, reply);
+        g_free(reply);
+    }
+    source_change_free(change);
+    remove_failed_source(set);
+}
+
+// Returns TRUE if the replacement is still waiting for its video pad
+static gboolean is_replacement_pending(SourceSet* set, GstElement* source) {
+    SourceChange* change = set->change;
+
+    return change && change->new_source == source && !change->old_blocking_started;
+}
+
+static gboolean preroll_timeout_handler(gpointer user_data) {
+    SourceSet* set = user_data;
+    gchar* reason = g_strdup_printf("replacement has not prerolled in %i s", SOURCE_PREROLL_TIMEOUT);
+
+    set->change->new_preroll_timeout = 0;
+    abort_source_change(set, reason);
+    g_free(reason);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean no_video_handler(gpointer user_data) {
+    SourceSet* set = user_data;
+    SourceChange* change = set->change;
+
+    // Change may have been finished or aborted meanwhile
+    if (change && change->new_source && g_object_get_data(G_OBJECT(change->new_source), "no-video") &&
+        is_replacement_pending(set, change->new_source)) {
+        abort_source_change(set, "replacement has no video");
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+// This function will be called by the no-more-pads signal of replacements. All pads have been added, if none of them
+// is video, the replacement can not take the place of the old source
+static void no_more_pads_handler(GstElement* source, SourceSet* set) {
+    GstIterator* iterator = gst_element_iterate_src_pads(source);
+    GValue item = G_VALUE_INIT;
+    gboolean has_video = FALSE;
+
+    while (!has_video && gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        GstCaps* caps = gst_pad_get_current_caps(g_value_get_object(&item));
+        if (caps) {
+            has_video = g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/x-raw");
+            gst_caps_unref(caps);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    if (!has_video) {
+        g_object_set_data(G_OBJECT(source), "no-video", GINT_TO_POINTER(TRUE));
+        g_idle_add(no_video_handler, set);
+    }
+}
+
+void source_set_remove(SourceSet* set, int index) {
+    SourceChange* change = g_new0(SourceChange, 1);
+
+    change->index = index;
+    change->old_source = gst_object_ref(set->callbacks.get_source(index, set->user_data));
+    change->new_pads = g_ptr_array_new_with_free_func(pending_pad_free);
+    set_change(set, change);
+
+    start_source_change(set);
+}
+
+void source_set_replace(SourceSet* set, int index, GstElement* source, ControlReply* reply) {
+    SourceChange* change = g_new0(SourceChange, 1);
+
+    // Old source keeps playing until the new one has prerolled, see pending_pad_handler
+    change->index = index;
+    change->old_source = gst_object_ref(set->callbacks.get_source(index, set->user_data));
+    change->new_source = gst_object_ref(source);
+    change->new_pads = g_ptr_array_new_with_free_func(pending_pad_free);
+    change->new_preroll_timeout = g_timeout_add_seconds(SOURCE_PREROLL_TIMEOUT, preroll_timeout_handler, set);
+    change->reply = reply;
+    set_change(set, change);
+
+    if (!clip_cache_is_source(source)) {
+        g_signal_connect(source, "no-more-pads", G_CALLBACK(no_more_pads_handler), set);
+    }
+}
+
+gboolean source_set_handle_error(SourceSet* set, GstMessage* msg, const GError* err) {
+    SourceChange* change = set->change;
+    GstElement* source;
+    gchar* reason;
+    int i;
+
+    if (change && change->new_source && gst_object_has_as_ancestor(msg->src, GST_OBJECT(change->new_source))) {
+        if (is_replacement_pending(set, change->new_source)) {
+            reason = g_strdup_printf("replacement failed: %s", err->message);
+            abort_source_change(set, reason);
+            g_free(reason);
+        } else if (change->index == set->main_index) {
+            return FALSE;
+        } else {
+            // Replacement is taking the place of the old source right now, it is removed after that
+            g_object_set_data(G_OBJECT(change->new_source), "source-failed", GINT_TO_POINTER(TRUE));
+        }
+        return TRUE;
+    }
+
+    for (i = 0; (source = set->callbacks.get_source(i, set->user_data)); ++i) {
+        if (gst_object_has_as_ancestor(msg->src, GST_OBJECT(source))) {
+            break;
+        }
+    }
+    if (!source || i == set->main_index || !g_object_get_data(G_OBJECT(source), "runtime-source")) {
+        return FALSE;
+    }
+
+    // Failed source may post several errors, it is removed once
+    if (!g_object_get_data(G_OBJECT(source), "source-failed")) {
+        g_object_set_data(G_OBJECT(source), "source-failed", GINT_TO_POINTER(TRUE));
+        remove_failed_source(set);
+    }
+
+    return TRUE;
+}
+
+SourceSet* source_set_new(GstElement* pipeline,
+                          GMutex* lock,
+                          int main_index,
+                          const SourceSetCallbacks* callbacks,
+                          gpointer user_data) {
+    SourceSet* set = g_new0(SourceSet, 1);
+
+    set->pipeline = pipeline;
+    set->lock = lock;
+    set->main_index = main_index;
+    set->callbacks = *callbacks;
+    set->user_data = user_data;
+
+    return set;
+}
+
+void source_set_free(SourceSet* set) {
+    if (!set) {
+        return;
+    }
+
+    // Source change which has not finished holds references to both sources
+    if (set->change) {
+        if (set->change->new_preroll_timeout) {
+            g_source_remove(set->change->new_preroll_timeout);
+        }
+        if (set->change->reply) {
+            control_reply_send(set->change->reply, "error: streaming is stopped\n");
+        }
+        source_change_free(set->change);
+    }
+    g_free(set);
+}
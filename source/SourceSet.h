@@ -0,0 +1,73 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_SOURCE_SET_H
+#define TWITCH_STREAMER_SOURCE_SET_H
+
+#include "Control.h"
+
+#include <gst/gst.h>
+
+// Lifecycle of file sources of a running pipeline. Pads of sources are blocked when they appear and linked by the main
+// thread, which owns the topology. Looping sources are switched to segment mode first: instead of EOS the demuxer
+// reports SEGMENT_DONE and a non-flushing seek back to the start continues playback, so decoders, pads and mixer state
+// stay alive and running time goes on without a gap.
+// Sources are removed and replaced one at a time. Linked pads of the old source are blocked once idle, so it is
+// unlinked between buffers. Replacement is prerolled first and takes the place of the old source as soon as its video
+// pad appears. If it fails, times out or turns out to have no video before that, the change is aborted and the old
+// source stays. Sources are identified by their index in the arrays of the owner, which changes them in callbacks
+typedef struct _SourceSet SourceSet;
+
+// Callbacks are called in the main thread
+typedef struct _SourceSetCallbacks {
+    // Returns source at 'index', NULL past the last one. Called in streaming threads as well with the lock held
+    GstElement* (*get_source)(int index, gpointer user_data);
+
+    // Links 'pad' of the source at 'index' into the pipeline
+    void (*link_pad)(int index, GstPad* pad, gboolean is_video, gpointer user_data);
+
+    // Stops the source at 'index' and removes it together with its own elements from the pipeline. Its place is taken
+    // by 'replacement', or removed if it is NULL: later sources move one index down
+    void (*replace_source)(int index, GstElement* replacement, gpointer user_data);
+
+    // Stops 'source' which has never taken a place and removes it from the pipeline
+    void (*discard_source)(GstElement* source, gpointer user_data);
+} SourceSetCallbacks;
+
+// Sources are added to 'pipeline'. 'lock' is the lock under which the owner changes its source arrays, streaming
+// threads find sources with it held. Source at 'main_index' provides the main audio, so its errors are not handled
+SourceSet* source_set_new(GstElement* pipeline,
+                          GMutex* lock,
+                          int main_index,
+                          const SourceSetCallbacks* callbacks,
+                          gpointer user_data);
+
+// Pipeline must be already stopped. Change which has not finished is dropped, its deferred reply gets an error
+void source_set_free(SourceSet* set);
+
+// Pads of 'source' will be linked by link_pad once the main loop is running. Source playing cached clip (see
+// ClipCache.h) has a single static video pad, other sources add pads while they preroll. Audio pads are ignored unless
+// 'link_audio' is set. 'loop' makes the source play in segment mode forever
+void source_set_watch(SourceSet* set, GstElement* source, gboolean link_audio, gboolean loop);
+
+// Adds watched 'source' to the running pipeline. Errors of sources started this way only take down that source
+void source_set_start(SourceSet* set, GstElement* source);
+
+// Returns index of 'element', which is either a source or a replacement (it is configured for the place it is going
+// to take), -1 otherwise. Must be called from the main thread or with the lock held
+int source_set_find(SourceSet* set, GstElement* element);
+
+// Returns TRUE while a source is being removed or replaced
+gboolean source_set_is_changing(SourceSet* set);
+
+// Unlinks the source at 'index' between buffers and removes it
+void source_set_remove(SourceSet* set, int index);
+
+// Replaces the source at 'index' by 'source' once it has prerolled, the replacement is then started with
+// source_set_start. 'reply' is sent once the change is finished or aborted, it may be NULL
+void source_set_replace(SourceSet* set, int index, GstElement* source, ControlReply* reply);
+
+// Takes down the source which has posted error 'msg', if it was started at runtime. Returns FALSE if the error is not
+// one of such a source
+gboolean source_set_handle_error(SourceSet* set, GstMessage* msg, const GError* err);
+
+#endif // TWITCH_STREAMER_SOURCE_SET_H
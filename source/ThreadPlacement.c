@@ -0,0 +1,401 @@
+// (c) Alexander Voitenko 2021 - present
+
+#define _GNU_SOURCE
+
+#include "ThreadPlacement.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define STAGE_KEY "thread-stage"
+#define AUDIO_REALTIME_PRIORITY 10
+
+static const char* const stage_names[THREAD_STAGE_COUNT] = {"other", "decode", "mix", "encode", "audio"};
+
+struct _ThreadPlacement {
+    gchar* name;
+    cpu_set_t cores[THREAD_STAGE_COUNT]; // empty if threads of the stage are not pinned
+    cpu_set_t process_cores;             // threads of other stages are returned here
+    gboolean pinned;                     // at least one stage is pinned
+    gboolean audio_realtime;
+    gint realtime_failed;
+
+    // Used by the main thread only
+    GHashTable* helper_ticks; // tid -> guint64*, CPU time of unregistered threads at the previous report
+    gint64 report_time;
+};
+
+// Streaming thread which has entered, registered threads of all placements of the process are kept together, so
+// helper threads of one placement are never streaming threads of another one
+typedef struct _PlacedThread {
+    ThreadPlacement* placement;
+    ThreadStage stage;
+    gchar* owner;
+    guint64 reported_ticks;
+} PlacedThread;
+
+static GMutex threads_lock;
+static GHashTable* placed_threads; // tid -> PlacedThread*
+
+static void placed_thread_free(gpointer user_data) {
+    PlacedThread* thread = user_data;
+
+    g_free(thread->owner);
+    g_free(thread);
+}
+
+static pid_t current_tid(void) {
+    return (pid_t)syscall(SYS_gettid);
+}
+
+// utime and stime are the 14th and 15th fields, the 2nd one is the thread name in parentheses which may hold spaces
+static gboolean read_thread_ticks(pid_t tid, guint64* ticks) {
+    gchar* path = g_strdup_printf("/proc/self/task/%i/stat", (int)tid);
+    gchar* contents = NULL;
+    guint64 user_ticks;
+    guint64 system_ticks;
+    gboolean result = FALSE;
+    char* fields;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL) && (fields = strrchr(contents, ')')) != NULL &&
+        sscanf(fields + 1,
+               " %*c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+               &user_ticks,
+               &system_ticks) == 2) {
+        *ticks = user_ticks + system_ticks;
+        result = TRUE;
+    }
+
+    g_free(contents);
+    g_free(path);
+
+    return result;
+}
+
+ThreadPlacement* thread_placement_new(const char* name) {
+    ThreadPlacement* placement = g_new0(ThreadPlacement, 1);
+
+    placement->name = g_strdup(name);
+    placement->helper_ticks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    if (sched_getaffinity(0, sizeof(placement->process_cores), &placement->process_cores) != 0) {
+        CPU_ZERO(&placement->process_cores);
+    }
+
+    return placement;
+}
+
+void thread_placement_free(ThreadPlacement* placement) {
+    GHashTableIter iter;
+    gpointer value;
+
+    if (!placement) {
+        return;
+    }
+
+    g_mutex_lock(&threads_lock);
+    if (placed_threads) {
+        g_hash_table_iter_init(&iter, placed_threads);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            if (((PlacedThread*)value)->placement == placement) {
+                g_hash_table_iter_remove(&iter);
+            }
+        }
+    }
+    g_mutex_unlock(&threads_lock);
+
+    g_hash_table_destroy(placement->helper_ticks);
+    g_free(placement->name);
+    g_free(placement);
+}
+
+static int parse_cores(const char* text, cpu_set_t* cores) {
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+    gchar** ranges = g_strsplit(text, ",", -1);
+    int result = 0;
+    int i;
+
+    CPU_ZERO(cores);
+    for (i = 0; ranges[i] && result == 0; ++i) {
+        int first;
+        int last;
+        int cpu;
+        char end;
+
+        if (sscanf(ranges[i], "%d-%d%c", &first, &last, &end) != 2) {
+            if (sscanf(ranges[i], "%d%c", &first, &end) != 1) {
+                g_printerr("Error: invalid CPU list '%s', expected e.g. 0-7,16-23\n", text);
+                result = 1;
+                break;
+            }
+            last = first;
+        }
+        if (first < 0 || first > last || last >= configured || last >= CPU_SETSIZE) {
+            g_printerr("Error: CPUs %i-%i are out of range [0, %li]\n", first, last, configured - 1);
+            result = 1;
+            break;
+        }
+        for (cpu = first; cpu <= last; ++cpu) {
+            CPU_SET(cpu, cores);
+        }
+    }
+
+    g_strfreev(ranges);
+
+    return result;
+}
+
+int thread_placement_set_cores(ThreadPlacement* placement, const char* assignment) {
+    const char* separator = strchr(assignment, '=');
+    ThreadStage stage;
+
+    for (stage = THREAD_STAGE_DECODE; stage < THREAD_STAGE_COUNT && separator; ++stage) {
+        if (strncmp(assignment, stage_names[stage], separator - assignment) == 0 &&
+            stage_names[stage][separator - assignment] == '\0') {
+            break;
+        }
+    }
+    if (!separator || stage == THREAD_STAGE_COUNT) {
+        g_printerr("Error: invalid core assignment '%s', expected STAGE=CPUS with stage decode, mix, encode or audio\n",
+                   assignment);
+        return 1;
+    }
+
+    if (parse_cores(separator + 1, &placement->cores[stage]) != 0) {
+        return 1;
+    }
+    placement->pinned = TRUE;
+    g_print("Threads of %s stage are pinned to CPUs %s\n", stage_names[stage], separator + 1);
+
+    return 0;
+}
+
+void thread_placement_set_audio_realtime(ThreadPlacement* placement, gboolean realtime) {
+    placement->audio_realtime = realtime;
+}
+
+int thread_placement_core_count(ThreadPlacement* placement, ThreadStage stage) {
+    return CPU_COUNT(&placement->cores[stage]);
+}
+
+void thread_placement_set_stage(GstElement* element, ThreadStage stage) {
+    g_object_set_data(G_OBJECT(element), STAGE_KEY, GINT_TO_POINTER(stage));
+}
+
+// Stage of the closest element with a stage, the owner itself or one of the bins it is in. Name of the owner is
+// prefixed with the name of that element, e.g. "source_0/multiqueue0"
+static ThreadStage find_stage(GstElement* owner, gchar** name) {
+    GstObject* object = gst_object_ref(owner);
+    ThreadStage stage = THREAD_STAGE_NONE;
+
+    while (object) {
+        GstObject* parent;
+
+        stage = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(object), STAGE_KEY));
+        if (stage != THREAD_STAGE_NONE) {
+            break;
+        }
+        parent = gst_object_get_parent(object);
+        gst_object_unref(object);
+        object = parent;
+    }
+
+    if (object && object != GST_OBJECT(owner)) {
+        *name = g_strdup_printf("%s/%s", GST_OBJECT_NAME(object), GST_OBJECT_NAME(owner));
+    } else {
+        *name = g_strdup(GST_OBJECT_NAME(owner));
+    }
+    if (object) {
+        gst_object_unref(object);
+    }
+
+    return stage;
+}
+
+// Task threads come from a pool and may be reused by a task of another stage, so every thread is placed on entry
+static void place_current_thread(ThreadPlacement* placement, GstElement* owner) {
+    PlacedThread* thread = g_new0(PlacedThread, 1);
+    pid_t tid = current_tid();
+    struct sched_param param = {0};
+    cpu_set_t* cores;
+
+    thread->placement = placement;
+    thread->stage = find_stage(owner, &thread->owner);
+    read_thread_ticks(tid, &thread->reported_ticks);
+
+    if (placement->pinned) {
+        cores = CPU_COUNT(&placement->cores[thread->stage]) > 0 ? &placement->cores[thread->stage]
+                                                                : &placement->process_cores;
+        if (pthread_setaffinity_np(pthread_self(), sizeof(*cores), cores) != 0) {
+            g_printerr("Error: thread of '%s' could not be pinned\n", thread->owner);
+        }
+    }
+
+    if (placement->audio_realtime) {
+        int policy = SCHED_OTHER;
+
+        if (thread->stage == THREAD_STAGE_AUDIO) {
+            policy = SCHED_FIFO;
+            param.sched_priority = AUDIO_REALTIME_PRIORITY;
+        }
+        if (pthread_setschedparam(pthread_self(), policy, &param) != 0 && policy == SCHED_FIFO &&
+            g_atomic_int_compare_and_exchange(&placement->realtime_failed, 0, 1)) {
+            g_printerr("Error: real-time priority is not permitted, audio threads run at normal priority\n");
+        }
+    }
+
+    g_mutex_lock(&threads_lock);
+    if (!placed_threads) {
+        placed_threads = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, placed_thread_free);
+    }
+    g_hash_table_replace(placed_threads, GINT_TO_POINTER(tid), thread);
+    g_mutex_unlock(&threads_lock);
+}
+
+static void forget_current_thread(void) {
+    g_mutex_lock(&threads_lock);
+    if (placed_threads) {
+        g_hash_table_remove(placed_threads, GINT_TO_POINTER(current_tid()));
+    }
+    g_mutex_unlock(&threads_lock);
+}
+
+// Stream status messages are posted by the streaming thread itself, sync handler runs in the same thread
+static GstBusSyncReply stream_status_handler(GstBus* bus, GstMessage* msg, gpointer user_data) {
+    ThreadPlacement* placement = user_data;
+    GstStreamStatusType type;
+    GstElement* owner;
+
+    if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS) {
+        return GST_BUS_PASS;
+    }
+
+    gst_message_parse_stream_status(msg, &type, &owner);
+    if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+        place_current_thread(placement, owner);
+    } else if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+        forget_current_thread();
+    }
+
+    return GST_BUS_PASS;
+}
+
+void thread_placement_attach(ThreadPlacement* placement, GstElement* pipeline) {
+    GstBus* bus = gst_element_get_bus(pipeline);
+
+    gst_bus_set_sync_handler(bus, stream_status_handler, placement, NULL);
+    gst_object_unref(bus);
+    placement->report_time = g_get_monotonic_time();
+}
+
+static gint compare_lines(gconstpointer a, gconstpointer b) {
+    return g_strcmp0(*(const gchar* const*)a, *(const gchar* const*)b);
+}
+
+// Threads which did not announce themselves, but run on the cores of a pinned stage, were started by its threads
+static void report_helper_threads(ThreadPlacement* placement, gdouble tick_rate) {
+    guint64 helper_ticks[THREAD_STAGE_COUNT] = {0};
+    int helper_count[THREAD_STAGE_COUNT] = {0};
+    GDir* dir = g_dir_open("/proc/self/task", 0, NULL);
+    const gchar* entry;
+    ThreadStage stage;
+
+    if (!dir) {
+        return;
+    }
+
+    while ((entry = g_dir_read_name(dir)) != NULL) {
+        pid_t tid = (pid_t)g_ascii_strtoll(entry, NULL, 10);
+        guint64* previous;
+        guint64 ticks;
+        cpu_set_t cores;
+        gboolean placed;
+
+        g_mutex_lock(&threads_lock);
+        placed = placed_threads && g_hash_table_contains(placed_threads, GINT_TO_POINTER(tid));
+        g_mutex_unlock(&threads_lock);
+
+        if (placed || sched_getaffinity(tid, sizeof(cores), &cores) != 0 || !read_thread_ticks(tid, &ticks)) {
+            continue;
+        }
+
+        for (stage = THREAD_STAGE_DECODE; stage < THREAD_STAGE_COUNT; ++stage) {
+            if (CPU_COUNT(&placement->cores[stage]) > 0 && CPU_EQUAL(&cores, &placement->cores[stage])) {
+                break;
+            }
+        }
+        if (stage == THREAD_STAGE_COUNT) {
+            continue;
+        }
+
+        previous = g_hash_table_lookup(placement->helper_ticks, GINT_TO_POINTER(tid));
+        if (!previous) {
+            previous = g_new0(guint64, 1);
+            g_hash_table_insert(placement->helper_ticks, GINT_TO_POINTER(tid), previous);
+        }
+        helper_ticks[stage] += ticks - *previous;
+        ++helper_count[stage];
+        *previous = ticks;
+    }
+    g_dir_close(dir);
+
+    for (stage = THREAD_STAGE_DECODE; stage < THREAD_STAGE_COUNT; ++stage) {
+        if (helper_count[stage] > 0) {
+            g_print("  %-6s %i helper threads: %.1f%%\n",
+                    stage_names[stage],
+                    helper_count[stage],
+                    100.0 * helper_ticks[stage] / tick_rate);
+        }
+    }
+}
+
+void thread_placement_report(ThreadPlacement* placement) {
+    gint64 now = g_get_monotonic_time();
+    gdouble seconds = (now - placement->report_time) / (gdouble)G_USEC_PER_SEC;
+    gdouble tick_rate = sysconf(_SC_CLK_TCK) * seconds;
+    GPtrArray* lines;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    guint i;
+
+    if (seconds <= 0.0) {
+        return;
+    }
+    placement->report_time = now;
+
+    // Lines start with the stage name, so sorting groups threads by stage
+    lines = g_ptr_array_new_with_free_func(g_free);
+    g_mutex_lock(&threads_lock);
+    if (placed_threads) {
+        g_hash_table_iter_init(&iter, placed_threads);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            PlacedThread* thread = value;
+            guint64 ticks;
+
+            if (thread->placement != placement || !read_thread_ticks(GPOINTER_TO_INT(key), &ticks)) {
+                continue;
+            }
+            g_ptr_array_add(lines,
+                            g_strdup_printf("  %-6s %s (tid %i): %.1f%%",
+                                            stage_names[thread->stage],
+                                            thread->owner,
+                                            GPOINTER_TO_INT(key),
+                                            100.0 * (ticks - thread->reported_ticks) / tick_rate));
+            thread->reported_ticks = ticks;
+        }
+    }
+    g_mutex_unlock(&threads_lock);
+    g_ptr_array_sort(lines, compare_lines);
+
+    g_print("Threads of '%s', CPU use over the last %.1f s (100%% is one core):\n", placement->name, seconds);
+    for (i = 0; i < lines->len; ++i) {
+        g_print("%s\n", (const gchar*)g_ptr_array_index(lines, i));
+    }
+    g_ptr_array_unref(lines);
+
+    report_helper_threads(placement, tick_rate);
+}
@@ -0,0 +1,49 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_THREAD_PLACEMENT_H
+#define TWITCH_STREAMER_THREAD_PLACEMENT_H
+
+#include <gst/gst.h>
+
+// Stages of the pipeline, threads of a stage share its set of cores
+typedef enum _ThreadStage {
+    THREAD_STAGE_NONE,   // threads are left where the scheduler puts them
+    THREAD_STAGE_DECODE, // sources: demuxers, multiqueues and decoders
+    THREAD_STAGE_MIX,    // video mixer aggregation and blending
+    THREAD_STAGE_ENCODE, // video encoders, each runs in the thread of its queue
+    THREAD_STAGE_AUDIO,  // audio mixer and audio encoder
+    THREAD_STAGE_COUNT
+} ThreadStage;
+
+// Places streaming threads of a pipeline onto the cores of their stages. Every streaming thread announces itself by a
+// stream status message posted from the thread itself, so it is pinned right there before it handles any data.
+// Threads of decoder and encoder libraries are started by the streaming thread which opens them and inherit its cores.
+// Audio threads can get real-time priority. CPU use of every streaming thread is reported, together with the helper
+// threads which run on the cores of a stage
+typedef struct _ThreadPlacement ThreadPlacement;
+
+// 'name' identifies the pipeline in reports
+ThreadPlacement* thread_placement_new(const char* name);
+
+// Pipeline must be already stopped
+void thread_placement_free(ThreadPlacement* placement);
+
+// Parses "STAGE=CPUS" where stage is decode, mix, encode or audio and CPUS is a list like "0-7,16-23"
+int thread_placement_set_cores(ThreadPlacement* placement, const char* assignment);
+
+// Audio threads run with SCHED_FIFO, which needs CAP_SYS_NICE or a real-time priority limit
+void thread_placement_set_audio_realtime(ThreadPlacement* placement, gboolean realtime);
+
+// Number of cores of 'stage', zero if its threads are not pinned
+int thread_placement_core_count(ThreadPlacement* placement, ThreadStage stage);
+
+// Threads of 'element' and of all elements inside it belong to 'stage'
+void thread_placement_set_stage(GstElement* element, ThreadStage stage);
+
+// Starts placing threads of 'pipeline', must be called before the pipeline is started
+void thread_placement_attach(ThreadPlacement* placement, GstElement* pipeline);
+
+// Logs CPU use of every thread since the previous report
+void thread_placement_report(ThreadPlacement* placement);
+
+#endif // TWITCH_STREAMER_THREAD_PLACEMENT_H
@@ -0,0 +1,694 @@
+// (c) Alexander Voitenko 2021 - present
+
+#include "TileMixer.h"
+
+#include "Blend.h"
+#include "Overlay.h"
+
+#include <gst/video/gstvideoaggregator.h>
+#include <gst/video/video.h>
+
+#include <string.h>
+
+// Black in limited range YUV
+#define BLACK_LUMA 16
+#define BLACK_CHROMA 128
+
+enum {
+    PROP_0,
+    PROP_OVERLAY,
+};
+
+enum {
+    PROP_PAD_0,
+    PROP_PAD_XPOS,
+    PROP_PAD_YPOS,
+    PROP_PAD_WIDTH,
+    PROP_PAD_HEIGHT,
+    PROP_PAD_ALPHA,
+};
+
+typedef struct _TileMixerPad {
+    GstVideoAggregatorPad parent;
+
+    // Placement of the tile, protected by the object lock of the pad. Zero width or height means size of the source
+    gint xpos;
+    gint ypos;
+    gint width;
+    gint height;
+    gdouble alpha;
+
+    // State of the aggregating thread. Tile is the latest source frame converted to the output format and tile size,
+    // it is the source frame itself if no conversion is needed
+    GstBuffer* source_buffer;
+    GstBuffer* tile;
+    GstVideoInfo tile_info;
+    GstVideoRectangle target; // where the tile should be drawn
+    guint target_alpha;       // 0 to BLEND_OPAQUE
+    gboolean tile_changed;    // tile was replaced since it was drawn
+    GstVideoConverter* converter;
+    GstVideoInfo converter_in_info;
+    GstVideoInfo converter_out_info;
+
+    // Area of the kept frame covered by the tile and its opacity, protected by the object lock of the mixer
+    GstVideoRectangle drawn;
+    guint drawn_alpha;
+} TileMixerPad;
+
+typedef struct _TileMixerPadClass {
+    GstVideoAggregatorPadClass parent_class;
+} TileMixerPadClass;
+
+typedef struct _TileMixer {
+    GstVideoAggregator parent;
+
+    // Protected by the object lock
+    GstBuffer* canvas; // previous output frame, NULL before the first frame and after renegotiation
+    GArray* damage;    // GstVideoRectangle, areas of the kept frame to redraw
+    OverlayLayer* overlay;
+
+    // State of the aggregating thread: the output buffer holds the kept frame, so only damage has to be redrawn
+    gboolean canvas_kept;
+} TileMixer;
+
+typedef struct _TileMixerClass {
+    GstVideoAggregatorClass parent_class;
+} TileMixerClass;
+
+GType tile_mixer_pad_get_type(void);
+GType tile_mixer_get_type(void);
+
+G_DEFINE_TYPE(TileMixerPad, tile_mixer_pad, GST_TYPE_VIDEO_AGGREGATOR_PAD);
+G_DEFINE_TYPE(TileMixer, tile_mixer, GST_TYPE_VIDEO_AGGREGATOR);
+
+#define TILE_MIXER_PAD(obj) ((TileMixerPad*)(obj))
+#define TILE_MIXER(obj) ((TileMixer*)(obj))
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
+    "src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE("{ I420, NV12 }")));
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE(
+    "sink_%u", GST_PAD_SINK, GST_PAD_REQUEST, GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE(GST_VIDEO_FORMATS_ALL)));
+
+static gboolean rectangle_is_empty(const GstVideoRectangle* rect) {
+    return rect->w <= 0 || rect->h <= 0;
+}
+
+static gboolean rectangles_equal(const GstVideoRectangle* a, const GstVideoRectangle* b) {
+    return a->x == b->x && a->y == b->y && a->w == b->w && a->h == b->h;
+}
+
+static gboolean rectangle_contains(const GstVideoRectangle* outer, const GstVideoRectangle* inner) {
+    return inner->x >= outer->x && inner->y >= outer->y && inner->x + inner->w <= outer->x + outer->w &&
+           inner->y + inner->h <= outer->y + outer->h;
+}
+
+static gboolean rectangle_intersect(const GstVideoRectangle* a, const GstVideoRectangle* b, GstVideoRectangle* result) {
+    int x0 = MAX(a->x, b->x);
+    int y0 = MAX(a->y, b->y);
+    int x1 = MIN(a->x + a->w, b->x + b->w);
+    int y1 = MIN(a->y + a->h, b->y + b->h);
+
+    result->x = x0;
+    result->y = y0;
+    result->w = x1 - x0;
+    result->h = y1 - y0;
+
+    return !rectangle_is_empty(result);
+}
+
+// Frames are never changed while they are shared, so a buffer holding the same memory as the previous one (e.g. a
+// frame repeated by imagefreeze or by clip cache) has the same content
+static gboolean buffer_has_same_content(GstBuffer* buffer, GstBuffer* previous) {
+    guint count;
+    guint i;
+
+    if (!previous) {
+        return FALSE;
+    }
+    if (buffer == previous) {
+        return TRUE;
+    }
+
+    count = gst_buffer_n_memory(buffer);
+    if (count != gst_buffer_n_memory(previous)) {
+        return FALSE;
+    }
+    for (i = 0; i < count; ++i) {
+        if (gst_buffer_peek_memory(buffer, i) != gst_buffer_peek_memory(previous, i)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean same_frame_layout(const GstVideoInfo* a, const GstVideoInfo* b) {
+    return GST_VIDEO_INFO_FORMAT(a) == GST_VIDEO_INFO_FORMAT(b) && GST_VIDEO_INFO_WIDTH(a) == GST_VIDEO_INFO_WIDTH(b) &&
+           GST_VIDEO_INFO_HEIGHT(a) == GST_VIDEO_INFO_HEIGHT(b);
+}
+
+static void clear_tile(TileMixerPad* pad) {
+    if (pad->tile) {
+        gst_buffer_unref(pad->tile);
+        pad->tile = NULL;
+    }
+    if (pad->source_buffer) {
+        gst_buffer_unref(pad->source_buffer);
+        pad->source_buffer = NULL;
+    }
+    pad->tile_changed = TRUE;
+}
+
+// Converts the source frame into the tile only when the frame or the tile size changed, otherwise the tile drawn
+// before stays valid and the pad costs nothing
+static gboolean tile_mixer_pad_prepare_frame(GstVideoAggregatorPad* video_pad,
+                                             GstVideoAggregator* aggregator,
+                                             GstBuffer* buffer,
+                                             GstVideoFrame* prepared_frame) {
+    TileMixerPad* pad = TILE_MIXER_PAD(video_pad);
+    GstVideoInfo tile_info;
+    GstVideoFrame source_frame;
+    GstVideoFrame tile_frame;
+    GstBuffer* tile;
+    int width;
+    int height;
+
+    GST_OBJECT_LOCK(pad);
+    width = pad->width > 0 ? pad->width : GST_VIDEO_INFO_WIDTH(&video_pad->info);
+    height = pad->height > 0 ? pad->height : GST_VIDEO_INFO_HEIGHT(&video_pad->info);
+    pad->target.x = pad->xpos;
+    pad->target.y = pad->ypos;
+    pad->target_alpha = (guint)(pad->alpha * BLEND_OPAQUE + 0.5);
+    GST_OBJECT_UNLOCK(pad);
+    pad->target.w = width;
+    pad->target.h = height;
+
+    gst_video_info_set_format(&tile_info, GST_VIDEO_INFO_FORMAT(&aggregator->info), width, height);
+    tile_info.colorimetry = aggregator->info.colorimetry;
+    tile_info.chroma_site = aggregator->info.chroma_site;
+
+    if (pad->tile && buffer_has_same_content(buffer, pad->source_buffer) &&
+        same_frame_layout(&tile_info, &pad->tile_info)) {
+        return TRUE;
+    }
+
+    clear_tile(pad);
+    pad->source_buffer = gst_buffer_ref(buffer);
+
+    // Frames already in the output format and tile size, e.g. from clip cache, are drawn as they are
+    if (same_frame_layout(&tile_info, &video_pad->info)) {
+        pad->tile = gst_buffer_ref(buffer);
+        pad->tile_info = video_pad->info;
+        return TRUE;
+    }
+
+    if (!pad->converter || !gst_video_info_is_equal(&pad->converter_in_info, &video_pad->info) ||
+        !gst_video_info_is_equal(&pad->converter_out_info, &tile_info)) {
+        if (pad->converter) {
+            gst_video_converter_free(pad->converter);
+        }
+        pad->converter = gst_video_converter_new(&video_pad->info, &tile_info, NULL);
+        pad->converter_in_info = video_pad->info;
+        pad->converter_out_info = tile_info;
+    }
+
+    // Pads which can not be converted are not drawn, failure of one pad must not stop preparation of others
+    if (!pad->converter) {
+        GST_WARNING_OBJECT(pad, "no conversion to %ix%i tile", width, height);
+        return TRUE;
+    }
+
+    if (!gst_video_frame_map(&source_frame, &video_pad->info, buffer, GST_MAP_READ)) {
+        GST_WARNING_OBJECT(pad, "failed to map source frame");
+        return TRUE;
+    }
+
+    tile = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&tile_info), NULL);
+    if (!gst_video_frame_map(&tile_frame, &tile_info, tile, GST_MAP_WRITE)) {
+        GST_WARNING_OBJECT(pad, "failed to map tile");
+        gst_video_frame_unmap(&source_frame);
+        gst_buffer_unref(tile);
+        return TRUE;
+    }
+
+    gst_video_converter_frame(pad->converter, &source_frame, &tile_frame);
+    gst_video_frame_unmap(&tile_frame);
+    gst_video_frame_unmap(&source_frame);
+
+    pad->tile = tile;
+    pad->tile_info = tile_info;
+
+    return TRUE;
+}
+
+static void tile_mixer_pad_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
+    TileMixerPad* pad = TILE_MIXER_PAD(object);
+
+    GST_OBJECT_LOCK(pad);
+    switch (prop_id) {
+    case PROP_PAD_XPOS:
+        pad->xpos = g_value_get_int(value);
+        break;
+    case PROP_PAD_YPOS:
+        pad->ypos = g_value_get_int(value);
+        break;
+    case PROP_PAD_WIDTH:
+        pad->width = g_value_get_int(value);
+        break;
+    case PROP_PAD_HEIGHT:
+        pad->height = g_value_get_int(value);
+        break;
+    case PROP_PAD_ALPHA:
+        pad->alpha = g_value_get_double(value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK(pad);
+}
+
+static void tile_mixer_pad_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec) {
+    TileMixerPad* pad = TILE_MIXER_PAD(object);
+
+    GST_OBJECT_LOCK(pad);
+    switch (prop_id) {
+    case PROP_PAD_XPOS:
+        g_value_set_int(value, pad->xpos);
+        break;
+    case PROP_PAD_YPOS:
+        g_value_set_int(value, pad->ypos);
+        break;
+    case PROP_PAD_WIDTH:
+        g_value_set_int(value, pad->width);
+        break;
+    case PROP_PAD_HEIGHT:
+        g_value_set_int(value, pad->height);
+        break;
+    case PROP_PAD_ALPHA:
+        g_value_set_double(value, pad->alpha);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK(pad);
+}
+
+static void tile_mixer_pad_finalize(GObject* object) {
+    TileMixerPad* pad = TILE_MIXER_PAD(object);
+
+    clear_tile(pad);
+    if (pad->converter) {
+        gst_video_converter_free(pad->converter);
+    }
+
+    G_OBJECT_CLASS(tile_mixer_pad_parent_class)->finalize(object);
+}
+
+static void tile_mixer_pad_class_init(TileMixerPadClass* klass) {
+    GObjectClass* object_class = G_OBJECT_CLASS(klass);
+    GstVideoAggregatorPadClass* pad_class = GST_VIDEO_AGGREGATOR_PAD_CLASS(klass);
+    const GParamFlags flags = G_PARAM_READWRITE | GST_PARAM_CONTROLLABLE | G_PARAM_STATIC_STRINGS;
+
+    object_class->set_property = tile_mixer_pad_set_property;
+    object_class->get_property = tile_mixer_pad_get_property;
+    object_class->finalize = tile_mixer_pad_finalize;
+
+    g_object_class_install_property(
+        object_class, PROP_PAD_XPOS, g_param_spec_int("xpos", "X", "X position", G_MININT, G_MAXINT, 0, flags));
+    g_object_class_install_property(
+        object_class, PROP_PAD_YPOS, g_param_spec_int("ypos", "Y", "Y position", G_MININT, G_MAXINT, 0, flags));
+    g_object_class_install_property(
+        object_class, PROP_PAD_WIDTH, g_param_spec_int("width", "Width", "Tile width", 0, G_MAXINT, 0, flags));
+    g_object_class_install_property(
+        object_class, PROP_PAD_HEIGHT, g_param_spec_int("height", "Height", "Tile height", 0, G_MAXINT, 0, flags));
+    g_object_class_install_property(
+        object_class, PROP_PAD_ALPHA, g_param_spec_double("alpha", "Alpha", "Tile opacity", 0.0, 1.0, 1.0, flags));
+
+    // Own conversion replaces the one of the base class, which would convert every frame
+    pad_class->prepare_frame = tile_mixer_pad_prepare_frame;
+#if GST_CHECK_VERSION(1, 20, 0)
+    pad_class->prepare_frame_start = NULL;
+    pad_class->prepare_frame_finish = NULL;
+#endif
+}
+
+static void tile_mixer_pad_init(TileMixerPad* pad) {
+    pad->alpha = 1.0;
+}
+
+// Components of one plane share subsampling, so the first component of the plane describes it
+static guint plane_component(const GstVideoFrame* frame, guint plane) {
+    guint i;
+
+    for (i = 0; i < GST_VIDEO_FRAME_N_COMPONENTS(frame); ++i) {
+        if ((guint)GST_VIDEO_FRAME_COMP_PLANE(frame, i) == plane) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+static void fill_black(GstVideoFrame* frame, const GstVideoRectangle* rect) {
+    guint plane;
+
+    for (plane = 0; plane < GST_VIDEO_FRAME_N_PLANES(frame); ++plane) {
+        guint component = plane_component(frame, plane);
+        guint w_sub = GST_VIDEO_FORMAT_INFO_W_SUB(frame->info.finfo, component);
+        guint h_sub = GST_VIDEO_FORMAT_INFO_H_SUB(frame->info.finfo, component);
+        int pixel_stride = GST_VIDEO_FRAME_COMP_PSTRIDE(frame, component);
+        int stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, plane);
+        int bytes = (((rect->x + rect->w) >> w_sub) - (rect->x >> w_sub)) * pixel_stride;
+        int first_row = rect->y >> h_sub;
+        int last_row = (rect->y + rect->h) >> h_sub;
+        int value = (guint)GST_VIDEO_FRAME_COMP_PLANE(frame, GST_VIDEO_COMP_Y) == plane ? BLACK_LUMA : BLACK_CHROMA;
+        guint8* data = (guint8*)GST_VIDEO_FRAME_PLANE_DATA(frame, plane) + (rect->x >> w_sub) * pixel_stride;
+        int row;
+
+        for (row = first_row; row < last_row; ++row) {
+            memset(data + row * stride, value, bytes);
+        }
+    }
+}
+
+// Draws 'rect' of the output frame from the tile placed at 'tile_x', 'tile_y'. Tile has the output format. Rows of
+// opaque tiles are copied, translucent ones are blended over what is already drawn
+static void draw_from_tile(GstVideoFrame* frame,
+                           const GstVideoRectangle* rect,
+                           const GstVideoFrame* tile,
+                           int tile_x,
+                           int tile_y,
+                           guint alpha) {
+    guint plane;
+
+    for (plane = 0; plane < GST_VIDEO_FRAME_N_PLANES(frame); ++plane) {
+        guint component = plane_component(frame, plane);
+        guint w_sub = GST_VIDEO_FORMAT_INFO_W_SUB(frame->info.finfo, component);
+        guint h_sub = GST_VIDEO_FORMAT_INFO_H_SUB(frame->info.finfo, component);
+        int pixel_stride = GST_VIDEO_FRAME_COMP_PSTRIDE(frame, component);
+        int stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, plane);
+        int tile_stride = GST_VIDEO_FRAME_PLANE_STRIDE(tile, plane);
+        int source_x = (rect->x - tile_x) >> w_sub;
+        int source_y = (rect->y - tile_y) >> h_sub;
+        int columns = MIN(((rect->x + rect->w) >> w_sub) - (rect->x >> w_sub),
+                          GST_VIDEO_FRAME_COMP_WIDTH(tile, component) - source_x);
+        int rows = MIN(((rect->y + rect->h) >> h_sub) - (rect->y >> h_sub),
+                       GST_VIDEO_FRAME_COMP_HEIGHT(tile, component) - source_y);
+        guint8* data = (guint8*)GST_VIDEO_FRAME_PLANE_DATA(frame, plane) + (rect->y >> h_sub) * stride +
+                       (rect->x >> w_sub) * pixel_stride;
+        const guint8* tile_data = (const guint8*)GST_VIDEO_FRAME_PLANE_DATA(tile, plane) + source_y * tile_stride +
+                                  source_x * pixel_stride;
+        int row;
+
+        if (alpha == BLEND_OPAQUE) {
+            for (row = 0; row < rows; ++row) {
+                memcpy(data + row * stride, tile_data + row * tile_stride, columns * pixel_stride);
+            }
+        } else {
+            for (row = 0; row < rows; ++row) {
+                blend_constant_row(data + row * stride, tile_data + row * tile_stride, columns * pixel_stride, alpha);
+            }
+        }
+    }
+}
+
+// Redraws 'area' of the kept frame: tiles in z-order starting from the topmost opaque tile which covers it all, or
+// from black background if there is none, so hidden tiles are never drawn. Area is extended to even coordinates, so
+// subsampled chroma is redrawn together with luma
+static void redraw_area(TileMixer* mixer, GstVideoFrame* frame, const GstVideoRectangle* area) {
+    GstVideoRectangle frame_rect = {0, 0, GST_VIDEO_FRAME_WIDTH(frame), GST_VIDEO_FRAME_HEIGHT(frame)};
+    GstVideoRectangle aligned;
+    GstVideoRectangle rect;
+    GList* first = NULL;
+    GList* l;
+
+    aligned.x = area->x & ~1;
+    aligned.y = area->y & ~1;
+    aligned.w = ((area->x + area->w + 1) & ~1) - aligned.x;
+    aligned.h = ((area->y + area->h + 1) & ~1) - aligned.y;
+    if (!rectangle_intersect(&aligned, &frame_rect, &rect)) {
+        return;
+    }
+
+    // Sink pads are sorted by z-order
+    for (l = GST_ELEMENT(mixer)->sinkpads; l; l = l->next) {
+        TileMixerPad* pad = l->data;
+        if (pad->tile && pad->drawn_alpha == BLEND_OPAQUE && rectangle_contains(&pad->drawn, &rect)) {
+            first = l;
+        }
+    }
+    if (!first) {
+        fill_black(frame, &rect);
+        first = GST_ELEMENT(mixer)->sinkpads;
+    }
+
+    for (l = first; l; l = l->next) {
+        TileMixerPad* pad = l->data;
+        GstVideoRectangle part;
+        GstVideoFrame tile_frame;
+
+        if (!pad->tile || pad->drawn_alpha == 0 || !rectangle_intersect(&pad->drawn, &rect, &part)) {
+            continue;
+        }
+        if (!gst_video_frame_map(&tile_frame, &pad->tile_info, pad->tile, GST_MAP_READ)) {
+            GST_WARNING_OBJECT(pad, "failed to map tile");
+            continue;
+        }
+        draw_from_tile(frame, &part, &tile_frame, pad->drawn.x, pad->drawn.y, pad->drawn_alpha);
+        gst_video_frame_unmap(&tile_frame);
+    }
+
+    if (mixer->overlay) {
+        overlay_layer_draw(mixer->overlay, frame, &rect);
+    }
+}
+
+static void add_damage(TileMixer* mixer, const GstVideoRectangle* rect) {
+    if (!rectangle_is_empty(rect)) {
+        g_array_append_val(mixer->damage, *rect);
+    }
+}
+
+// Copies the kept frame into a buffer of the output pool
+static gboolean copy_canvas(GstVideoAggregator* aggregator, GstBuffer* canvas, GstBuffer* outbuffer) {
+    GstVideoFrame source;
+    GstVideoFrame target;
+    gboolean copied;
+
+    if (!gst_video_frame_map(&source, &aggregator->info, canvas, GST_MAP_READ)) {
+        return FALSE;
+    }
+    if (!gst_video_frame_map(&target, &aggregator->info, outbuffer, GST_MAP_WRITE)) {
+        gst_video_frame_unmap(&source);
+        return FALSE;
+    }
+    copied = gst_video_frame_copy(&target, &source);
+    gst_video_frame_unmap(&target);
+    gst_video_frame_unmap(&source);
+
+    return copied;
+}
+
+static GstFlowReturn tile_mixer_create_output_buffer(GstVideoAggregator* aggregator, GstBuffer** outbuffer) {
+    TileMixer* mixer = TILE_MIXER(aggregator);
+    GstFlowReturn ret;
+    GstBuffer* canvas;
+
+    // The mixer's reference to the kept frame is taken over, the output buffer becomes the kept frame again
+    GST_OBJECT_LOCK(mixer);
+    canvas = mixer->canvas;
+    mixer->canvas = NULL;
+    GST_OBJECT_UNLOCK(mixer);
+
+    // Previous frame is not used downstream anymore, so it is redrawn in place
+    if (canvas && gst_buffer_is_writable(canvas) && gst_buffer_is_all_memory_writable(canvas)) {
+        *outbuffer = canvas;
+        mixer->canvas_kept = TRUE;
+        return GST_FLOW_OK;
+    }
+
+    // Otherwise the new frame comes from the output pool like any other, so its memory is allocated the way
+    // downstream asked for, and the kept frame is copied into it. Buffers already pushed never change
+    ret = GST_VIDEO_AGGREGATOR_CLASS(tile_mixer_parent_class)->create_output_buffer(aggregator, outbuffer);
+    mixer->canvas_kept = ret == GST_FLOW_OK && canvas && copy_canvas(aggregator, canvas, *outbuffer);
+    if (canvas) {
+        gst_buffer_unref(canvas);
+    }
+
+    return ret;
+}
+
+static GstFlowReturn tile_mixer_aggregate_frames(GstVideoAggregator* aggregator, GstBuffer* outbuffer) {
+    TileMixer* mixer = TILE_MIXER(aggregator);
+    GstVideoRectangle frame_rect = {
+        0, 0, GST_VIDEO_INFO_WIDTH(&aggregator->info), GST_VIDEO_INFO_HEIGHT(&aggregator->info)};
+    GstVideoFrame frame;
+    GList* l;
+    guint i;
+
+    GST_OBJECT_LOCK(mixer);
+
+    // Frame which does not hold the kept frame is drawn from scratch
+    if (!mixer->canvas_kept) {
+        g_array_set_size(mixer->damage, 0);
+        add_damage(mixer, &frame_rect);
+    }
+
+    // Tiles which got a new frame, moved, appeared or disappeared are redrawn together with whatever overlaps them.
+    // New frames of invisible tiles change nothing
+    for (l = GST_ELEMENT(mixer)->sinkpads; l; l = l->next) {
+        TileMixerPad* pad = l->data;
+        GstVideoRectangle target = {0, 0, 0, 0};
+
+        if (pad->tile && gst_video_aggregator_pad_has_current_buffer(GST_VIDEO_AGGREGATOR_PAD(pad))) {
+            target = pad->target;
+        }
+        if (!rectangles_equal(&target, &pad->drawn)) {
+            add_damage(mixer, &pad->drawn);
+            add_damage(mixer, &target);
+        } else if ((pad->tile_changed && pad->target_alpha > 0) || pad->target_alpha != pad->drawn_alpha) {
+            add_damage(mixer, &target);
+        }
+        pad->drawn = target;
+        pad->drawn_alpha = pad->target_alpha;
+        pad->tile_changed = FALSE;
+    }
+
+    // Graphics which appeared, changed or disappeared are redrawn with the tiles under them, others stay in the kept
+    // frame and cost nothing
+    if (mixer->overlay) {
+        overlay_layer_take_damage(mixer->overlay, mixer->damage);
+    }
+
+    if (mixer->damage->len > 0) {
+        if (!gst_video_frame_map(&frame, &aggregator->info, outbuffer, GST_MAP_WRITE)) {
+            GST_OBJECT_UNLOCK(mixer);
+            GST_ERROR_OBJECT(mixer, "failed to map output frame");
+            return GST_FLOW_ERROR;
+        }
+        for (i = 0; i < mixer->damage->len; ++i) {
+            redraw_area(mixer, &frame, &g_array_index(mixer->damage, GstVideoRectangle, i));
+        }
+        gst_video_frame_unmap(&frame);
+        g_array_set_size(mixer->damage, 0);
+    }
+
+    mixer->canvas = gst_buffer_ref(outbuffer);
+    GST_OBJECT_UNLOCK(mixer);
+
+    return GST_FLOW_OK;
+}
+
+// Area of the released tile is redrawn with whatever is under it
+static void tile_mixer_release_pad(GstElement* element, GstPad* pad) {
+    TileMixer* mixer = TILE_MIXER(element);
+
+    GST_OBJECT_LOCK(mixer);
+    add_damage(mixer, &TILE_MIXER_PAD(pad)->drawn);
+    GST_OBJECT_UNLOCK(mixer);
+
+    GST_ELEMENT_CLASS(tile_mixer_parent_class)->release_pad(element, pad);
+}
+
+// Kept frame has the old format or size, so the next frame is drawn from scratch
+static gboolean tile_mixer_negotiated_src_caps(GstAggregator* aggregator, GstCaps* caps) {
+    TileMixer* mixer = TILE_MIXER(aggregator);
+
+    GST_OBJECT_LOCK(mixer);
+    gst_buffer_replace(&mixer->canvas, NULL);
+    GST_OBJECT_UNLOCK(mixer);
+
+    return GST_AGGREGATOR_CLASS(tile_mixer_parent_class)->negotiated_src_caps(aggregator, caps);
+}
+
+static gboolean tile_mixer_stop(GstAggregator* aggregator) {
+    TileMixer* mixer = TILE_MIXER(aggregator);
+
+    GST_OBJECT_LOCK(mixer);
+    gst_buffer_replace(&mixer->canvas, NULL);
+    g_array_set_size(mixer->damage, 0);
+    GST_OBJECT_UNLOCK(mixer);
+
+    return GST_AGGREGATOR_CLASS(tile_mixer_parent_class)->stop(aggregator);
+}
+
+static void tile_mixer_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
+    TileMixer* mixer = TILE_MIXER(object);
+
+    GST_OBJECT_LOCK(mixer);
+    switch (prop_id) {
+    case PROP_OVERLAY:
+        mixer->overlay = g_value_get_pointer(value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK(mixer);
+}
+
+static void tile_mixer_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec) {
+    TileMixer* mixer = TILE_MIXER(object);
+
+    GST_OBJECT_LOCK(mixer);
+    switch (prop_id) {
+    case PROP_OVERLAY:
+        g_value_set_pointer(value, mixer->overlay);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK(mixer);
+}
+
+static void tile_mixer_finalize(GObject* object) {
+    TileMixer* mixer = TILE_MIXER(object);
+
+    gst_buffer_replace(&mixer->canvas, NULL);
+    g_array_unref(mixer->damage);
+
+    G_OBJECT_CLASS(tile_mixer_parent_class)->finalize(object);
+}
+
+static void tile_mixer_class_init(TileMixerClass* klass) {
+    GObjectClass* object_class = G_OBJECT_CLASS(klass);
+    GstElementClass* element_class = GST_ELEMENT_CLASS(klass);
+    GstAggregatorClass* aggregator_class = GST_AGGREGATOR_CLASS(klass);
+    GstVideoAggregatorClass* video_aggregator_class = GST_VIDEO_AGGREGATOR_CLASS(klass);
+
+    object_class->set_property = tile_mixer_set_property;
+    object_class->get_property = tile_mixer_get_property;
+    object_class->finalize = tile_mixer_finalize;
+    element_class->release_pad = tile_mixer_release_pad;
+    aggregator_class->negotiated_src_caps = tile_mixer_negotiated_src_caps;
+    aggregator_class->stop = tile_mixer_stop;
+    video_aggregator_class->create_output_buffer = tile_mixer_create_output_buffer;
+    video_aggregator_class->aggregate_frames = tile_mixer_aggregate_frames;
+
+    // Layer must outlive the mixer
+    g_object_class_install_property(
+        object_class,
+        PROP_OVERLAY,
+        g_param_spec_pointer(
+            "overlay", "Overlay", "OverlayLayer drawn over the tiles", G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_add_static_pad_template_with_gtype(element_class, &src_template, GST_TYPE_AGGREGATOR_PAD);
+    gst_element_class_add_static_pad_template_with_gtype(element_class, &sink_template, tile_mixer_pad_get_type());
+    gst_element_class_set_static_metadata(element_class,
+                                          "Tile mixer",
+                                          "Filter/Editor/Video/Compositor",
+                                          "Composites tiles redrawing only regions which changed",
+                                          "Alexander Voitenko");
+}
+
+static void tile_mixer_init(TileMixer* mixer) {
+    mixer->damage = g_array_new(FALSE, FALSE, sizeof(GstVideoRectangle));
+}
+
+gboolean tile_mixer_register(void) {
+    return gst_element_register(NULL, "tilemixer", GST_RANK_NONE, tile_mixer_get_type());
+}
@@ -0,0 +1,22 @@
+// (c) Alexander Voitenko 2021 - present
+
+#ifndef TWITCH_STREAMER_TILE_MIXER_H
+#define TWITCH_STREAMER_TILE_MIXER_H
+
+#include <gst/gst.h>
+
+// Incremental video mixer registered as "tilemixer". Unlike compositor, which blends every tile into every output
+// frame, it keeps the previous output frame and redraws only regions which changed: tiles which received a new frame,
+// moved or disappeared. Unchanged tiles cost neither scaling nor copying, so layouts with slides, paused feeds and
+// static overlays are composited almost for free. Sink pads have the same "xpos", "ypos", "width", "height", "alpha"
+// and "zorder" properties as compositor pads, uncovered area is black. Output formats are I420 and NV12. Opaque
+// tiles are copied row by row and tiles hidden under them are skipped, only translucent tiles are blended with
+// SIMD kernels (see Blend.h). Graphics of the OverlayLayer set as "overlay" property are drawn over the tiles and
+// redrawn only where they or the tiles under them changed.
+//
+// The kept frame is the previous output buffer: once downstream has released it, it is redrawn in place. If it is
+// still used downstream, the new frame is taken from the output buffer pool and the kept frame is copied into it, so
+// buffers already pushed never change. A fixed pool therefore needs at least two buffers
+gboolean tile_mixer_register(void);
+
+#endif // TWITCH_STREAMER_TILE_MIXER_H